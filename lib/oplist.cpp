@@ -162,8 +162,8 @@ const char *name[] = {
     "BUILD_STRING",
     "BUILD_TUPLE_UNPACK_WITH_CALL",
     "<159>",
-    "<160>",
-    "<161>",
+    "LOAD_METHOD",
+    "CALL_METHOD",
     "<162>",
     "<163>",
     "<164>",
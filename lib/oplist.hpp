@@ -130,6 +130,11 @@ const uint8_t FORMAT_VALUE    = 0x9b;
 const uint8_t BUILD_CONST_KEY_MAP = 0x9c;
 const uint8_t BUILD_STRING    = 0x9d;
 const uint8_t BUILD_TUPLE_UNPACK_WITH_CALL = 0x9e;
+
+// not emitted by the python compiler, Code rewrites LOAD_ATTR ... CALL_FUNCTION
+// pairs into these so that method calls do not allocate a bound method
+const uint8_t LOAD_METHOD     = 0xa0;
+const uint8_t CALL_METHOD     = 0xa1;
 namespace cmp {
 
 const uint8_t LT = 0;
@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+
+#include "pygc.hpp"
+
+namespace gc {
+
+void gc_mark_worker::publish() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->shared.insert(this->shared.end(), this->local.begin(), this->local.begin() + PUBLISH_BATCH);
+    this->local.erase(this->local.begin(), this->local.begin() + PUBLISH_BATCH);
+    this->shared_size.store(this->shared.size(), std::memory_order_relaxed);
+}
+
+bool gc_mark_worker::take(gc_work& work, bool own) {
+    if (this->shared_size.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->shared.empty()) {
+        return false;
+    }
+    if (own) {
+        work = this->shared.back();
+        this->shared.pop_back();
+    } else {
+        work = this->shared.front();
+        this->shared.pop_front();
+    }
+    this->shared_size.store(this->shared.size(), std::memory_order_relaxed);
+    return true;
+}
+
+size_t gc_mark_worker::drain(size_t budget) {
+    gc_mark_worker* previous = gc_mark_worker::current;
+    gc_mark_worker::current = this;
+    size_t scanned = 0;
+    gc_work work;
+    while (scanned < budget) {
+        if (!this->local.empty()) {
+            work = this->local.back();
+            this->local.pop_back();
+        } else if (!this->take(work, true)) {
+            break;
+        }
+        work.scan(work.object);
+        ++scanned;
+    }
+    gc_mark_worker::current = previous;
+    return scanned;
+}
+
+gc_marker::gc_marker(size_t threads) {
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) {
+        this->workers.push_back(std::make_unique<gc_mark_worker>());
+    }
+    for (size_t i = 1; i < this->workers.size(); ++i) {
+        this->pool.emplace_back(&gc_marker::serve, this, i);
+    }
+}
+
+gc_marker::~gc_marker() {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    for (std::thread& thread : this->pool) {
+        thread.join();
+    }
+}
+
+void gc_marker::run(const std::function<void()>& roots) {
+    gc_mark_worker& self = *this->workers[0];
+    gc_mark_worker* previous = gc_mark_worker::current;
+    gc_mark_worker::current = &self;
+    roots();
+
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->idle.store(0);
+        this->running = this->pool.size();
+        this->generation++;
+    }
+    this->wake.notify_all();
+    this->work(0);
+
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->finished.wait(guard, [this]() { return this->running == 0; });
+    }
+    gc_mark_worker::current = previous;
+}
+
+void gc_marker::serve(size_t index) {
+    gc_mark_worker& self = *this->workers[index];
+    gc_mark_worker::current = &self;
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->wake.wait(guard, [this, seen]() { return this->stopping || this->generation != seen; });
+            if (this->stopping) {
+                return ;
+            }
+            seen = this->generation;
+        }
+
+        this->work(index);
+
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (--this->running == 0) {
+            this->finished.notify_one();
+        }
+    }
+}
+
+void gc_marker::work(size_t index) {
+    gc_mark_worker& self = *this->workers[index];
+    gc_work work;
+    for (;;) {
+        while (!self.local.empty()) {
+            work = self.local.back();
+            self.local.pop_back();
+            work.scan(work.object);
+        }
+        if (self.take(work, true) || this->steal(index, work)) {
+            work.scan(work.object);
+            continue;
+        }
+
+        // only a busy worker shares work, so once all of them are idle
+        // there is nothing left anywhere
+        this->idle.fetch_add(1);
+        for (;;) {
+            if (this->idle.load() == this->workers.size()) {
+                return ;
+            }
+            bool found = false;
+            for (auto& other : this->workers) {
+                if (other->shared_size.load(std::memory_order_relaxed) != 0) {
+                    found = true;
+                    break;
+                }
+            }
+            if (found) {
+                this->idle.fetch_sub(1);
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool gc_marker::steal(size_t index, gc_work& work) {
+    // every thread starts from the one after it, so they do not all queue up
+    // on the same victim
+    const size_t count = this->workers.size();
+    for (size_t i = 1; i < count; ++i) {
+        if (this->workers[(index + i) % count]->take(work, false)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool gc_pool::huge_pages = false;
+
+namespace {
+
+// maps size bytes aligned to align: more is mapped so that an aligned block
+// can be cut out of it, and the ends are unmapped
+void* map_aligned(size_t size, size_t align) {
+    void* mapped = mmap(nullptr, size + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    const uintptr_t start = (uintptr_t)mapped;
+    const uintptr_t end = start + size + align;
+    const uintptr_t aligned = (start + align - 1) & ~(uintptr_t)(align - 1);
+    if (aligned != start) {
+        munmap(mapped, aligned - start);
+    }
+    if (aligned + size != end) {
+        munmap((void*)(aligned + size), end - aligned - size);
+    }
+    return (void*)aligned;
+}
+
+// the NUMA node the calling thread runs on, -1 when the machine has only one
+int numa_node() {
+    static const bool several = []() {
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string nodes;
+        online >> nodes;
+        return nodes.find_first_of(",-") != std::string::npos;
+    }();
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (!several || syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return -1;
+    }
+    return node;
+}
+
+}
+
+void gc_pool::slab_list::push_front(slab* s) {
+    s->prev = nullptr;
+    s->next = this->head;
+    if (this->head != nullptr) {
+        this->head->prev = s;
+    } else {
+        this->tail = s;
+    }
+    this->head = s;
+}
+
+void gc_pool::slab_list::push_back(slab* s) {
+    s->next = nullptr;
+    s->prev = this->tail;
+    if (this->tail != nullptr) {
+        this->tail->next = s;
+    } else {
+        this->head = s;
+    }
+    this->tail = s;
+}
+
+void gc_pool::slab_list::remove(slab* s) {
+    (s->prev != nullptr ? s->prev->next : this->head) = s->next;
+    (s->next != nullptr ? s->next->prev : this->tail) = s->prev;
+    s->prev = s->next = nullptr;
+}
+
+gc_pool::~gc_pool() {
+    for (slab_list* list : {&this->partial, &this->full, &this->empty, &this->released}) {
+        while (slab* s = list->head) {
+            list->remove(s);
+            munmap(s, SLAB_SIZE);
+        }
+    }
+}
+
+// a new slab aligned to its size, so that any slot finds its slab by masking
+// its address
+void* gc_pool::map_slab() {
+    if (!huge_pages) {
+        return map_aligned(SLAB_SIZE, SLAB_SIZE);
+    }
+    return this->regions->cut();
+}
+
+gc_regions::~gc_regions() {
+    if (this->left != 0) {
+        munmap(this->region, this->left);
+    }
+}
+
+void* gc_regions::cut() {
+    if (this->left == 0) {
+        this->region = (char*)map_aligned(gc_pool::REGION_SIZE, gc_pool::REGION_SIZE);
+        this->left = gc_pool::REGION_SIZE;
+        // a hint, the kernel backs the region with a huge page if it can find
+        // one when it is first touched. Releasing a slab later splits it
+        madvise(this->region, gc_pool::REGION_SIZE, MADV_HUGEPAGE);
+        // first touch would place the pages on the interpreter thread's node
+        // too, but khugepaged or a marker thread may get to them first
+        const int node = numa_node();
+        if (node >= 0 && node < 64) {
+            const unsigned long nodes = 1UL << node;
+            syscall(SYS_mbind, this->region, gc_pool::REGION_SIZE, MPOL_PREFERRED, &nodes, 65, 0);
+        }
+    }
+    void* s = this->region;
+    this->region += gc_pool::SLAB_SIZE;
+    this->left -= gc_pool::SLAB_SIZE;
+    return s;
+}
+
+// the first slab with room, or an empty one made the first
+gc_pool::slab* gc_pool::next_slab() {
+    if (this->partial.head != nullptr) {
+        return this->partial.head;
+    }
+
+    slab* s = this->empty.head;
+    if (s != nullptr) {
+        this->empty.remove(s);
+    } else if ((s = this->released.head) != nullptr) {
+        this->released.remove(s);
+    } else {
+        s = new (this->map_slab()) slab();
+    }
+    this->partial.push_front(s);
+    return s;
+}
+
+void* gc_pool::allocate(size_t size) {
+    if (this->slot_size == 0) {
+        this->slot_size = slot_for(size);
+        this->capacity = (SLAB_SIZE - header_size()) / this->slot_size;
+    }
+
+    slab* s = this->next_slab();
+    if (s->free == nullptr && s->bump == this->capacity) {
+        this->unpark(s);
+    }
+    void* object = s->free;
+    if (object != nullptr) {
+        s->free = *(void**)object;
+    } else {
+        object = (char*)s + header_size() + s->bump * this->slot_size;
+        s->bump++;
+        this->touched++;
+    }
+    s->used++;
+    this->used++;
+    if (s->used == this->capacity) {
+        this->partial.remove(s);
+        this->full.push_back(s);
+    }
+    return object;
+}
+
+void gc_pool::deallocate(void* object) {
+    slab* s = (slab*)((uintptr_t)object & ~(uintptr_t)(SLAB_SIZE - 1));
+    *(void**)object = s->free;
+    s->free = object;
+    this->used--;
+    // a full slab goes behind the ones being filled, an empty one is kept
+    // for the next slab needed until it is released
+    if (s->used-- == this->capacity) {
+        this->full.remove(s);
+        this->partial.push_back(s);
+    }
+    if (s->used == 0) {
+        this->partial.remove(s);
+        this->empty.push_front(s);
+    }
+}
+
+size_t gc_pool::release() {
+    size_t released = 0;
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    while (page < SLAB_SIZE && this->empty.head != nullptr) {
+        slab* s = this->empty.head;
+        this->empty.remove(s);
+        // the first page holds the slab's header, the rest are all free slots
+        madvise((char*)s + page, SLAB_SIZE - page, MADV_DONTNEED);
+        released += (s->bump - s->parked_slots) * this->slot_size;
+        this->touched -= s->bump - s->parked_slots;
+        s->free = nullptr;
+        s->bump = 0;
+        s->parked = 0;
+        s->parked_slots = 0;
+        this->released.push_back(s);
+    }
+
+    // the densest slabs are filled first, so the sparse ones can empty out
+    std::vector<slab*> slabs;
+    for (slab* s = this->partial.head; s != nullptr; s = s->next) {
+        released += this->park(s);
+        slabs.push_back(s);
+    }
+    std::stable_sort(slabs.begin(), slabs.end(), [](slab* a, slab* b) {
+        return a->used > b->used;
+    });
+    this->partial = slab_list();
+    for (slab* s : slabs) {
+        this->partial.push_back(s);
+    }
+    return released;
+}
+
+bool gc_pool::on_pages(size_t slot, uint64_t pages) const {
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t start = header_size() + slot * this->slot_size;
+    const size_t end = start + this->slot_size - 1;
+    for (size_t p = start / page; p <= end / page; ++p) {
+        if (pages & (uint64_t(1) << p)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t gc_pool::park(slab* s) {
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t pages = SLAB_SIZE / page;
+    if (pages > 64 || s->free == nullptr) {
+        return 0;
+    }
+
+    // the slots no object is on: the free ones, the ones on pages already
+    // given back and the ones never handed out
+    std::vector<bool> free(this->capacity, false);
+    for (void* slot = s->free; slot != nullptr; slot = *(void**)slot) {
+        free[((char*)slot - (char*)s - header_size()) / this->slot_size] = true;
+    }
+    for (size_t i = 0; i < this->capacity; ++i) {
+        if (i >= s->bump || (s->parked != 0 && this->on_pages(i, s->parked))) {
+            free[i] = true;
+        }
+    }
+
+    // a page can go when all the slots on it are free, the first holds the
+    // header. Only pages the bump pointer is past are looked at, so it never
+    // hands out a slot on one
+    uint64_t parked = s->parked;
+    for (size_t p = 1; p < pages; ++p) {
+        const size_t first = (p * page - header_size()) / this->slot_size;
+        const size_t last = std::min(((p + 1) * page - 1 - header_size()) / this->slot_size, this->capacity - 1);
+        if (first >= this->capacity || last >= s->bump || (parked & (uint64_t(1) << p))) {
+            continue;
+        }
+        bool empty = true;
+        for (size_t i = first; i <= last && empty; ++i) {
+            empty = free[i];
+        }
+        if (empty) {
+            madvise((char*)s + p * page, page, MADV_DONTNEED);
+            parked |= uint64_t(1) << p;
+        }
+    }
+    if (parked == s->parked) {
+        return 0;
+    }
+
+    // the free list only keeps the slots that are still on resident pages,
+    // lowest first
+    size_t parked_slots = 0;
+    void** tail = &s->free;
+    for (size_t i = 0; i < s->bump; ++i) {
+        if (!free[i]) {
+            continue;
+        } else if (this->on_pages(i, parked)) {
+            parked_slots++;
+        } else {
+            void* slot = (char*)s + header_size() + i * this->slot_size;
+            *tail = slot;
+            tail = (void**)slot;
+        }
+    }
+    *tail = nullptr;
+
+    const size_t released = (parked_slots - s->parked_slots) * this->slot_size;
+    this->touched -= parked_slots - s->parked_slots;
+    s->parked = parked;
+    s->parked_slots = parked_slots;
+    return released;
+}
+
+void gc_pool::unpark(slab* s) {
+    for (size_t i = s->bump; i-- > 0;) {
+        if (this->on_pages(i, s->parked)) {
+            void* slot = (char*)s + header_size() + i * this->slot_size;
+            *(void**)slot = s->free;
+            s->free = slot;
+        }
+    }
+    this->touched += s->parked_slots;
+    s->parked = 0;
+    s->parked_slots = 0;
+}
+
+bool gc_pool::huge_page_usage(size_t& huge, size_t& resident) {
+    huge = 0;
+    resident = 0;
+    std::ifstream smaps("/proc/self/smaps");
+    if (!smaps) {
+        return false;
+    }
+    // every mapping lists its sizes, then its flags last, hg for the advised
+    size_t rss = 0;
+    size_t anon_huge = 0;
+    std::string line;
+    while (std::getline(smaps, line)) {
+        if (line.rfind("Rss:", 0) == 0) {
+            rss = std::strtoull(line.c_str() + 4, nullptr, 10) * 1024;
+        } else if (line.rfind("AnonHugePages:", 0) == 0) {
+            anon_huge = std::strtoull(line.c_str() + 14, nullptr, 10) * 1024;
+        } else if (line.rfind("VmFlags:", 0) == 0) {
+            if ((line + " ").find(" hg ") != std::string::npos) {
+                huge += anon_huge;
+                resident += rss;
+            }
+            rss = 0;
+            anon_huge = 0;
+        }
+    }
+    return true;
+}
+
+}
@@ -1,10 +1,17 @@
 #ifndef PYGC3_H
 #define PYGC3_H
 
+#include <algorithm>
 #include <list>
 #include <functional>
 #include <optional>
 #include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <stdint.h>
 
 // #define DEBUG_ON
@@ -17,6 +24,286 @@
 
 namespace gc {
 
+// An object whose mark bit is set but whose children are not marked yet, and
+// the function that marks them
+struct gc_work {
+    void* object;
+    void (*scan)(void* object);
+};
+
+class gc_marker;
+
+// What one thread of a gc_marker marks from. Objects it finds go on a private
+// stack, and once that is deep it moves the oldest ones, which likely have the
+// most behind them, to a shared deque that idle threads steal from
+class gc_mark_worker {
+public:
+    // the worker of this thread while a gc_marker runs, otherwise objects are
+    // marked by recursing into their children
+    static inline thread_local gc_mark_worker* current = nullptr;
+
+    // the worker holding the grey objects of the incremental marking of this
+    // thread's heaps while one is going on. New objects start out grey on it
+    static inline thread_local gc_mark_worker* incremental = nullptr;
+
+    // scans up to budget objects of a worker that marks a little at a time
+    // on its own thread, and returns how many it scanned
+    size_t drain(size_t budget);
+
+    bool empty() const {
+        return this->local.empty() && this->shared_size.load(std::memory_order_relaxed) == 0;
+    }
+
+    inline void push(gc_work work) {
+        this->local.push_back(work);
+        if (this->local.size() >= 2 * PUBLISH_BATCH && this->shared_size.load(std::memory_order_relaxed) == 0) {
+            this->publish();
+        }
+    }
+
+private:
+    friend class gc_marker;
+
+    static constexpr size_t PUBLISH_BATCH = 64;
+
+    std::vector<gc_work> local; // only touched by the worker's own thread
+    std::mutex lock;
+    std::deque<gc_work> shared; // guarded by lock
+    std::atomic<size_t> shared_size{0};
+
+    void publish();
+    // takes from the shared deque, from the newest end when it is the
+    // worker's own and from the oldest when it is stolen
+    bool take(gc_work& work, bool own);
+};
+
+// Marks on a pool of threads that steal work from each other. The threads
+// are started once and wait for the next collection in between. Defined in
+// pygc.cpp
+class gc_marker {
+public:
+    explicit gc_marker(size_t threads);
+    ~gc_marker();
+
+    gc_marker(const gc_marker&) = delete;
+    gc_marker& operator=(const gc_marker&) = delete;
+
+    size_t threads() const {
+        return this->workers.size();
+    }
+
+    // marks everything reachable from the objects roots marks, roots runs on
+    // the calling thread which then marks along with the pool
+    void run(const std::function<void()>& roots);
+
+private:
+    std::vector<std::unique_ptr<gc_mark_worker>> workers; // the caller's is the first
+    std::vector<std::thread> pool;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    uint64_t generation = 0; // counts the runs
+    size_t running = 0; // threads of the pool still marking
+    bool stopping = false;
+
+    std::atomic<size_t> idle{0}; // workers that found nothing left to do
+
+    void work(size_t index);
+    bool steal(size_t index, gc_work& work);
+    void serve(size_t index);
+};
+
+// The 2MB regions that slabs are cut from when gc_pool::huge_pages is set.
+// The pools of one owner share them, so a pool that needs only a slab or two
+// does not map a region of its own. Defined in pygc.cpp
+class gc_regions {
+public:
+    gc_regions() = default;
+    ~gc_regions();
+
+    gc_regions(const gc_regions&) = delete;
+    gc_regions& operator=(const gc_regions&) = delete;
+
+    // a slab of gc_pool::SLAB_SIZE bytes aligned to its size
+    void* cut();
+
+    // the bytes of the current region no slab was cut from yet. A huge page
+    // backs them along with the slabs that were
+    size_t uncut_bytes() const {
+        return this->left;
+    }
+
+private:
+    char* region = nullptr;
+    size_t left = 0;
+};
+
+// Hands out the memory of one heap's objects from slabs of its own, so they
+// lie together instead of among everything else malloc hands out. Objects
+// never move, but new ones fill the densest slabs first so the ones a
+// collection left nearly empty drain, and release() gives the pages of the
+// empty slabs back to the OS, and the pages no object is left on in the
+// others. Defined in pygc.cpp
+class gc_pool {
+public:
+    static constexpr size_t SLAB_SIZE = 256 * 1024;
+    // larger objects come from operator new
+    static constexpr size_t MAX_SLOT = SLAB_SIZE / 16;
+    // the size of a huge page on x86-64 and arm64
+    static constexpr size_t REGION_SIZE = 2 * 1024 * 1024;
+
+    // when set, slabs are cut from regions aligned to a huge page that the
+    // kernel is asked to back with huge pages, on the NUMA node of the thread
+    // that maps them. Slabs mapped before it is set stay as they are
+    static bool huge_pages;
+
+    // the bytes of the process' huge page advised mappings that are resident,
+    // and how many of those are on huge pages, read from /proc/self/smaps.
+    // Returns false if that could not be read
+    static bool huge_page_usage(size_t& huge, size_t& resident);
+
+    // where slabs are cut from with huge_pages set, the pool's own regions
+    // unless they are shared with other pools
+    gc_regions* regions = &this->own_regions;
+
+    gc_pool() = default;
+    ~gc_pool();
+
+    gc_pool(const gc_pool&) = delete;
+    gc_pool& operator=(const gc_pool&) = delete;
+
+    // the pool holds objects of the size it is first asked for
+    bool holds(size_t size) const {
+        const size_t slot = slot_for(size);
+        return this->slot_size == 0 ? slot <= MAX_SLOT : slot == this->slot_size;
+    }
+
+    void* allocate(size_t size);
+    void deallocate(void* object);
+
+    // gives back the pages of the empty slabs and the free pages of the
+    // others, orders those densest first and returns how many bytes were
+    // given back
+    size_t release();
+
+    // whether a slab has no object left on it
+    bool has_empty() const {
+        return this->empty.head != nullptr;
+    }
+
+    // the bytes taken by objects, and by all the slots handed out since the
+    // slabs they are on were last released
+    size_t used_bytes() const {
+        return this->used * this->slot_size;
+    }
+
+    size_t resident_bytes() const {
+        return this->touched * this->slot_size;
+    }
+
+    // what one object takes, with the list node around it, 0 until the
+    // first one is allocated
+    size_t slot_bytes() const {
+        return this->slot_size;
+    }
+
+private:
+    struct slab {
+        slab* prev = nullptr;
+        slab* next = nullptr;
+        void* free = nullptr; // freed slots, each holding the next one
+        size_t used = 0;
+        size_t bump = 0; // slots past this one were never handed out
+        // the pages given back while objects were left on the slab, one bit
+        // each. The free slots on them are off the free list until the slab
+        // has no other room
+        uint64_t parked = 0;
+        size_t parked_slots = 0;
+    };
+
+    struct slab_list {
+        slab* head = nullptr;
+        slab* tail = nullptr;
+
+        void push_front(slab* s);
+        void push_back(slab* s);
+        void remove(slab* s);
+    };
+
+    size_t slot_size = 0;
+    size_t capacity = 0; // slots per slab
+    size_t used = 0;
+    size_t touched = 0;
+
+    // slabs with room, the first is allocated from, and the full, empty and
+    // released ones
+    slab_list partial;
+    slab_list full;
+    slab_list empty;
+    slab_list released;
+
+    gc_regions own_regions;
+
+    static size_t slot_for(size_t size) {
+        return (std::max(size, sizeof(void*)) + 15) & ~size_t(15);
+    }
+
+    static size_t header_size() {
+        return (sizeof(slab) + 15) & ~size_t(15);
+    }
+
+    slab* next_slab();
+    void* map_slab();
+
+    // whether a slot lies on one of the pages
+    bool on_pages(size_t slot, uint64_t pages) const;
+    // gives back the pages of a slab no object is on, returns the bytes
+    size_t park(slab* s);
+    // puts the free slots of the pages given back on the free list again
+    void unpark(slab* s);
+};
+
+// Lets a heap's std::list take its nodes from the heap's pool
+template<typename U>
+struct gc_pool_allocator {
+    using value_type = U;
+
+    gc_pool* pool;
+
+    explicit gc_pool_allocator(gc_pool* pool) : pool(pool) {
+    }
+
+    template<typename V>
+    gc_pool_allocator(const gc_pool_allocator<V>& other) : pool(other.pool) {
+    }
+
+    U* allocate(size_t n) {
+        if (n == 1 && this->pool->holds(sizeof(U))) {
+            return static_cast<U*>(this->pool->allocate(sizeof(U)));
+        }
+        return static_cast<U*>(::operator new(n * sizeof(U)));
+    }
+
+    void deallocate(U* object, size_t n) {
+        if (n == 1 && this->pool->holds(sizeof(U))) {
+            this->pool->deallocate(object);
+        } else {
+            ::operator delete(object);
+        }
+    }
+
+    template<typename V>
+    bool operator == (const gc_pool_allocator<V>& other) const {
+        return this->pool == other.pool;
+    }
+
+    template<typename V>
+    bool operator != (const gc_pool_allocator<V>& other) const {
+        return this->pool != other.pool;
+    }
+};
+
 template<typename T>
 struct gc_heap;
 
@@ -89,17 +376,11 @@ public:
     }
     
     void mark() const {
-        if (!(this->object->flags & FLAG_MARKED)) {
-            this->object->flags |= FLAG_MARKED;
-            mark_children(*this);
-        }
+        mark(this->object);
     }
 
     void mark() {
-        if (!(this->object->flags & FLAG_MARKED)) {
-            this->object->flags |= FLAG_MARKED;
-            mark_children(*this);
-        }
+        mark(this->object);
     }
 
     T* get() {
@@ -119,18 +400,40 @@ public:
 
     // WARNING: maximum reference count is 127, greater than this and things
     // break horribly, and there is no checking.
+    // the mark bit can still be set from the last collection while its sweep
+    // is unfinished, so only the count bits are looked at
     inline gc_ptr<T> retain() {
-        if (this->object->flags < 127) {
+        if ((this->object->flags & MASK_REFCOUNT) < 127) {
             this->object->flags += 1;
         }
         return *this;
     }
 
     void release() {
-        if (this->object->flags != 127) {
+        if ((this->object->flags & MASK_REFCOUNT) != 127) {
             this->object->flags -= 1;
         }
     }
+
+private:
+    static void mark(gc_object* object) {
+        if (gc_mark_worker* worker = gc_mark_worker::current) {
+            // other threads may reach the same object, the one that sets the
+            // bit is the one that scans it
+            if (!(__atomic_load_n(&object->flags, __ATOMIC_RELAXED) & FLAG_MARKED)
+                    && !(__atomic_fetch_or(&object->flags, FLAG_MARKED, __ATOMIC_RELAXED) & FLAG_MARKED)) {
+                worker->push(gc_work {object, &gc_ptr<T>::scan});
+            }
+        } else if (!(object->flags & FLAG_MARKED)) {
+            object->flags |= FLAG_MARKED;
+            scan(object);
+        }
+    }
+
+    static void scan(void* object) {
+        gc_ptr<T> ptr(*(gc_object*)object);
+        mark_children(ptr);
+    }
 };
 
 
@@ -140,17 +443,31 @@ public:
     // declare a few type aliases to make our code more concise
     using ptr_t = gc_ptr<T>;
     using gc_object = typename ptr_t::gc_object;
+    using object_list = std::list<gc_object, gc_pool_allocator<gc_object>>;
+
+    // where the objects are allocated, it outlives the lists that use it
+    gc_pool pool;
 
     // the objects array is effectively the heap
-    std::list<gc_object> objects;
+    object_list objects = object_list(gc_pool_allocator<gc_object>(&pool));
+
+    // what is left to allocate before the owner wants to look at its heaps,
+    // every object made takes the room it has in the heap off it
+    std::atomic<int64_t>* countdown = &unused_countdown;
+
+    // whether a sweep is unfinished, and the next object it looks at. New
+    // objects go in front of the cursor, so a sweep never frees anything
+    // allocated after the marking it follows
+    bool sweeping = false;
+    typename object_list::iterator sweep_cursor;
 
 public:
     template < typename... Args> 
     ptr_t make(Args&&... args) {
         DEBUG("we tried to allocate an object!");
-        typename std::list<gc_object>::iterator object_itr = 
+        typename object_list::iterator object_itr = 
             objects.emplace(objects.begin(), std::forward<Args>(args)...);
-        return ptr_t(*object_itr);
+        return this->made(*object_itr);
     }
 
     size_t size() {
@@ -161,22 +478,90 @@ public:
         return size() * sizeof(T);
     }
     
+    void start_sweep() {
+        this->sweep_cursor = this->objects.begin();
+        this->sweeping = this->sweep_cursor != this->objects.end();
+    }
+
+    // sweeps up to budget objects from where the sweep is at, calls survivor
+    // on every one that stays and returns how many it looked at
+    template<typename Survivor>
+    size_t sweep_some(size_t budget, Survivor survivor) {
+        return this->sweep_with(budget, survivor, [this](auto itr) {
+            return this->objects.erase(itr);
+        });
+    }
+
+    size_t sweep_some(size_t budget) {
+        return this->sweep_some(budget, [](T&) {});
+    }
+
     void sweep() {
-        for (auto itr = this->objects.begin(); itr != this->objects.end();) {
+        this->start_sweep();
+        this->sweep_some(SIZE_MAX);
+    }
+
+    void retain_all() {
+        for (auto& object : this->objects) {
+            object.flags |= 1;
+        }
+    }
+
+    // gives the pages no object is on back to the OS, returns how many bytes
+    size_t compact() {
+        return this->pool.release();
+    }
+
+    // whether compact() would free a whole slab
+    bool has_empty_slabs() const {
+        return this->pool.has_empty();
+    }
+
+    // calls f on every object that is marked
+    template<typename F>
+    void for_each_marked(F f) {
+        for (auto& object : this->objects) {
+            if (object.flags & ptr_t::FLAG_MARKED) {
+                f(ptr_t(object));
+            }
+        }
+    }
+
+protected:
+    static inline std::atomic<int64_t> unused_countdown{0};
+
+    // an object made while an incremental marking goes on is grey, its
+    // children are marked once it was filled in
+    ptr_t made(gc_object& object) {
+        // only the owner's thread allocates, so this need not be one atomic step
+        const int64_t size = std::max(sizeof(T), this->pool.slot_bytes());
+        this->countdown->store(this->countdown->load(std::memory_order_relaxed) - size,
+            std::memory_order_relaxed);
+        if (gc_mark_worker* worker = gc_mark_worker::incremental) {
+            object.flags |= ptr_t::FLAG_MARKED;
+            worker->push(gc_work {&object, &ptr_t::scan});
+        }
+        return ptr_t(object);
+    }
+
+    template<typename Survivor, typename Free>
+    size_t sweep_with(size_t budget, Survivor& survivor, Free free) {
+        size_t swept = 0;
+        auto itr = this->sweep_cursor;
+        while (swept < budget && itr != this->objects.end()) {
             auto &obj = *itr;
             if (!obj.flags) { // object.flags must be all 0's for us to clear it :)
-                itr = objects.erase(itr);
+                itr = free(itr);
             } else {
                 (*itr).flags &= ~(ptr_t::FLAG_MARKED);
+                survivor(obj.object);
                 ++itr;
             }
+            ++swept;
         }
-    }
-
-    void retain_all() {
-        for (auto& object : this->objects) {
-            object.flags |= 1;
-        }
+        this->sweep_cursor = itr;
+        this->sweeping = itr != this->objects.end();
+        return swept;
     }
 };
 
@@ -187,18 +572,19 @@ protected:
     // declare a few type aliases to make our code more concise
     using ptr_t = gc_ptr<T>;
     using gc_object = typename ptr_t::gc_object;
+    using object_list = typename gc_heap<T>::object_list;
 
-    std::list<gc_object> freelist;
+    object_list freelist = object_list(gc_pool_allocator<gc_object>(&this->pool));
 
 public:
     template < typename... Args> 
     ptr_t make(Args&&... args) {
-        using itertype = typename std::list<gc_object>::iterator;
+        using itertype = typename object_list::iterator;
         if (freelist.size() == 0) {
             DEBUG("trying to allocate an object");
             itertype object_itr = 
                 this->objects.emplace(this->objects.begin(), std::forward<Args>(args)...);
-            return ptr_t(*object_itr);
+            return this->made(*object_itr);
         } else {
             DEBUG("trying to recycle an object");
             // always recycle the most recently returned object,
@@ -206,25 +592,40 @@ public:
             gc_object& obj = this->freelist.front();
             obj.object.recycle(std::forward<Args>(args)...);
             this->objects.splice(this->objects.begin(), this->freelist, this->freelist.begin());
-            return ptr_t(obj);
+            return this->made(obj);
         }
     }
 
+    template<typename Survivor>
+    size_t sweep_some(size_t budget, Survivor survivor) {
+        return this->sweep_with(budget, survivor, [this](auto itr) {
+            auto next_itr = itr;
+            next_itr++;
+            // we splice the object out rather than truely delete it
+            (*itr).object.initialize_fields();
+            this->freelist.splice(this->freelist.begin(), this->objects, itr);
+            return next_itr;
+        });
+    }
+
+    size_t sweep_some(size_t budget) {
+        return this->sweep_some(budget, [](T&) {});
+    }
+
     void sweep() {
-        for (auto itr = this->objects.begin(); itr != this->objects.end();) {
-            auto &obj = *itr;
-            if (!obj.flags) { // object.flags must be all 0's for us to clear it :)
-                auto next_itr = itr;
-                next_itr++;
-                // we splice the object out rather than truely delete it
-                (*itr).object.initialize_fields();
-                this->freelist.splice(this->freelist.begin(), this->objects, itr);
-                itr = next_itr;
-            } else {
-                (*itr).flags &= ~(ptr_t::FLAG_MARKED);
-                ++itr;
-            }
-        }
+        this->start_sweep();
+        this->sweep_some(SIZE_MAX);
+    }
+
+    // the objects kept for recycling are freed as well
+    size_t compact() {
+        this->freelist.clear();
+        return this->pool.release();
+    }
+
+    // the objects kept for recycling may be all that is left on a slab
+    bool has_empty_slabs() const {
+        return this->pool.has_empty() || !this->freelist.empty();
     }
 };
 
@@ -44,6 +44,19 @@ else:
         def helper(obj):
             if type(obj) == code_type:
                 return jsonify_code(obj)
+            elif type(obj) == tuple:
+                return {
+                    "type": "literal",
+                    "real_type": str(type(obj)),
+                    "value": list(map(helper, obj))
+                }
+            elif type(obj) == int and not -2**63 <= obj < 2**63:
+                # the interpreter's json parser only takes 64 bit ints
+                return {
+                    "type": "literal",
+                    "real_type": str(type(obj)),
+                    "value": str(obj)
+                }
             else:
                 return {
                     "type": "literal",
@@ -11,6 +11,7 @@
 #include "../pyerror.hpp"
 #include "../pyframe.hpp"
 #include "../pyvalue.hpp"
+#include "../pyoutput.hpp"
 
 using std::string;
 
@@ -27,41 +28,95 @@ struct float_visitor {
         return (double)value;
     }
 
+    double operator()(ValueBigInt value) {
+        return value->to_double();
+    }
+
     double operator()(auto value) {
         throw pyerror("Can not convert value to int");
     }
 };
 
 struct int_visitor {
-    int64_t operator()(int64_t value) {
+    Value operator()(int64_t value) {
+        return value;
+    }
+
+    Value operator()(double value) {
+        if (value >= -9.2e18 && value <= 9.2e18) {
+            return (int64_t)value;
+        }
+        return value::BigInt::to_value(value::BigInt::from_double(value));
+    }
+
+    Value operator()(ValueBigInt value) {
         return value;
     }
 
-    int64_t operator()(double value) {
-        return (int64_t)value;
+    Value operator()(ValueString value) {
+        return value::BigInt::to_value(value::BigInt::from_string(*value));
     }
 
-    int64_t operator()(auto value) {
+    Value operator()(auto value) {
         throw pyerror("Can not convert value to int");
     }
 };
 
+std::optional<Value> range_generator::next() {
+    DEBUG_ADV("start: " << start << " stop: " << stop);
+    if (start < stop) {
+        int64_t ret = start;
+        start += step_size;
+        return ret;
+    } else 
+        return std::nullopt;
+}
+
 extern void inject_builtins(Namespace& ns) {
 
     // inject the global print builtin
-    // TODO: add argument count support
     (*ns)["print"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
-        try {
-            for (size_t i = 0; i < args.size(); ++i) {
-                const std::string str = std::visit(value_helper::visitor_str(), args[i]);
-                std::cout << str;
-                if (i != args.size() - 1){
-                    std::cout << " ";
+        Value sep = value::NoneType();
+        Value end = value::NoneType();
+        bool flush = false;
+        for (size_t i = 0; i < args.kwnames.size(); ++i) {
+            const std::string& name = *args.kwnames[i];
+            const Value& value = args[args.positional() + i];
+            if (name == "sep") {
+                sep = value;
+            } else if (name == "end") {
+                end = value;
+            } else if (name == "flush") {
+                flush = std::visit(value_helper::visitor_is_truthy(), value);
+            } else {
+                throw pyerror("TypeError: '" + name + "' is an invalid keyword argument for print()");
+            }
+        }
+        if (!std::holds_alternative<value::NoneType>(sep) && !std::holds_alternative<ValueString>(sep)) {
+            throw pyerror("TypeError: sep must be None or a string");
+        }
+        if (!std::holds_alternative<value::NoneType>(end) && !std::holds_alternative<ValueString>(end)) {
+            throw pyerror("TypeError: end must be None or a string");
+        }
+
+        const size_t count = args.positional();
+        for (size_t i = 0; i < count; ++i) {
+            output.write_value(args[i]);
+            if (i != count - 1) {
+                if (auto str = std::get_if<ValueString>(&sep)) {
+                    output.write((*str)->c_str(), (*str)->size());
+                } else {
+                    output.write(" ", 1);
                 }
             }
-            std::cout << std::endl;
-        } catch (std::bad_variant_access& err) {
-            throw pyerror(std::string("can not print non-string value"));
+        }
+        if (auto str = std::get_if<ValueString>(&end)) {
+            output.write((*str)->c_str(), (*str)->size());
+        } else {
+            output.write("\n", 1);
+        }
+        if (flush) {
+            output.flush();
         }
         
         // return None
@@ -90,28 +145,6 @@ extern void inject_builtins(Namespace& ns) {
             throw pyerror("range takes at most 3 arguments");
         }
 
-        struct range_generator : public value::CGenerator {
-            int64_t start;
-            int64_t stop;
-            int64_t step_size;
-
-            range_generator(int64_t start, int64_t stop, int64_t step_size) {
-                this->start = start;
-                this->stop = stop;
-                this->step_size = step_size;
-            }
-
-            virtual std::optional<Value> next() {
-                DEBUG_ADV("start: " << start << " stop: " << stop);
-                if (start < stop) {
-                    int64_t ret = start;
-                    start += step_size;
-                    return ret;
-                } else 
-                    return std::nullopt;
-            }
-        };
-        
         Value retval = std::make_shared<range_generator>(start, stop, step_size);
 
         frame.value_stack.push_back(retval);
@@ -122,26 +155,79 @@ extern void inject_builtins(Namespace& ns) {
             throw pyerror("ArgError: string takes 1 argument");
         }
         frame.value_stack.push_back(
-            alloc.heap_string.make(std::visit(value_helper::visitor_str(), args[0]))
+            alloc().heap_string.make(std::visit(value_helper::visitor_str(), args[0]))
         );
     });
 
     (*ns)["len"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& _args) {
+        if (_args.size() == 1) {
+            if (auto obj = std::get_if<ValuePyObject>(&_args[0])) {
+                ArgList len_args;
+                if (!value_helper::call_slot(frame, *obj, value::slot::LEN, len_args)) {
+                    throw pyerror("TypeError: object has no len()");
+                }
+                return ;
+            } else if (auto dict = std::get_if<ValueDict>(&_args[0])) {
+                frame.value_stack.push_back((int64_t)(*dict)->size());
+                return ;
+            } else if (auto set = std::get_if<ValueSet>(&_args[0])) {
+                frame.value_stack.push_back((int64_t)(*set)->size());
+                return ;
+            } else if (auto tuple = std::get_if<ValueTuple>(&_args[0])) {
+                frame.value_stack.push_back((int64_t)(*tuple)->size());
+                return ;
+            } else if (auto str = std::get_if<ValueString>(&_args[0])) {
+                frame.value_stack.push_back((int64_t)(*str)->size());
+                return ;
+            }
+        }
+
         arg_decoder<ValueList> args(_args);
         ValueList list = args.get<0>();
 
         frame.value_stack.push_back(
-            (int64_t)list->values.size()
+            (int64_t)list->size()
         );
     });
 
+    (*ns)["dict"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        if (args.size() == 0) {
+            frame.value_stack.push_back(alloc().heap_dict.make());
+        } else if (args.size() == 1 && std::holds_alternative<ValueDict>(args[0])) {
+            frame.value_stack.push_back(alloc().heap_dict.make(*std::get<ValueDict>(args[0])));
+        } else {
+            throw pyerror("TypeError: dict expects no arguments or a dict to copy");
+        }
+    });
+
+    (*ns)["set"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        if (args.size() == 0) {
+            frame.value_stack.push_back(alloc().heap_set.make());
+        } else if (args.size() == 1) {
+            frame.value_stack.push_back(builtins_set_from(args[0]));
+        } else {
+            throw pyerror("TypeError: set expected at most 1 argument");
+        }
+    });
+
+    (*ns)["sorted"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        Value key = value::NoneType();
+        bool reverse = false;
+        builtins_sort_options(args, 1, "sorted", key, reverse);
+
+        ValueList list = builtins_list_from(args[0]);
+        // on the stack while key functions run, which may collect garbage
+        frame.value_stack.push_back(list);
+        builtins_list_sort(frame, list, key, reverse);
+        frame.value_stack.back() = list;
+    });
+
     (*ns)["int"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& _args) {
         if (_args.size() != 1) {
             throw pyerror("ArgError: int takes 1 argument");
         }
 
-        int64_t intValue = std::visit(int_visitor(), _args[0]);
-        frame.value_stack.push_back(intValue);
+        frame.value_stack.push_back(std::visit(int_visitor(), _args[0]));
     });
 
     (*ns)["float"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& _args) {
@@ -160,11 +246,75 @@ extern void inject_builtins(Namespace& ns) {
     });
 
     (*ns)["collect_garbage"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
-        alloc.collect_garbage(*(frame.interpreter_state));
+        alloc().collect_garbage(*(frame.interpreter_state), true);
         frame.value_stack.push_back(value::NoneType());
     });
 
-    (*ns)["math"] = alloc.heap_namespace.make();
+    // what the collections so far took, the time spent marking and sweeping
+    // are reported apart, and the pauses as a histogram
+    (*ns)["gc_stats"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        const Allocator::Stats& stats = alloc().stats;
+        ValueDict result = alloc().heap_dict.make();
+        result->set(value::String::intern("collections"), (int64_t)stats.collections);
+        result->set(value::String::intern("mark_ms"), stats.mark_ns / 1e6);
+        result->set(value::String::intern("sweep_ms"), stats.sweep_ns / 1e6);
+        result->set(value::String::intern("sweep_steps"), (int64_t)stats.sweep_steps);
+        result->set(value::String::intern("freed"), (int64_t)stats.freed);
+        result->set(value::String::intern("sweeping"), alloc().sweeping);
+        result->set(value::String::intern("mark_steps"), (int64_t)stats.mark_steps);
+        result->set(value::String::intern("marking"), alloc().marking);
+        result->set(value::String::intern("pause_p50_us"), (int64_t)stats.pauses.percentile_us(0.5));
+        result->set(value::String::intern("pause_p99_us"), (int64_t)stats.pauses.percentile_us(0.99));
+        result->set(value::String::intern("pause_max_us"), stats.pauses.max_ns / 1e3);
+        // the number of pauses under each power of two microseconds
+        ValueDict pauses = alloc().heap_dict.make();
+        for (size_t i = 0; i < stats.pauses.buckets.size(); ++i) {
+            if (stats.pauses.buckets[i] != 0) {
+                pauses->set((int64_t)1 << i, (int64_t)stats.pauses.buckets[i]);
+            }
+        }
+        result->set(value::String::intern("pauses"), pauses);
+        result->set(value::String::intern("compactions"), (int64_t)stats.compactions);
+        result->set(value::String::intern("released"), (int64_t)stats.released);
+        result->set(value::String::intern("fragmentation"), alloc().fragmentation());
+        result->set(value::String::intern("huge_pages"), Allocator::huge_page_coverage());
+        frame.value_stack.push_back(result);
+    });
+
+    // the collector's controls, a class standing in for the gc module
+    ValuePyClass gc_module = alloc().heap_pyclass.make(std::string("gc"));
+    (*ns)["gc"] = gc_module;
+
+    // collects, then gives the pages no object is left on back to the OS and
+    // returns how many bytes that was
+    gc_module->store_attr("compact", std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        Allocator& heap = alloc();
+        heap.collect_garbage(*(frame.interpreter_state), true);
+        if (heap.sweeping) {
+            heap.sweep_step(SIZE_MAX);
+        }
+        frame.value_stack.push_back((int64_t)heap.compact());
+    }));
+
+    // the limit set with --max-heap, 0 when there is none, and what is used
+    // against it in bytes
+    (*ns)["heap_limit"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        Allocator& heap = alloc();
+        ValueDict result = heap.heap_dict.make();
+        result->set(value::String::intern("limit"), (int64_t)heap.max_heap);
+        result->set(value::String::intern("soft_limit"), (int64_t)(heap.max_heap * Allocator::SOFT_LIMIT));
+        result->set(value::String::intern("used"), (int64_t)heap.heap_usage());
+        result->set(value::String::intern("peak"), (int64_t)heap.peak);
+        result->set(value::String::intern("emergency_collections"), (int64_t)heap.stats.emergency_collections);
+        result->set(value::String::intern("memory_errors"), (int64_t)heap.stats.memory_errors);
+        frame.value_stack.push_back(result);
+    });
+
+    // what the interpreter raises once it outgrows its heap limit, the only
+    // error an except clause catches
+    (*ns)["MemoryError"] = alloc().heap_pyclass.make(std::string("MemoryError"));
+
+    (*ns)["math"] = alloc().heap_namespace.make();
 
     (*ns)["sqrt"] = pycfunction_builder([](double val) -> double {
         return sqrt(val);
@@ -231,7 +381,7 @@ extern void inject_builtins(Namespace& ns) {
         }
 
         // Allocate the class
-        ValuePyClass new_class = alloc.heap_pyclass.make(tmp_vect);
+        ValuePyClass new_class = alloc().heap_pyclass.make(tmp_vect);
 
         // Allocate the class and push it to the top of the stack
         // Args now holds the list of parents
@@ -242,9 +392,12 @@ extern void inject_builtins(Namespace& ns) {
         // Push the static initializer frame ontop the stack
         // The static initializer code block is the first argument
         frame.interpreter_state->push_frame(
-            alloc.heap_frame.make(init_code, new_class)
+            alloc().heap_frame.make(init_code, new_class)
         );
 
+        // The class body gets the cells of the scope it is defined in
+        frame.interpreter_state->cur_frame->initialize_cells(std::get<ValuePyFunction>(args[0]));
+
         // Add it's name to it's local namespace
         // Remember that this actually adds it to the class
         frame.interpreter_state->cur_frame->add_to_ns_local("__name__",class_name);
@@ -288,7 +441,7 @@ extern void inject_builtins(Namespace& ns) {
             if(vpo != NULL){
                 // Create a function with self one level deeper
                 frame.value_stack.push_back(
-                    alloc.heap_pyfunc.make( 
+                    alloc().heap_pyfunc.make( 
                         value::PyFunc {
                             vpf->name, 
                             vpf->code, 
@@ -302,7 +455,7 @@ extern void inject_builtins(Namespace& ns) {
                 if(frame.init_class){
                     // Read the class from the framestate
                     frame.value_stack.push_back(
-                        alloc.heap_pyfunc.make( 
+                        alloc().heap_pyfunc.make( 
                             value::PyFunc {
                                 vpf->name,
                                 vpf->code,
@@ -330,7 +483,7 @@ extern void inject_builtins(Namespace& ns) {
         try {
             ValuePyFunction& vpf = std::get<ValuePyFunction>(args[0]);
             frame.value_stack.push_back(
-                alloc.heap_pyfunc.make( 
+                alloc().heap_pyfunc.make( 
                     // Throw one up on the stack with static flag set
                     value::PyFunc {
                         vpf->name,
@@ -347,7 +500,11 @@ extern void inject_builtins(Namespace& ns) {
     });
 
     (*ns)["slice"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
-        if(args.size() == 2){
+        if(args.size() == 1){
+            frame.value_stack.push_back(
+                builtins_slice_get_slice_object(value::NoneType(),args[0],value::NoneType())
+            );
+        } else if(args.size() == 2){
             frame.value_stack.push_back(
                 builtins_slice_get_slice_object(args[0],args[1],value::NoneType())
             );
@@ -360,12 +517,14 @@ extern void inject_builtins(Namespace& ns) {
         } else {
             throw pyerror(
                 std::string(
-                    "slice called with " + std::to_string(args.size()) + " args, should be 2 or 3"
+                    "slice called with " + std::to_string(args.size()) + " args, should be 1, 2 or 3"
                 )
             );
         }
     });
-    
+
+    inject_reduce_builtins(ns);
+    inject_file_builtins(ns);
 }
 
 }
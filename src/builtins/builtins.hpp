@@ -1,25 +1,109 @@
 #ifndef BUILTINS_H
 #define BUILTINS_H
 
+#include <memory>
+#include <string_view>
+
 #include "../pyinterpreter.hpp"
 #include "../pyvalue.hpp"
 
 namespace py {
+
+class OutputBuffer;
+
 namespace builtins {
 
 extern void inject_builtins(Namespace& ns);
+// sum, min, max, any, all and abs, called by inject_builtins
+extern void inject_reduce_builtins(Namespace& ns);
+
+// Python's a < b for numbers and for strings, anything else is a TypeError
+extern bool builtins_less_than(FrameState& frame, const Value& a, const Value& b);
+
+// the iterator range() returns, named so that the reductions can recognize it
+struct range_generator : public value::CGenerator {
+    int64_t start;
+    int64_t stop;
+    int64_t step_size;
+
+    range_generator(int64_t start, int64_t stop, int64_t step_size)
+        : start(start), stop(stop), step_size(step_size) {}
+
+    virtual std::optional<Value> next();
+};
+
+// a file returned by open(), iterating it yields its lines. Large regular files
+// are read through an mmap of the whole file, anything else in chunks with
+// read(2), and writes go through an OutputBuffer. Defined in builtins_file.cpp
+struct file_object : public value::CGenerator {
+    const std::string name;
+
+    // takes ownership of fd, which was opened for reading or for writing
+    file_object(std::string name, int fd, bool readable);
+    virtual ~file_object();
+
+    virtual std::optional<Value> next();
+
+    // the next line including its newline, empty at the end of the file. The
+    // view is only valid until the next read
+    std::string_view read_line();
+    // the next count bytes, or all of the rest when count is negative
+    std::string_view read(int64_t count);
+    void write(std::string_view str);
+    void close();
+
+private:
+    int fd;
+    bool readable;
+
+    // the unread bytes are data[pos, size)
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    bool at_eof = false;
+    void* mapping = nullptr;
+    std::string chunks;
+
+    std::unique_ptr<OutputBuffer> out;
+
+    void check_open(bool reading);
+    // reads another chunk into chunks, returns false at the end of the file
+    bool fill();
+};
 
 extern std::unordered_map<std::string, ValueCMethod> builtin_list_attributes; // methods for lists 
+extern std::unordered_map<std::string, ValueCMethod> builtin_dict_attributes; // methods for dicts
+extern std::unordered_map<std::string, ValueCMethod> builtin_set_attributes; // methods for sets
+extern std::unordered_map<std::string, ValueCMethod> builtin_string_attributes; // methods for strings
+extern std::unordered_map<std::string, ValueCMethod> builtin_file_attributes; // methods for files
 
 // initializers for the various builtin classes, should be called at program startup
 // i.e. from main or from pycode
-extern void initialize_slice_class();
 extern void initialize_list_class();
-extern void initialize_cell_class();
+// a new list of the items of a builtin iterable
+extern ValueList builtins_list_from(const Value& iterable);
+// sorts list in place, stably, by key(item) when key is not None
+extern void builtins_list_sort(FrameState& frame, ValueList list, const Value& key, bool reverse);
+// reads the key= and reverse= keyword arguments of list.sort and sorted
+extern void builtins_sort_options(ArgList& args, size_t positional, const char* fname, Value& key, bool& reverse);
+extern void initialize_dict_class();
+
+// what an iterator over a dict yields, (key, value) tuples for ITEMS
+enum class DictIter { KEYS, VALUES, ITEMS };
+extern ValueCGenerator builtins_dict_iterator(ValueDict dict, DictIter kind);
+
+extern void initialize_set_class();
+extern ValueCGenerator builtins_set_iterator(ValueSet set);
+// a new set holding the elements of a list, tuple, set or the keys of a dict
+extern ValueSet builtins_set_from(const Value& iterable);
+
+extern void initialize_string_class();
+
+extern void initialize_file_class();
+// open, called by inject_builtins
+extern void inject_file_builtins(Namespace& ns);
 
-extern ValuePyClass slice_class;
-extern ValuePyClass cell_class;
-extern ValuePyObject builtins_slice_get_slice_object(Value start,Value stop,Value step);
+extern ValueSlice builtins_slice_get_slice_object(Value start,Value stop,Value step);
 
 
 
@@ -0,0 +1,163 @@
+#include <iostream>
+#include <sstream>
+
+#include "builtins.hpp"
+#include "builtins_helpers.hpp"
+#include "../pyallocator.hpp"
+
+namespace py {
+namespace builtins {
+
+std::unordered_map<std::string, ValueCMethod> builtin_dict_attributes;
+
+struct dict_iterator : public value::CGenerator {
+    ValueDict dict;
+    DictIter kind;
+    size_t i = 0;
+    size_t expected_size;
+
+    dict_iterator(ValueDict dict, DictIter kind) : dict(dict), kind(kind) {
+        this->expected_size = dict->size();
+        this->dict.retain();
+    }
+
+    virtual ~dict_iterator() {
+        dict.release();
+    }
+
+    virtual std::optional<Value> next() {
+        if (dict->size() != expected_size) {
+            throw pyerror("RuntimeError: dictionary changed size during iteration");
+        }
+
+        auto& entries = dict->entries;
+        while (i < entries.size() && entries[i].hash == 0) {
+            ++i; // skip over erased entries
+        }
+        if (i >= entries.size()) {
+            return std::nullopt;
+        }
+
+        auto& entry = entries[i++];
+        switch (kind) {
+            case DictIter::KEYS:
+                return entry.key;
+            case DictIter::VALUES:
+                return entry.value;
+            default:
+            {
+                ValueTuple item = alloc().heap_tuple.make();
+                item->values.reserve(2);
+                item->values.push_back(entry.key);
+                item->values.push_back(entry.value);
+                return item;
+            }
+        }
+    }
+};
+
+ValueCGenerator builtins_dict_iterator(ValueDict dict, DictIter kind) {
+    return std::make_shared<dict_iterator>(dict, kind);
+}
+
+static void throw_key_error(const Value& key) {
+    std::stringstream ss;
+    ss << "KeyError: " << key;
+    throw pyerror(ss.str());
+}
+
+void initialize_dict_class() {
+    builtin_dict_attributes["get"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueDict> args(_args);
+        if (_args.size() < 2 || _args.size() > 3) {
+            throw pyerror("TypeError: dict.get expected 1 or 2 arguments.");
+        }
+
+        Value* found = args.get<0>()->find(_args[1]);
+        if (found != nullptr) {
+            frame.value_stack.push_back(*found);
+        } else if (_args.size() == 3) {
+            frame.value_stack.push_back(_args[2]);
+        } else {
+            frame.value_stack.push_back(value::NoneType());
+        }
+    });
+
+    builtin_dict_attributes["setdefault"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueDict> args(_args);
+        if (_args.size() < 2 || _args.size() > 3) {
+            throw pyerror("TypeError: dict.setdefault expected 1 or 2 arguments.");
+        }
+
+        ValueDict dict = args.get<0>();
+        Value* found = dict->find(_args[1]);
+        if (found != nullptr) {
+            frame.value_stack.push_back(*found);
+        } else {
+            Value value = _args.size() == 3 ? _args[2] : value::NoneType();
+            dict->set(_args[1], value);
+            frame.value_stack.push_back(std::move(value));
+        }
+    });
+
+    builtin_dict_attributes["pop"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueDict> args(_args);
+        if (_args.size() < 2 || _args.size() > 3) {
+            throw pyerror("TypeError: dict.pop expected 1 or 2 arguments.");
+        }
+
+        Value removed;
+        if (args.get<0>()->erase(_args[1], &removed)) {
+            frame.value_stack.push_back(std::move(removed));
+        } else if (_args.size() == 3) {
+            frame.value_stack.push_back(_args[2]);
+        } else {
+            throw_key_error(_args[1]);
+        }
+    });
+
+    builtin_dict_attributes["update"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueDict, ValueDict> args(_args);
+        ValueDict dict = args.get<0>();
+        ValueDict other = args.get<1>();
+
+        dict->reserve(dict->size() + other->size());
+        for (auto& entry : other->entries) {
+            if (entry.hash != 0) {
+                dict->set(entry.key, entry.value);
+            }
+        }
+
+        frame.value_stack.push_back(value::NoneType());
+    });
+
+    builtin_dict_attributes["clear"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueDict> args(_args);
+        args.get<0>()->clear();
+        frame.value_stack.push_back(value::NoneType());
+    });
+
+    builtin_dict_attributes["copy"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueDict> args(_args);
+        // copies the index as well, so no key is hashed again
+        frame.value_stack.push_back(alloc().heap_dict.make(*args.get<0>()));
+    });
+
+    builtin_dict_attributes["keys"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueDict> args(_args);
+        frame.value_stack.push_back(builtins_dict_iterator(args.get<0>(), DictIter::KEYS));
+    });
+
+    builtin_dict_attributes["values"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueDict> args(_args);
+        frame.value_stack.push_back(builtins_dict_iterator(args.get<0>(), DictIter::VALUES));
+    });
+
+    builtin_dict_attributes["items"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueDict> args(_args);
+        frame.value_stack.push_back(builtins_dict_iterator(args.get<0>(), DictIter::ITEMS));
+    });
+}
+
+}
+}
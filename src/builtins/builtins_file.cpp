@@ -0,0 +1,285 @@
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "builtins.hpp"
+#include "builtins_helpers.hpp"
+#include "../pyallocator.hpp"
+#include "../pyoutput.hpp"
+#include "../optflags.hpp"
+
+namespace py {
+namespace builtins {
+
+std::unordered_map<std::string, ValueCMethod> builtin_file_attributes;
+
+namespace {
+
+// files at least this large are mapped instead of read, below it the mapping
+// costs more than copying the file through a single chunk
+constexpr size_t MMAP_MIN_SIZE = 1 << 16;
+constexpr size_t CHUNK_SIZE = 1 << 16;
+
+pyerror os_error(const std::string& name) {
+    std::stringstream ss;
+    ss << (errno == ENOENT ? "FileNotFoundError" : "OSError")
+        << ": [Errno " << errno << "] " << std::strerror(errno) << ": '" << name << "'";
+    return pyerror(ss.str());
+}
+
+file_object& file_arg(ArgList& args, const char* method, size_t min, size_t max) {
+    if (args.size() < min + 1 || args.size() > max + 1) {
+        std::stringstream ss;
+        ss << "TypeError: file." << method << "() takes at most " << max
+            << " arguments but " << args.size() - 1 << " were given";
+        throw pyerror(ss.str());
+    }
+    return static_cast<file_object&>(*std::get<ValueCGenerator>(args[0]));
+}
+
+inline ValueString make_string(std::string_view str) {
+    if (str.size() == 1) {
+        return value::String::character(str[0]);
+    }
+    return alloc().heap_string.make(std::string(str));
+}
+
+}
+
+file_object::file_object(std::string name, int fd, bool readable)
+        : name(std::move(name)), fd(fd), readable(readable) {
+    if (!readable) {
+        this->out = std::make_unique<OutputBuffer>(fd);
+        return ;
+    }
+#ifdef MMAP_FILES_ON
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && (size_t)info.st_size >= MMAP_MIN_SIZE) {
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+            this->mapping = mapping;
+            this->data = (const char*)mapping;
+            this->size = info.st_size;
+            this->at_eof = true;
+        }
+    }
+#endif
+}
+
+file_object::~file_object() {
+    try {
+        this->close();
+    } catch (const pyerror&) {
+        // a failed flush has nowhere to go from a destructor
+    }
+}
+
+std::optional<Value> file_object::next() {
+    std::string_view line = this->read_line();
+    if (line.empty()) {
+        return std::nullopt;
+    }
+    return make_string(line);
+}
+
+std::string_view file_object::read_line() {
+    this->check_open(true);
+    size_t scanned = 0;
+    for (;;) {
+        const char* start = this->data + this->pos;
+        const size_t unread = this->size - this->pos;
+        if (unread > scanned) {
+            auto newline = (const char*)std::memchr(start + scanned, '\n', unread - scanned);
+            if (newline != nullptr) {
+                const size_t length = newline + 1 - start;
+                this->pos += length;
+                return std::string_view(start, length);
+            }
+        }
+        scanned = unread;
+        if (!this->fill()) {
+            // the last line has no newline, fill may have moved it
+            std::string_view rest(this->data + this->pos, this->size - this->pos);
+            this->pos = this->size;
+            return rest;
+        }
+    }
+}
+
+std::string_view file_object::read(int64_t count) {
+    this->check_open(true);
+    while ((count < 0 || this->size - this->pos < (size_t)count) && this->fill()) { }
+    const size_t length = count < 0 ? this->size - this->pos : std::min<size_t>(count, this->size - this->pos);
+    std::string_view result(this->data + this->pos, length);
+    this->pos += length;
+    return result;
+}
+
+void file_object::write(std::string_view str) {
+    this->check_open(false);
+    this->out->write(str.data(), str.size());
+}
+
+void file_object::close() {
+    if (this->fd < 0) {
+        return ;
+    }
+    const int fd = this->fd;
+    this->fd = -1;
+    if (this->mapping != nullptr) {
+        munmap(this->mapping, this->size);
+        this->mapping = nullptr;
+    }
+    this->data = nullptr;
+    this->size = this->pos = 0;
+    this->chunks.clear();
+    try {
+        if (this->out != nullptr) {
+            this->out->flush();
+        }
+    } catch (const pyerror&) {
+        ::close(fd);
+        throw;
+    }
+    if (::close(fd) != 0) {
+        throw os_error(this->name);
+    }
+}
+
+void file_object::check_open(bool reading) {
+    if (this->fd < 0) {
+        throw pyerror("ValueError: I/O operation on closed file");
+    }
+    if (reading != this->readable) {
+        throw pyerror(reading ? "io.UnsupportedOperation: not readable" : "io.UnsupportedOperation: not writable");
+    }
+}
+
+bool file_object::fill() {
+    if (this->at_eof) {
+        return false;
+    }
+    // drop what was read already, what is left is less than a line
+    this->chunks.erase(0, this->pos);
+    this->pos = 0;
+
+    const size_t old_size = this->chunks.size();
+    this->chunks.resize(old_size + CHUNK_SIZE);
+    ssize_t count;
+    do {
+        count = ::read(this->fd, &this->chunks[old_size], CHUNK_SIZE);
+    } while (count < 0 && errno == EINTR);
+    if (count < 0) {
+        this->chunks.resize(old_size);
+        throw os_error(this->name);
+    }
+    this->chunks.resize(old_size + count);
+    this->data = this->chunks.data();
+    this->size = this->chunks.size();
+    if (count == 0) {
+        this->at_eof = true;
+        return false;
+    }
+    return true;
+}
+
+void initialize_file_class() {
+    builtin_file_attributes["read"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        file_object& file = file_arg(args, "read", 0, 1);
+        int64_t count = -1;
+        if (args.size() == 2 && !std::holds_alternative<value::NoneType>(args[1])) {
+            auto i = std::get_if<int64_t>(&args[1]);
+            if (i == nullptr) {
+                throw pyerror("TypeError: file.read() expected an int");
+            }
+            count = *i;
+        }
+        frame.value_stack.push_back(make_string(file.read(count)));
+    });
+
+    builtin_file_attributes["readline"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        file_object& file = file_arg(args, "readline", 0, 0);
+        frame.value_stack.push_back(make_string(file.read_line()));
+    });
+
+    builtin_file_attributes["readlines"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        file_object& file = file_arg(args, "readlines", 0, 0);
+        std::vector<Value> lines;
+        for (std::string_view line = file.read_line(); !line.empty(); line = file.read_line()) {
+            lines.push_back(make_string(line));
+        }
+        frame.value_stack.push_back(alloc().heap_list.make(std::move(lines)));
+    });
+
+    builtin_file_attributes["write"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        file_object& file = file_arg(args, "write", 1, 1);
+        auto str = std::get_if<ValueString>(&args[1]);
+        if (str == nullptr) {
+            std::stringstream ss;
+            ss << "TypeError: write() argument must be str, not " << args[1];
+            throw pyerror(ss.str());
+        }
+        file.write((*str)->str());
+        frame.value_stack.push_back((int64_t)(*str)->size());
+    });
+
+    builtin_file_attributes["close"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        file_arg(args, "close", 0, 0).close();
+        frame.value_stack.push_back(value::NoneType());
+    });
+}
+
+void inject_file_builtins(Namespace& ns) {
+    (*ns)["open"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        if (args.size() < 1 || args.size() > 2) {
+            throw pyerror("TypeError: open() takes a file name and an optional mode");
+        }
+        auto name = std::get_if<ValueString>(&args[0]);
+        auto mode = args.size() == 2 ? std::get_if<ValueString>(&args[1]) : nullptr;
+        if (name == nullptr || (args.size() == 2 && mode == nullptr)) {
+            throw pyerror("TypeError: open() expects str arguments");
+        }
+
+        // there is no bytes type, so binary and text mode read the same strings
+        const std::string how = mode != nullptr ? (*mode)->str() : "r";
+        int flags = -1;
+        for (char c : how) {
+            if (c == 'b' || c == 't') {
+                continue;
+            } else if (flags != -1) {
+                flags = -1;
+                break;
+            } else if (c == 'r') {
+                flags = O_RDONLY;
+            } else if (c == 'w') {
+                flags = O_WRONLY | O_CREAT | O_TRUNC;
+            } else if (c == 'a') {
+                flags = O_WRONLY | O_CREAT | O_APPEND;
+            } else {
+                break;
+            }
+        }
+        if (flags == -1) {
+            throw pyerror("ValueError: invalid mode: '" + how + "'");
+        }
+
+        int fd;
+        do {
+            fd = ::open((*name)->c_str(), flags | O_CLOEXEC, 0666);
+        } while (fd < 0 && errno == EINTR);
+        if (fd < 0) {
+            throw os_error((*name)->str());
+        }
+        frame.value_stack.push_back(
+            ValueCGenerator(std::make_shared<file_object>((*name)->str(), fd, flags == O_RDONLY))
+        );
+    });
+}
+
+}
+}
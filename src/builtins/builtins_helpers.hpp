@@ -2,6 +2,7 @@
 #define BUILTINS_HELPERS_HPP
 
 #include <sstream>
+#include "../pyerror.hpp"
 #include "../pyvalue.hpp"
 #include "./builtins_helpers_old.hpp"
 
@@ -47,7 +48,43 @@ namespace py {
             return std::get<argType>(arglist[index]);
         }
     };
+
+namespace builtins {
+
+// Calls f on each item of a builtin iterable until f returns false,
+// fname names the caller in the TypeError for anything else
+template<typename F>
+void for_each_item(const Value& iterable, const char* fname, F&& f) {
+    if (auto list = std::get_if<ValueList>(&iterable)) {
+        for (size_t i = 0; i < (*list)->size(); ++i) {
+            if (!f((*list)->get(i))) return;
+        }
+    } else if (auto tuple = std::get_if<ValueTuple>(&iterable)) {
+        for (const Value& value : **tuple) {
+            if (!f(value)) return;
+        }
+    } else if (auto set = std::get_if<ValueSet>(&iterable)) {
+        size_t pos = 0;
+        Value value;
+        while ((*set)->next(pos, value)) {
+            if (!f(value)) return;
+        }
+    } else if (auto dict = std::get_if<ValueDict>(&iterable)) {
+        for (const auto& entry : (*dict)->entries) {
+            if (entry.hash != 0 && !f(entry.key)) return;
+        }
+    } else if (auto gen = std::get_if<ValueCGenerator>(&iterable)) {
+        while (std::optional<Value> value = (*gen)->next()) {
+            if (!f(*value)) return;
+        }
+    } else {
+        std::stringstream ss;
+        ss << "TypeError: " << fname << "() can not iterate over " << iterable;
+        throw pyerror(ss.str());
+    }
 }
 
+}
+}
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "builtins.hpp"
 #include "builtins_helpers.hpp"
+#include "../pysort.hpp"
 
 // #include "../pyvalue_helpers.hpp"
 
@@ -10,6 +11,181 @@ namespace builtins {
 
 std::unordered_map<std::string, ValueCMethod> builtin_list_attributes;
 
+ValueList builtins_list_from(const Value& iterable) {
+    ValueList list = alloc().heap_list.make();
+    if (auto other = std::get_if<ValueList>(&iterable)) {
+        list->extend(**other);
+        return list;
+    }
+    for_each_item(iterable, "list", [&](const Value& value) {
+        list->append(value);
+        return true;
+    });
+    return list;
+}
+
+namespace {
+
+#ifdef TYPED_SORT_ON
+// int lists at least this long are radix sorted
+constexpr size_t RADIX_SORT_THRESHOLD = 256;
+#endif
+
+// Sorts items by keys, both are reordered. Equal keys keep their order, also when
+// reversed, which like CPython is done by reversing before and after the sort
+template<typename K, typename Less>
+void sort_decorated(std::vector<K>& keys, std::vector<Value>& items, bool reverse, Less less) {
+    std::vector<std::pair<K, Value>> pairs;
+    pairs.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        pairs.emplace_back(std::move(keys[i]), std::move(items[i]));
+    }
+    if (reverse) {
+        std::reverse(pairs.begin(), pairs.end());
+    }
+
+    auto by_key = [&less](const std::pair<K, Value>& a, const std::pair<K, Value>& b) {
+        return less(a.first, b.first);
+    };
+#ifdef TYPED_SORT_ON
+    if constexpr (std::is_same<K, int64_t>::value) {
+        if (pairs.size() >= RADIX_SORT_THRESHOLD) {
+            sort::radix_sort(pairs, [](const std::pair<K, Value>& p) { return p.first; });
+        } else {
+            sort::timsort(pairs.begin(), pairs.end(), by_key);
+        }
+    } else
+#endif
+    sort::timsort(pairs.begin(), pairs.end(), by_key);
+
+    if (reverse) {
+        std::reverse(pairs.begin(), pairs.end());
+    }
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        items[i] = std::move(pairs[i].second);
+    }
+}
+
+// the items sorted by themselves, or by the keys when keys is not null
+void sort_items(FrameState& frame, std::vector<Value>& items, value::List* keys, bool reverse) {
+    auto generic_less = [&frame](const Value& a, const Value& b) {
+        return builtins_less_than(frame, a, b);
+    };
+    value::List self;
+    if (keys == nullptr) {
+        self = value::List(items.begin(), items.end());
+        keys = &self;
+    }
+
+#ifdef TYPED_SORT_ON
+    // keys of a single type are compared without going through a visitor
+    if (keys->strategy == value::List::INTS) {
+        sort_decorated(keys->ints, items, reverse, std::less<int64_t>());
+        return;
+    } else if (keys->strategy == value::List::DOUBLES) {
+        sort_decorated(keys->doubles, items, reverse, std::less<double>());
+        return;
+    }
+    std::vector<Value>& values = keys->values;
+    if (std::all_of(values.begin(), values.end(),
+            [](const Value& v) { return std::holds_alternative<ValueString>(v); })) {
+        std::vector<ValueString> strings;
+        strings.reserve(values.size());
+        for (const Value& v : values) {
+            strings.push_back(std::get<ValueString>(v));
+        }
+        sort_decorated(strings, items, reverse, [](const ValueString& a, const ValueString& b) {
+            return *a < *b;
+        });
+        return;
+    }
+#endif
+    sort_decorated(keys->generic(), items, reverse, generic_less);
+}
+
+}
+
+void builtins_list_sort(FrameState& frame, ValueList list, const Value& key, bool reverse) {
+#ifdef TYPED_SORT_ON
+    // a list of ints or floats is sorted in place, equal ints can not be told
+    // apart so only floats (0.0 and -0.0) need the stable sort
+    if (std::holds_alternative<value::NoneType>(key)) {
+        if (list->strategy == value::List::INTS) {
+            std::vector<int64_t>& ints = list->ints;
+            if (ints.size() >= RADIX_SORT_THRESHOLD) {
+                sort::radix_sort(ints, [](int64_t v) { return v; });
+            } else {
+                sort::timsort(ints.begin(), ints.end(), std::less<int64_t>());
+            }
+            if (reverse) {
+                std::reverse(ints.begin(), ints.end());
+            }
+            return;
+        } else if (list->strategy == value::List::DOUBLES) {
+            std::vector<double>& doubles = list->doubles;
+            if (reverse) std::reverse(doubles.begin(), doubles.end());
+            sort::timsort(doubles.begin(), doubles.end(), std::less<double>());
+            if (reverse) std::reverse(doubles.begin(), doubles.end());
+            return;
+        }
+    }
+#endif
+
+    // like CPython the list is empty while it is sorted, so that a key function
+    // that changes it can be caught, and the items are kept alive on the stack
+    ValueList saved = alloc().heap_list.make(std::move(*list));
+    *list = value::List();
+    frame.value_stack.push_back(saved);
+    ValueList keys = alloc().heap_list.make();
+    frame.value_stack.push_back(keys);
+
+    std::vector<Value> items;
+    try {
+        items.reserve(saved->size());
+        for (size_t i = 0; i < saved->size(); ++i) {
+            items.push_back(saved->get(i));
+        }
+        if (!std::holds_alternative<value::NoneType>(key)) {
+            keys->reserve(items.size());
+            for (const Value& item : items) {
+                ArgList key_args(item);
+                keys->append(value_helper::call_sync(frame, key, key_args));
+            }
+        }
+        sort_items(frame, items, std::holds_alternative<value::NoneType>(key) ? nullptr : &*keys, reverse);
+    } catch (...) {
+        *list = std::move(*saved);
+        frame.value_stack.resize(frame.value_stack.size() - 2);
+        throw;
+    }
+
+    frame.value_stack.resize(frame.value_stack.size() - 2);
+    if (list->size() != 0) {
+        *list = std::move(*saved);
+        throw pyerror("ValueError: list modified during sort");
+    }
+    *list = value::List(std::move(items));
+}
+
+void builtins_sort_options(ArgList& args, size_t positional, const char* fname, Value& key, bool& reverse) {
+    if (args.positional() != positional) {
+        std::stringstream ss;
+        ss << "TypeError: " << fname << "() takes " << positional << " positional arguments";
+        throw pyerror(ss.str());
+    }
+    for (size_t i = 0; i < args.kwnames.size(); ++i) {
+        const std::string& name = *args.kwnames[i];
+        const Value& value = args[args.positional() + i];
+        if (name == "key") {
+            key = value;
+        } else if (name == "reverse") {
+            reverse = std::visit(value_helper::visitor_is_truthy(), value);
+        } else {
+            throw pyerror("TypeError: '" + name + "' is an invalid keyword argument for " + fname + "()");
+        }
+    }
+}
+
 void initialize_list_class() {
     // builtin_list_attributes["append"] = pycfunction_builder([](ValueList& list, Value val) -> void {
     //     list->values.push_back(val);
@@ -21,7 +197,7 @@ void initialize_list_class() {
         if (_args.size() < 2) {
             throw pyerror("list.append expected 2 arguments.");
         }
-        args.get<0>()->values.push_back(_args[1]);
+        args.get<0>()->append(_args[1]);
 
         frame.value_stack.push_back(value::NoneType());
     });
@@ -29,10 +205,7 @@ void initialize_list_class() {
     builtin_list_attributes["extend"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
         arg_decoder<ValueList, ValueList> args(_args);
         ValueList list = args.get<0>();
-        
-        for (auto& val : args.get<1>()->values) {
-            list->values.push_back(val);
-        }
+        list->extend(*args.get<1>());
 
         frame.value_stack.push_back(value::NoneType());
     });
@@ -48,11 +221,23 @@ void initialize_list_class() {
         
         Value val = _args[2];
 
-        if (index < 0 || index >= list->values.size()) {
+        if (index < 0 || index >= list->size()) {
             throw pyerror("RangeError: index is out of range.");
         }
 
-        list->values.insert(list->values.begin() + index, val);
+        list->insert(index, val);
+
+        frame.value_stack.push_back(value::NoneType());
+    });
+
+    builtin_list_attributes["sort"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueList> args(_args);
+        ValueList list = args.get<0>();
+
+        Value key = value::NoneType();
+        bool reverse = false;
+        builtins_sort_options(_args, 1, "sort", key, reverse);
+        builtins_list_sort(frame, list, key, reverse);
 
         frame.value_stack.push_back(value::NoneType());
     });
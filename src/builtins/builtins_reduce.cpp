@@ -0,0 +1,508 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <sstream>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "builtins.hpp"
+#include "builtins_helpers.hpp"
+#include "../optflags.hpp"
+#include "../pyophelpers.hpp"
+
+namespace py {
+namespace builtins {
+
+/*
+    sum, min, max, any and all
+
+    Every one of them works on any iterable the builtins know how to walk, by
+    boxing each item and applying the interpreter's own operators to it. With
+    VECTOR_REDUCTIONS_ON the int and float strategies of a list are instead
+    reduced straight from their arrays, by AVX2 kernels when the CPU has them
+    (checked once at runtime) and by plain loops otherwise, and an unconsumed
+    range is reduced in closed form.
+*/
+
+namespace {
+
+#ifdef VECTOR_REDUCTIONS_ON
+
+namespace kernels {
+
+// the sum wraps around, min and max tell whether it could have
+struct int_stats {
+    int64_t sum = 0;
+    int64_t min = std::numeric_limits<int64_t>::max();
+    int64_t max = std::numeric_limits<int64_t>::min();
+};
+
+struct double_stats {
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    bool has_nan = false;
+};
+
+int_stats int_stats_scalar(const int64_t* data, size_t n) {
+    int_stats stats;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += (uint64_t)data[i];
+        stats.min = std::min(stats.min, data[i]);
+        stats.max = std::max(stats.max, data[i]);
+    }
+    stats.sum = (int64_t)sum;
+    return stats;
+}
+
+double_stats double_stats_scalar(const double* data, size_t n) {
+    double_stats stats;
+    for (size_t i = 0; i < n; ++i) {
+        if (std::isnan(data[i])) {
+            stats.has_nan = true;
+            return stats;
+        }
+        stats.min = std::min(stats.min, data[i]);
+        stats.max = std::max(stats.max, data[i]);
+    }
+    return stats;
+}
+
+// index of the first item that is (or is not) zero, n if there is none
+template<typename T>
+size_t find_zero_scalar(const T* data, size_t n, bool zero) {
+    for (size_t i = 0; i < n; ++i) {
+        if ((data[i] == 0) == zero) {
+            return i;
+        }
+    }
+    return n;
+}
+
+#ifdef __x86_64__
+
+__attribute__((target("avx2")))
+int_stats int_stats_avx2(const int64_t* data, size_t n) {
+    __m256i sum = _mm256_setzero_si256();
+    __m256i min = _mm256_set1_epi64x(std::numeric_limits<int64_t>::max());
+    __m256i max = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        sum = _mm256_add_epi64(sum, v);
+        // there is no 64 bit min or max before AVX-512
+        min = _mm256_blendv_epi8(min, v, _mm256_cmpgt_epi64(min, v));
+        max = _mm256_blendv_epi8(max, v, _mm256_cmpgt_epi64(v, max));
+    }
+
+    alignas(32) int64_t sums[4], mins[4], maxs[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(sums), sum);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(mins), min);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(maxs), max);
+
+    int_stats stats = int_stats_scalar(data + i, n - i);
+    uint64_t total = (uint64_t)stats.sum;
+    for (size_t lane = 0; lane < 4; ++lane) {
+        total += (uint64_t)sums[lane];
+        stats.min = std::min(stats.min, mins[lane]);
+        stats.max = std::max(stats.max, maxs[lane]);
+    }
+    stats.sum = (int64_t)total;
+    return stats;
+}
+
+__attribute__((target("avx2")))
+double_stats double_stats_avx2(const double* data, size_t n) {
+    __m256d min = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    __m256d max = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+    __m256d nan = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256d v = _mm256_loadu_pd(data + i);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+        min = _mm256_min_pd(min, v);
+        max = _mm256_max_pd(max, v);
+    }
+
+    double_stats stats = double_stats_scalar(data + i, n - i);
+    if (_mm256_movemask_pd(nan) != 0) {
+        stats.has_nan = true;
+    }
+    if (stats.has_nan) {
+        return stats;
+    }
+
+    alignas(32) double mins[4], maxs[4];
+    _mm256_store_pd(mins, min);
+    _mm256_store_pd(maxs, max);
+    for (size_t lane = 0; lane < 4; ++lane) {
+        stats.min = std::min(stats.min, mins[lane]);
+        stats.max = std::max(stats.max, maxs[lane]);
+    }
+    return stats;
+}
+
+__attribute__((target("avx2")))
+size_t find_zero_avx2(const int64_t* data, size_t n, bool zero) {
+    const int flip = zero ? 0 : 0xf;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const int mask = _mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpeq_epi64(v, _mm256_setzero_si256()))) ^ flip;
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_zero_scalar(data + i, n - i, zero);
+}
+
+__attribute__((target("avx2")))
+size_t find_zero_avx2(const double* data, size_t n, bool zero) {
+    const int flip = zero ? 0 : 0xf;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        // -0.0 is zero and nan is not, as with == 0
+        const int mask = _mm256_movemask_pd(
+            _mm256_cmp_pd(_mm256_loadu_pd(data + i), _mm256_setzero_pd(), _CMP_EQ_OQ)) ^ flip;
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_zero_scalar(data + i, n - i, zero);
+}
+
+inline bool has_avx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+#endif
+
+inline int_stats int_stats_of(const std::vector<int64_t>& data) {
+#ifdef __x86_64__
+    if (has_avx2()) return int_stats_avx2(data.data(), data.size());
+#endif
+    return int_stats_scalar(data.data(), data.size());
+}
+
+inline double_stats double_stats_of(const std::vector<double>& data) {
+#ifdef __x86_64__
+    if (has_avx2()) return double_stats_avx2(data.data(), data.size());
+#endif
+    return double_stats_scalar(data.data(), data.size());
+}
+
+template<typename T>
+inline size_t find_zero(const std::vector<T>& data, bool zero) {
+#ifdef __x86_64__
+    if (has_avx2()) return find_zero_avx2(data.data(), data.size(), zero);
+#endif
+    return find_zero_scalar(data.data(), data.size(), zero);
+}
+
+}
+
+value::BigInt bigint_of(__int128 value) {
+    // value is high * 2^64 + low, built up 32 bits at a time
+    const uint64_t low = (uint64_t)value;
+    value::BigInt result = value::BigInt::shift_left(value::BigInt((int64_t)(value >> 64)), 32);
+    result = value::BigInt::add(result, value::BigInt((int64_t)(low >> 32)));
+    result = value::BigInt::shift_left(result, 32);
+    return value::BigInt::add(result, value::BigInt((int64_t)(low & 0xffffffff)));
+}
+
+Value int128_to_value(__int128 value) {
+    if (value >= std::numeric_limits<int64_t>::min() && value <= std::numeric_limits<int64_t>::max()) {
+        return (int64_t)value;
+    }
+    return value::BigInt::to_value(bigint_of(value));
+}
+
+// the exact sum of an int list, the vector sum is used when no order of
+// additions can overflow, so the wrapped result is the real one
+Value sum_ints(const std::vector<int64_t>& ints) {
+    if (ints.empty()) {
+        return (int64_t)0;
+    }
+    const kernels::int_stats stats = kernels::int_stats_of(ints);
+    const uint64_t magnitude = std::max(
+        stats.max > 0 ? (uint64_t)stats.max : 0,
+        stats.min < 0 ? -(uint64_t)stats.min : 0);
+    if (magnitude <= (uint64_t)std::numeric_limits<int64_t>::max() / ints.size()) {
+        return stats.sum;
+    }
+
+    __int128 sum = 0;
+    for (int64_t value : ints) {
+        sum += value;
+    }
+    return int128_to_value(sum);
+}
+
+// the range a fresh range() would still yield, only increasing ranges are handled
+bool range_bounds(const Value& iterable, std::shared_ptr<range_generator>& range, uint64_t& length) {
+    auto gen = std::get_if<ValueCGenerator>(&iterable);
+    if (gen == nullptr) {
+        return false;
+    }
+    range = std::dynamic_pointer_cast<range_generator>(*gen);
+    if (range == nullptr || range->step_size <= 0) {
+        return false;
+    }
+    length = range->start < range->stop ?
+        ((uint64_t)range->stop - (uint64_t)range->start - 1) / (uint64_t)range->step_size + 1 : 0;
+    return true;
+}
+
+#endif
+
+// Python's + and < for the numeric types, the result of the visit is left on the stack
+template<typename Op>
+Value numeric_op(FrameState& frame, const Value& a, const Value& b) {
+    auto unbool = [](const Value& v) -> Value {
+        if (auto b = std::get_if<bool>(&v)) return (int64_t)*b;
+        if (std::holds_alternative<ValuePyObject>(v)) {
+            // an overload would push a frame rather than return its result here
+            throw pyerror(std::string("TypeError: unsupported operand type(s) for ") + Op::op_name);
+        }
+        return v;
+    };
+    Value v1 = unbool(a), v2 = unbool(b);
+    std::visit(eval_helpers::numeric_visitor<Op>(frame), v1, v2);
+    Value result = std::move(frame.value_stack.back());
+    frame.value_stack.pop_back();
+    return result;
+}
+
+}
+
+bool builtins_less_than(FrameState& frame, const Value& a, const Value& b) {
+    auto s1 = std::get_if<ValueString>(&a);
+    auto s2 = std::get_if<ValueString>(&b);
+    if (s1 != nullptr && s2 != nullptr) {
+        return **s1 < **s2;
+    }
+    return std::get<bool>(numeric_op<eval_helpers::op_lt>(frame, a, b));
+}
+
+namespace {
+
+Value builtin_sum(FrameState& frame, const Value& iterable, const Value& start) {
+#ifdef VECTOR_REDUCTIONS_ON
+    if (auto list = std::get_if<ValueList>(&iterable)) {
+        const value::List& l = **list;
+        if (l.strategy == value::List::INTS && std::holds_alternative<int64_t>(start)) {
+            return numeric_op<eval_helpers::op_add>(frame, start, sum_ints(l.ints));
+        } else if (l.strategy == value::List::DOUBLES && l.size() != 0) {
+            // added in order so that the rounding matches a loop
+            double sum = std::get<double>(numeric_op<eval_helpers::op_add>(frame, start, l.doubles[0]));
+            for (size_t i = 1; i < l.doubles.size(); ++i) {
+                sum += l.doubles[i];
+            }
+            return sum;
+        }
+    }
+
+    std::shared_ptr<range_generator> range;
+    uint64_t length;
+    if (std::holds_alternative<int64_t>(start) && range_bounds(iterable, range, length)) {
+        // start + length * first + step * length * (length - 1) / 2
+        const unsigned __int128 n = length;
+        const unsigned __int128 pairs = n == 0 ? 0 : n * (n - 1) / 2;
+        value::BigInt sum = value::BigInt::add(
+            value::BigInt::mul(value::BigInt(range->start), bigint_of(n)),
+            value::BigInt::mul(value::BigInt(range->step_size), bigint_of(pairs)));
+        sum = value::BigInt::add(sum, value::BigInt(std::get<int64_t>(start)));
+        range->start = std::max(range->start, range->stop);
+        return value::BigInt::to_value(std::move(sum));
+    }
+#endif
+
+    Value sum = start;
+    for_each_item(iterable, "sum", [&](const Value& value) {
+        sum = numeric_op<eval_helpers::op_add>(frame, sum, value);
+        return true;
+    });
+    return sum;
+}
+
+// min or max, either over one iterable or over the arguments
+template<bool is_min>
+Value builtin_minmax(FrameState& frame, ArgList& args, const char* fname) {
+    if (args.size() == 0) {
+        throw pyerror(std::string("TypeError: ") + fname + "() expected at least 1 argument");
+    }
+
+#ifdef VECTOR_REDUCTIONS_ON
+    if (args.size() == 1) {
+        if (auto list = std::get_if<ValueList>(&args[0])) {
+            const value::List& l = **list;
+            if (l.strategy == value::List::INTS && l.size() != 0) {
+                const kernels::int_stats stats = kernels::int_stats_of(l.ints);
+                return is_min ? stats.min : stats.max;
+            } else if (l.strategy == value::List::DOUBLES && l.size() != 0) {
+                const kernels::double_stats stats = kernels::double_stats_of(l.doubles);
+                // nan makes the answer depend on the order, which only the loop below keeps
+                if (!stats.has_nan) {
+                    const double result = is_min ? stats.min : stats.max;
+                    // 0.0 and -0.0 are equal, the first one of them is the answer
+                    return result != 0 ? result : *std::find(l.doubles.begin(), l.doubles.end(), 0.0);
+                }
+            }
+        }
+
+        std::shared_ptr<range_generator> range;
+        uint64_t length;
+        if (range_bounds(args[0], range, length) && length != 0) {
+            const int64_t first = range->start;
+            const int64_t last = (int64_t)((uint64_t)first + (length - 1) * (uint64_t)range->step_size);
+            range->start = range->stop;
+            return is_min ? first : last;
+        }
+    }
+#endif
+
+    std::optional<Value> best;
+    auto step = [&](const Value& value) {
+        if (!best || (is_min ? builtins_less_than(frame, value, *best) : builtins_less_than(frame, *best, value))) {
+            best = value;
+        }
+        return true;
+    };
+    if (args.size() == 1) {
+        for_each_item(args[0], fname, step);
+    } else {
+        for (size_t i = 0; i < args.size(); ++i) {
+            step(args[i]);
+        }
+    }
+
+    if (!best) {
+        throw pyerror(std::string("ValueError: ") + fname + "() arg is an empty sequence");
+    }
+    return *best;
+}
+
+// any looks for the first true item and all for the first false one
+Value builtin_any_all(const Value& iterable, bool any) {
+#ifdef VECTOR_REDUCTIONS_ON
+    if (auto list = std::get_if<ValueList>(&iterable)) {
+        const value::List& l = **list;
+        if (l.strategy == value::List::INTS) {
+            return (kernels::find_zero(l.ints, !any) != l.ints.size()) == any;
+        } else if (l.strategy == value::List::DOUBLES) {
+            return (kernels::find_zero(l.doubles, !any) != l.doubles.size()) == any;
+        }
+    }
+
+    std::shared_ptr<range_generator> range;
+    uint64_t length;
+    if (range_bounds(iterable, range, length)) {
+        // the index of the only item that can be 0
+        const uint64_t distance = 0 - (uint64_t)range->start;
+        const uint64_t zero = range->start <= 0 && distance % (uint64_t)range->step_size == 0 ?
+            distance / (uint64_t)range->step_size : UINT64_MAX;
+        uint64_t found;
+        if (any) {
+            found = zero != 0 ? 0 : 1;
+        } else {
+            found = zero;
+        }
+        if (found >= length) {
+            range->start = range->stop;
+            return !any;
+        }
+        // leave the range just past the item that decided it, as a loop would
+        range->start += (int64_t)(found + 1) * range->step_size;
+        return any;
+    }
+#endif
+
+    bool result = !any;
+    for_each_item(iterable, any ? "any" : "all", [&](const Value& value) {
+        if (std::visit(value_helper::visitor_is_truthy(), value) == any) {
+            result = any;
+            return false;
+        }
+        return true;
+    });
+    return result;
+}
+
+struct abs_visitor {
+    Value operator()(bool value) const {
+        return (int64_t)value;
+    }
+
+    Value operator()(int64_t value) const {
+        if (value == std::numeric_limits<int64_t>::min()) {
+            return value::BigInt::to_value(value::BigInt::sub(value::BigInt(0), value::BigInt(value)));
+        }
+        return value < 0 ? -value : value;
+    }
+
+    Value operator()(double value) const {
+        return std::fabs(value);
+    }
+
+    Value operator()(const ValueBigInt& value) const {
+        value::BigInt result = *value;
+        result.negative = false;
+        return value::BigInt::to_value(std::move(result));
+    }
+
+    template<typename T>
+    Value operator()(const T& value) const {
+        std::stringstream ss;
+        ss << "TypeError: bad operand type for abs(): " << Value(value);
+        throw pyerror(ss.str());
+    }
+};
+
+}
+
+void inject_reduce_builtins(Namespace& ns) {
+    (*ns)["sum"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        if (args.size() != 1 && args.size() != 2) {
+            throw pyerror("TypeError: sum expected 1 or 2 arguments");
+        }
+        frame.value_stack.push_back(
+            builtin_sum(frame, args[0], args.size() == 2 ? args[1] : Value((int64_t)0)));
+    });
+
+    (*ns)["min"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        frame.value_stack.push_back(builtin_minmax<true>(frame, args, "min"));
+    });
+
+    (*ns)["max"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        frame.value_stack.push_back(builtin_minmax<false>(frame, args, "max"));
+    });
+
+    (*ns)["any"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        if (args.size() != 1) {
+            throw pyerror("TypeError: any expected 1 argument");
+        }
+        frame.value_stack.push_back(builtin_any_all(args[0], true));
+    });
+
+    (*ns)["all"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        if (args.size() != 1) {
+            throw pyerror("TypeError: all expected 1 argument");
+        }
+        frame.value_stack.push_back(builtin_any_all(args[0], false));
+    });
+
+    (*ns)["abs"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+        if (args.size() != 1) {
+            throw pyerror("TypeError: abs expected 1 argument");
+        }
+        frame.value_stack.push_back(std::visit(abs_visitor(), args[0]));
+    });
+}
+
+}
+}
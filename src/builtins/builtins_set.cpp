@@ -0,0 +1,149 @@
+#include <iostream>
+#include <sstream>
+
+#include "builtins.hpp"
+#include "builtins_helpers.hpp"
+#include "../pyallocator.hpp"
+
+namespace py {
+namespace builtins {
+
+std::unordered_map<std::string, ValueCMethod> builtin_set_attributes;
+
+struct set_iterator : public value::CGenerator {
+    ValueSet set;
+    size_t pos = 0;
+    size_t expected_size;
+
+    set_iterator(ValueSet set) : set(set) {
+        this->expected_size = set->size();
+        this->set.retain();
+    }
+
+    virtual ~set_iterator() {
+        set.release();
+    }
+
+    virtual std::optional<Value> next() {
+        if (set->size() != expected_size) {
+            throw pyerror("RuntimeError: Set changed size during iteration");
+        }
+
+        Value value;
+        if (set->next(pos, value)) {
+            return value;
+        }
+        return std::nullopt;
+    }
+};
+
+ValueCGenerator builtins_set_iterator(ValueSet set) {
+    return std::make_shared<set_iterator>(set);
+}
+
+ValueSet builtins_set_from(const Value& iterable) {
+    ValueSet set = alloc().heap_set.make();
+    if (auto list = std::get_if<ValueList>(&iterable)) {
+        for (size_t i = 0; i < (*list)->size(); ++i) {
+            set->add((*list)->get(i));
+        }
+    } else if (auto tuple = std::get_if<ValueTuple>(&iterable)) {
+        for (const Value& value : **tuple) {
+            set->add(value);
+        }
+    } else if (auto other = std::get_if<ValueSet>(&iterable)) {
+        *set = **other;
+    } else if (auto dict = std::get_if<ValueDict>(&iterable)) {
+        for (const auto& entry : (*dict)->entries) {
+            if (entry.hash != 0) set->add(entry.key);
+        }
+    } else {
+        std::stringstream ss;
+        ss << "TypeError: can not build a set from " << iterable;
+        throw pyerror(ss.str());
+    }
+    return set;
+}
+
+// set.union(other) and friends, other may be any iterable builtins_set_from takes
+template<void (*Op)(value::Set&, const value::Set&, const value::Set&)>
+static ValueCMethod make_set_op() {
+    return std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueSet> args(_args);
+        if (_args.size() != 2) {
+            throw pyerror("TypeError: expected 1 argument.");
+        }
+
+        ValueSet set = args.get<0>();
+        ValueSet other = std::holds_alternative<ValueSet>(_args[1]) ?
+            std::get<ValueSet>(_args[1]) : builtins_set_from(_args[1]);
+        ValueSet result = alloc().heap_set.make();
+        Op(*result, *set, *other);
+        frame.value_stack.push_back(result);
+    });
+}
+
+void initialize_set_class() {
+    builtin_set_attributes["add"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueSet> args(_args);
+        if (_args.size() != 2) {
+            throw pyerror("TypeError: set.add expected 1 argument.");
+        }
+        args.get<0>()->add(_args[1]);
+        frame.value_stack.push_back(value::NoneType());
+    });
+
+    builtin_set_attributes["discard"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueSet> args(_args);
+        if (_args.size() != 2) {
+            throw pyerror("TypeError: set.discard expected 1 argument.");
+        }
+        args.get<0>()->remove(_args[1]);
+        frame.value_stack.push_back(value::NoneType());
+    });
+
+    builtin_set_attributes["remove"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueSet> args(_args);
+        if (_args.size() != 2) {
+            throw pyerror("TypeError: set.remove expected 1 argument.");
+        }
+        if (!args.get<0>()->remove(_args[1])) {
+            std::stringstream ss;
+            ss << "KeyError: " << _args[1];
+            throw pyerror(ss.str());
+        }
+        frame.value_stack.push_back(value::NoneType());
+    });
+
+    builtin_set_attributes["update"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueSet> args(_args);
+        if (_args.size() != 2) {
+            throw pyerror("TypeError: set.update expected 1 argument.");
+        }
+        ValueSet set = args.get<0>();
+        ValueSet other = builtins_set_from(_args[1]);
+        value::Set result;
+        value::Set::set_union(result, *set, *other);
+        *set = std::move(result);
+        frame.value_stack.push_back(value::NoneType());
+    });
+
+    builtin_set_attributes["clear"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueSet> args(_args);
+        args.get<0>()->clear();
+        frame.value_stack.push_back(value::NoneType());
+    });
+
+    builtin_set_attributes["copy"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& _args) {
+        arg_decoder<ValueSet> args(_args);
+        frame.value_stack.push_back(alloc().heap_set.make(*args.get<0>()));
+    });
+
+    builtin_set_attributes["union"] = make_set_op<value::Set::set_union>();
+    builtin_set_attributes["intersection"] = make_set_op<value::Set::set_intersection>();
+    builtin_set_attributes["difference"] = make_set_op<value::Set::set_difference>();
+    builtin_set_attributes["symmetric_difference"] = make_set_op<value::Set::set_symmetric_difference>();
+}
+
+}
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <limits>
 
 #include "builtins.hpp"
 #include "builtins_helpers.hpp"
@@ -7,28 +8,70 @@
 #include "../pyvalue_helpers.hpp"
 
 namespace py {
-namespace builtins {
 
-ValuePyClass slice_class;
+// Follows CPython's PySlice_Unpack followed by PySlice_AdjustIndices
+size_t value::Slice::adjust_indices(
+    size_t length, const Value& start, const Value& stop, const Value& step,
+    int64_t& r_start, int64_t& r_step
+) {
+    auto to_index = [](const Value& val, int64_t default_value) -> int64_t {
+        if (std::holds_alternative<value::NoneType>(val)) {
+            return default_value;
+        } else if (auto i = std::get_if<int64_t>(&val)) {
+            return *i;
+        } else if (auto b = std::get_if<bool>(&val)) {
+            return *b;
+        }
+        throw pyerror("TypeError: slice indices must be integers or None");
+    };
+
+    const int64_t len = length;
+    r_step = to_index(step, 1);
+    if (r_step == 0) {
+        throw pyerror("ValueError: slice step cannot be zero");
+    }
 
-void initialize_slice_class(){
-    slice_class = alloc.heap_pyclass.make("SLICE_CLASS").retain();
+    // a missing start or stop means 'all the way to the end' in the direction of the step
+    int64_t r_stop;
+    if (r_step < 0) {
+        r_start = to_index(start, std::numeric_limits<int64_t>::max());
+        r_stop = to_index(stop, std::numeric_limits<int64_t>::min());
+    } else {
+        r_start = to_index(start, 0);
+        r_stop = to_index(stop, std::numeric_limits<int64_t>::max());
+    }
 
-    (*(slice_class->attrs))["start"] = value::NoneType();
-    (*(slice_class->attrs))["stop"] = value::NoneType();
-    (*(slice_class->attrs))["step"] = value::NoneType();
+    auto clamp = [len, r_step](int64_t& index) {
+        if (index < 0) {
+            index += len;
+            if (index < 0) {
+                index = r_step < 0 ? -1 : 0;
+            }
+        } else if (index >= len) {
+            index = r_step < 0 ? len - 1 : len;
+        }
+    };
+    clamp(r_start);
+    clamp(r_stop);
+
+    if (r_step < 0) {
+        return r_stop < r_start ? (r_start - r_stop - 1) / (-r_step) + 1 : 0;
+    }
+    return r_start < r_stop ? (r_stop - r_start - 1) / r_step + 1 : 0;
 }
 
-ValuePyObject builtins_slice_get_slice_object(Value start, Value stop, Value step){
+namespace builtins {
+
+ValueSlice builtins_slice_get_slice_object(Value start, Value stop, Value step){
     DEBUG_ADV("Creating Slice: " << start << ", " << stop << ", " << step);
-    
-    ValuePyObject obj = alloc.heap_pyobject.make(slice_class);
-    obj->store_attr("start",start);
-    obj->store_attr("stop",stop);
-    obj->store_attr("step",step);
-    
-    return obj;
+
+    ValueSlice slice = alloc().heap_slice.make();
+    slice->start = std::move(start);
+    slice->stop = std::move(stop);
+    slice->step = std::move(step);
+
+    return slice;
 }
 
 }
-}
\ No newline at end of file
+}
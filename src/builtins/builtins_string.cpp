@@ -0,0 +1,365 @@
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "builtins.hpp"
+#include "builtins_helpers.hpp"
+#include "../pyallocator.hpp"
+#include "../optflags.hpp"
+
+namespace py {
+namespace builtins {
+
+std::unordered_map<std::string, ValueCMethod> builtin_string_attributes;
+
+namespace {
+
+constexpr size_t npos = std::string::npos;
+
+const char* const WHITESPACE = " \t\n\r\x0b\x0c";
+
+inline bool is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/*
+    The index of the first needle in haystack at or after start, or npos. Single
+    characters go to memchr. Longer needles compare the first and the last
+    character of the needle against 16 positions at a time and only memcmp the
+    positions where both match, which for text is a small fraction of them.
+*/
+size_t find_in(std::string_view haystack, std::string_view needle, size_t start = 0) {
+    const size_t n = haystack.size();
+    const size_t m = needle.size();
+    if (start > n || m > n - start) {
+        return npos;
+    }
+    if (m == 0) {
+        return start;
+    }
+    const char* hay = haystack.data();
+    if (m == 1) {
+        const void* found = memchr(hay + start, needle[0], n - start);
+        return found == nullptr ? npos : (const char*)found - hay;
+    }
+
+    size_t i = start;
+#if defined(VECTOR_STRING_SEARCH_ON) && defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        const __m128i block_first = _mm_loadu_si128((const __m128i*)(hay + i));
+        const __m128i block_last = _mm_loadu_si128((const __m128i*)(hay + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            const size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(hay + pos + 1, needle.data() + 1, m - 2) == 0) {
+                return pos;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    return haystack.find(needle, i);
+}
+
+const value::String& string_arg(ArgList& args, size_t index, const char* method) {
+    if (index >= args.size()) {
+        std::stringstream ss;
+        ss << "TypeError: str." << method << "() takes at least " << index << " arguments";
+        throw pyerror(ss.str());
+    }
+    auto str = std::get_if<ValueString>(&args[index]);
+    if (str == nullptr) {
+        std::stringstream ss;
+        ss << "TypeError: str." << method << "() expected a str, got " << args[index];
+        throw pyerror(ss.str());
+    }
+    return **str;
+}
+
+// an optional int argument, None counts as missing
+int64_t int_arg(ArgList& args, size_t index, int64_t missing, const char* method) {
+    if (index >= args.size() || std::holds_alternative<value::NoneType>(args[index])) {
+        return missing;
+    }
+    auto i = std::get_if<int64_t>(&args[index]);
+    if (i == nullptr) {
+        std::stringstream ss;
+        ss << "TypeError: str." << method << "() expected an int, got " << args[index];
+        throw pyerror(ss.str());
+    }
+    return *i;
+}
+
+void check_arg_count(ArgList& args, size_t min, size_t max, const char* method) {
+    if (args.size() < min + 1 || args.size() > max + 1) {
+        std::stringstream ss;
+        ss << "TypeError: str." << method << "() takes ";
+        if (min == max) {
+            ss << min;
+        } else {
+            ss << "from " << min << " to " << max;
+        }
+        ss << " arguments but " << args.size() - 1 << " were given";
+        throw pyerror(ss.str());
+    }
+}
+
+// start and end of str.find and str.count, clamped like slice indices.
+// Returns false when start is past the end of str, where not even the empty
+// string is found
+bool find_bounds(ArgList& args, size_t first, size_t size, const char* method, size_t& start, size_t& end) {
+    int64_t s = int_arg(args, first, 0, method);
+    int64_t e = int_arg(args, first + 1, size, method);
+    if (s < 0) s = std::max<int64_t>(s + (int64_t)size, 0);
+    if (e < 0) e = std::max<int64_t>(e + (int64_t)size, 0);
+    if (s > (int64_t)size) {
+        return false;
+    }
+    start = s;
+    end = std::min<int64_t>(e, size);
+    return true;
+}
+
+inline ValueString make_string(std::string_view str) {
+    if (str.size() == 1) {
+        return value::String::character(str[0]);
+    }
+    return alloc().heap_string.make(std::string(str));
+}
+
+// the pieces are collected first so the list is allocated once
+ValueList split(std::string_view str, int64_t maxsplit) {
+    std::vector<Value> pieces;
+    size_t i = 0;
+    const size_t n = str.size();
+    while (true) {
+        while (i < n && is_space(str[i])) ++i;
+        if (i == n) break;
+        if (maxsplit-- == 0) {
+            size_t end = n;
+            while (end > i && is_space(str[end - 1])) --end;
+            pieces.push_back(make_string(str.substr(i, end - i)));
+            break;
+        }
+        size_t j = i;
+        while (j < n && !is_space(str[j])) ++j;
+        pieces.push_back(make_string(str.substr(i, j - i)));
+        i = j;
+    }
+    return alloc().heap_list.make(std::move(pieces));
+}
+
+ValueList split(std::string_view str, std::string_view sep, int64_t maxsplit) {
+    if (sep.empty()) {
+        throw pyerror("ValueError: empty separator");
+    }
+    std::vector<Value> pieces;
+    size_t i = 0;
+    for (size_t found; maxsplit != 0 && (found = find_in(str, sep, i)) != npos; --maxsplit) {
+        pieces.push_back(make_string(str.substr(i, found - i)));
+        i = found + sep.size();
+    }
+    pieces.push_back(make_string(str.substr(i)));
+    return alloc().heap_list.make(std::move(pieces));
+}
+
+// which ends strip removes chars from
+enum Strip { LEFT = 1, RIGHT = 2, BOTH = 3 };
+
+template<int Side>
+void strip(FrameState& frame, ArgList& args, const char* method) {
+    check_arg_count(args, 0, 1, method);
+    const ValueString& self = std::get<ValueString>(args[0]);
+    std::string_view str = self->str();
+    std::string_view chars = WHITESPACE;
+    if (args.size() == 2 && !std::holds_alternative<value::NoneType>(args[1])) {
+        chars = string_arg(args, 1, method).str();
+    }
+
+    size_t first = 0, last = str.size();
+    if (Side & LEFT) {
+        first = str.find_first_not_of(chars);
+        if (first == npos) first = str.size();
+    }
+    if (Side & RIGHT) {
+        const size_t pos = str.find_last_not_of(chars);
+        last = pos == npos ? 0 : pos + 1;
+    }
+    if (first == 0 && last == str.size()) {
+        frame.value_stack.push_back(self);
+    } else {
+        frame.value_stack.push_back(make_string(first < last ? str.substr(first, last - first) : ""));
+    }
+}
+
+// whether str starts (or ends) with the prefix, or with any prefix of a tuple
+template<bool starts>
+bool has_affix(std::string_view str, const Value& affix, const char* method) {
+    if (auto s = std::get_if<ValueString>(&affix)) {
+        const std::string& a = (*s)->str();
+        if (a.size() > str.size()) return false;
+        return starts ? str.compare(0, a.size(), a) == 0
+                      : str.compare(str.size() - a.size(), a.size(), a) == 0;
+    } else if (auto tuple = std::get_if<ValueTuple>(&affix)) {
+        for (const Value& item : **tuple) {
+            if (has_affix<starts>(str, item, method)) return true;
+        }
+        return false;
+    }
+    std::stringstream ss;
+    ss << "TypeError: str." << method << "() arg must be a str or a tuple of str, not " << affix;
+    throw pyerror(ss.str());
+}
+
+}
+
+void initialize_string_class() {
+    builtin_string_attributes["find"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        check_arg_count(args, 1, 3, "find");
+        const std::string& str = std::get<ValueString>(args[0])->str();
+        const value::String& sub = string_arg(args, 1, "find");
+        size_t start, end;
+        const bool found = find_bounds(args, 2, str.size(), "find", start, end);
+        size_t pos = found && start <= end ? find_in(std::string_view(str).substr(0, end), sub.str(), start) : npos;
+        frame.value_stack.push_back(pos == npos ? (int64_t)-1 : (int64_t)pos);
+    });
+
+    builtin_string_attributes["count"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        check_arg_count(args, 1, 3, "count");
+        const std::string& str = std::get<ValueString>(args[0])->str();
+        const std::string& sub = string_arg(args, 1, "count").str();
+        size_t start, end;
+        int64_t count = 0;
+        if (find_bounds(args, 2, str.size(), "count", start, end) && start <= end) {
+            std::string_view range = std::string_view(str).substr(0, end);
+            if (sub.empty()) {
+                count = end - start + 1;
+            } else {
+                for (size_t pos = find_in(range, sub, start); pos != npos; pos = find_in(range, sub, pos + sub.size())) {
+                    ++count;
+                }
+            }
+        }
+        frame.value_stack.push_back(count);
+    });
+
+    builtin_string_attributes["split"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        check_arg_count(args, 0, 2, "split");
+        const std::string& str = std::get<ValueString>(args[0])->str();
+        const int64_t maxsplit = int_arg(args, 2, -1, "split");
+        if (args.size() < 2 || std::holds_alternative<value::NoneType>(args[1])) {
+            frame.value_stack.push_back(split(str, maxsplit));
+        } else {
+            frame.value_stack.push_back(split(str, string_arg(args, 1, "split").str(), maxsplit));
+        }
+    });
+
+    builtin_string_attributes["join"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        check_arg_count(args, 1, 1, "join");
+        const std::string& sep = std::get<ValueString>(args[0])->str();
+
+        // the total length is known before anything is copied, so the
+        // result is allocated once
+        std::vector<ValueString> parts;
+        if (auto str = std::get_if<ValueString>(&args[1])) {
+            for (size_t i = 0; i < (*str)->size(); ++i) {
+                parts.push_back(value::String::character((**str)[i]));
+            }
+        } else {
+            for_each_item(args[1], "join", [&](const Value& item) {
+                auto part = std::get_if<ValueString>(&item);
+                if (part == nullptr) {
+                    std::stringstream ss;
+                    ss << "TypeError: sequence item " << parts.size() << ": expected str instance, got " << item;
+                    throw pyerror(ss.str());
+                }
+                parts.push_back(*part);
+                return true;
+            });
+        }
+
+        if (parts.size() == 1) {
+            frame.value_stack.push_back(parts[0]);
+            return;
+        }
+        size_t length = parts.empty() ? 0 : sep.size() * (parts.size() - 1);
+        for (const ValueString& part : parts) {
+            length += part->size();
+        }
+        std::string result;
+        result.reserve(length);
+        for (size_t i = 0; i < parts.size(); ++i) {
+            if (i != 0) result.append(sep);
+            result.append(parts[i]->str());
+        }
+        frame.value_stack.push_back(alloc().heap_string.make(std::move(result)));
+    });
+
+    builtin_string_attributes["replace"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        check_arg_count(args, 2, 3, "replace");
+        const ValueString& self = std::get<ValueString>(args[0]);
+        const std::string& str = self->str();
+        const std::string& old = string_arg(args, 1, "replace").str();
+        const std::string& replacement = string_arg(args, 2, "replace").str();
+        int64_t count = int_arg(args, 3, -1, "replace");
+
+        // an empty old matches between every character, like CPython
+        std::vector<size_t> matches;
+        if (old.empty()) {
+            for (size_t i = 0; i <= str.size() && count != 0; ++i, --count) {
+                matches.push_back(i);
+            }
+        } else {
+            for (size_t pos = find_in(str, old); pos != npos && count != 0; pos = find_in(str, old, pos + old.size()), --count) {
+                matches.push_back(pos);
+            }
+        }
+        if (matches.empty()) {
+            frame.value_stack.push_back(self);
+            return;
+        }
+
+        std::string result;
+        result.reserve(str.size() - matches.size() * old.size() + matches.size() * replacement.size());
+        size_t copied = 0;
+        for (size_t pos : matches) {
+            result.append(str, copied, pos - copied);
+            result.append(replacement);
+            copied = pos + old.size();
+        }
+        result.append(str, copied, npos);
+        frame.value_stack.push_back(alloc().heap_string.make(std::move(result)));
+    });
+
+    builtin_string_attributes["strip"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        strip<BOTH>(frame, args, "strip");
+    });
+
+    builtin_string_attributes["lstrip"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        strip<LEFT>(frame, args, "lstrip");
+    });
+
+    builtin_string_attributes["rstrip"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        strip<RIGHT>(frame, args, "rstrip");
+    });
+
+    builtin_string_attributes["startswith"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        check_arg_count(args, 1, 1, "startswith");
+        frame.value_stack.push_back(has_affix<true>(std::get<ValueString>(args[0])->str(), args[1], "startswith"));
+    });
+
+    builtin_string_attributes["endswith"] = std::make_shared<value::CMethod>([](FrameState& frame, ArgList& args) {
+        check_arg_count(args, 1, 1, "endswith");
+        frame.value_stack.push_back(has_affix<false>(std::get<ValueString>(args[0])->str(), args[1], "endswith"));
+    });
+}
+
+}
+}
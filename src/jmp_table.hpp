@@ -159,8 +159,8 @@ const static void* jmp_table[] = {
     &&BUILD_STRING,
     &&BUILD_TUPLE_UNPACK_WITH_CALL,
     &&NOP,
-    &&NOP,
-    &&NOP,
+    &&LOAD_METHOD,
+    &&CALL_METHOD,
     &&NOP,
     &&NOP,
     &&NOP,
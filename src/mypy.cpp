@@ -0,0 +1,185 @@
+#include <fstream>
+#include <mutex>
+
+#include "mypy.hpp"
+#include "pyvalue_helpers.hpp"
+#include "builtins/builtins.hpp"
+
+namespace mypy {
+
+using namespace py;
+
+Handle::Handle(Allocator& heap, Value value) : heap(&heap), value(std::move(value)) {
+    this->heap->link(this);
+}
+
+Handle::Handle(const Handle& other) : heap(other.heap), value(other.value) {
+    if (this->heap != nullptr) {
+        this->heap->link(this);
+    }
+}
+
+Handle& Handle::operator=(const Handle& other) {
+    if (this->heap != other.heap) {
+        if (this->heap != nullptr) {
+            this->heap->unlink(this);
+        }
+        this->heap = other.heap;
+        if (this->heap != nullptr) {
+            this->heap->link(this);
+        }
+    }
+    this->set(other.value);
+    return *this;
+}
+
+Handle::~Handle() {
+    if (this->heap != nullptr) {
+        this->heap->unlink(this);
+    }
+}
+
+void Handle::set(Value value) {
+    // no barrier, an incremental marking marks the roots again before it ends
+    this->value = std::move(value);
+}
+
+void Handle::mark() {
+    mark_value(this->value);
+}
+
+// A module's interpreter, kept after its top level returned. Its bottom frame
+// is the one calls are made from, whose locals are the module's globals
+struct ModuleState : Allocator::Root {
+    Allocator* heap;
+    std::unique_ptr<InterpreterState> interp;
+    gc_ptr<FrameState> host;
+
+    ModuleState(Allocator& heap, ValueCode code) : heap(&heap) {
+        this->interp = std::make_unique<InterpreterState>(code);
+        builtins::inject_builtins(this->interp->ns_builtins);
+        this->host = this->interp->cur_frame;
+        this->heap->link(this);
+    }
+
+    ~ModuleState() {
+        Allocator::Scope scope(*this->heap);
+        this->heap->unlink(this);
+        this->interp.reset();
+    }
+
+    void mark() override {
+        this->host.mark();
+        this->interp->ns_globals.mark();
+        this->interp->ns_builtins.mark();
+        this->interp->main_code.mark();
+    }
+
+    // the frames an error left are dropped, so the next call starts afresh
+    void reset(size_t depth) {
+        this->interp->cur_frame = nullptr;
+        this->host->value_stack.resize(depth);
+        this->host->block_stack.clear();
+    }
+};
+
+Callable::Callable(std::shared_ptr<ModuleState> module, Value function)
+    : module(std::move(module)), function(*this->module->heap, std::move(function)) {
+}
+
+Value Callable::invoke(const Value* args, size_t count) const {
+    InterpreterState& interp = *this->module->interp;
+    FrameState& host = *this->module->host;
+    const size_t depth = host.value_stack.size();
+
+    interp.cur_frame = this->module->host;
+    try {
+        // functions take their arguments straight from the array, anything
+        // else goes through the ArgList the interpreter calls it with
+        auto func = std::get_if<ValuePyFunction>(&this->function.get());
+        if (func != nullptr && ((*func)->flags & (value::CLASS_METHOD | value::INSTANCE_METHOD)) == 0) {
+            if (count > (*func)->code->co_argcount) {
+                throw pyerror("TypeError: " + *((*func)->name) + " takes " + std::to_string((*func)->code->co_argcount)
+                    + " positional arguments but " + std::to_string(count) + " were given");
+            }
+            interp.push_frame(alloc().heap_frame.make((*func)->code));
+            interp.cur_frame->initialize_from_pyfunc(*func, args, count);
+        } else {
+            ArgList list;
+            for (size_t i = 0; i < count; ++i) {
+                list.append_arg(args[i]);
+            }
+            Value callable = this->function.get();
+            std::visit(value_helper::call_visitor(host, list), callable);
+        }
+        interp.run(this->module->host);
+    } catch (...) {
+        this->module->reset(depth);
+        throw;
+    }
+
+    if (host.value_stack.size() != depth + 1) {
+        this->module->reset(depth);
+        throw pyerror("INTERNAL ERROR: call did not leave exactly one result");
+    }
+    Value result = std::move(host.value_stack.back());
+    host.value_stack.pop_back();
+    interp.cur_frame = nullptr;
+    return result;
+}
+
+Handle Module::get(const std::string& name) const {
+    const Namespace& globals = this->state->interp->ns_globals;
+    auto itr = globals->find(name);
+    if (itr == globals->end()) {
+        throw pyerror("NameError: name '" + name + "' is not defined");
+    }
+    return Handle(*this->state->heap, itr->second);
+}
+
+Callable Module::function(const std::string& name) const {
+    Handle global = this->get(name);
+    const Value& value = global.get();
+    if (!std::holds_alternative<ValuePyFunction>(value) && !std::holds_alternative<ValueCFunction>(value)
+            && !std::holds_alternative<ValuePyClass>(value) && !std::holds_alternative<ValuePyObject>(value)) {
+        throw pyerror("TypeError: '" + name + "' is not callable");
+    }
+    return Callable(this->state, value);
+}
+
+Runtime::Runtime(std::string compiler) : compiler(std::move(compiler)) {
+    // the methods of the builtin types are shared by every interpreter
+    static std::once_flag classes;
+    std::call_once(classes, []() {
+        builtins::initialize_list_class();
+        builtins::initialize_dict_class();
+        builtins::initialize_set_class();
+        builtins::initialize_string_class();
+        builtins::initialize_file_class();
+    });
+}
+
+Module Runtime::load(const std::string& source) {
+    Allocator::Scope scope(this->heap);
+    auto state = std::make_shared<ModuleState>(this->heap, Code::from_program(source, this->compiler));
+    try {
+        state->interp->run(nullptr);
+    } catch (...) {
+        state->reset(0);
+        throw;
+    }
+    // the top level returned, and leaves its frame to make calls from
+    state->host->value_stack.clear();
+    return Module(state);
+}
+
+Module Runtime::load_file(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw pyerror("FileNotFoundError: " + path);
+    }
+    std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return this->load(source);
+}
+
+}
@@ -0,0 +1,214 @@
+#pragma once
+#ifndef MYPY_H
+#define MYPY_H
+
+#include <array>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include "pyerror.hpp"
+#include "pyvalue.hpp"
+#include "pyallocator.hpp"
+#include "pyinterpreter.hpp"
+
+/*
+    The interface for embedding the interpreter in a C++ program. A Runtime
+    owns the heaps, a Module is a program whose top level has run once, and a
+    Callable is one of its functions, called as often as needed with native
+    arguments and results:
+
+        mypy::Runtime runtime;
+        mypy::Module module = runtime.load("def add(a, b):\n    return a + b\n");
+        mypy::Callable add = module.function("add");
+        int64_t sum = add.call<int64_t>(1, 2);
+
+    The arguments are passed in an array on the C++ stack and land in the
+    new frame's locals, nothing else is allocated for a call. What is held
+    from C++ is kept alive by the handles holding it. Objects of one runtime
+    must only be used by one thread at a time, every call makes its heaps the
+    current ones of the calling thread, and the runtime must outlive them
+*/
+
+namespace mypy {
+
+using py::Value;
+
+class Runtime;
+class Module;
+class Callable;
+struct ModuleState;
+
+// Keeps a value alive across collections for as long as the handle exists
+class Handle : private py::Allocator::Root {
+public:
+    Handle() = default;
+    Handle(py::Allocator& heap, Value value);
+    Handle(const Handle& other);
+    Handle& operator=(const Handle& other);
+    ~Handle();
+
+    const Value& get() const {
+        return this->value;
+    }
+
+    void set(Value value);
+
+    // the heaps the value is on, none for a handle made empty
+    py::Allocator* allocator() const {
+        return this->heap;
+    }
+
+    // the value as an int64_t, double, bool or std::string, a TypeError when
+    // it is none of those
+    template<typename R>
+    R as() const;
+
+private:
+    py::Allocator* heap = nullptr;
+    Value value = py::value::NoneType();
+
+    void mark() override;
+};
+
+// the value a native argument is passed to Python as
+template<typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, int>::type = 0>
+inline Value to_value(T i) {
+    return (int64_t)i;
+}
+
+inline Value to_value(bool b) {
+    return b;
+}
+
+inline Value to_value(double d) {
+    return d;
+}
+
+inline Value to_value(const std::string& s) {
+    return py::alloc().heap_string.make(s);
+}
+
+inline Value to_value(const char* s) {
+    return py::alloc().heap_string.make(std::string(s));
+}
+
+inline Value to_value(const Handle& handle) {
+    return handle.get();
+}
+
+// the native value of a result, see Handle::as
+template<typename R>
+R from_value(const Value& value) {
+    if constexpr (std::is_same<R, bool>::value) {
+        if (auto b = std::get_if<bool>(&value)) {
+            return *b;
+        }
+        throw pyerror("TypeError: expected a bool");
+    } else if constexpr (std::is_integral<R>::value) {
+        if (auto i = std::get_if<int64_t>(&value)) {
+            return (R)*i;
+        }
+        throw pyerror("TypeError: expected an int");
+    } else if constexpr (std::is_floating_point<R>::value) {
+        if (auto d = std::get_if<double>(&value)) {
+            return (R)*d;
+        } else if (auto i = std::get_if<int64_t>(&value)) {
+            return (R)*i;
+        }
+        throw pyerror("TypeError: expected a float");
+    } else if constexpr (std::is_same<R, std::string>::value) {
+        if (auto s = std::get_if<py::ValueString>(&value)) {
+            return (*s)->str();
+        }
+        throw pyerror("TypeError: expected a str");
+    } else {
+        static_assert(!std::is_same<R, R>::value, "results are returned as int, float, bool, std::string or a Handle");
+    }
+}
+
+template<typename R>
+R Handle::as() const {
+    return from_value<R>(this->value);
+}
+
+// A function of a module, or anything else callable found in one
+class Callable {
+public:
+    // calls with native arguments, converted by to_value, and returns the
+    // result as R: void, a Handle, or what Handle::as converts to
+    template<typename R = Handle, typename... Args>
+    R call(const Args&... args) const {
+        py::Allocator::Scope scope(*this->function.allocator());
+        const std::array<Value, sizeof...(Args)> values = {to_value(args)...};
+        Value result = this->invoke(values.data(), values.size());
+        if constexpr (std::is_void<R>::value) {
+            return ;
+        } else if constexpr (std::is_same<R, Handle>::value) {
+            return Handle(*this->function.allocator(), std::move(result));
+        } else {
+            return from_value<R>(result);
+        }
+    }
+
+    template<typename... Args>
+    Handle operator()(const Args&... args) const {
+        return this->call<Handle>(args...);
+    }
+
+private:
+    friend class Module;
+
+    std::shared_ptr<ModuleState> module;
+    Handle function;
+
+    Callable(std::shared_ptr<ModuleState> module, Value function);
+
+    // runs the call on the module's interpreter until it returns
+    Value invoke(const Value* args, size_t count) const;
+};
+
+// A program whose top level has run, its globals stay as it left them
+class Module {
+public:
+    // a global, a NameError when there is none
+    Handle get(const std::string& name) const;
+
+    // a global to call, a TypeError when it can not be
+    Callable function(const std::string& name) const;
+
+private:
+    friend class Runtime;
+
+    std::shared_ptr<ModuleState> state;
+
+    explicit Module(std::shared_ptr<ModuleState> state) : state(std::move(state)) {
+    }
+};
+
+// The heaps of the modules loaded and of everything they make
+class Runtime {
+public:
+    // compiler is the script that turns source into the code the interpreter
+    // runs, relative paths are from the working directory
+    explicit Runtime(std::string compiler = "../pytools/compile.py");
+
+    Runtime(const Runtime&) = delete;
+    Runtime& operator=(const Runtime&) = delete;
+
+    // compiles and runs the top level of source once
+    Module load(const std::string& source);
+    Module load_file(const std::string& path);
+
+    py::Allocator& allocator() {
+        return this->heap;
+    }
+
+private:
+    py::Allocator heap;
+    std::string compiler;
+};
+
+}
+
+#endif
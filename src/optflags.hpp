@@ -9,8 +9,68 @@
 // #define DIRECT_THREADED
 // #define RECYCLING_ON
 
+// Rewrite obj.method(...) calls to LOAD_METHOD/CALL_METHOD so no bound method is allocated
+#define LOAD_METHOD_ON
+
+// Resolve operator overloads through a per class slot table instead of by name
+#define OPERATOR_SLOTS_ON
+
+// Slice directly when BUILD_SLICE is followed by BINARY_SUBSCR/STORE_SUBSCR on a builtin sequence
+#define FUSED_SLICE_ON
+
+// Let long slices of strings and tuples share the characters or items of what they were cut from
+#define SLICE_VIEWS_ON
+
+// Reduce int and float lists and ranges in sum/min/max/any/all without boxing, with AVX2 when available
+#define VECTOR_REDUCTIONS_ON
+
+// Sort int and float lists in place (radix sorting long int lists) and compare keys of one type directly
+#define TYPED_SORT_ON
+
+// Intern identifier-like string constants and one character strings
+#define STRING_INTERNING_ON
+
+// Let long string concatenations extend a shared buffer in place instead of copying
+#define STRING_BUILDER_ON
+
+// Search strings 16 bytes at a time with SSE2 in find, split, count and replace
+#define VECTOR_STRING_SEARCH_ON
+
+// Buffer print's output and only flush per line when stdout is a terminal
+#define BUFFERED_OUTPUT_ON
+
+// Read large files opened with open() through an mmap instead of read(2)
+#define MMAP_FILES_ON
+
+// Fold constants and constant branches, thread jumps and drop dead code when code is loaded
+#define OPTIMIZE_BYTECODE_ON
+
+// Mark large heaps on a pool of threads that steal work from each other, MYPY_GC_THREADS sets how many
+#define PARALLEL_MARK_ON
+
+// Only mark during the collection pause and sweep a little at a time at every later check for garbage
+#define LAZY_SWEEP_ON
+
+// With MYPY_GC_BUDGET set, mark a slice at a time behind a write barrier instead of all at once
+#define INCREMENTAL_MARK_ON
+
+// Compact the heaps once a sweep leaves most of their slabs unused, giving the empty pages back to the OS
+#define COMPACTION_ON
+
+// Count what each interpreter allocates so --max-heap can collect early and raise MemoryError past the limit
+#define HEAP_LIMIT_ON
+
+// Let --huge-pages cut the heaps' slabs from 2MB regions backed by huge pages on the interpreter's NUMA node
+#define HUGE_PAGES_ON
+
+// Trace hot loops and compile them to x86-64 that works on unboxed ints and floats
+#define TRACING_JIT_ON
+
 // #define CHECK_STACK_SIZES 
 
+// Print every code object's instructions to stderr once it is loaded and optimized
+// #define DUMP_BYTECODE
+
 // #define DEBUG_ON
 // #define DEBUG_STACK
 
@@ -25,4 +85,10 @@
 
 // #define TYPE_INFORMATION_PROFILING
 
+// traces are recorded by stepping the interpreter one instruction at a time,
+// which the direct threaded interpreter does not return for
+#if defined(TRACING_JIT_ON) && (defined(DIRECT_THREADED) || !defined(__x86_64__))
+#undef TRACING_JIT_ON
+#endif
+
 #endif
\ No newline at end of file
@@ -1,5 +1,16 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <variant>
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <new>
+#include <string>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #include "pyallocator.hpp"
 #include "pyinterpreter.hpp"
@@ -9,9 +20,95 @@
 
 #include <debug.hpp>
 
-namespace py {
+#if defined(HEAP_LIMIT_ON) && defined(__GLIBC__)
+// While the current allocator of the thread has a limit, what operator new
+// hands out counts against it, as much as malloc set aside for it. Every block
+// starts with the account it was counted against, none when it was not, so
+// operator delete takes it off that one. The other forms of new and delete are
+// defined here as well, older libstdc++ does not send the nothrow ones through
+// these
+namespace {
+
+struct alignas(alignof(std::max_align_t)) BlockHeader {
+    py::Allocator::Account* account;
+    size_t size;
+};
+
+void* allocate(std::size_t size) noexcept {
+    void* memory = std::malloc(sizeof(BlockHeader) + size);
+    if (memory == nullptr) {
+        return nullptr;
+    }
+    BlockHeader* header = static_cast<BlockHeader*>(memory);
+    header->account = nullptr;
+    py::Allocator* heap = py::Allocator::current;
+    if (heap != nullptr && heap->max_heap != 0) {
+        header->account = heap->account;
+        header->size = malloc_usable_size(memory);
+        heap->count_allocation(header->size);
+    }
+    return header + 1;
+}
+
+void deallocate(void* memory) noexcept {
+    if (memory == nullptr) {
+        return ;
+    }
+    BlockHeader* header = static_cast<BlockHeader*>(memory) - 1;
+    if (header->account != nullptr) {
+        header->account->release((int64_t)header->size);
+    }
+    std::free(header);
+}
+
+}
+
+void* operator new(std::size_t size) {
+    void* memory = allocate(size);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void* memory) noexcept {
+    deallocate(memory);
+}
 
-Allocator alloc;
+void operator delete[](void* memory) noexcept {
+    deallocate(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    deallocate(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept {
+    deallocate(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept {
+    deallocate(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept {
+    deallocate(memory);
+}
+#endif
+
+namespace py {
 
 struct gc_visitor {
     void operator() (value::PyGenerator gen) {
@@ -29,6 +126,17 @@ struct gc_visitor {
     }
 };
 
+void shade(const Value& value) {
+    gc_mark_worker* previous = gc_mark_worker::current;
+    gc_mark_worker::current = gc_mark_worker::incremental;
+    std::visit(gc_visitor(), value);
+    gc_mark_worker::current = previous;
+}
+
+void mark_value(const Value& value) {
+    std::visit(gc_visitor(), value);
+}
+
 }
 
 namespace gc {
@@ -59,7 +167,7 @@ namespace gc {
             framestate->curr_func.mark();
         }
 
-        for (ValuePyObject cell : framestate->cells) {
+        for (ValueCell cell : framestate->cells) {
             cell.mark();
         }
 
@@ -70,6 +178,10 @@ namespace gc {
 
     void mark_children(ValueString string) {
         DEBUG_ADV("\tMarking string: " << Value(string));
+        // a slice keeps the string it is a view of
+        if (string->viewed() != nullptr) {
+            string->viewed().mark();
+        }
     }
 
     void mark_children(ValueCode code) {
@@ -88,12 +200,20 @@ namespace gc {
 
     void mark_children(ValueList list) {
         DEBUG_ADV("\tMarking ValueList " << Value(list));
-        mark_children(list->values);
+        // unboxed int and float lists hold no references
+        if (list->strategy == value::List::OBJECTS) {
+            mark_children(list->values);
+        }
     }
 
     void mark_children(ValueTuple list) {
         DEBUG_ADV("\tMarking ValueTuple " << Value(list));
-        mark_children(list->values);
+        // a slice keeps the tuple it is a view of, and with it its items
+        if (list->base != nullptr) {
+            list->base.mark();
+        } else {
+            mark_children(list->values);
+        }
     }
 
     void mark_children(ValuePyObject pyobject) {
@@ -105,6 +225,38 @@ namespace gc {
         pyobject->attrs.mark();
     }
 
+    void mark_children(ValueCell cell) {
+        DEBUG_ADV("\tMarking ValueCell " << Value(cell));
+        std::visit(gc_visitor(), cell->contents);
+    }
+
+    void mark_children(ValueSlice slice) {
+        DEBUG_ADV("\tMarking ValueSlice " << Value(slice));
+        std::visit(gc_visitor(), slice->start);
+        std::visit(gc_visitor(), slice->stop);
+        std::visit(gc_visitor(), slice->step);
+    }
+
+    void mark_children(ValueDict dict) {
+        DEBUG_ADV("\tMarking ValueDict " << Value(dict));
+        for (auto& entry : dict->entries) {
+            std::visit(gc_visitor(), entry.key);
+            std::visit(gc_visitor(), entry.value);
+        }
+    }
+
+    void mark_children(ValueSet set) {
+        DEBUG_ADV("\tMarking ValueSet " << Value(set));
+        // only a generic set can hold anything but ints
+        for (auto& entry : set->generic.entries) {
+            std::visit(gc_visitor(), entry.key);
+        }
+    }
+
+    void mark_children(ValueBigInt bigint) {
+        DEBUG_ADV("\tMarking ValueBigInt " << Value(bigint));
+    }
+
     void mark_children(ValuePyClass pyclass) {
         DEBUG_ADV("\tMarking ValuePyClass " << Value(pyclass));
         pyclass->attrs.mark();
@@ -134,14 +286,194 @@ namespace gc {
 
 namespace py {
 
-void Allocator::mark_live_objects(InterpreterState& interp) {
-    DEBUG_ADV("MARKING LIVE OBJECTS");
+#ifdef PARALLEL_MARK_ON
+// smaller heaps are marked faster by one thread than it takes to wake the others
+constexpr size_t PARALLEL_MARK_MIN_OBJECTS = 1 << 16;
+
+// the threads that mark a heap, including the interpreter's own. Set by
+// MYPY_GC_THREADS, by default one per core up to eight
+static size_t gc_threads() {
+    static const size_t threads = []() -> size_t {
+        if (const char* env = std::getenv("MYPY_GC_THREADS")) {
+            const long count = std::strtol(env, nullptr, 10);
+            return count > 0 ? count : 1;
+        }
+        return std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+    }();
+    return threads;
+}
+#endif
+
+Allocator::Allocator() {
+    heap_list.countdown = &this->countdown;
+    heap_tuple.countdown = &this->countdown;
+    heap_string.countdown = &this->countdown;
+    heap_code.countdown = &this->countdown;
+    heap_frame.countdown = &this->countdown;
+    heap_pyfunc.countdown = &this->countdown;
+    heap_pyobject.countdown = &this->countdown;
+    heap_pyclass.countdown = &this->countdown;
+    heap_namespace.countdown = &this->countdown;
+    heap_cell.countdown = &this->countdown;
+    heap_slice.countdown = &this->countdown;
+    heap_dict.countdown = &this->countdown;
+    heap_set.countdown = &this->countdown;
+    heap_bigint.countdown = &this->countdown;
+    this->for_each_heap([this](auto& heap) {
+        heap.pool.regions = &this->regions;
+    });
+}
+
+Allocator::~Allocator() {
+    this->account->release(Account::OPEN);
+}
+
+void Allocator::safepoint(InterpreterState& interp) {
+    const uint32_t requests = this->requests.exchange(0);
+    if (requests & REQUEST_COLLECT) {
+        this->collect_garbage(interp, true);
+    } else {
+        if (this->marking || this->sweeping) {
+            this->gc_step();
+        }
+        if (!this->marking && this->memory_footprint() >= this->size_at_last_gc * 2) {
+            this->collect_garbage(interp);
+        }
+    }
+
+#ifdef HEAP_LIMIT_ON
+    if (this->max_heap != 0 && this->heap_usage() >= this->pressure_at) {
+        this->relieve_pressure(interp);
+    }
+#endif
+
+    // an unfinished collection takes another step after a little more is
+    // allocated, otherwise the next one starts once the heap has doubled
+    int64_t next = STEP_ALLOCATION;
+    if (!this->marking && !this->sweeping) {
+        next = (int64_t)(this->size_at_last_gc * 2) - (int64_t)this->memory_footprint();
+    }
+
+#ifdef HEAP_LIMIT_ON
+    size_t usage = 0;
+    if (this->max_heap != 0) {
+        // objects fill the slabs without going through operator new, so they
+        // also count down to the limit
+        usage = this->heap_usage();
+        this->peak = std::max(this->peak, usage);
+        next = std::min<int64_t>(next, (int64_t)std::min(this->pressure_at, this->raise_at) - (int64_t)usage);
+        this->watch_limit(usage);
+    }
+#endif
+    this->countdown.store(std::max<int64_t>(next, 1));
+
+#ifdef HEAP_LIMIT_ON
+    // raised here rather than in operator new, where the interpreter may be
+    // halfway through changing a list or a dict
+    if (this->max_heap != 0 && usage > this->raise_at) {
+        // the except block gets an eighth of the limit on top to run in, and
+        // the next safepoint collects what the frames it left held
+        this->raise_at = usage + this->max_heap / 8;
+        this->pressure_at = usage;
+        this->watch_limit(usage);
+        this->stats.memory_errors++;
+        throw pymemoryerror("the heap limit of " + std::to_string(this->max_heap) + " bytes was exceeded");
+    }
+#endif
+}
+
+void Allocator::set_max_heap(size_t bytes) {
+    this->max_heap = bytes;
+    this->pressure_at = bytes != 0 ? (size_t)(bytes * SOFT_LIMIT) : SIZE_MAX;
+    this->raise_at = bytes != 0 ? bytes : SIZE_MAX;
+    if (bytes != 0) {
+        this->watch_limit(this->heap_usage());
+    } else {
+        this->alert_at = INT64_MAX;
+    }
+}
+
+size_t Allocator::heap_usage() {
+    size_t resident = 0;
+    size_t used = 0;
+    this->slab_bytes(resident, used);
+    // a huge page takes the whole region in, whether slabs were cut from
+    // all of it or not
+    resident += this->regions.uncut_bytes();
+    return resident + (size_t)std::max<int64_t>(this->account->used(), 0);
+}
+
+void Allocator::watch_limit(size_t usage) {
+    const int64_t room = (int64_t)std::min(this->pressure_at, this->raise_at) - (int64_t)usage;
+    this->alert_at = this->account->used() + std::max<int64_t>(room, 0);
+}
+
+void Allocator::relieve_pressure(InterpreterState& interp) {
+    this->stats.emergency_collections++;
+    this->collect_garbage(interp, true);
+    if (this->sweeping) {
+        this->sweep_step(SIZE_MAX);
+    }
+    this->compact();
 
+    const size_t usage = this->heap_usage();
+    const size_t soft = (size_t)(this->max_heap * SOFT_LIMIT);
+    if (usage < soft) {
+        this->raise_at = this->max_heap;
+    }
+    // a heap that stays full is not collected at every safepoint, the next
+    // emergency collection waits for half of what is left to be used
+    const size_t left = this->raise_at > usage ? this->raise_at - usage : 0;
+    this->pressure_at = std::max(soft, usage + std::max<size_t>(left / 2, STEP_ALLOCATION));
+}
+
+size_t Allocator::parse_size(const char* text) {
+    char* unit = nullptr;
+    const unsigned long long amount = std::strtoull(text, &unit, 10);
+    if (unit == text) {
+        return 0;
+    }
+    switch (*unit) {
+        case '\0': return amount;
+        case 'k': case 'K': return unit[1] == '\0' ? amount << 10 : 0;
+        case 'm': case 'M': return unit[1] == '\0' ? amount << 20 : 0;
+        case 'g': case 'G': return unit[1] == '\0' ? amount << 30 : 0;
+        default: return 0;
+    }
+}
+
+size_t Allocator::object_count() {
+    return heap_list.size() + heap_tuple.size() + heap_string.size() + heap_code.size() +
+        heap_frame.size() + heap_pyfunc.size() + heap_pyobject.size() + heap_pyclass.size() +
+        heap_namespace.size() + heap_cell.size() + heap_slice.size() + heap_dict.size() +
+        heap_set.size() + heap_bigint.size();
+}
+
+static void mark_roots(InterpreterState& interp) {
     if (interp.cur_frame != nullptr) {
         interp.cur_frame.mark();
     }
     interp.ns_globals.mark();
+    interp.ns_builtins.mark();
     interp.main_code.mark();
+    for (Allocator::Root* root = interp.heap->roots; root != nullptr; root = root->next) {
+        root->mark();
+    }
+}
+
+void Allocator::mark_live_objects(InterpreterState& interp) {
+    DEBUG_ADV("MARKING LIVE OBJECTS");
+
+#ifdef PARALLEL_MARK_ON
+    if (gc_threads() > 1 && this->object_count() >= PARALLEL_MARK_MIN_OBJECTS) {
+        if (this->marker == nullptr) {
+            this->marker = std::make_unique<gc_marker>(gc_threads());
+        }
+        this->marker->run([&interp]() { mark_roots(interp); });
+        return ;
+    }
+#endif
+    mark_roots(interp);
 }
 
 void Allocator::print_debug_info() {
@@ -154,9 +486,29 @@ void Allocator::print_debug_info() {
     DEBUG_ADV("\tSIZE OF HEAP_PYOBJECT " << heap_pyobject.memory_footprint() << " - " << heap_pyobject.size());
     DEBUG_ADV("\tSIZE OF HEAP_PYCLASS: " << heap_pyclass.memory_footprint() << " - " << heap_pyclass.size());
     DEBUG_ADV("\tSIZE OF HEAP_NAMESPACE: " << heap_namespace.memory_footprint() << " - " << heap_namespace.size());
+    DEBUG_ADV("\tSIZE OF HEAP_CELL: " << heap_cell.memory_footprint() << " - " << heap_cell.size());
+    DEBUG_ADV("\tSIZE OF HEAP_SLICE: " << heap_slice.memory_footprint() << " - " << heap_slice.size());
+    DEBUG_ADV("\tSIZE OF HEAP_DICT: " << heap_dict.memory_footprint() << " - " << heap_dict.size());
+    DEBUG_ADV("\tSIZE OF HEAP_SET: " << heap_set.memory_footprint() << " - " << heap_set.size());
+    DEBUG_ADV("\tSIZE OF HEAP_BIGINT: " << heap_bigint.memory_footprint() << " - " << heap_bigint.size());
 }
 
-void Allocator::collect_garbage(InterpreterState& interp) {
+static uint64_t nanoseconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void Allocator::collect_garbage(InterpreterState& interp, bool full) {
+    auto pause_start = std::chrono::steady_clock::now();
+
+    // what the last collection left unmarked or unswept is finished first,
+    // its marks would otherwise be taken for this one's
+    if (this->marking) {
+        this->finish_marking();
+    }
+    if (this->sweeping) {
+        this->sweep_step(SIZE_MAX);
+    }
     
     #ifdef PROFILING_ON
         #ifdef GARBAGE_COLLECTION_PROFILING
@@ -164,57 +516,355 @@ void Allocator::collect_garbage(InterpreterState& interp) {
         #endif
     #endif
 
+    this->stats.collections++;
+
+#ifdef INCREMENTAL_MARK_ON
+    if (!full && this->budget.incremental()) {
+        // only the roots are marked now, the rest a slice at a time in gc_step
+        this->marking = true;
+        this->marking_interp = &interp;
+        this->marking_footprint = this->memory_footprint();
+        gc_mark_worker::incremental = &this->grey;
+
+        gc_mark_worker* previous = gc_mark_worker::current;
+        gc_mark_worker::current = &this->grey;
+        mark_roots(interp);
+        gc_mark_worker::current = previous;
+
+        this->stats.mark_ns += nanoseconds_since(pause_start);
+        this->stats.pauses.add(nanoseconds_since(pause_start));
+        this->next_step = std::chrono::steady_clock::now();
+
+        #ifdef PROFILING_ON
+            #ifdef GARBAGE_COLLECTION_PROFILING
+                interp.emit_gc_event(false);
+            #endif
+        #endif
+        return ;
+    }
+#endif
+
+    auto mark_start = std::chrono::steady_clock::now();
     this->mark_live_objects(interp);
+    this->stats.mark_ns += nanoseconds_since(mark_start);
 
-    size_t size_before = this->memory_footprint();
-    DEBUG_ADV("SWEEPING THE HEAP, CURRENT SIZE: " << size_before);
-    print_debug_info();
-    
-    DEBUG_ADV("\tCLEANING LISTS");
-    heap_list.sweep();
-    DEBUG_ADV("\tCLEANING TUPLES");
-    heap_tuple.sweep();
-    DEBUG_ADV("\tCLEANING STRINGS");
-    heap_string.sweep();
-    DEBUG_ADV("\tCLEANING CODE");
-    heap_code.sweep();
-    DEBUG_ADV("\tCLEANING FRAME");
-    heap_frame.sweep();
-    DEBUG_ADV("\tCLEANING PYFUNCS");
-    heap_pyfunc.sweep();
-    DEBUG_ADV("\tCLEANING PYOBJECTS");
-    heap_pyobject.sweep();
-    DEBUG_ADV("\tCLEANING PYCLASSES");
-    heap_pyclass.sweep();
-    DEBUG_ADV("\tCLEANING NAMESPACES");
-    heap_namespace.sweep();
+    this->begin_sweep();
 
-    DEBUG_ADV("DEBUG INFO AFTER");
+    #ifndef LAZY_SWEEP_ON
+    this->sweep_step(SIZE_MAX);
+    #endif
 
-    print_debug_info();
+    this->stats.pauses.add(nanoseconds_since(pause_start));
+
+    #ifdef PROFILING_ON
+        #ifdef GARBAGE_COLLECTION_PROFILING
+            interp.emit_gc_event(false);
+        #endif
+    #endif
+}
+
+// how many objects are marked or swept between looking at the clock, when
+// the budget is a time
+constexpr size_t TIMED_STEP = 64;
+
+void Allocator::gc_step() {
+    auto start = std::chrono::steady_clock::now();
+    if (start < this->next_step) {
+        return ;
+    }
+
+    if (this->marking) {
+        this->mark_slice(start);
+    } else {
+        this->sweep_slice(start);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    this->stats.pauses.add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    this->next_step = end + (end - start);
+}
+
+void Allocator::mark_slice(std::chrono::steady_clock::time_point start) {
+    // the marking is not keeping up with the allocations, so it is finished at once
+    if (this->memory_footprint() >= 2 * this->marking_footprint) {
+        this->finish_marking();
+        return ;
+    }
+
+    if (this->budget.objects != 0) {
+        this->grey.drain(this->budget.objects);
+    } else {
+        auto deadline = start + std::chrono::nanoseconds(this->budget.ns);
+        while (this->grey.drain(TIMED_STEP) == TIMED_STEP && std::chrono::steady_clock::now() < deadline) {
+        }
+    }
+    this->stats.mark_steps++;
+    this->stats.mark_ns += nanoseconds_since(start);
+
+    if (this->grey.empty()) {
+        this->finish_marking();
+    }
+}
+
+void Allocator::sweep_slice(std::chrono::steady_clock::time_point start) {
+    if (this->budget.objects != 0) {
+        this->sweep_step(this->budget.objects);
+    } else if (this->budget.ns != 0) {
+        auto deadline = start + std::chrono::nanoseconds(this->budget.ns);
+        do {
+            this->sweep_step(TIMED_STEP);
+        } while (this->sweeping && std::chrono::steady_clock::now() < deadline);
+    } else {
+        this->sweep_step(LAZY_SWEEP_BUDGET);
+    }
+}
+
+void Allocator::finish_marking() {
+    auto start = std::chrono::steady_clock::now();
+    InterpreterState& interp = *this->marking_interp;
+
+    gc_mark_worker* previous = gc_mark_worker::current;
+    gc_mark_worker::current = &this->grey;
+    mark_roots(interp);
+    // frames, and the namespaces and cells they hold, are written to without
+    // a write barrier, so whatever they hold by now is marked again
+    mark_children(interp.ns_globals);
+    mark_children(interp.ns_builtins);
+    this->heap_frame.for_each_marked([](gc_ptr<FrameState> frame) {
+        mark_children(frame);
+        mark_children(frame->ns_local);
+        for (ValueCell cell : frame->cells) {
+            mark_children(cell);
+        }
+    });
+    gc_mark_worker::current = previous;
+    this->grey.drain(SIZE_MAX);
 
-    size_t new_size = this->memory_footprint();
-    DEBUG_ADV("CLEANED UP " << size_before - new_size << " BYTES, NEW SIZE: " << new_size);
+    this->marking = false;
+    this->marking_interp = nullptr;
+    gc_mark_worker::incremental = nullptr;
+    this->stats.mark_ns += nanoseconds_since(start);
+
+    this->begin_sweep();
+}
+
+void Allocator::begin_sweep() {
+    DEBUG_ADV("SWEEPING THE HEAP, CURRENT SIZE: " << this->memory_footprint());
     print_debug_info();
 
-    this->size_at_last_gc = new_size;
-    
-    for (auto& object : this->heap_list.objects) {
-        this->size_at_last_gc += object.object.size();
+    heap_list.start_sweep();
+    heap_tuple.start_sweep();
+    heap_string.start_sweep();
+    heap_code.start_sweep();
+    heap_frame.start_sweep();
+    heap_pyfunc.start_sweep();
+    heap_pyobject.start_sweep();
+    heap_pyclass.start_sweep();
+    heap_namespace.start_sweep();
+    heap_cell.start_sweep();
+    heap_slice.start_sweep();
+    heap_dict.start_sweep();
+    heap_set.start_sweep();
+    heap_bigint.start_sweep();
+    this->sweeping = true;
+    this->sweep_heap = 0;
+    this->sweep_live = 0;
+
+    // until the sweep is done the garbage still counts towards the footprint,
+    // so the next collection waits for the heap to double from here
+    this->size_at_last_gc = this->memory_footprint();
+}
+
+// the heaps sweep_step goes through, in order
+constexpr size_t HEAP_COUNT = 14;
+
+void Allocator::sweep_step(size_t budget) {
+    auto sweep_start = std::chrono::steady_clock::now();
+    size_t size_before = this->object_count();
+
+    // sweeps as much of one heap as the budget allows and tells whether that
+    // heap is done. Lists, dicts and sets also count what they hold
+    auto sweep = [this, &budget](auto& heap, auto contents) {
+        budget -= heap.sweep_some(budget, [this, &contents](auto& object) {
+            this->sweep_live += sizeof(object) + contents(object);
+        });
+        return !heap.sweeping;
+    };
+    // namespaces are left out of memory_footprint, so they are not counted
+    auto sweep_uncounted = [&budget](auto& heap) {
+        budget -= heap.sweep_some(budget);
+        return !heap.sweeping;
+    };
+    auto nothing = [](auto& object) -> size_t { return 0; };
+    auto size = [](auto& object) -> size_t { return object.size(); };
+
+    while (budget > 0 && this->sweep_heap < HEAP_COUNT) {
+        bool done = true;
+        switch (this->sweep_heap) {
+            case 0: DEBUG_ADV("\tCLEANING LISTS"); done = sweep(heap_list, size); break;
+            case 1: DEBUG_ADV("\tCLEANING TUPLES"); done = sweep(heap_tuple, nothing); break;
+            case 2: DEBUG_ADV("\tCLEANING STRINGS"); done = sweep(heap_string, nothing); break;
+            case 3: DEBUG_ADV("\tCLEANING CODE"); done = sweep(heap_code, nothing); break;
+            case 4: DEBUG_ADV("\tCLEANING FRAME"); done = sweep(heap_frame, nothing); break;
+            case 5: DEBUG_ADV("\tCLEANING PYFUNCS"); done = sweep(heap_pyfunc, nothing); break;
+            case 6: DEBUG_ADV("\tCLEANING PYOBJECTS"); done = sweep(heap_pyobject, nothing); break;
+            case 7: DEBUG_ADV("\tCLEANING PYCLASSES"); done = sweep(heap_pyclass, nothing); break;
+            case 8: DEBUG_ADV("\tCLEANING NAMESPACES"); done = sweep_uncounted(heap_namespace); break;
+            case 9: DEBUG_ADV("\tCLEANING CELLS"); done = sweep(heap_cell, nothing); break;
+            case 10: DEBUG_ADV("\tCLEANING SLICES"); done = sweep(heap_slice, nothing); break;
+            case 11: DEBUG_ADV("\tCLEANING DICTS"); done = sweep(heap_dict, size); break;
+            case 12: DEBUG_ADV("\tCLEANING SETS"); done = sweep(heap_set, size); break;
+            case 13: DEBUG_ADV("\tCLEANING BIGINTS"); done = sweep(heap_bigint, nothing); break;
+        }
+        if (done) {
+            this->sweep_heap++;
+        }
     }
+    this->sweeping = this->sweep_heap < HEAP_COUNT;
+
+    this->stats.freed += size_before - this->object_count();
+    this->stats.sweep_steps++;
+    this->stats.sweep_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - sweep_start).count();
 
-    DEBUG_ADV("computing new size_at_last_gc as " << new_size << " + " << (this->size_at_last_gc - new_size) << " when we account for lists");
+    if (this->sweeping) {
+        return ;
+    }
+
+    DEBUG_ADV("DEBUG INFO AFTER");
+    print_debug_info();
+
+    this->size_at_last_gc = this->sweep_live;
+    DEBUG_ADV("computing new size_at_last_gc as " << this->sweep_live << " when we account for lists, dicts and sets");
 
     if (this->size_at_last_gc < 16 * 1024) {
         this->size_at_last_gc = 16 * 1024;
         DEBUG_ADV("\tupped the size_at_last_gc to " << this->size_at_last_gc << " because it was too small.");
     }
 
-    #ifdef PROFILING_ON
-        #ifdef GARBAGE_COLLECTION_PROFILING
-            interp.emit_gc_event(false);
-        #endif
-    #endif
+#ifdef COMPACTION_ON
+    size_t resident = 0;
+    size_t used = 0;
+    this->slab_bytes(resident, used);
+    // the free pages of the slabs objects are left on are only given back
+    // along with empty slabs, or by gc.compact(). Looking for them after
+    // every sweep would cost more than they are worth
+    bool empty_slabs = false;
+    this->for_each_heap([&empty_slabs](auto& heap) {
+        empty_slabs = empty_slabs || heap.has_empty_slabs();
+    });
+    if (empty_slabs && resident - used >= COMPACT_MIN_BYTES && resident - used > COMPACT_FRAGMENTATION * resident) {
+        this->compact();
+    }
+#endif
+}
+
+void Allocator::slab_bytes(size_t& resident, size_t& used) {
+    this->for_each_heap([&resident, &used](auto& heap) {
+        resident += heap.pool.resident_bytes();
+        used += heap.pool.used_bytes();
+    });
+}
+
+double Allocator::fragmentation() {
+    size_t resident = 0;
+    size_t used = 0;
+    this->slab_bytes(resident, used);
+    return resident == 0 ? 0.0 : 1.0 - (double)used / resident;
+}
+
+size_t Allocator::compact() {
+    size_t released = 0;
+    this->for_each_heap([&released](auto& heap) {
+        released += heap.compact();
+    });
+#ifdef __GLIBC__
+    // what lists, dicts and strings held outside the heaps went back to malloc,
+    // which keeps the pages until it is asked to let them go
+    malloc_trim(0);
+#endif
+    this->stats.compactions++;
+    this->stats.released += released;
+    return released;
+}
+
+double Allocator::huge_page_coverage() {
+    size_t huge = 0;
+    size_t resident = 0;
+    if (!gc_pool::huge_pages || !gc_pool::huge_page_usage(huge, resident) || resident == 0) {
+        return 0.0;
+    }
+    return (double)huge / resident;
+}
+
+Allocator::Budget Allocator::Budget::from_env() {
+    static const Budget budget = []() {
+        Budget budget;
+        if (const char* env = std::getenv("MYPY_GC_BUDGET")) {
+            char* unit = nullptr;
+            const unsigned long long amount = std::strtoull(env, &unit, 10);
+            if (std::strcmp(unit, "us") == 0) {
+                budget.ns = amount * 1000;
+            } else if (std::strcmp(unit, "ms") == 0) {
+                budget.ns = amount * 1000000;
+            } else {
+                budget.objects = amount;
+            }
+        }
+        return budget;
+    }();
+    return budget;
+}
+
+void Allocator::Stats::Histogram::add(uint64_t ns) {
+    const uint64_t us = ns / 1000;
+    size_t bucket = 0;
+    while (bucket + 1 < this->buckets.size() && (uint64_t(1) << bucket) <= us) {
+        bucket++;
+    }
+    this->buckets[bucket]++;
+    this->count++;
+    this->max_ns = std::max(this->max_ns, ns);
+}
+
+uint64_t Allocator::Stats::Histogram::percentile_us(double p) const {
+    size_t seen = 0;
+    for (size_t i = 0; i < this->buckets.size(); ++i) {
+        seen += this->buckets[i];
+        if (seen > 0 && seen >= p * this->count) {
+            return uint64_t(1) << i;
+        }
+    }
+    return 0;
+}
+
+void Allocator::print_stats(std::ostream& out) {
+    out << "gc: " << stats.collections << " collections, "
+        << stats.mark_ns / 1000 << "us marking in " << stats.mark_steps << " steps, "
+        << stats.sweep_ns / 1000 << "us sweeping in " << stats.sweep_steps << " steps, "
+        << stats.freed << " objects freed" << std::endl;
+    if (this->max_heap != 0) {
+        out << "heap limit: " << this->max_heap << " bytes, " << this->heap_usage() << " used, "
+            << this->peak << " at most, " << stats.emergency_collections << " emergency collections, "
+            << stats.memory_errors << " MemoryErrors" << std::endl;
+    }
+    out << "gc compactions: " << stats.compactions << ", " << stats.released / 1024 << "kB released, "
+        << (int)(this->fragmentation() * 100) << "% of the heaps unused" << std::endl;
+#ifdef HUGE_PAGES_ON
+    size_t huge = 0;
+    size_t resident = 0;
+    if (gc_pool::huge_pages && gc_pool::huge_page_usage(huge, resident)) {
+        out << "gc huge pages: " << huge / 1024 << "kB of " << resident / 1024 << "kB resident, "
+            << (int)(huge_page_coverage() * 100) << "% coverage" << std::endl;
+    }
+#endif
+    out << "gc pauses: " << stats.pauses.count << ", p50 < " << stats.pauses.percentile_us(0.5)
+        << "us, p99 < " << stats.pauses.percentile_us(0.99) << "us, max " << stats.pauses.max_ns / 1000 << "us" << std::endl;
+    for (size_t i = 0; i < stats.pauses.buckets.size(); ++i) {
+        if (stats.pauses.buckets[i] != 0) {
+            out << "\t< " << (uint64_t(1) << i) << "us: " << stats.pauses.buckets[i] << std::endl;
+        }
+    }
 }
 
 void Allocator::retain_all() {
@@ -227,6 +877,11 @@ void Allocator::retain_all() {
     heap_pyobject.retain_all();
     heap_pyclass.retain_all();
     heap_namespace.retain_all();
+    heap_cell.retain_all();
+    heap_slice.retain_all();
+    heap_dict.retain_all();
+    heap_set.retain_all();
+    heap_bigint.retain_all();
 }
 
 }
\ No newline at end of file
@@ -2,28 +2,67 @@
 #define PYALLOCATOR_H
 
 #include <pygc.hpp>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <unordered_map>
 #include <string>
+#include <ostream>
 
 #include "pyvalue.hpp"
 #include "pycode.hpp" // TODO: i am unhappy about having to have this included
 #include "pyframe.hpp"
+#include "optflags.hpp"
+
+namespace gc {
+    // mark what an object refers to, defined in pyallocator.cpp. Objects made
+    // during an incremental marking are scanned through these, so they are
+    // needed wherever objects are made
+    void mark_children(gc_ptr<py::FrameState> framestate);
+    void mark_children(py::ValueString string);
+    void mark_children(py::ValueCode code);
+    void mark_children(py::Namespace ns);
+    void mark_children(py::ValueList list);
+    void mark_children(py::ValueTuple list);
+    void mark_children(py::ValuePyObject pyobject);
+    void mark_children(py::ValueCell cell);
+    void mark_children(py::ValueSlice slice);
+    void mark_children(py::ValueDict dict);
+    void mark_children(py::ValueSet set);
+    void mark_children(py::ValueBigInt bigint);
+    void mark_children(py::ValuePyClass pyclass);
+    void mark_children(py::ValuePyFunction func);
+}
+
 namespace py {
 
     using namespace gc;
 
     struct InterpreterState;
 
+    // The heaps of one interpreter. Every thread works with one allocator at a
+    // time, the current one, which is where alloc() allocates. An interpreter
+    // makes the allocator it was created under current while it runs, so
+    // several interpreters can run side by side on their own threads
     struct Allocator {
         size_t size_at_last_gc = 32; // 32 bytes or something like that.
+
+        // the huge page regions every heap below cuts its slabs from
+        gc_regions regions;
         
         gc_heap<value::List> heap_list;
-        gc_heap<const std::string> heap_string;
+        gc_heap<const value::String> heap_string;
         gc_heap<Code> heap_code;
         gc_heap<value::PyFunc> heap_pyfunc;
         gc_heap<value::PyObject> heap_pyobject;
         gc_heap<value::PyClass> heap_pyclass;
         gc_heap<std::unordered_map<std::string, Value>> heap_namespace;
+        gc_heap<value::Cell> heap_cell;
+        gc_heap<value::Slice> heap_slice;
+        gc_heap<value::Dict> heap_dict;
+        gc_heap<value::Set> heap_set;
+        gc_heap<value::BigInt> heap_bigint;
     
         // the recyclable heap types are defined here
         #ifdef RECYCLING_ON
@@ -33,6 +72,40 @@ namespace py {
         gc_heap<FrameState> heap_frame;
         gc_heap<value::Tuple> heap_tuple;
         #endif
+
+        // the strings made by String::intern and String::character, which are
+        // never collected
+        std::unordered_map<std::string, ValueString> interned;
+        std::array<ValueString, 256> characters;
+
+        // the current allocator of this thread
+        static inline thread_local Allocator* current = nullptr;
+
+        Allocator();
+        ~Allocator();
+
+        Allocator(const Allocator&) = delete;
+        Allocator& operator=(const Allocator&) = delete;
+
+        // makes an allocator the current one of this thread until it goes out
+        // of scope
+        class Scope {
+        public:
+            Scope(Allocator& heap) : previous(current) {
+                current = &heap;
+                gc_mark_worker::incremental = heap.marking ? &heap.grey : nullptr;
+            }
+            ~Scope() {
+                current = this->previous;
+                gc_mark_worker::incremental = current != nullptr && current->marking ? &current->grey : nullptr;
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            Allocator* previous;
+        };
         
         inline size_t memory_footprint() {
             return heap_list.memory_footprint() + 
@@ -42,21 +115,278 @@ namespace py {
                 heap_frame.memory_footprint() + 
                 heap_pyfunc.memory_footprint() + 
                 heap_pyobject.memory_footprint() + 
-                heap_pyclass.memory_footprint();
+                heap_pyclass.memory_footprint() + 
+                heap_cell.memory_footprint() + 
+                heap_slice.memory_footprint() + 
+                heap_dict.memory_footprint() + 
+                heap_set.memory_footprint() + 
+                heap_bigint.memory_footprint();
+        }
+
+        // The interpreter stops at a safepoint on every jump and return once
+        // countdown runs out or a request is made, which costs it two
+        // compares. Objects made take their size off the countdown, and
+        // anything else that needs the interpreter to stop, from any thread,
+        // asks with request()
+        enum Request : uint32_t {
+            REQUEST_COLLECT = 1 << 0, // a full collection
+        };
+
+        std::atomic<int64_t> countdown{0};
+        std::atomic<uint32_t> requests{0};
+
+        // the countdown is only written by the interpreter's thread, objects
+        // made take their size off it without an atomic step, so a request
+        // is not put on it but seen by at_safepoint() on its own
+        void request(Request reason) {
+            this->requests.fetch_or(reason);
         }
 
-        inline bool check_if_gc_needed() {
-            return this->memory_footprint() >= size_at_last_gc * 2;
+        inline bool at_safepoint() const {
+            return this->countdown.load(std::memory_order_relaxed) <= 0
+                || this->requests.load(std::memory_order_relaxed) != 0;
         }
 
+        // handles the requests, collects or does a step of the collection
+        // that is going on, and restarts the countdown
+        void safepoint(InterpreterState& interp);
+
+        // The most the interpreter may use, 0 for no limit. While there is
+        // one, what operator new hands out while this is the current allocator
+        // counts as much as malloc set aside for it, and so do the slots
+        // handed out from the heaps' slabs. Past pressure_at the next
+        // safepoint collects everything, and a safepoint that is still past
+        // raise_at after that raises MemoryError
+        size_t max_heap = 0;
+        size_t pressure_at = SIZE_MAX;
+        size_t raise_at = SIZE_MAX;
+        size_t peak = 0; // the most used at any safepoint
+
+        // What operator new counted against an allocator less what was
+        // deleted since. Every block remembers the account it was counted
+        // against, so it is taken off the right one whichever allocator is
+        // current, or none, when it is deleted, and from any thread. Blocks
+        // can outlive their allocator, the account is then freed with the
+        // last of them
+        struct Account {
+            // held by the allocator until it is destroyed
+            static constexpr int64_t OPEN = INT64_C(1) << 62;
+
+            std::atomic<int64_t> bytes{OPEN};
+
+            int64_t used() const {
+                return this->bytes.load(std::memory_order_relaxed) - OPEN;
+            }
+
+            // returns the bytes still counted
+            int64_t add(int64_t size) {
+                return this->bytes.fetch_add(size, std::memory_order_relaxed) + size - OPEN;
+            }
+
+            void release(int64_t size) {
+                if (this->bytes.fetch_sub(size, std::memory_order_acq_rel) == size) {
+                    delete this;
+                }
+            }
+        };
+
+        Account* account = new Account();
+
+        // how much may be counted before the interpreter is stopped to look
+        // at the limit
+        int64_t alert_at = INT64_MAX;
+
+        // the share of max_heap past which everything is collected at once
+        static constexpr double SOFT_LIMIT = 0.75;
+
+        void set_max_heap(size_t bytes);
+
+        // the bytes the interpreter uses now
+        size_t heap_usage();
+
+        inline void count_allocation(size_t bytes) {
+            if (this->account->add((int64_t)bytes) > this->alert_at) {
+                this->countdown.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // a number of bytes such as 512M, with an optional k, M or G, 0 if
+        // text is not one
+        static size_t parse_size(const char* text);
+
+        // what is allocated between two steps of an unfinished collection
+        static constexpr int64_t STEP_ALLOCATION = 32 * 1024;
+
+        // how many objects the interpreter sweeps each step while a sweep is
+        // unfinished and no budget is set
+        static constexpr size_t LAZY_SWEEP_BUDGET = 1024;
+
+        // how much of a collection is done at each safepoint, as a number of
+        // objects or of nanoseconds. Set by MYPY_GC_BUDGET, a number of objects
+        // or a time ending in us or ms. Without one every collection marks
+        // everything at once
+        struct Budget {
+            size_t objects = 0;
+            uint64_t ns = 0;
+
+            bool incremental() const {
+                return this->objects != 0 || this->ns != 0;
+            }
+
+            static Budget from_env();
+        };
+        Budget budget = Budget::from_env();
+
+        // whether an incremental marking is going on, whose objects it marks
+        // and the footprint it started at. grey holds the objects that are
+        // marked but whose children are not yet
+        bool marking = false;
+        InterpreterState* marking_interp = nullptr;
+        size_t marking_footprint = 0;
+        gc_mark_worker grey;
+
+        // when the next step may run
+        std::chrono::steady_clock::time_point next_step;
+
+        // does one step of the marking or the sweep that is going on, paced so
+        // the interpreter runs at least as long as the last step took
+        void gc_step();
+        void mark_slice(std::chrono::steady_clock::time_point start);
+        void sweep_slice(std::chrono::steady_clock::time_point start);
+        // marks again what changes without a write barrier, then marks the
+        // rest at once and starts the sweep
+        void finish_marking();
+        void begin_sweep();
+
+        // whether the heaps are still being swept after the last marking, the
+        // heap the sweep is at and the bytes it found live so far
+        bool sweeping = false;
+        size_t sweep_heap = 0;
+        size_t sweep_live = 0;
+
+        // sweeps up to budget objects, and sets the size the next collection
+        // waits for once every heap is swept
+        void sweep_step(size_t budget);
+
+        // what the collections of this allocator took, the time spent sweeping
+        // is counted apart from the pause for marking
+        struct Stats {
+            size_t collections = 0;
+            uint64_t mark_ns = 0;
+            uint64_t sweep_ns = 0;
+            size_t mark_steps = 0;
+            size_t sweep_steps = 0;
+            size_t freed = 0;
+            size_t compactions = 0;
+            size_t released = 0; // bytes given back to the OS
+            size_t emergency_collections = 0;
+            size_t memory_errors = 0;
+
+            // how long the interpreter was stopped by each collection or
+            // step, bucket i counts the pauses shorter than 2^i microseconds
+            // that did not fit in the one before
+            struct Histogram {
+                std::array<size_t, 32> buckets{};
+                size_t count = 0;
+                uint64_t max_ns = 0;
+
+                void add(uint64_t ns);
+                // the upper bound of the bucket that holds the p-th quantile
+                uint64_t percentile_us(double p) const;
+            } pauses;
+        } stats;
+
+        // prints the stats and the pause histogram, run with MYPY_GC_STATS set
+        // the interpreter prints them to stderr when it exits
+        void print_stats(std::ostream& out);
+
+        // the threads that mark in parallel, started by the first collection
+        // of a heap large enough to use them
+        std::unique_ptr<gc_marker> marker;
+
+        // the number of objects in all heaps
+        size_t object_count();
+
         void print_debug_info();
         void mark_live_objects(InterpreterState& interp);
-        void collect_garbage(InterpreterState& interp);
+        // collects, or with a budget starts an incremental collection unless
+        // full is set
+        void collect_garbage(InterpreterState& interp, bool full = false);
 
         void retain_all();
+
+        // Holds objects from outside the heaps, such as code that embeds the
+        // interpreter, for as long as it is linked. Every collection marks
+        // the roots of the allocator it runs on along with the interpreter's,
+        // unlike retain() there is no limit on how many hold one object
+        struct Root {
+            Root* prev = nullptr;
+            Root* next = nullptr;
+
+            virtual void mark() = 0;
+            virtual ~Root() { };
+        };
+        Root* roots = nullptr;
+
+        void link(Root* root) {
+            root->prev = nullptr;
+            root->next = this->roots;
+            if (this->roots != nullptr) {
+                this->roots->prev = root;
+            }
+            this->roots = root;
+        }
+
+        void unlink(Root* root) {
+            (root->prev != nullptr ? root->prev->next : this->roots) = root->next;
+            if (root->next != nullptr) {
+                root->next->prev = root->prev;
+            }
+            root->prev = root->next = nullptr;
+        }
+
+        // once a sweep leaves more than this much of the memory the heaps'
+        // slabs keep unused, and at least COMPACT_MIN_BYTES of it, the heaps
+        // are compacted if that frees a slab
+        static constexpr double COMPACT_FRAGMENTATION = 0.5;
+        static constexpr size_t COMPACT_MIN_BYTES = 4 * 1024 * 1024;
+
+        // how much of the memory the heaps' slabs keep is not used by objects
+        double fragmentation();
+
+        // frees the objects kept for recycling and gives the pages that hold
+        // no object back to the OS, those of empty slabs and those among the
+        // objects of the others, returns how many bytes that was. Objects do
+        // not move, so nothing that points at them changes
+        size_t compact();
+
+        // how much of the heaps' slabs that is resident is on huge pages, 0
+        // unless gc_pool::huge_pages was set. The whole process is counted, so
+        // with several interpreters this is their coverage together
+        static double huge_page_coverage();
+
+    private:
+        // adds up the bytes of the slabs whose pages are kept, and of the
+        // objects on them
+        void slab_bytes(size_t& resident, size_t& used);
+
+        // collects and compacts everything once usage crossed pressure_at,
+        // and moves pressure_at past what is left
+        void relieve_pressure(InterpreterState& interp);
+        // sets alert_at to when usage reaches pressure_at or raise_at
+        void watch_limit(size_t usage);
+
+        template<typename F>
+        void for_each_heap(F f) {
+            f(heap_list); f(heap_tuple); f(heap_string); f(heap_code); f(heap_frame);
+            f(heap_pyfunc); f(heap_pyobject); f(heap_pyclass); f(heap_namespace);
+            f(heap_cell); f(heap_slice); f(heap_dict); f(heap_set); f(heap_bigint);
+        }
     };
 
-    extern Allocator alloc;
+    inline Allocator& alloc() {
+        return *Allocator::current;
+    }
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,568 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "pyvalue.hpp"
+#include "pyallocator.hpp"
+
+namespace py {
+namespace value {
+
+/*
+    The magnitude helpers below work on digit vectors and ignore signs, the
+    BigInt methods apply Python's sign rules on top of them. Multiplication is
+    schoolbook for short operands and Karatsuba once both are long enough to
+    make the extra additions pay off, division is Knuth's algorithm D.
+*/
+
+namespace {
+
+using Digits = std::vector<uint32_t>;
+
+constexpr uint64_t BASE = (uint64_t)1 << 32;
+constexpr size_t KARATSUBA_CUTOFF = 40;
+constexpr uint32_t DECIMAL_BASE = 1000000000; // the largest power of 10 in a digit
+
+inline void trim(Digits& d) {
+    while (!d.empty() && d.back() == 0) {
+        d.pop_back();
+    }
+}
+
+int compare_mag(const Digits& a, const Digits& b) {
+    if (a.size() != b.size()) {
+        return a.size() < b.size() ? -1 : 1;
+    }
+    for (size_t i = a.size(); i-- > 0;) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+Digits add_mag(const Digits& a, const Digits& b) {
+    const Digits& longer = a.size() >= b.size() ? a : b;
+    const Digits& shorter = a.size() >= b.size() ? b : a;
+    Digits r(longer.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < longer.size(); ++i) {
+        carry += (uint64_t)longer[i] + (i < shorter.size() ? shorter[i] : 0);
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    r[longer.size()] = (uint32_t)carry;
+    trim(r);
+    return r;
+}
+
+// a -= b, requires a >= b
+void sub_mag_in_place(Digits& a, const Digits& b) {
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        int64_t t = (int64_t)a[i] - (i < b.size() ? b[i] : 0) - borrow;
+        a[i] = (uint32_t)t;
+        borrow = t < 0;
+        if (i >= b.size() && borrow == 0) break;
+    }
+    trim(a);
+}
+
+// a += b << (32 * shift)
+void add_shifted(Digits& a, const Digits& b, size_t shift) {
+    if (b.empty()) {
+        return;
+    }
+    if (a.size() < b.size() + shift + 1) {
+        a.resize(b.size() + shift + 1, 0);
+    }
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < b.size(); ++i) {
+        carry += (uint64_t)a[i + shift] + b[i];
+        a[i + shift] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (i += shift; carry != 0; ++i) {
+        carry += a[i];
+        a[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    trim(a);
+}
+
+Digits mul_schoolbook(const Digits& a, const Digits& b) {
+    Digits r(a.size() + b.size(), 0);
+    for (size_t i = 0; i < b.size(); ++i) {
+        const uint64_t bi = b[i];
+        if (bi == 0) continue;
+        uint64_t carry = 0;
+        for (size_t j = 0; j < a.size(); ++j) {
+            carry += a[j] * bi + r[i + j];
+            r[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r[i + a.size()] = (uint32_t)carry;
+    }
+    trim(r);
+    return r;
+}
+
+Digits mul_mag(const Digits& a, const Digits& b) {
+    if (a.size() < b.size()) {
+        return mul_mag(b, a);
+    }
+    if (b.size() < KARATSUBA_CUTOFF) {
+        return b.empty() ? Digits() : mul_schoolbook(a, b);
+    }
+
+    // a = a1 * B^m + a0 and b = b1 * B^m + b0
+    const size_t m = a.size() / 2;
+    Digits a0(a.begin(), a.begin() + m), a1(a.begin() + m, a.end());
+    trim(a0);
+    if (b.size() <= m) {
+        // too unbalanced to split b, a * b = a1 * b * B^m + a0 * b
+        Digits r = mul_mag(a0, b);
+        add_shifted(r, mul_mag(a1, b), m);
+        return r;
+    }
+    Digits b0(b.begin(), b.begin() + m), b1(b.begin() + m, b.end());
+    trim(b0);
+
+    Digits z0 = mul_mag(a0, b0);
+    Digits z2 = mul_mag(a1, b1);
+    // (a0 + a1) * (b0 + b1) - z0 - z2 = a0 * b1 + a1 * b0
+    Digits z1 = mul_mag(add_mag(a0, a1), add_mag(b0, b1));
+    sub_mag_in_place(z1, z0);
+    sub_mag_in_place(z1, z2);
+
+    Digits r = std::move(z0);
+    add_shifted(r, z1, m);
+    add_shifted(r, z2, 2 * m);
+    return r;
+}
+
+// a = a * mul + add
+void mul_add_small(Digits& a, uint32_t mul, uint32_t add) {
+    uint64_t carry = add;
+    for (uint32_t& digit : a) {
+        carry += (uint64_t)digit * mul;
+        digit = (uint32_t)carry;
+        carry >>= 32;
+    }
+    if (carry != 0) {
+        a.push_back((uint32_t)carry);
+    }
+}
+
+// a /= d, returns the remainder
+uint32_t divmod_small_in_place(Digits& a, uint32_t d) {
+    uint64_t rem = 0;
+    for (size_t i = a.size(); i-- > 0;) {
+        const uint64_t cur = (rem << 32) | a[i];
+        a[i] = (uint32_t)(cur / d);
+        rem = cur % d;
+    }
+    trim(a);
+    return (uint32_t)rem;
+}
+
+// Knuth's algorithm D, as in Hacker's Delight, requires v.size() >= 2
+void divmod_knuth(const Digits& u_in, const Digits& v_in, Digits& q, Digits& r) {
+    const size_t n = v_in.size();
+    const size_t m = u_in.size() - n;
+
+    // normalize so that the top bit of the divisor is set, this keeps qhat within 2 of the real digit
+    const int s = __builtin_clz(v_in.back());
+    Digits v(n), u(u_in.size() + 1);
+    for (size_t i = n; i-- > 0;) {
+        v[i] = (v_in[i] << s) | (s && i > 0 ? (uint32_t)((uint64_t)v_in[i - 1] >> (32 - s)) : 0);
+    }
+    u[u_in.size()] = s ? (uint32_t)((uint64_t)u_in.back() >> (32 - s)) : 0;
+    for (size_t i = u_in.size(); i-- > 0;) {
+        u[i] = (u_in[i] << s) | (s && i > 0 ? (uint32_t)((uint64_t)u_in[i - 1] >> (32 - s)) : 0);
+    }
+
+    q.assign(m + 1, 0);
+    for (size_t j = m + 1; j-- > 0;) {
+        const uint64_t num = ((uint64_t)u[j + n] << 32) | u[j + n - 1];
+        uint64_t qhat = num / v[n - 1];
+        uint64_t rhat = num % v[n - 1];
+        while (qhat >= BASE || qhat * v[n - 2] > ((rhat << 32) | u[j + n - 2])) {
+            qhat--;
+            rhat += v[n - 1];
+            if (rhat >= BASE) break;
+        }
+
+        // u[j..j+n] -= qhat * v
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+        for (size_t i = 0; i < n; ++i) {
+            const uint64_t p = qhat * v[i] + carry;
+            carry = p >> 32;
+            const int64_t t = (int64_t)u[i + j] - (int64_t)(uint32_t)p - borrow;
+            u[i + j] = (uint32_t)t;
+            borrow = t < 0;
+        }
+        const int64_t t = (int64_t)u[j + n] - (int64_t)carry - borrow;
+        u[j + n] = (uint32_t)t;
+
+        if (t < 0) {
+            // qhat was one too large, add the divisor back
+            qhat--;
+            uint64_t c = 0;
+            for (size_t i = 0; i < n; ++i) {
+                c += (uint64_t)u[i + j] + v[i];
+                u[i + j] = (uint32_t)c;
+                c >>= 32;
+            }
+            u[j + n] += (uint32_t)c;
+        }
+        q[j] = (uint32_t)qhat;
+    }
+
+    r.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        r[i] = (u[i] >> s) | (s ? (uint32_t)((uint64_t)u[i + 1] << (32 - s)) : 0);
+    }
+    trim(q);
+    trim(r);
+}
+
+void divmod_mag(const Digits& a, const Digits& b, Digits& q, Digits& r) {
+    if (compare_mag(a, b) < 0) {
+        q.clear();
+        r = a;
+    } else if (b.size() == 1) {
+        q = a;
+        const uint32_t rem = divmod_small_in_place(q, b[0]);
+        r.clear();
+        if (rem != 0) r.push_back(rem);
+    } else {
+        divmod_knuth(a, b, q, r);
+    }
+}
+
+Digits shift_left_mag(const Digits& a, uint64_t bits) {
+    if (a.empty()) {
+        return Digits();
+    }
+    const size_t words = bits / 32;
+    const int s = bits % 32;
+    Digits r(a.size() + words + 1, 0);
+    for (size_t i = 0; i < a.size(); ++i) {
+        const uint64_t shifted = (uint64_t)a[i] << s;
+        r[i + words] |= (uint32_t)shifted;
+        r[i + words + 1] = (uint32_t)(shifted >> 32);
+    }
+    trim(r);
+    return r;
+}
+
+Digits shift_right_mag(const Digits& a, uint64_t bits) {
+    const size_t words = bits / 32;
+    if (words >= a.size()) {
+        return Digits();
+    }
+    const int s = bits % 32;
+    Digits r(a.size() - words);
+    for (size_t i = 0; i < r.size(); ++i) {
+        const uint64_t pair = a[i + words] | (i + words + 1 < a.size() ? (uint64_t)a[i + words + 1] << 32 : 0);
+        r[i] = (uint32_t)(pair >> s);
+    }
+    trim(r);
+    return r;
+}
+
+// the two's complement form of a, sign extended to n digits
+Digits to_twos_complement(const BigInt& a, size_t n) {
+    Digits r(a.digits);
+    r.resize(n, 0);
+    if (a.negative) {
+        uint64_t carry = 1;
+        for (uint32_t& digit : r) {
+            carry += (uint32_t)~digit;
+            digit = (uint32_t)carry;
+            carry >>= 32;
+        }
+    }
+    return r;
+}
+
+BigInt from_twos_complement(Digits r) {
+    BigInt result;
+    result.negative = !r.empty() && (r.back() >> 31);
+    if (result.negative) {
+        uint64_t carry = 1;
+        for (uint32_t& digit : r) {
+            carry += (uint32_t)~digit;
+            digit = (uint32_t)carry;
+            carry >>= 32;
+        }
+    }
+    trim(r);
+    result.digits = std::move(r);
+    return result;
+}
+
+template<typename Op>
+BigInt bitwise(const BigInt& a, const BigInt& b, Op op) {
+    // one extra digit so that the sign bit of the result is never lost
+    const size_t n = std::max(a.digits.size(), b.digits.size()) + 1;
+    Digits da = to_twos_complement(a, n);
+    const Digits db = to_twos_complement(b, n);
+    for (size_t i = 0; i < n; ++i) {
+        da[i] = op(da[i], db[i]);
+    }
+    return from_twos_complement(std::move(da));
+}
+
+BigInt make(bool negative, Digits&& digits) {
+    BigInt result;
+    result.digits = std::move(digits);
+    result.negative = negative && !result.digits.empty();
+    return result;
+}
+
+}
+
+BigInt::BigInt(int64_t value) {
+    this->negative = value < 0;
+    uint64_t mag = this->negative ? -(uint64_t)value : (uint64_t)value;
+    while (mag != 0) {
+        this->digits.push_back((uint32_t)mag);
+        mag >>= 32;
+    }
+}
+
+BigInt BigInt::from_string(const std::string& str) {
+    size_t begin = str.find_first_not_of(" \t\n");
+    size_t end = str.find_last_not_of(" \t\n");
+    if (begin == std::string::npos) {
+        throw pyerror("ValueError: invalid literal for int() with base 10: '" + str + "'");
+    }
+
+    BigInt result;
+    bool negative = false;
+    if (str[begin] == '+' || str[begin] == '-') {
+        negative = str[begin] == '-';
+        begin++;
+    }
+    if (begin > end) {
+        throw pyerror("ValueError: invalid literal for int() with base 10: '" + str + "'");
+    }
+
+    // consume up to 9 decimal digits per multiply
+    for (size_t i = begin; i <= end;) {
+        uint32_t chunk = 0, scale = 1;
+        for (; i <= end && scale < DECIMAL_BASE; ++i, scale *= 10) {
+            if (str[i] < '0' || str[i] > '9') {
+                throw pyerror("ValueError: invalid literal for int() with base 10: '" + str + "'");
+            }
+            chunk = chunk * 10 + (str[i] - '0');
+        }
+        mul_add_small(result.digits, scale, chunk);
+    }
+    trim(result.digits);
+    result.negative = negative && !result.digits.empty();
+    return result;
+}
+
+BigInt BigInt::from_double(double d) {
+    if (!std::isfinite(d)) {
+        throw pyerror(std::isnan(d) ?
+            "ValueError: cannot convert float NaN to integer" :
+            "OverflowError: cannot convert float infinity to integer");
+    }
+
+    int exp;
+    const double mantissa = std::frexp(std::fabs(std::trunc(d)), &exp);
+    // the mantissa holds the 53 significant bits
+    BigInt result((int64_t)std::ldexp(mantissa, 53));
+    exp -= 53;
+    result.digits = exp >= 0 ? shift_left_mag(result.digits, exp) : shift_right_mag(result.digits, -exp);
+    result.negative = d < 0 && !result.digits.empty();
+    return result;
+}
+
+Value BigInt::to_value(BigInt&& value) {
+    if (value.fits_int64()) {
+        return value.to_int64();
+    }
+    return alloc().heap_bigint.make(std::move(value));
+}
+
+bool BigInt::fits_int64() const {
+    if (this->digits.size() <= 1) {
+        return true;
+    } else if (this->digits.size() > 2) {
+        return false;
+    }
+    const uint64_t mag = ((uint64_t)this->digits[1] << 32) | this->digits[0];
+    return this->negative ? mag <= (uint64_t)1 << 63 : mag < (uint64_t)1 << 63;
+}
+
+int64_t BigInt::to_int64() const {
+    uint64_t mag = 0;
+    for (size_t i = std::min<size_t>(this->digits.size(), 2); i-- > 0;) {
+        mag = (mag << 32) | this->digits[i];
+    }
+    return this->negative ? (int64_t)-mag : (int64_t)mag;
+}
+
+double BigInt::to_double() const {
+    // the top three digits hold more bits than a double's mantissa
+    double result = 0;
+    const size_t n = this->digits.size();
+    const size_t low = n > 3 ? n - 3 : 0;
+    for (size_t i = n; i-- > low;) {
+        result = result * (double)BASE + this->digits[i];
+    }
+    result = std::ldexp(result, 32 * low);
+    if (std::isinf(result)) {
+        throw pyerror("OverflowError: int too large to convert to float");
+    }
+    return this->negative ? -result : result;
+}
+
+std::string BigInt::to_string() const {
+    if (this->digits.empty()) {
+        return "0";
+    }
+
+    // peel off 9 decimal digits at a time, least significant first
+    std::vector<uint32_t> chunks;
+    Digits mag = this->digits;
+    while (!mag.empty()) {
+        chunks.push_back(divmod_small_in_place(mag, DECIMAL_BASE));
+    }
+
+    std::string result = this->negative ? "-" : "";
+    result += std::to_string(chunks.back());
+    char buf[16];
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        snprintf(buf, sizeof(buf), "%09u", chunks[i]);
+        result += buf;
+    }
+    return result;
+}
+
+int BigInt::compare(const BigInt& a, const BigInt& b) {
+    if (a.negative != b.negative) {
+        return a.negative ? -1 : 1;
+    }
+    const int cmp = compare_mag(a.digits, b.digits);
+    return a.negative ? -cmp : cmp;
+}
+
+BigInt BigInt::add(const BigInt& a, const BigInt& b) {
+    if (a.negative == b.negative) {
+        return make(a.negative, add_mag(a.digits, b.digits));
+    }
+    // the signs differ, subtract the smaller magnitude from the larger one
+    if (compare_mag(a.digits, b.digits) >= 0) {
+        Digits r = a.digits;
+        sub_mag_in_place(r, b.digits);
+        return make(a.negative, std::move(r));
+    }
+    Digits r = b.digits;
+    sub_mag_in_place(r, a.digits);
+    return make(b.negative, std::move(r));
+}
+
+BigInt BigInt::sub(const BigInt& a, const BigInt& b) {
+    BigInt negated = b;
+    negated.negative = !b.negative && !b.digits.empty();
+    return add(a, negated);
+}
+
+BigInt BigInt::mul(const BigInt& a, const BigInt& b) {
+    return make(a.negative != b.negative, mul_mag(a.digits, b.digits));
+}
+
+BigInt BigInt::pow(const BigInt& base, uint64_t exp) {
+    BigInt result(1);
+    BigInt square = base;
+    while (true) {
+        if (exp & 1) {
+            result = mul(result, square);
+        }
+        exp >>= 1;
+        if (exp == 0) break;
+        square = mul(square, square);
+    }
+    return result;
+}
+
+void BigInt::divmod(const BigInt& a, const BigInt& b, BigInt* quotient, BigInt* remainder) {
+    if (b.digits.empty()) {
+        throw pyerror("ZeroDivisionError: integer division or modulo by zero");
+    }
+
+    Digits q, r;
+    divmod_mag(a.digits, b.digits, q, r);
+    if (a.negative != b.negative && !r.empty()) {
+        // round the quotient towards negative infinity, the remainder takes the divisor's sign
+        add_shifted(q, Digits {1}, 0);
+        Digits adjusted = b.digits;
+        sub_mag_in_place(adjusted, r);
+        r = std::move(adjusted);
+    }
+    if (quotient != nullptr) {
+        *quotient = make(a.negative != b.negative, std::move(q));
+    }
+    if (remainder != nullptr) {
+        *remainder = make(b.negative, std::move(r));
+    }
+}
+
+BigInt BigInt::shift_left(const BigInt& a, uint64_t bits) {
+    return make(a.negative, shift_left_mag(a.digits, bits));
+}
+
+BigInt BigInt::shift_right(const BigInt& a, uint64_t bits) {
+    if (!a.negative) {
+        return make(false, shift_right_mag(a.digits, bits));
+    }
+    // shifts round towards negative infinity, -a >> n == -(((a - 1) >> n) + 1)
+    Digits mag = a.digits;
+    sub_mag_in_place(mag, Digits {1});
+    mag = shift_right_mag(mag, bits);
+    add_shifted(mag, Digits {1}, 0);
+    return make(true, std::move(mag));
+}
+
+BigInt BigInt::bit_and(const BigInt& a, const BigInt& b) {
+    return bitwise(a, b, [](uint32_t x, uint32_t y) { return x & y; });
+}
+
+BigInt BigInt::bit_or(const BigInt& a, const BigInt& b) {
+    return bitwise(a, b, [](uint32_t x, uint32_t y) { return x | y; });
+}
+
+BigInt BigInt::bit_xor(const BigInt& a, const BigInt& b) {
+    return bitwise(a, b, [](uint32_t x, uint32_t y) { return x ^ y; });
+}
+
+Value BigInt::add_int64(int64_t a, int64_t b) {
+    return to_value(add(BigInt(a), BigInt(b)));
+}
+
+Value BigInt::sub_int64(int64_t a, int64_t b) {
+    return to_value(sub(BigInt(a), BigInt(b)));
+}
+
+Value BigInt::mul_int64(int64_t a, int64_t b) {
+    return to_value(mul(BigInt(a), BigInt(b)));
+}
+
+Value BigInt::pow_int64(int64_t base, int64_t exp) {
+    return to_value(pow(BigInt(base), exp));
+}
+
+Value BigInt::lshift_int64(int64_t a, int64_t bits) {
+    return to_value(shift_left(BigInt(a), bits));
+}
+
+}
+}
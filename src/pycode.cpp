@@ -3,6 +3,7 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <iomanip>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,6 +15,8 @@
 #include "oplist.hpp"
 #include "pyallocator.hpp"
 #include "pyvalue.hpp"
+#include "pyjit.hpp"
+#include "optflags.hpp"
 
 // #undef DEBUG_ON
 // #define DEBUG_ON
@@ -27,6 +30,34 @@
 
 namespace py {
 
+// Decode a literal from co_consts, tuples hold literals themselves
+static Value load_literal(const json& element) {
+    const auto& real_type = element.at("real_type").get<std::string>();
+    if (real_type == "<class 'str'>") {
+        return value::String::intern(element.at("value").get<std::string>());
+    } else if (real_type == "<class 'int'>") {
+        // ints outside of the int64_t range are written out as decimal strings
+        const json& value = element.at("value");
+        if (value.is_string()) {
+            return value::BigInt::to_value(value::BigInt::from_string(value.get<std::string>()));
+        }
+        return value.get<int64_t>();
+    } else if (real_type == "<class 'float'>") {
+        return element.at("value").get<double>();
+    } else if (real_type == "<class 'NoneType'>") {
+        return value::NoneType();
+    } else if (real_type == "<class 'bool'>") {
+        return element.at("value").get<bool>();
+    } else if (real_type == "<class 'tuple'>") {
+        ValueTuple tuple = alloc().heap_tuple.make();
+        for (const json& item : element.at("value")) {
+            tuple->values.push_back(load_literal(item));
+        }
+        return tuple;
+    }
+    throw pyerror(std::string("unrecognized type of constant: ") + real_type);
+}
+
 Code::Code(const json& tree) {
     DEBUG("loading in source code from json");
 
@@ -67,15 +98,12 @@ Code::Code(const json& tree) {
     */
     {
         DEBUG_ADV("decoding instructions from this->bytecode");
-        size_t lnotab_idx = 0;
         uint64_t pc = 0;
 
-        // we use pc_map to serve a dual purpose
-        // 1) it lets us translate from the bytecode's jump locations to the new
-        //    decoded instruction jump target locations for instructions
-        //    that take a bytecode address as their argument
-        // 2) it lets us validate that jump targets are indeed valid before runtime.
-        pc_map.resize(this->bytecode.size());
+        // pc_map translates from the bytecode's jump locations to the decoded
+        // instructions, offsets that are not the start of an instruction map to
+        // NOT_AN_INSTRUCTION so that bad jump targets are caught before runtime
+        pc_map.assign(this->bytecode.size(), NOT_AN_INSTRUCTION);
 
         while (pc < this->bytecode.size()) {
             ByteCode bytecode = this->bytecode[pc];
@@ -84,14 +112,6 @@ Code::Code(const json& tree) {
             instruction.bytecode = bytecode;
             instruction.bytecode_index = pc;
             pc_map[pc] = instructions.size();
-            
-            // do some book keeping, translate the line number table to the new virtual bytecode format
-            if (pc >= lnotab_orig[lnotab_idx].pc && lnotab_idx < lnotab_orig.size()) {
-                this->lnotab.push_back(
-                    LineNoMapping {this->instructions.size(), lnotab_orig[lnotab_idx].line}
-                );
-                lnotab_idx++;
-            }
 
             // decode the arg if there is an argument, otherwise set it to 0
             if (bytecode >= op::HAVE_ARGUMENT) {
@@ -107,19 +127,24 @@ Code::Code(const json& tree) {
             this->instructions.push_back(instruction);
         }
 
-        // stitch arguments that reference program counter
+        // every jump is stitched to the index of the instruction it lands on,
+        // relative jumps count from the end of the jumping instruction
         for (auto& instr : this->instructions) {
-            switch (instr.bytecode) {
-                case op::POP_JUMP_IF_FALSE:
-                case op::JUMP_ABSOLUTE:
-                {
-                    if (instr.arg >= pc_map.size() || pc_map[instr.arg] == 0) {
-                        throw pyerror("invalid jump target, is not the beginning of an instruction.");
-                    }
-                    instr.arg = pc_map[instr.arg];
-                    break;
-                }
-                default: continue;
+            if (!is_jump(instr.bytecode)) continue;
+            uint64_t target = instr.arg;
+            if (is_relative_jump(instr.bytecode)) {
+                target += instr.bytecode_index + 3;
+            }
+            if (target >= pc_map.size() || pc_map[target] == NOT_AN_INSTRUCTION) {
+                throw pyerror("invalid jump target, is not the beginning of an instruction.");
+            }
+            instr.arg = pc_map[target];
+        }
+
+        // translate the line number table to instruction indices
+        for (const LineNoMapping& mapping : lnotab_orig) {
+            if (mapping.pc < pc_map.size() && pc_map[mapping.pc] != NOT_AN_INSTRUCTION) {
+                this->lnotab.push_back(LineNoMapping {mapping.line, pc_map[mapping.pc]});
             }
         }
     }
@@ -131,37 +156,10 @@ Code::Code(const json& tree) {
     for (const json& element : co_consts) {
         const auto& type = element.at("type").get<std::string>();
         if (type == "literal") {
-            const auto& real_type = element.at("real_type").get<std::string>();
-            if (real_type == "<class 'str'>") {
-                DEBUG("constant at index %lu is string", this->co_consts.size());
-                this->co_consts.push_back(
-                    alloc.heap_string.make(element.at("value").get<std::string>())
-                );
-            } else if (real_type == "<class 'int'>") {
-                DEBUG("constant at index %lu is int", this->co_consts.size());
-                this->co_consts.push_back(
-                    element.at("value").get<int64_t>()
-                );
-            } else if (real_type == "<class 'float'>") {
-                DEBUG("constant at index %lu is float", this->co_consts.size());
-                this->co_consts.push_back(
-                    element.at("value").get<double>()
-                );
-            } else if (real_type == "<class 'NoneType'>") {
-                DEBUG("constant at index %lu is nonetype", this->co_consts.size());
-                this->co_consts.push_back(
-                    value::NoneType()
-                );
-            } else if (real_type == "<class 'bool'>") {
-                DEBUG("constant at index %lu is bool", this->co_consts.size());
-                this->co_consts.push_back(
-                    element.at("value").get<bool>()
-                );
-            } else {
-                throw pyerror(std::string("unrecognized type of constant: ") + real_type);
-            }
+            DEBUG("loading constant at index %lu", this->co_consts.size());
+            this->co_consts.push_back(load_literal(element));
         } else if (type == "code") {
-            gc_ptr<Code> code = alloc.heap_code.make(Code(element));
+            gc_ptr<Code> code = alloc().heap_code.make(element);
             this->co_consts.push_back(code);
         } else {
             throw pyerror(std::string("unrecognized type of constant: ") + type);
@@ -200,37 +198,211 @@ Code::Code(const json& tree) {
         );
     }
 
-    // build the co_cellmap
-    {
-        size_t index = 0;
-        for (std::string& cellvarname : this->co_cellvars) {
-            DEBUG_ADV("Code " << this->co_name << " has a cell named " << cellvarname);
-            this->co_cellmap[cellvarname] = index++;
+    // build the co_cell2arg table, cells for arguments are filled in with the argument's value
+    for (const std::string& cellvarname : this->co_cellvars) {
+        DEBUG_ADV("Code has a cell named " << cellvarname);
+        int64_t arg_index = -1;
+        for (size_t i = 0; i < this->co_argcount && i < this->co_varnames.size(); ++i) {
+            if (this->co_varnames[i] == cellvarname) {
+                arg_index = i;
+                break;
+            }
         }
-    }
-
-    // load lnotab 
-    for (const json& linenumber : tree.at("lnotab")) {
-        DEBUG("loaded line number %d", linenumber.at(0).get<uint64_t>());
-        this->lnotab.push_back(
-            LineNoMapping {linenumber.at(0).get<uint64_t>(), linenumber.at(1).get<uint64_t>()}
-        );
+        this->co_cell2arg.push_back(arg_index);
     }
 
     // load co_name
     this->co_name = tree.at("co_name").get<std::string>();
 
+#ifdef OPTIMIZE_BYTECODE_ON
+    this->optimize();
+#endif
+
+#ifdef LOAD_METHOD_ON
+    this->rewrite_method_calls();
+#endif
+
+#ifdef DUMP_BYTECODE
+    this->dump(std::cerr);
+#endif
+
     // set flags by scanning the instructions
     for (const Instruction& instr : this->instructions) {
         if (instr.bytecode == op::YIELD_FROM || instr.bytecode == op::YIELD_VALUE) {
             this->set_flag(FLAG_IS_GENERATOR_FUNCTION);
         }
     }
+
+#ifdef TRACING_JIT_ON
+    this->loops = std::make_unique<jit::Loops>(this->instructions.size());
+#endif
 }   
 
 Code::~Code() {
 }
 
+bool Code::is_jump(ByteCode bytecode) {
+    switch (bytecode) {
+        case op::JUMP_ABSOLUTE:
+        case op::POP_JUMP_IF_FALSE:
+        case op::POP_JUMP_IF_TRUE:
+        case op::JUMP_IF_FALSE_OR_POP:
+        case op::JUMP_IF_TRUE_OR_POP:
+        case op::CONTINUE_LOOP:
+            return true;
+        default:
+            return is_relative_jump(bytecode);
+    }
+}
+
+bool Code::is_relative_jump(ByteCode bytecode) {
+    switch (bytecode) {
+        case op::JUMP_FORWARD:
+        case op::FOR_ITER:
+        case op::SETUP_LOOP:
+        case op::SETUP_EXCEPT:
+        case op::SETUP_FINALLY:
+        case op::SETUP_WITH:
+        case op::SETUP_ASYNC_WITH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void Code::dump(std::ostream& stream) const {
+    stream << "code " << this->co_name << ":" << std::endl;
+    size_t line = 0;
+    for (size_t i = 0; i < this->instructions.size(); ++i) {
+        const Instruction& instr = this->instructions[i];
+        while (line < this->lnotab.size() && this->lnotab[line].pc <= i) {
+            stream << "  line " << this->lnotab[line++].line << std::endl;
+        }
+        stream << "    " << std::setw(4) << i << " " << op::name[instr.bytecode];
+        if (is_jump(instr.bytecode)) {
+            stream << " -> " << instr.arg;
+        } else if (instr.bytecode == op::LOAD_CONST) {
+            const Value& value = this->co_consts[instr.arg];
+            if (auto code = std::get_if<ValueCode>(&value)) {
+                stream << " <code " << (*code)->co_name << ">";
+            } else {
+                stream << " " << value;
+            }
+        } else if (instr.bytecode >= op::HAVE_ARGUMENT) {
+            stream << " " << instr.arg;
+        }
+        stream << std::endl;
+    }
+}
+
+// How many values an instruction that may sit between a LOAD_ATTR and the
+// CALL_FUNCTION consuming it pops, and how many it pushes back. Instructions that
+// only reorder or look at the top of the stack pop and push those values again.
+// Returns false for anything that branches or is not understood, which stops the
+// search for the call.
+static bool simple_stack_effect(const Code::Instruction& instr, int64_t& pops, int64_t& pushes) {
+    pops = 0;
+    pushes = 1;
+    switch (instr.bytecode) {
+        case op::LOAD_CONST:
+        case op::LOAD_NAME:
+        case op::LOAD_GLOBAL:
+        case op::LOAD_FAST:
+        case op::LOAD_DEREF:
+        case op::LOAD_CLASSDEREF:
+        case op::LOAD_CLOSURE:
+            return true;
+        case op::DUP_TOP:
+        case op::LOAD_METHOD:
+            pops = 1;
+            pushes = 2;
+            return true;
+        case op::ROT_TWO:
+            pops = pushes = 2;
+            return true;
+        case op::ROT_THREE:
+            pops = pushes = 3;
+            return true;
+        case op::LOAD_ATTR:
+        case op::UNARY_POSITIVE:
+        case op::UNARY_NEGATIVE:
+        case op::UNARY_NOT:
+        case op::UNARY_INVERT:
+        case op::GET_ITER:
+            pops = 1;
+            return true;
+        case op::BINARY_POWER:
+        case op::BINARY_MULTIPLY:
+        case op::BINARY_MODULO:
+        case op::BINARY_ADD:
+        case op::BINARY_SUBTRACT:
+        case op::BINARY_SUBSCR:
+        case op::BINARY_FLOOR_DIVIDE:
+        case op::BINARY_TRUE_DIVIDE:
+        case op::BINARY_LSHIFT:
+        case op::BINARY_RSHIFT:
+        case op::BINARY_AND:
+        case op::BINARY_XOR:
+        case op::BINARY_OR:
+        case op::COMPARE_OP:
+            pops = 2;
+            return true;
+        case op::BUILD_TUPLE:
+        case op::BUILD_LIST:
+        case op::BUILD_SET:
+        case op::BUILD_SLICE:
+            pops = (int64_t)instr.arg;
+            return true;
+        case op::BUILD_MAP:
+            pops = 2 * (int64_t)instr.arg;
+            return true;
+        case op::MAKE_FUNCTION:
+            // pops the code and the name, plus the positional defaults
+            if (instr.arg > 0xff) return false;
+            pops = 2 + (int64_t)instr.arg;
+            return true;
+        case op::MAKE_CLOSURE:
+            if (instr.arg > 0xff) return false;
+            pops = 3 + (int64_t)instr.arg;
+            return true;
+        case op::CALL_FUNCTION:
+            pops = 1 + (int64_t)(instr.arg & 0xff) + 2 * (int64_t)((instr.arg >> 8) & 0xff);
+            return true;
+        case op::CALL_METHOD:
+            pops = 2 + (int64_t)instr.arg;
+            return true;
+        default:
+            return false;
+    }
+}
+
+void Code::rewrite_method_calls() {
+    for (size_t i = 0; i < this->instructions.size(); ++i) {
+        if (this->instructions[i].bytecode != op::LOAD_ATTR) continue;
+
+        // depth counts the values pushed on top of the loaded attribute, the call
+        // that consumes the attribute is the one whose arguments are exactly those.
+        // An instruction popping more than that uses the attribute itself, as in
+        // a.b.c() or a.f[0](), and the attribute is then not the one called
+        int64_t depth = 0;
+        for (size_t j = i + 1; j < this->instructions.size(); ++j) {
+            Instruction& instr = this->instructions[j];
+            if (instr.bytecode == op::CALL_FUNCTION && (int64_t)instr.arg == depth) {
+                DEBUG_ADV("rewrote method call " << this->co_names[this->instructions[i].arg]
+                    << " at " << i << " called at " << j);
+                this->instructions[i].bytecode = op::LOAD_METHOD;
+                instr.bytecode = op::CALL_METHOD;
+                break;
+            }
+
+            int64_t pops;
+            int64_t pushes;
+            if (!simple_stack_effect(instr, pops, pushes) || pops > depth) break;
+            depth += pushes - pops;
+        }
+    }
+}
+
 gc_ptr<Code> Code::from_program(const std::string& python, const std::string& compilePyPath) {
     procxx::process compilePyProc{"python3", compilePyPath.c_str()};
     
@@ -257,7 +429,7 @@ gc_ptr<Code> Code::from_program(const std::string& python, const std::string& co
         throw err;
     }
     DEBUG("read successful.");
-    return alloc.heap_code.make(tree);
+    return alloc().heap_code.make(tree);
 }
 
 }
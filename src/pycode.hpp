@@ -5,6 +5,7 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <ostream>
 
 #include "pyvalue.hpp"
 #include "../lib/json_fwd.hpp"
@@ -13,10 +14,15 @@ using json = nlohmann::json;
 
 namespace py {
 
+namespace jit {
+    struct Loops;
+}
+
 struct Code {
     using ByteCode = uint8_t;
 
     static constexpr const uint8_t FLAG_IS_GENERATOR_FUNCTION = 1; // contains the opcode op::YIELD_VALUE;
+    static constexpr const uint64_t NOT_AN_INSTRUCTION = UINT64_MAX; // pc_map entry for offsets inside an instruction
 
     uint8_t flags = 0;
     std::string co_name;
@@ -30,7 +36,7 @@ struct Code {
     std::vector<std::string> co_varnames;
     std::vector<std::string> co_cellvars;
     std::vector<std::string> co_freevars;
-    std::unordered_map<std::string, size_t> co_cellmap;
+    std::vector<int64_t> co_cell2arg; // the argument each cell var starts out as, or -1
 
     struct LineNoMapping {
         uint64_t line;
@@ -43,11 +49,28 @@ struct Code {
         uint64_t arg;
     };
 
-    std::vector<LineNoMapping> lnotab; // lookup the line number that the error happened on
+    std::vector<LineNoMapping> lnotab; // the line that starts at each instruction index, to report errors
     std::vector<Instruction> instructions; // we decode instructions at this step to make later analysis easier
+    std::unique_ptr<jit::Loops> loops; // how hot each loop is and its trace, with TRACING_JIT_ON
     
     Code(const json& tree);
     ~Code();
+
+    // whether the instruction's arg is a jump target, these are all stitched to
+    // the index of the instruction they land on when the code is decoded
+    static bool is_jump(ByteCode bytecode);
+    // whether the bytecode counts the target from the end of the instruction
+    static bool is_relative_jump(ByteCode bytecode);
+
+    // Folds constant expressions and branches, threads jumps to jumps and drops
+    // NOPs and unreachable instructions. Defined in pyoptimizer.cpp
+    void optimize();
+
+    // prints the decoded instructions, for DUMP_BYTECODE
+    void dump(std::ostream& stream) const;
+
+    // Turns LOAD_ATTR ... CALL_FUNCTION pairs into LOAD_METHOD ... CALL_METHOD
+    void rewrite_method_calls();
     
     static gc_ptr<Code> from_program(const std::string& python, const std::string& compilePyPath);
 
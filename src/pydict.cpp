@@ -0,0 +1,254 @@
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pyvalue.hpp"
+#include "pyvalue_helpers.hpp"
+
+namespace py {
+namespace value {
+
+/*
+    The index is a SwissTable style open addressing table. Every slot has a
+    control byte, and a lookup compares the 7 bit tag of the hash against 16
+    control bytes at once, so a probe rarely has to touch an entry whose key
+    does not match. Groups are visited in triangular order, which reaches every
+    group of a power of two sized table.
+
+    Slots are never reused after an erase (like CPython's dummy entries), the
+    index is rebuilt from the cached hashes once the tombstones use up the
+    space that is left, which also compacts the entries.
+*/
+
+namespace {
+
+constexpr int8_t CTRL_EMPTY = -128;
+constexpr int8_t CTRL_DELETED = -2;
+
+inline size_t hash_slot(size_t hash) {
+    return hash >> 7;
+}
+
+inline int8_t hash_tag(size_t hash) {
+    return hash & 0x7f;
+}
+
+// 16 control bytes, the bits of the masks returned correspond to the bytes
+struct Group {
+#ifdef __SSE2__
+    __m128i ctrl;
+
+    explicit Group(const int8_t* pos)
+        : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos))) {}
+
+    inline uint32_t match(int8_t tag) const {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), ctrl));
+    }
+#else
+    const int8_t* ctrl;
+
+    explicit Group(const int8_t* pos) : ctrl(pos) {}
+
+    inline uint32_t match(int8_t tag) const {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < Dict::GROUP_WIDTH; ++i) {
+            mask |= (uint32_t)(ctrl[i] == tag) << i;
+        }
+        return mask;
+    }
+#endif
+
+    inline uint32_t match_empty() const {
+        return match(CTRL_EMPTY);
+    }
+};
+
+// the smallest capacity that holds n entries at a load factor of at most 7/8
+inline size_t capacity_for(size_t n) {
+    size_t capacity = Dict::GROUP_WIDTH;
+    while (capacity - capacity / 8 < n) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+}
+
+inline void Dict::set_ctrl(size_t slot, int8_t value) {
+    this->ctrl[slot] = value;
+    // keep the copy of the first group that follows the table in sync
+    if (slot < GROUP_WIDTH) {
+        this->ctrl[this->capacity() + slot] = value;
+    }
+}
+
+template<typename Eq>
+inline size_t Dict::find_slot(size_t hash, Eq&& eq) const {
+    if (this->live == 0) {
+        return SIZE_MAX;
+    }
+
+    const size_t mask = this->capacity() - 1;
+    const int8_t tag = hash_tag(hash);
+    size_t pos = hash_slot(hash) & mask;
+    size_t step = 0;
+    while (true) {
+        Group group(&this->ctrl[pos]);
+        for (uint32_t bits = group.match(tag); bits != 0; bits &= bits - 1) {
+            const size_t slot = (pos + __builtin_ctz(bits)) & mask;
+            const Entry& entry = this->entries[this->slots[slot]];
+            if (entry.hash == hash && eq(entry.key)) {
+                return slot;
+            }
+        }
+        if (group.match_empty()) {
+            return SIZE_MAX;
+        }
+        step += GROUP_WIDTH;
+        pos = (pos + step) & mask;
+    }
+}
+
+size_t Dict::find_slot(const Value& key, size_t hash) const {
+    // ints and strings are by far the most common keys, compare them without a visit
+    if (auto i = std::get_if<int64_t>(&key)) {
+        const int64_t k = *i;
+        return find_slot(hash, [&](const Value& other) {
+            auto o = std::get_if<int64_t>(&other);
+            return o != nullptr ? *o == k : value_helper::values_equal(other, key);
+        });
+    } else if (auto s = std::get_if<ValueString>(&key)) {
+        const ValueString& k = *s;
+        return find_slot(hash, [&](const Value& other) {
+            auto o = std::get_if<ValueString>(&other);
+            return o != nullptr && (*o == k || **o == *k);
+        });
+    }
+    return find_slot(hash, [&](const Value& other) {
+        return value_helper::values_equal(other, key);
+    });
+}
+
+Value* Dict::find(const Value& key) {
+    const size_t slot = this->find_slot(key, value_helper::hash_value(key));
+    if (slot == SIZE_MAX) {
+        return nullptr;
+    }
+    return &this->entries[this->slots[slot]].value;
+}
+
+const Value* Dict::find(const Value& key) const {
+    const size_t slot = this->find_slot(key, value_helper::hash_value(key));
+    if (slot == SIZE_MAX) {
+        return nullptr;
+    }
+    return &this->entries[this->slots[slot]].value;
+}
+
+void Dict::set(const Value& key, Value value) {
+    write_barrier(key);
+    write_barrier(value);
+    const size_t hash = value_helper::hash_value(key);
+    const size_t slot = this->find_slot(key, hash);
+    if (slot != SIZE_MAX) {
+        this->entries[this->slots[slot]].value = std::move(value);
+    } else {
+        this->insert_new(hash, key, std::move(value));
+    }
+}
+
+bool Dict::erase(const Value& key, Value* removed) {
+    const size_t slot = this->find_slot(key, value_helper::hash_value(key));
+    if (slot == SIZE_MAX) {
+        return false;
+    }
+
+    Entry& entry = this->entries[this->slots[slot]];
+    if (removed != nullptr) {
+        *removed = std::move(entry.value);
+    }
+    // drop the references so the collector can free them
+    entry.hash = 0;
+    entry.key = value::NoneType();
+    entry.value = value::NoneType();
+    this->set_ctrl(slot, CTRL_DELETED);
+    this->live--;
+
+    if (this->live == 0) {
+        this->clear();
+    }
+    return true;
+}
+
+void Dict::clear() {
+    this->entries.clear();
+    this->ctrl.clear();
+    this->slots.clear();
+    this->live = 0;
+    this->growth_left = 0;
+}
+
+void Dict::reserve(size_t n) {
+    if (n > this->live + this->growth_left) {
+        this->rebuild(capacity_for(n));
+    }
+}
+
+void Dict::insert_new(size_t hash, const Value& key, Value value) {
+    if (this->growth_left == 0) {
+        this->rebuild(capacity_for(this->live * 2 + 1));
+    }
+
+    const size_t mask = this->capacity() - 1;
+    size_t pos = hash_slot(hash) & mask;
+    size_t step = 0;
+    while (true) {
+        const uint32_t empty = Group(&this->ctrl[pos]).match_empty();
+        if (empty != 0) {
+            const size_t slot = (pos + __builtin_ctz(empty)) & mask;
+            this->set_ctrl(slot, hash_tag(hash));
+            this->slots[slot] = this->entries.size();
+            break;
+        }
+        step += GROUP_WIDTH;
+        pos = (pos + step) & mask;
+    }
+
+    this->entries.push_back(Entry {hash, key, std::move(value)});
+    this->live++;
+    this->growth_left--;
+}
+
+void Dict::rebuild(size_t new_capacity) {
+    if (this->live != this->entries.size()) {
+        this->entries.erase(
+            std::remove_if(this->entries.begin(), this->entries.end(),
+                [](const Entry& entry) { return entry.hash == 0; }),
+            this->entries.end());
+    }
+
+    this->ctrl.assign(new_capacity + GROUP_WIDTH, CTRL_EMPTY);
+    this->slots.resize(new_capacity);
+    this->growth_left = new_capacity - new_capacity / 8 - this->live;
+
+    // the hashes are cached, so no key is looked at here
+    const size_t mask = new_capacity - 1;
+    for (size_t i = 0; i < this->entries.size(); ++i) {
+        const size_t hash = this->entries[i].hash;
+        size_t pos = hash_slot(hash) & mask;
+        size_t step = 0;
+        uint32_t empty;
+        while ((empty = Group(&this->ctrl[pos]).match_empty()) == 0) {
+            step += GROUP_WIDTH;
+            pos = (pos + step) & mask;
+        }
+        const size_t slot = (pos + __builtin_ctz(empty)) & mask;
+        this->set_ctrl(slot, hash_tag(hash));
+        this->slots[slot] = i;
+    }
+}
+
+}
+}
@@ -7,4 +7,12 @@ struct pyerror : public std::runtime_error {
     pyerror(const std::string& message) : std::runtime_error(message) {};
 };
 
+// Raised when an interpreter outgrows its heap limit. Unlike the other errors
+// a script can catch it with except MemoryError
+struct pymemoryerror : public pyerror {
+    std::string detail;
+
+    pymemoryerror(const std::string& detail) : pyerror("MemoryError: " + detail), detail(detail) {};
+};
+
 #endif
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include "../lib/oplist.hpp"
 #include "../lib/debug.hpp"
 #include "pyophelpers.hpp"
+#include "pyoutput.hpp"
+#include "pyjit.hpp"
 #include "optflags.hpp"
 
 #ifdef PROFILING_ON
@@ -58,10 +60,35 @@
     #define CASE(arg) case op::arg:
 #endif
 
+#ifdef TRACING_JIT_ON
+    // a jump back to a loop header counts towards tracing the loop, and once
+    // the loop is traced runs the trace from there
+    #define JUMP_TO(target) \
+        if ((target) < this->r_pc) { \
+            this->r_pc = (target); \
+            loop_backedge(*this); \
+        } else { \
+            this->r_pc = (target); \
+        }
+#else
+    #define JUMP_TO(target) this->r_pc = (target);
+#endif
+
+// every jump and return is a safepoint, where the interpreter stops once the
+// allocator's countdown has run out
+#define SAFEPOINT() \
+    if (alloc().at_safepoint()) { \
+        alloc().safepoint(*(this->interpreter_state)); \
+    }
+
 using std::string;
 
 namespace py {
 
+#ifdef TRACING_JIT_ON
+static void loop_backedge(FrameState& frame);
+#endif
+
 #ifdef PROFILING_ON
 
     #ifdef TYPE_INFORMATION_PROFILING
@@ -96,7 +123,7 @@ void FrameState::recycle(const ValueCode code) {
     #endif
 
     // this->ns_local = std::make_shared<std::unordered_map<std::string, Value>>();
-    this->ns_local = alloc.heap_namespace.make();
+    this->ns_local = alloc().heap_namespace.make();
     this->code = code;
     DEBUG("reserved %lu bytes for the stack", code->co_stacksize);
     this->value_stack.reserve(code->co_stacksize);
@@ -146,6 +173,17 @@ std::tuple<Value,bool> value::PyClass::find_attr_in_parents(
     return std::tuple<Value,bool>(value::NoneType(),false);
 }
 
+std::tuple<Value,bool> value::PyClass::find_attr_in_class(
+                                    ValuePyClass& cls,
+                                    const std::string& attr
+) {
+    auto itr = cls->attrs->find(attr);
+    if(itr != cls->attrs->end()){
+        return std::tuple<Value,bool>(itr->second,true);
+    }
+    return value::PyClass::find_attr_in_parents(cls,attr);
+}
+
 std::tuple<Value,bool> value::PyObject::find_attr_in_obj(
     ValuePyObject& obj,
     const std::string& attr
@@ -170,20 +208,19 @@ std::tuple<Value,bool> value::PyObject::find_attr_in_obj(
         }
         
         // Check to see if it is a PyFunc, and if so make it's self to obj
-        // This essentially accomplishes lazy initialization of instance functions
+        // The bound method is not stored back into attrs, that would make every
+        // object carry a copy of each method it ever used. Calls written as
+        // obj.method(...) never get here, they go through LOAD_METHOD instead
         auto pf = std::get_if<ValuePyFunction>(&static_val);
         if(pf != NULL){
             // Push a new PyFunc with self set to obj or obj's class
-            // Store it so that next time it is accessed it will be found in attrs
-            //if(((*pf)->flags & value::CLASS_METHOD)
-            //|| ((*pf)->flags & value::STATIC_METHOD) ){
             if((*pf)->flags & (value::CLASS_METHOD | value::STATIC_METHOD)){
                 // All good, just return
                 return std::tuple<Value,bool>((*pf),true);
             } else {
                 DEBUG("Instantiating instance method");
                 // Create an instance method
-                Value npf = alloc.heap_pyfunc.make(
+                Value npf = alloc().heap_pyfunc.make(
                     value::PyFunc {
                         (*pf)->name,
                         (*pf)->code,
@@ -192,7 +229,6 @@ std::tuple<Value,bool> value::PyObject::find_attr_in_obj(
                         value::INSTANCE_METHOD
                     }
                 );
-                obj->store_attr(attr, npf); // Does this create a shared_ptr cycle // no it does not. we use gc ptr now :)
                 return std::tuple<Value,bool>(npf,true);
             }
         } else {
@@ -224,7 +260,7 @@ struct for_iter_visitor {
             frame.r_pc++;
         } else {
             DEBUG_ADV("\tITERATOR EXHAUSTED, JUMPING TO END OF LOOP");
-            frame.r_pc = frame.code->pc_map[frame.code->instructions[frame.r_pc].bytecode_index + arg] + 1;
+            frame.r_pc = arg;
         }
     }
 
@@ -238,7 +274,7 @@ struct for_iter_visitor {
         } else {
             DEBUG_ADV("\tno more values from iterator");
             frame.value_stack.pop_back();
-            frame.r_pc = frame.code->pc_map[frame.code->instructions[frame.r_pc].bytecode_index + arg] + 1;
+            frame.r_pc = arg;
         }
     }
 
@@ -251,34 +287,56 @@ struct for_iter_visitor {
 struct get_iter_visitor {
     FrameState& frame;
 
+    // lists and tuples are walked by index, so appending while iterating works like in python
+    template<typename Seq>
+    struct sequence_iterator : public value::CGenerator {
+        Seq theList;
+        size_t i = 0;
+
+        sequence_iterator(Seq theList) {
+            this->theList = theList;
+            this->i = 0;
+            theList.retain();
+        }
+
+        virtual ~sequence_iterator() {
+            // hopefully we corretly free the list here,
+            theList.release();
+        }
+
+        virtual std::optional<Value> next() {
+            if (i >= theList->size()) {
+                return std::nullopt;
+            } else {
+                return item(theList, i++);
+            }
+        }
+
+        static inline Value item(const ValueList& list, size_t i) {
+            return list->get(i);
+        }
+
+        static inline const Value& item(const ValueTuple& tuple, size_t i) {
+            return (*tuple)[i];
+        }
+    };
+
     inline void operator()(ValueList list) {
         DEBUG_ADV("building an iterator for the list");
-        struct list_iterator : public value::CGenerator {
-            ValueList theList;
-            size_t i = 0;
+        frame.value_stack.back() = std::make_shared<sequence_iterator<ValueList>>(list);
+    }
 
-            list_iterator(ValueList theList) {
-                this->theList = theList;
-                this->i = 0;
-                theList.retain();
-            }
+    inline void operator()(ValueTuple tuple) {
+        frame.value_stack.back() = std::make_shared<sequence_iterator<ValueTuple>>(tuple);
+    }
 
-            virtual ~list_iterator() {
-                // hopefully we corretly free the list here,
-                theList.release();
-            }
+    inline void operator()(ValueDict& dict) {
+        // iterating a dict walks its keys
+        frame.value_stack.back() = builtins::builtins_dict_iterator(dict, builtins::DictIter::KEYS);
+    }
 
-            virtual std::optional<Value> next() {
-                if (i >= theList->size()) {
-                    return std::nullopt;
-                } else {
-                    return theList->values[i++];
-                }
-            }
-        };
-        
-        Value retval = std::make_shared<list_iterator>(list);
-        frame.value_stack.push_back(retval);
+    inline void operator()(ValueSet& set) {
+        frame.value_stack.back() = builtins::builtins_set_iterator(set);
     }
 
     inline void operator()(auto top) {
@@ -286,13 +344,69 @@ struct get_iter_visitor {
     }
 };
 
+void FrameState::initialize_cells(const ValuePyFunction& func) {
+    const size_t ncells = this->code->co_cellvars.size();
+    const size_t nfree = this->code->co_freevars.size();
+    this->cells.resize(ncells + nfree);
+
+    for (size_t i = 0; i < ncells; ++i) {
+        this->cells[i] = alloc().heap_cell.make();
+    }
+
+    if (nfree > 0) {
+        if (func->__closure__ == nullptr || func->__closure__->values.size() != nfree) {
+            throw pyerror(std::string("closure of ") + *(func->name) + " does not match its free variables");
+        }
+        try {
+            for (size_t i = 0; i < nfree; ++i) {
+                this->cells[ncells + i] = std::get<ValueCell>(func->__closure__->values[i]);
+            }
+        } catch (std::bad_variant_access&) {
+            throw pyerror(std::string("closure of ") + *(func->name) + " must only contain cells");
+        }
+    }
+}
+
+void FrameState::call_function_kw(uint64_t arg) {
+    // the low byte counts the positional arguments, the next one the
+    // keyword arguments, which are pushed as (name, value) pairs after them
+    const size_t npos = arg & 0xff;
+    const size_t nkw = (arg >> 8) & 0xff;
+    this->check_stack_size(1 + npos + 2 * nkw);
+
+    ArgList args(
+        this->value_stack.end() - (npos + 2 * nkw),
+        this->value_stack.end() - 2 * nkw);
+    for (auto itr = this->value_stack.end() - 2 * nkw; itr != this->value_stack.end(); itr += 2) {
+        args.kwnames.push_back(std::get<ValueString>(*itr));
+        args.append_arg(*(itr + 1));
+    }
+    this->value_stack.resize(this->value_stack.size() - (npos + 2 * nkw));
+    Value func = std::move(this->value_stack.back());
+    this->value_stack.pop_back();
+
+    if (!std::holds_alternative<ValueCFunction>(func) && !std::holds_alternative<ValueCMethod>(func)) {
+        throw pyerror("TypeError: keyword arguments are only supported when calling builtins");
+    }
+    std::visit(value_helper::call_visitor(*this, args), func);
+}
+
 void FrameState::initialize_from_pyfunc(ValuePyFunction func, ArgList& args){
+    bool has_implicit_arg = func->flags & (value::CLASS_METHOD | value::INSTANCE_METHOD);
+    if (has_implicit_arg) {
+        DEBUG_ADV("calling a class method! binding func->self as thisArg");
+        args.bind(func->self);
+    }
+    this->initialize_from_pyfunc(func, args._args.data() + args.offset, args.size());
+}
+
+void FrameState::initialize_from_pyfunc(const ValuePyFunction& func, const Value* args, size_t count) {
     // Set current function
     curr_func = func;
     DEBUG_ADV("Setting up stackframe from " << Value(func));
     DEBUG_ADV("Arguments passed to function: ");
     #ifdef DEBUG 
-    for (size_t i = 0; i < args.size(); ++i) {
+    for (size_t i = 0; i < count; ++i) {
         DEBUG_ADV("\t" << i << ") " << args[i]);
     }
     #endif
@@ -304,18 +418,8 @@ void FrameState::initialize_from_pyfunc(ValuePyFunction func, ArgList& args){
         argcount++;
     }
 
-    // compute the index of the first argument that should be treated as a
-    // default argument parameter
-
-    bool has_implicit_arg = func->flags & (value::CLASS_METHOD | value::INSTANCE_METHOD);
-    if (has_implicit_arg) {
-        DEBUG_ADV("calling a class method! binding func->self as thisArg");
-        args.bind(func->self);
-    }
-
-
-    if (args.size() < this->code->co_argcount - func->def_args->size()) {
-        int missing_num = (this->code->co_argcount - func->def_args->size()) - args.size();
+    if (count < this->code->co_argcount - func->def_args->size()) {
+        int missing_num = (this->code->co_argcount - func->def_args->size()) - count;
         DEBUG_ADV("Found that we are missing " << missing_num << " arguments, preparing and then throwing error.");
         std::stringstream ss;
         ss << "TypeError: " << Value(func) << " missing " << (missing_num) << " required positional arguments:";
@@ -324,7 +428,6 @@ void FrameState::initialize_from_pyfunc(ValuePyFunction func, ArgList& args){
     }
 
     DEBUG_ADV("Useful values to keep in mind:" 
-        << "\n\thas_implicit_arg: " << has_implicit_arg 
         << "\n\targcount: " << argcount
         << "\n\tco_argcount: " << this->code->co_argcount
         << "\n\tdef_args->size(): " << func->def_args->size()
@@ -332,32 +435,23 @@ void FrameState::initialize_from_pyfunc(ValuePyFunction func, ArgList& args){
 
     
 
-    bool have_cells = this->code->co_cellvars.size() > 0;
-    this->cells.resize(this->code->co_cellvars.size());
-
-    DEBUG_ADV("Determined we have " << this->code->co_cellvars.size());
+    this->initialize_cells(func);
 
     DEBUG_ADV("Assigning arguments that do not have default values");
-    for (size_t i = 0; i < args.size(); ++i) {
+    for (size_t i = 0; i < count; ++i) {
         const std::string& varname = this->code->co_varnames[i];
         const Value v = args[i];
 
         DEBUG_ADV("\t" << i << ") assigning '" << varname << "' = '" << v << "'");
 
-        if (have_cells && (this->code->co_cellmap.find(varname) != this->code->co_cellmap.end())) {
-            ValuePyObject new_cell = value_helper::create_cell(v);
-            this->ns_local->emplace(varname, new_cell);
-            this->cells[i] = new_cell;
-        } else {
-            this->ns_local->emplace(varname, v);
-        }
+        this->ns_local->emplace(varname, v);
     }
 
     DEBUG_ADV("Assigning arguments that DO have default values");
     DEBUG_ADV("first we will dump default arguments:");
     #ifdef DEBUG
-    for (const auto& defarg : *(func->def_args)) {
-        DEBUG_ADV("\t" << defarg);
+    for (size_t i = 0; i < func->def_args->size(); ++i) {
+        DEBUG_ADV("\t" << func->def_args->get(i));
     }
     #endif
 
@@ -366,22 +460,24 @@ void FrameState::initialize_from_pyfunc(ValuePyFunction func, ArgList& args){
         // this is pretty terrible
         size_t first_def_arg = func->code->co_argcount - func->def_args->size();
 
-        for (size_t i = args.size(); i < this->code->co_argcount; ++i) {
+        for (size_t i = count; i < this->code->co_argcount; ++i) {
             const std::string& varname = this->code->co_varnames[i];
             int offset = i - first_def_arg;
             DEBUG_ADV("calculated offset: " << offset);
-            Value default_value = (*(func->def_args))[offset];
+            Value default_value = func->def_args->get(offset);
 
             DEBUG_ADV("\t" << i << ") assigning '" << varname << "' = '" << default_value << "'");
 
-            if (have_cells && this->code->co_cellmap.find(varname) != this->code->co_cellmap.end()) {
-                ValuePyObject new_cell = value_helper::create_cell(default_value);
-                this->ns_local->emplace(varname, new_cell);
+            this->ns_local->emplace(varname, default_value);
+        }
+    }
 
-                this->cells[i] = new_cell;
-            } else {
-                this->ns_local->emplace(varname, default_value);
-            }
+    // arguments that are captured by a closure live in their cell
+    for (size_t i = 0; i < this->code->co_cell2arg.size(); ++i) {
+        int64_t arg_index = this->code->co_cell2arg[i];
+        if (arg_index >= 0) {
+            this->cells[i]->contents = this->ns_local->at(this->code->co_varnames[arg_index]);
+            this->cells[i]->bound = true;
         }
     }
     
@@ -389,7 +485,7 @@ void FrameState::initialize_from_pyfunc(ValuePyFunction func, ArgList& args){
     // for(size_t i = 0; i < this->code->co_argcount; i++){
     //     //Error if not given enough arguments
     //     //TypeError: simplefunc() missing 2 required positional arguments: 'a' and 'd'
-    //     if(i < first_def_arg && arg_num >= args.size()){
+    //     if(i < first_def_arg && arg_num >= count){
             
     //         return;
     //     }
@@ -397,7 +493,7 @@ void FrameState::initialize_from_pyfunc(ValuePyFunction func, ArgList& args){
     //     J_DEBUG("Name: %s\n",this->code->co_varnames[i].c_str());
     //     J_DEBUG("Value: ");
     //     #ifdef JOHN_DEBUG_ON
-    //     print_value(arg_num < args.size() ? args[arg_num] : (*(func->def_args))[arg_num - first_def_arg]);
+    //     print_value(arg_num < count ? args[arg_num] : (*(func->def_args))[arg_num - first_def_arg]);
     //     #endif
 
     //     if(this->code->co_cellvars.size() == 0){
@@ -406,11 +502,11 @@ void FrameState::initialize_from_pyfunc(ValuePyFunction func, ArgList& args){
     //             // Read the name to save to from the constants pool
     //             this->code->co_varnames[i], 
     //             // read the value from passed in args, or else the default
-    //             arg_num < args.size() ? std::move(args[arg_num]) : (*(func->def_args))[arg_num - first_def_arg] 
+    //             arg_num < count ? std::move(args[arg_num]) : (*(func->def_args))[arg_num - first_def_arg] 
     //         );
     //     } else {
     //         // I haaate this copy/paste
-    //         Value v = arg_num < args.size() ? std::move(args[arg_num]) : (*(func->def_args))[arg_num - first_def_arg];
+    //         Value v = arg_num < count ? std::move(args[arg_num]) : (*(func->def_args))[arg_num - first_def_arg];
             
     //         bool found = false;
     //         // Check to see if this is a cell var
@@ -439,6 +535,7 @@ void FrameState::initialize_from_pyfunc(ValuePyFunction func, ArgList& args){
 
 // Add a value to the ns local
 void FrameState::add_to_ns_local(const std::string& name, Value&& v){
+    write_barrier(v);
     this->ns_local->emplace(name,v);
 }
 
@@ -450,6 +547,7 @@ void FrameState::print_value(Value& val) {
             },
             [](double arg) { std::cerr << "double(" << arg << ")"; },
             [](int64_t arg) { std::cerr << "int64(" << arg << ")"; },
+            [](const ValueBigInt arg) { std::cerr << "bigint(" << arg->to_string() << ")"; },
             [](const ValueString arg) {std::cerr << "ValueString(" << *arg << ")"; },
             [](const ValueCFunction arg) {std::cerr << "CFunction()"; },
             [](const ValueCMethod arg) {std::cerr << "CMethod()"; },
@@ -463,11 +561,11 @@ void FrameState::print_value(Value& val) {
             [](bool val) {if (val) std::cerr << "bool(true)"; else std::cout << "bool(false)"; },
             [](ValueList value) {
                 std::cerr << "[";
-                size_t i = 0;
-                for (Value& value : value->values) {
-                    FrameState::print_value(value);
+                for (size_t i = 0; i < value->size(); ++i) {
+                    Value item = value->get(i);
+                    FrameState::print_value(item);
                     std::cerr << ",";
-                    if (i++ > 100) {
+                    if (i > 101) {
                         std::cerr << "...";
                         break ;
                     }
@@ -491,42 +589,19 @@ void FrameState::print_value(Value& val) {
 }
 
 // If TOS supports an inplace operation, do it
-bool attempt_inplace_op(FrameState& frame,const std::string& i_attr){
+bool attempt_inplace_op(FrameState& frame, value::slot::Slot i_slot){
         // Get the TOS and check if it's and object
         frame.check_stack_size(2);
         Value v1 = frame.value_stack[frame.value_stack.size() - 2];
         auto obj = std::get_if<ValuePyObject>(&v1);
         if(obj != NULL){
-
-            // Check if it  overloaded the attr
-            std::tuple<Value,bool> res = (*obj)->find_attr_in_obj((*obj),i_attr);
-            
-            if(std::get<1>(res)) {
-                // Call the function
-                // std::vector<Value> args;
-                // args.push_back(std::move(frame.value_stack[frame.value_stack.size() - 1]));
-                // frame.value_stack.resize(frame.value_stack.size() - 2);
-                // ArgList arglist(std::move(args));
-                // std::visit(
-                //     value_helper::call_visitor(frame, arglist),
-                //     std::get<0>(res)
-                // );
-                // throw pyerror("inplace op not implemented since ArgList refactor.");
-
-                ArgList args(frame.value_stack.back());
-                frame.value_stack.pop_back();
-                args.bind(frame.value_stack.back());
-                frame.value_stack.pop_back();
-                std::visit(
-                    value_helper::call_visitor(frame, args),
-                    std::get<0>(res)
-                );
-
-                return true;
+            // Default to non-inplace if the class does not overload it
+            if (value::PyClass::get_slot((*obj)->static_attrs, i_slot) == nullptr) {
+                return false;
             }
-
-            // Default to non-inplace
-            return false;
+            ArgList args(frame.value_stack.back());
+            frame.value_stack.resize(frame.value_stack.size() - 2);
+            return value_helper::call_slot(frame, *obj, i_slot, args);
         }
         return false;
 
@@ -615,136 +690,62 @@ inline void FrameState::eval_next() {
             }
             GOTO_NEXT_OP ;
         CASE(LOAD_CLOSURE)
-            try {
-                std::string name;
-                if(arg < this->code->co_cellvars.size()){
-                    name = this->code->co_cellvars.at(arg);
-                } else {
-                    name = this->code->co_freevars.at(arg - this->code->co_cellvars.size());
-                }
-                const auto& globals = this->interpreter_state->ns_globals;
-                const auto& builtins = this->interpreter_state->ns_builtins;
-                // Search through all local namespaces up the stack
-                auto curr_frame = this;
-                bool found = false;
-                while(curr_frame != NULL){
-                    auto itr_local = curr_frame->ns_local->find(name);
-                    if (itr_local != curr_frame->ns_local->end()) {
-                        DEBUG("op::LOAD_CLOSURE ('%s') loaded a local", name.c_str());
-                        // This is expected to be a cell
-                        this->value_stack.push_back(itr_local->second);
-                        found = true;
-                        curr_frame = NULL;
-                        break ;
-                    } 
-                    curr_frame = curr_frame->parent_frame.get();
-                }
-                // Do not check globals or builtins for free vars
-                if(!found){
-                    throw pyerror(string("op::LOAD_CLOSURE name not found: ") + name);
-                }
-            } catch (std::out_of_range& err) {
-                throw pyerror("op::LOAD_CLOSURE tried to load name out of range");
+        {
+            if (arg >= this->cells.size()) {
+                throw pyerror("op::LOAD_CLOSURE tried to load cell out of range");
             }
+            this->value_stack.push_back(this->cells[arg]);
             GOTO_NEXT_OP;
+        }
         CASE(LOAD_CLASSDEREF)
         {
-            // First check the locals, otherwise fall through into LOAD_DEREF
-            try {
-                std::string name;
-                if(arg < this->code->co_cellvars.size()){
-                    name = this->code->co_cellvars.at(arg);
-                } else {
-                    name = this->code->co_freevars.at(arg - this->code->co_cellvars.size());
-                }
-                auto itr_local = this->ns_local->find(name);
-                if (itr_local != this->ns_local->end()) {
-                    DEBUG("op::LOAD_CLASSDEREF ('%s') loaded a local", name.c_str());
-                    // This is expected to be a cell
-                    this->value_stack.push_back(itr_local->second);
-                    GOTO_NEXT_OP ;
-                } else {
-                    DEBUG("op::LOAD_CLASSDEREF did not find ('%s') locally, falling through...", name.c_str());
-                }
-            } catch (std::out_of_range& err) {
-                throw pyerror("op::LOAD_CLASSDEREF tried to load name out of range");
+            // A class body first checks its own namespace, otherwise falls through into LOAD_DEREF
+            if (arg >= this->cells.size()) {
+                throw pyerror("op::LOAD_CLASSDEREF tried to load cell out of range");
             }
+            const std::string& name = arg < this->code->co_cellvars.size() ?
+                this->code->co_cellvars[arg] :
+                this->code->co_freevars[arg - this->code->co_cellvars.size()];
+            auto itr_local = this->ns_local->find(name);
+            if (itr_local != this->ns_local->end()) {
+                DEBUG("op::LOAD_CLASSDEREF ('%s') loaded a local", name.c_str());
+                this->value_stack.push_back(itr_local->second);
+                GOTO_NEXT_OP ;
+            }
+            DEBUG("op::LOAD_CLASSDEREF did not find ('%s') locally, falling through...", name.c_str());
         }
         CASE(LOAD_DEREF)
         {
-            auto which_frame = this;
-            if(this->flags & FLAG_CLASS_INIT_FRAME) {
-                which_frame = this->parent_frame.get();
-            }
-
-            // Check out of range
-            if(arg >= which_frame->cells.size()){
-                if(which_frame->curr_func && which_frame->curr_func->__closure__ != nullptr){
-                    if((arg - which_frame->cells.size()) >=  which_frame->curr_func->__closure__->values.size()){
-                        throw pyerror(std::string(
-                            "Attempted LOAD_DEREF out of range 2 (" + std::to_string(arg) + ")\n"
-                        ));
-                    }
-                } else {
-                    throw pyerror(std::string(
-                        "Attempted LOAD_DEREF out of range (" + std::to_string(arg) + ")\n"
-                    ));
-                }
-            } 
-            
-            DEBUG("Accessing Cell %d",arg);
-            DEBUG("Cells: %d",which_frame->cells.size());
-            if(arg >= cells.size()){
-                DEBUG("Function Closure: %d",which_frame->curr_func->__closure__->values.size());
+            if (arg >= this->cells.size()) {
+                throw pyerror(std::string(
+                    "Attempted LOAD_DEREF out of range (" + std::to_string(arg) + ")\n"
+                ));
             }
-
-            // Access the closure of the function or the cells
-            if(arg < which_frame->cells.size()){
-                this->value_stack.push_back(
-                    which_frame->cells[arg]->attrs->at("contents")
-                );
-            } else {
-                // Push to the top of the stack the contents of cell arg in the current enclosing scope
-                DEBUG_ADV("Here are some things: "   
-                    << which_frame->curr_func << ","
-                    << which_frame->curr_func->__closure__ << ","
-                    << which_frame->curr_func->__closure__->values[arg] << ","
-                    << std::get<ValuePyObject>(which_frame->curr_func->__closure__->values[arg]) << ","
-                    << (*(std::get<ValuePyObject>(which_frame->curr_func->__closure__->values[arg])->attrs))["contents"] << "\n"
-                );
-                this->value_stack.push_back(
-                    std::get<ValuePyObject>(which_frame->curr_func->__closure__->values[arg])->attrs->at("contents")
-                );
+            DEBUG("Accessing Cell %d",arg);
+            if (__builtin_expect(!this->cells[arg]->bound, 0)) {
+                const size_t ncells = this->code->co_cellvars.size();
+                if (arg < ncells) {
+                    throw pyerror("UnboundLocalError: local variable '" + this->code->co_cellvars[arg]
+                        + "' referenced before assignment");
+                }
+                throw pyerror("NameError: free variable '" + this->code->co_freevars[arg - ncells]
+                    + "' referenced before assignment in enclosing scope");
             }
+            this->value_stack.push_back(this->cells[arg]->contents);
             GOTO_NEXT_OP;
         }
         CASE(STORE_DEREF)
         {
             this->check_stack_size(1);
-
-            // Access the closure of the function or the cells
-            if(arg < this->cells.size()){
-                    (*(this->cells[arg]->attrs))["contents"] = std::move(this->value_stack.back());
-                    this->value_stack.pop_back();
-            } else {
-                // If the function does not have a closure yet, give it one
-                if(this->curr_func){
-                    if(this->curr_func->__closure__ == nullptr){
-                        this->curr_func->__closure__ = alloc.heap_list.make();
-                    }
-                    while(this->curr_func->__closure__->values.size() <= arg){
-                        this->curr_func->__closure__->values.push_back(
-                            value_helper::create_cell(value::NoneType())
-                        );
-                    }
-                } else {
-                    throw pyerror("Attempted STORE_DEREF out of range\n");
-                }
-                // Push to the top of the stack the contents of cell arg in the current enclosing scope
-                (*(std::get<ValuePyObject>(this->curr_func->__closure__->values[arg])->attrs))["contents"]
-                                                                    = std::move(this->value_stack.back());
-                this->value_stack.pop_back();  
+            if (arg >= this->cells.size()) {
+                throw pyerror(std::string(
+                    "Attempted STORE_DEREF out of range (" + std::to_string(arg) + ")\n"
+                ));
             }
+            write_barrier(this->value_stack.back());
+            this->cells[arg]->contents = std::move(this->value_stack.back());
+            this->cells[arg]->bound = true;
+            this->value_stack.pop_back();
             GOTO_NEXT_OP;
         }
         CASE(LOAD_NAME)
@@ -784,6 +785,7 @@ inline void FrameState::eval_next() {
                 // Check which name we are storing and store it
                 const std::string& name = this->code->co_names.at(arg);
                 DEBUG_ADV("\top::STORE_GLOBAL set " << name << " = " << this->value_stack.back());
+                write_barrier(this->value_stack.back());
                 (*(this->interpreter_state->ns_globals))[name] = std::move(this->value_stack.back());
                 this->value_stack.pop_back();
             } catch (std::out_of_range& err) {
@@ -797,6 +799,7 @@ inline void FrameState::eval_next() {
                 // Check which name we are storing and store it
                 const std::string& name = this->code->co_varnames.at(arg);
                 DEBUG_ADV("\top::STORE_FAST set " << name << " = " << this->value_stack.back());
+                write_barrier(this->value_stack.back());
                 (*(this->ns_local))[name] = std::move(this->value_stack.back());
                 this->value_stack.pop_back();
             } catch (std::out_of_range& err) {
@@ -809,6 +812,7 @@ inline void FrameState::eval_next() {
             try {
                 const std::string& name = this->code->co_names.at(arg);
                 DEBUG_ADV("\top::STORE_NAME set " << name << " = " << this->value_stack.back());
+                write_barrier(this->value_stack.back());
                 (*(this->ns_local))[name] = std::move(this->value_stack.back());
                 this->value_stack.pop_back();
             } catch (std::out_of_range& err) {
@@ -816,6 +820,22 @@ inline void FrameState::eval_next() {
             }
             GOTO_NEXT_OP;
         }
+        CASE(DELETE_FAST)
+        {
+            const std::string& name = this->code->co_varnames.at(arg);
+            if (this->ns_local->erase(name) == 0) {
+                throw pyerror("UnboundLocalError: local variable '" + name + "' referenced before assignment");
+            }
+            GOTO_NEXT_OP;
+        }
+        CASE(DELETE_NAME)
+        {
+            const std::string& name = this->code->co_names.at(arg);
+            if (this->ns_local->erase(name) == 0) {
+                throw pyerror("NameError: name '" + name + "' is not defined");
+            }
+            GOTO_NEXT_OP;
+        }
         CASE(LOAD_CONST)
         {
             try {
@@ -831,6 +851,10 @@ inline void FrameState::eval_next() {
         CASE(CALL_FUNCTION)
         {
             DEBUG("op::CALL_FUNCTION attempted to call a function with %d arguments", arg);
+            if (__builtin_expect(arg > 0xff, 0)) {
+                this->call_function_kw(arg);
+                CONTEXT_SWITCH ;
+            }
             this->check_stack_size(1 + arg);
             
             // Instead of reading out into a vector, can I just pass have 'initialize_from_pyfunc'
@@ -862,7 +886,7 @@ inline void FrameState::eval_next() {
         CASE(ROT_TWO)
         {
             this->check_stack_size(2);
-            std::swap(*(this->value_stack.end()), *(this->value_stack.end() - 1));
+            std::swap(*(this->value_stack.end() - 1), *(this->value_stack.end() - 2));
             GOTO_NEXT_OP ;
         }
         CASE(COMPARE_OP)
@@ -904,6 +928,28 @@ inline void FrameState::eval_next() {
                         eval_helpers::numeric_visitor<eval_helpers::op_neq>(*this),
                         val1, val2);
                     break ;
+                case op::cmp::IN:
+                    this->value_stack.push_back(std::visit(eval_helpers::contains_visitor {val1}, val2));
+                    break ;
+                case op::cmp::NOTIN:
+                    this->value_stack.push_back(!std::visit(eval_helpers::contains_visitor {val1}, val2));
+                    break ;
+                case op::cmp::EXCEPTION_MATCH:
+                {
+                    // val1 is the type of the error being handled, val2 the
+                    // class or tuple of classes the except clause names
+                    auto type = std::get_if<ValuePyClass>(&val1);
+                    auto is_type = [type](const Value& cls) {
+                        auto pycls = std::get_if<ValuePyClass>(&cls);
+                        return type != nullptr && pycls != nullptr && *pycls == *type;
+                    };
+                    bool matches = is_type(val2);
+                    if (auto tuple = std::get_if<ValueTuple>(&val2)) {
+                        matches = std::any_of((*tuple)->begin(), (*tuple)->end(), is_type);
+                    }
+                    this->value_stack.push_back(matches);
+                    break ;
+                }
                 default:
                     throw pyerror(string("operator ") + op::cmp::name[arg] + " not implemented.");
             }
@@ -915,7 +961,7 @@ inline void FrameState::eval_next() {
             this->check_stack_size(2);
         // see https://stackoverflow.com/questions/15376509/when-is-i-x-different-from-i-i-x-in-python
         // INPLACE_ADD should call __iadd__ method on full objects, falls back to __add__ if not available.
-            if(attempt_inplace_op(*this,"__iadd__")){ 
+            if(attempt_inplace_op(*this, value::slot::IADD)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -931,7 +977,7 @@ inline void FrameState::eval_next() {
         }
         CASE(INPLACE_SUBTRACT)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__isub__")){ 
+            if(attempt_inplace_op(*this, value::slot::ISUB)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -941,13 +987,13 @@ inline void FrameState::eval_next() {
             Value v2 = std::move(this->value_stack[this->value_stack.size() - 1]);
             Value v1 = std::move(this->value_stack[this->value_stack.size() - 2]);
             this->value_stack.resize(this->value_stack.size() - 2);
-            std::visit(eval_helpers::numeric_visitor<eval_helpers::op_sub>(*this),v1,v2);
+            std::visit(eval_helpers::sub_visitor(*this),v1,v2);
             CONTEXT_SWITCH_IF_NEEDED;
             GOTO_NEXT_OP ;
         }
         CASE(INPLACE_FLOOR_DIVIDE)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__ifloordiv__")){ 
+            if(attempt_inplace_op(*this, value::slot::IFLOORDIV)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -963,7 +1009,7 @@ inline void FrameState::eval_next() {
         }
         CASE(INPLACE_MULTIPLY)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__imul__")){ 
+            if(attempt_inplace_op(*this, value::slot::IMUL)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -979,7 +1025,7 @@ inline void FrameState::eval_next() {
         }
         CASE(INPLACE_MODULO)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__imod__")){ 
+            if(attempt_inplace_op(*this, value::slot::IMOD)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -995,7 +1041,7 @@ inline void FrameState::eval_next() {
         }
         CASE(INPLACE_POWER)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__ipow__")){ 
+            if(attempt_inplace_op(*this, value::slot::IPOW)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -1011,7 +1057,7 @@ inline void FrameState::eval_next() {
         }
         CASE(INPLACE_TRUE_DIVIDE)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__itruediv__")){ 
+            if(attempt_inplace_op(*this, value::slot::ITRUEDIV)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -1027,7 +1073,7 @@ inline void FrameState::eval_next() {
         }
         CASE(INPLACE_LSHIFT)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__ilshift__")){ 
+            if(attempt_inplace_op(*this, value::slot::ILSHIFT)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -1043,7 +1089,7 @@ inline void FrameState::eval_next() {
         }
         CASE(INPLACE_RSHIFT)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__irshift__")){ 
+            if(attempt_inplace_op(*this, value::slot::IRSHIFT)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -1059,7 +1105,7 @@ inline void FrameState::eval_next() {
         }
         CASE(INPLACE_AND)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__iand__")){ 
+            if(attempt_inplace_op(*this, value::slot::IAND)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -1069,13 +1115,13 @@ inline void FrameState::eval_next() {
             Value v2 = std::move(this->value_stack[this->value_stack.size() - 1]);
             Value v1 = std::move(this->value_stack[this->value_stack.size() - 2]);
             this->value_stack.resize(this->value_stack.size() - 2);
-            std::visit(eval_helpers::numeric_visitor<eval_helpers::op_and>(*this),v1,v2);
+            std::visit(eval_helpers::and_visitor(*this),v1,v2);
             CONTEXT_SWITCH_IF_NEEDED;
             GOTO_NEXT_OP;
         }
         CASE(INPLACE_XOR)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__ixor__")){ 
+            if(attempt_inplace_op(*this, value::slot::IXOR)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -1085,13 +1131,13 @@ inline void FrameState::eval_next() {
             Value v2 = std::move(this->value_stack[this->value_stack.size() - 1]);
             Value v1 = std::move(this->value_stack[this->value_stack.size() - 2]);
             this->value_stack.resize(this->value_stack.size() - 2);
-            std::visit(eval_helpers::numeric_visitor<eval_helpers::op_xor>(*this),v1,v2);
+            std::visit(eval_helpers::xor_visitor(*this),v1,v2);
             CONTEXT_SWITCH_IF_NEEDED;
             GOTO_NEXT_OP;
         }
         CASE(INPLACE_OR)
             this->check_stack_size(2);
-            if(attempt_inplace_op(*this,"__ior__")){ 
+            if(attempt_inplace_op(*this, value::slot::IOR)){ 
                 CONTEXT_SWITCH_IF_NEEDED;
                 GOTO_NEXT_OP;
             }
@@ -1101,7 +1147,7 @@ inline void FrameState::eval_next() {
             Value v2 = std::move(this->value_stack[this->value_stack.size() - 1]);
             Value v1 = std::move(this->value_stack[this->value_stack.size() - 2]);
             this->value_stack.resize(this->value_stack.size() - 2);
-            std::visit(eval_helpers::numeric_visitor<eval_helpers::op_or>(*this),v1,v2);
+            std::visit(eval_helpers::or_visitor(*this),v1,v2);
             CONTEXT_SWITCH_IF_NEEDED;
             GOTO_NEXT_OP;
         }
@@ -1109,8 +1155,38 @@ inline void FrameState::eval_next() {
         {
             this->check_stack_size(1);
 
+            // a finally block the return leaves runs first, with the result
+            // under the instruction to come back to once it ends
+            for (size_t i = this->block_stack.size(); i-- > 0;) {
+                if (this->block_stack[i].type == Block::Type::FINALLY) {
+                    const Block finally = this->block_stack[i];
+                    Value result = std::move(this->value_stack.back());
+                    this->block_stack.resize(i);
+                    this->value_stack.resize(finally.level);
+                    this->value_stack.push_back(std::move(result));
+                    this->value_stack.push_back((int64_t)this->r_pc);
+                    this->r_pc = finally.handler;
+                    GOTO_TARGET_OP;
+                }
+            }
+
             DEBUG("\tRETURNED FRAME'S FLAGS WERE: %x", (uint32_t)this->flags);
 
+            if (this->get_flag(FrameState::FLAG_CLASS_INIT_FRAME)) {
+                // the class body wrote straight into the class's namespace
+                value::PyClass::epoch.fetch_add(1, std::memory_order_relaxed);
+                value::PyClass::fill_slots(this->init_class);
+
+                // methods using super() or __class__ close over the class being built
+                for (size_t i = 0; i < this->code->co_cellvars.size(); ++i) {
+                    if (this->code->co_cellvars[i] == "__class__") {
+                        write_barrier(this->init_class);
+                        this->cells[i]->contents = this->init_class;
+                        this->cells[i]->bound = true;
+                    }
+                }
+            }
+
             if (this->get_flag(FrameState::FLAG_DONT_RETURN | FrameState::FLAG_CLASS_INIT_FRAME | FrameState::FLAG_OBJECT_INIT_FRAME)) {
                 DEBUG_ADV("POPPED FRAME, NO RETURN");
                 this->interpreter_state->pop_frame();
@@ -1133,9 +1209,7 @@ inline void FrameState::eval_next() {
             this->interpreter_state->pop_frame();
 
             // NOTE: this can not be used past this point
-            if (alloc.check_if_gc_needed()) {
-                alloc.collect_garbage(*(this->interpreter_state));
-            }
+            SAFEPOINT();
 
             return ;
         }
@@ -1144,27 +1218,87 @@ inline void FrameState::eval_next() {
             Block newBlock;
             newBlock.type = Block::Type::LOOP;
             newBlock.level = this->value_stack.size();
-            newBlock.pc_start = this->code->instructions[this->r_pc + 1].bytecode_index; // GARETH: changed this offset to 1
-            newBlock.pc_delta = arg;
+            newBlock.handler = arg;
             this->block_stack.push_back(newBlock);
             DEBUG("new block stack height: %lu", this->block_stack.size())
             GOTO_NEXT_OP;
         }
         CASE(BREAK_LOOP)
         {
-            Block topBlock = this->block_stack.back();
-            this->block_stack.pop_back();
-            size_t jumpTo = this->code->pc_map[(topBlock.pc_start + topBlock.pc_delta)];
-            if (jumpTo == 0) {
-                throw pyerror("invalid jump destination for break loop!");
+            // the blocks inside the loop are left as well. A finally block on
+            // the way runs first, and runs the break again once it ends
+            for (;;) {
+                Block topBlock = this->block_stack.back();
+                this->block_stack.pop_back();
+                // a for loop leaves its iterator on the stack
+                this->value_stack.resize(topBlock.level);
+                if (topBlock.type == Block::Type::FINALLY) {
+                    this->value_stack.push_back((int64_t)this->r_pc);
+                }
+                if (topBlock.type == Block::Type::LOOP || topBlock.type == Block::Type::FINALLY) {
+                    this->r_pc = topBlock.handler;
+                    break;
+                }
             }
-
-            this->r_pc = jumpTo;
             GOTO_TARGET_OP;
         }
         CASE(POP_BLOCK)
             this->block_stack.pop_back();
             GOTO_NEXT_OP;
+        CASE(SETUP_EXCEPT)
+        {
+            Block newBlock;
+            newBlock.type = Block::Type::EXCEPT;
+            newBlock.level = this->value_stack.size();
+            newBlock.handler = arg;
+            this->block_stack.push_back(newBlock);
+            GOTO_NEXT_OP;
+        }
+        CASE(SETUP_FINALLY)
+        {
+            // the compiler also wraps an except clause's body in one, to
+            // delete the name the error was bound to with `as`
+            Block newBlock;
+            newBlock.type = Block::Type::FINALLY;
+            newBlock.level = this->value_stack.size();
+            newBlock.handler = arg;
+            this->block_stack.push_back(newBlock);
+            GOTO_NEXT_OP;
+        }
+        CASE(POP_EXCEPT)
+        {
+            // the handler is done with the error, and with what was pushed
+            // for the one handled before it
+            Block topBlock = this->block_stack.back();
+            this->block_stack.pop_back();
+            if (topBlock.type != Block::Type::EXCEPT_HANDLER) {
+                throw pyerror("POP_EXCEPT outside of an except block");
+            }
+            this->value_stack.resize(topBlock.level);
+            GOTO_NEXT_OP;
+        }
+        CASE(END_FINALLY)
+        {
+            // reached with None, with the instruction a break or return that
+            // entered a finally block was at, which goes on from there, or
+            // with an error no except clause matched, which is raised again
+            // for the blocks further out
+            this->check_stack_size(1);
+            if (std::holds_alternative<value::NoneType>(this->value_stack.back())) {
+                this->value_stack.pop_back();
+                GOTO_NEXT_OP;
+            }
+            if (auto resume = std::get_if<int64_t>(&this->value_stack.back())) {
+                this->r_pc = *resume;
+                this->value_stack.pop_back();
+                GOTO_TARGET_OP;
+            }
+            this->check_stack_size(3);
+            Value error = this->value_stack[this->value_stack.size() - 2];
+            this->value_stack.resize(this->value_stack.size() - 3);
+            auto detail = std::get_if<ValueString>(&error);
+            throw pymemoryerror(detail != nullptr ? (*detail)->str() : std::string("out of memory"));
+        }
         CASE(POP_JUMP_IF_TRUE)
         {
             this->check_stack_size(1);
@@ -1173,15 +1307,11 @@ inline void FrameState::eval_next() {
             this->value_stack.pop_back();
 
             if (std::visit(value_helper::visitor_is_truthy(), top)) {
-                this->r_pc = arg;
-                if (alloc.check_if_gc_needed()) {
-                    alloc.collect_garbage(*(this->interpreter_state));
-                }
+                JUMP_TO(arg);
+                SAFEPOINT();
                 GOTO_TARGET_OP;
             }
-            if (alloc.check_if_gc_needed()) {
-                alloc.collect_garbage(*(this->interpreter_state));
-            }
+            SAFEPOINT();
             GOTO_NEXT_OP;
         }
         CASE(POP_JUMP_IF_FALSE)
@@ -1192,30 +1322,20 @@ inline void FrameState::eval_next() {
             this->value_stack.pop_back();
 
             if (!std::visit(value_helper::visitor_is_truthy(), top)) {
-                this->r_pc = arg;
-
-                if (alloc.check_if_gc_needed()) {
-                    alloc.collect_garbage(*(this->interpreter_state));
-                }
+                JUMP_TO(arg);
+                SAFEPOINT();
                 GOTO_TARGET_OP;
             }
-            if (alloc.check_if_gc_needed()) {
-                alloc.collect_garbage(*(this->interpreter_state));
-            }
+            SAFEPOINT();
             GOTO_NEXT_OP;
         }
         CASE(JUMP_ABSOLUTE)
-            this->r_pc = arg;
-            // if (alloc.check_if_gc_needed()) FOR
-            if (alloc.check_if_gc_needed()) {
-                alloc.collect_garbage(*(this->interpreter_state));
-            }
+            JUMP_TO(arg);
+            SAFEPOINT();
             GOTO_TARGET_OP;
         CASE(JUMP_FORWARD)
-            this->r_pc += arg;
-            if (alloc.check_if_gc_needed()) {
-                alloc.collect_garbage(*(this->interpreter_state));
-            }
+            this->r_pc = arg;
+            SAFEPOINT();
             GOTO_TARGET_OP;
         CASE(MAKE_CLOSURE)
         {
@@ -1229,12 +1349,11 @@ inline void FrameState::eval_next() {
             this->value_stack.pop_back();
             Value closure_code = std::move(value_stack.back());
             this->value_stack.pop_back();
-            //ValueList closure = std::move(std::get<ValueList>(value_stack.back()));
-            ValueList closure = std::get<ValueList>(value_stack.back());
+            Value closure = std::move(value_stack.back());
             this->value_stack.pop_back();
 
             // Create a shared pointer to a vector from the args
-            ValueList v = alloc.heap_list.make(
+            ValueList v = alloc().heap_list.make(
                 this->value_stack.end() - arg, this->value_stack.end()
             );
             
@@ -1243,16 +1362,15 @@ inline void FrameState::eval_next() {
             // Create the function object
             // Error here if the wrong types
             try {
-                ValuePyFunction nv = alloc.heap_pyfunc.make(
+                ValuePyFunction nv = alloc().heap_pyfunc.make(
                     value::PyFunc {std::get<ValueString>(name), std::get<ValueCode>(closure_code), v}
                 );
-                // CHange to a tuple!
-                nv->__closure__ = closure;
+                nv->__closure__ = std::get<ValueTuple>(closure);
                 this->value_stack.push_back(nv);
             } catch (std::bad_variant_access&) {
                 std::stringstream ss;
                 ss << "MAKE FUNCTION called with name '" << name << "' and code block: " << closure_code;
-                ss << ", but make function expects string and code object";
+                ss << ", but make closure expects string, code object and a tuple of cells";
                 throw pyerror(ss.str());
             }
             GOTO_NEXT_OP;
@@ -1279,7 +1397,7 @@ inline void FrameState::eval_next() {
             }
 
             // Create a shared pointer to a vector from the args
-            ValueList v = alloc.heap_list.make(
+            ValueList v = alloc().heap_list.make(
                 std::vector<Value>(this->value_stack.end() - arg, this->value_stack.end())
             );
             this->value_stack.resize(this->value_stack.size() - arg);
@@ -1287,12 +1405,12 @@ inline void FrameState::eval_next() {
             DEBUG_ADV("Arguments:");
             #ifdef DEBUG_ON
             for(int i = 0; i < v->size(); i++) {
-                DEBUG_ADV(i << " => " << (*v)[i]);
+                DEBUG_ADV(i << " => " << v->get(i));
             }
             #endif
 
             this->value_stack.push_back(
-                alloc.heap_pyfunc.make(
+                alloc().heap_pyfunc.make(
                     value::PyFunc {name, func_code, v}
                 )
             );
@@ -1319,6 +1437,54 @@ inline void FrameState::eval_next() {
             );
             GOTO_NEXT_OP;
         }
+        CASE(LOAD_METHOD)
+        {
+            this->check_stack_size(1);
+            DEBUG("Loading Method %s",this->code->co_names[arg].c_str()) ;
+            Value val = std::move(value_stack.back());
+            this->value_stack.pop_back();
+            std::visit(
+                value_helper::load_method_visitor(*this,this->code->co_names[arg]),
+                val
+            );
+            GOTO_NEXT_OP;
+        }
+        CASE(CALL_METHOD)
+        {
+            DEBUG("op::CALL_METHOD attempted to call a method with %d arguments", arg);
+            this->check_stack_size(2 + arg);
+
+            ArgList args(
+                this->value_stack.end() - arg,
+                this->value_stack.end());
+            this->value_stack.resize(this->value_stack.size() - arg);
+            Value self = std::move(this->value_stack.back());
+            this->value_stack.pop_back();
+            Value method = std::move(this->value_stack.back());
+            this->value_stack.pop_back();
+
+            if (std::holds_alternative<value::NoneType>(method)) {
+                // LOAD_METHOD fell back to a regular attribute, which is in self's slot
+                std::visit(
+                    value_helper::call_visitor(*this, args),
+                    self
+                );
+            } else {
+                args.bind(std::move(self));
+                auto cmethod = std::get_if<ValueCMethod>(&method);
+                if (cmethod != NULL) {
+                    // call_visitor would bind the method's own (empty) thisArg over self
+                    (*cmethod)->action(*this, args);
+                } else {
+                    std::visit(
+                        value_helper::call_visitor(*this, args),
+                        method
+                    );
+                }
+            }
+
+            CONTEXT_SWITCH ;
+        }
         CASE(STORE_ATTR)
         {
             this->check_stack_size(2);
@@ -1351,7 +1517,7 @@ inline void FrameState::eval_next() {
             this->check_stack_size(arg);
 
             // Pop the arguments to turn into a list.
-            ValueTuple newTuple = alloc.heap_tuple.make();
+            ValueTuple newTuple = alloc().heap_tuple.make();
             newTuple->values.assign(this->value_stack.end() - arg, this->value_stack.end());
             this->value_stack.resize(this->value_stack.size() - arg);
             this->value_stack.push_back(newTuple);
@@ -1363,15 +1529,87 @@ inline void FrameState::eval_next() {
             this->check_stack_size(arg);
 
             // Pop the arguments to turn into a list.
-            ValueList newList = alloc.heap_list.make();
-
-            newList->values.assign(this->value_stack.end() - arg, this->value_stack.end());
+            ValueList newList = alloc().heap_list.make(
+                this->value_stack.end() - arg, this->value_stack.end()
+            );
             this->value_stack.resize(this->value_stack.size() - arg);
             
             this->value_stack.push_back(newList);
 
             GOTO_NEXT_OP;
         }
+        CASE(BUILD_SET)
+        {
+            this->check_stack_size(arg);
+
+            ValueSet newSet = alloc().heap_set.make();
+            for (auto itr = this->value_stack.end() - arg; itr != this->value_stack.end(); ++itr) {
+                newSet->add(*itr);
+            }
+            this->value_stack.resize(this->value_stack.size() - arg);
+            this->value_stack.push_back(newSet);
+
+            GOTO_NEXT_OP;
+        }
+        CASE(SET_ADD)
+        {
+            this->check_stack_size(arg + 1);
+            try {
+                std::get<ValueSet>(*(this->value_stack.end() - arg - 1))->add(this->value_stack.back());
+                this->value_stack.pop_back();
+            } catch (std::bad_variant_access& e) {
+                throw pyerror("SET_ADD expects a set as its first argument");
+            }
+            GOTO_NEXT_OP;
+        }
+        CASE(BUILD_MAP)
+        {
+            this->check_stack_size(2 * arg);
+
+            // the stack holds key, value pairs
+            ValueDict newDict = alloc().heap_dict.make();
+            newDict->reserve(arg);
+            for (auto itr = this->value_stack.end() - 2 * arg; itr != this->value_stack.end(); itr += 2) {
+                newDict->set(*itr, std::move(*(itr + 1)));
+            }
+            this->value_stack.resize(this->value_stack.size() - 2 * arg);
+            this->value_stack.push_back(newDict);
+
+            GOTO_NEXT_OP;
+        }
+        CASE(BUILD_CONST_KEY_MAP)
+        {
+            this->check_stack_size(arg + 1);
+
+            // TOS is a tuple of the keys, below it are the values
+            ValueTuple keys = std::get<ValueTuple>(this->value_stack.back());
+            this->value_stack.pop_back();
+            ValueDict newDict = alloc().heap_dict.make();
+            newDict->reserve(arg);
+            auto values = this->value_stack.end() - arg;
+            for (size_t i = 0; i < arg; ++i) {
+                newDict->set(keys->values[i], std::move(values[i]));
+            }
+            this->value_stack.resize(this->value_stack.size() - arg);
+            this->value_stack.push_back(newDict);
+
+            GOTO_NEXT_OP;
+        }
+        CASE(MAP_ADD)
+        {
+            this->check_stack_size(arg + 2);
+            Value key = std::move(this->value_stack.back());
+            this->value_stack.pop_back();
+            Value value = std::move(this->value_stack.back());
+            this->value_stack.pop_back();
+
+            try {
+                std::get<ValueDict>(*(this->value_stack.end() - arg))->set(key, std::move(value));
+            } catch (std::bad_variant_access& e) {
+                throw pyerror("MAP_ADD expects a dict as its first argument");
+            }
+            GOTO_NEXT_OP;
+        }
         CASE(BINARY_SUBSCR)
         {
             this->check_stack_size(2);
@@ -1380,6 +1618,26 @@ inline void FrameState::eval_next() {
             Value list = this->value_stack.back();
             this->value_stack.pop_back();
 
+            if (auto dict = std::get_if<ValueDict>(&list)) {
+                Value* found = (*dict)->find(index);
+                if (found == nullptr) {
+                    std::stringstream ss;
+                    ss << "KeyError: " << index;
+                    throw pyerror(ss.str());
+                }
+                this->value_stack.push_back(*found);
+                GOTO_NEXT_OP ;
+            }
+
+            if (auto obj = std::get_if<ValuePyObject>(&list)) {
+                ArgList args(index);
+                if (!value_helper::call_slot(*this, *obj, value::slot::GETITEM, args)) {
+                    throw pyerror("TypeError: object does not support indexing");
+                }
+                CONTEXT_SWITCH_IF_NEEDED;
+                GOTO_NEXT_OP ;
+            }
+
             this->value_stack.push_back(
                 std::visit(eval_helpers::binary_subscr_visitor(), list, index)
             );
@@ -1447,22 +1705,98 @@ inline void FrameState::eval_next() {
             Value value = this->value_stack.back();
             this->value_stack.pop_back();
 
+            if (auto dict = std::get_if<ValueDict>(&self)) {
+                (*dict)->set(key, std::move(value));
+                GOTO_NEXT_OP;
+            }
+
+            if (auto obj = std::get_if<ValuePyObject>(&self)) {
+                ArgList args(key);
+                args.append_arg(value);
+                if (!value_helper::call_slot(*this, *obj, value::slot::SETITEM, args)) {
+                    throw pyerror("TypeError: object does not support item assignment");
+                }
+                // __setitem__'s return value is not wanted
+                if (this->interpreter_state->cur_frame.get() != this) {
+                    this->interpreter_state->cur_frame->set_flag(FrameState::FLAG_DONT_RETURN);
+                }
+                CONTEXT_SWITCH_IF_NEEDED;
+                GOTO_NEXT_OP;
+            }
+
             DEBUG_ADV("Trying to run store_subscr_visitor");
             eval_helpers::store_subscr_visitor visitor { value };
             std::visit(visitor, self, key);
             DEBUG_ADV("Finished running store_subscr_visitor");
             GOTO_NEXT_OP;
         }
+        CASE(DELETE_SUBSCR)
+        {
+            this->check_stack_size(2);
+            Value key = std::move(this->value_stack.back());
+            this->value_stack.pop_back();
+            Value self = std::move(this->value_stack.back());
+            this->value_stack.pop_back();
+
+            if (auto dict = std::get_if<ValueDict>(&self)) {
+                if (!(*dict)->erase(key)) {
+                    std::stringstream ss;
+                    ss << "KeyError: " << key;
+                    throw pyerror(ss.str());
+                }
+            } else if (std::holds_alternative<ValueList>(self) && std::holds_alternative<int64_t>(key)) {
+                ValueList& list = std::get<ValueList>(self);
+                const size_t index =
+                    eval_helpers::normalize_index(std::get<int64_t>(key), list->size(), "list");
+                list->erase(index, index + 1);
+            } else {
+                std::stringstream ss;
+                ss << "TypeError: " << self << " does not support item deletion";
+                throw pyerror(ss.str());
+            }
+            GOTO_NEXT_OP;
+        }
         CASE(BUILD_SLICE)
         {
             this->check_stack_size(arg);
-            ArgList args(
-                this->value_stack.end() - arg,
-                this->value_stack.end());
-            this->value_stack.resize(this->value_stack.size() - arg);
-            (std::get<ValueCFunction>(
-                (*(this->interpreter_state->ns_builtins))["slice"]
-            ))->action((*this),args);
+            auto& stack = this->value_stack;
+            const Value none = value::NoneType();
+            const Value& start = *(stack.end() - arg);
+            const Value& stop = *(stack.end() - arg + 1);
+            const Value& step = arg == 3 ? stack.back() : none;
+
+#ifdef FUSED_SLICE_ON
+            // seq[a:b] and seq[a:b] = v on builtin sequences never need the slice object
+            const auto next_op = this->code->instructions[this->r_pc + 1].bytecode;
+            if (next_op == op::BINARY_SUBSCR && stack.size() > arg) {
+                Value& seq = *(stack.end() - arg - 1);
+                if (std::holds_alternative<ValueList>(seq) || 
+                    std::holds_alternative<ValueTuple>(seq) || 
+                    std::holds_alternative<ValueString>(seq)) {
+                    Value result = std::visit(eval_helpers::slice_visitor {start, stop, step}, seq);
+                    stack.resize(stack.size() - arg);
+                    stack.back() = std::move(result);
+                    this->r_pc++; // skip the BINARY_SUBSCR
+                    GOTO_NEXT_OP;
+                }
+            } else if (next_op == op::STORE_SUBSCR && stack.size() > arg + 1) {
+                Value& seq = *(stack.end() - arg - 1);
+                if (std::holds_alternative<ValueList>(seq)) {
+                    const Value& value = *(stack.end() - arg - 2);
+                    eval_helpers::store_slice_visitor {start, stop, step, value}(std::get<ValueList>(seq));
+                    stack.resize(stack.size() - arg - 2);
+                    this->r_pc++; // skip the STORE_SUBSCR
+                    GOTO_NEXT_OP;
+                }
+            }
+#endif
+
+            ValueSlice slice = alloc().heap_slice.make();
+            slice->start = start;
+            slice->stop = stop;
+            slice->step = step;
+            stack.resize(stack.size() - arg);
+            stack.push_back(std::move(slice));
             GOTO_NEXT_OP;
         }
         CASE(UNPACK_SEQUENCE) 
@@ -1477,8 +1811,8 @@ inline void FrameState::eval_next() {
         CASE(LIST_APPEND) 
         {
             try {
-                std::get<ValueList>(*(this->value_stack.end() - arg - 1))->values
-                    .push_back(this->value_stack.back());
+                std::get<ValueList>(*(this->value_stack.end() - arg - 1))->append(
+                    this->value_stack.back());
                 this->value_stack.pop_back();
             } catch (std::bad_variant_access& e) {
                 throw pyerror("LIST_APPEND expects a list as its first argument");
@@ -1504,8 +1838,28 @@ inline void FrameState::eval_next() {
             this->value_stack.insert(this->value_stack.end() - 2,tmp);
             GOTO_NEXT_OP;
         }
-        CASE(UNARY_POSITIVE)
         CASE(UNARY_NEGATIVE)
+        {
+            this->check_stack_size(1);
+            Value& top = this->value_stack.back();
+            if (auto i = std::get_if<int64_t>(&top)) {
+                if (__builtin_expect(*i == INT64_MIN, 0)) {
+                    top = value::BigInt::sub_int64(0, *i);
+                } else {
+                    *i = -*i;
+                }
+            } else if (auto d = std::get_if<double>(&top)) {
+                *d = -*d;
+            } else if (auto big = std::get_if<ValueBigInt>(&top)) {
+                top = value::BigInt::to_value(value::BigInt::sub(value::BigInt(), **big));
+            } else {
+                std::stringstream ss;
+                ss << "TypeError: bad operand type for unary -: " << top;
+                throw pyerror(ss.str());
+            }
+            GOTO_NEXT_OP;
+        }
+        CASE(UNARY_POSITIVE)
         CASE(UNARY_NOT)
         CASE(UNARY_INVERT)
         CASE(BINARY_MATRIX_MULTIPLY)
@@ -1513,7 +1867,6 @@ inline void FrameState::eval_next() {
         CASE(GET_AITER)
         CASE(GET_ANEXT)
         CASE(BEFORE_ASYNC_WITH)
-        CASE(DELETE_SUBSCR)
         CASE(GET_YIELD_FROM_ITER)
         CASE(PRINT_EXPR)
         CASE(YIELD_FROM)
@@ -1522,22 +1875,14 @@ inline void FrameState::eval_next() {
         CASE(WITH_CLEANUP_FINISH)
         CASE(IMPORT_STAR)
         CASE(SETUP_ANNOTATIONS)
-        CASE(END_FINALLY)
-        CASE(POP_EXCEPT)
-        CASE(DELETE_NAME)
         CASE(UNPACK_EX)
         CASE(DELETE_ATTR)
         CASE(DELETE_GLOBAL)
-        CASE(BUILD_SET)
-        CASE(BUILD_MAP)
         CASE(IMPORT_NAME)
         CASE(IMPORT_FROM)
         CASE(JUMP_IF_FALSE_OR_POP)
         CASE(JUMP_IF_TRUE_OR_POP)
         CASE(CONTINUE_LOOP)
-        CASE(SETUP_EXCEPT)
-        CASE(SETUP_FINALLY)
-        CASE(DELETE_FAST)
         CASE(STORE_ANNOTATION)
         CASE(RAISE_VARARGS)
         CASE(DELETE_DEREF)
@@ -1545,8 +1890,6 @@ inline void FrameState::eval_next() {
         CASE(CALL_FUNCTION_EX)
         CASE(SETUP_WITH)
         CASE(EXTENDED_ARG)
-        CASE(SET_ADD)
-        CASE(MAP_ADD)
         CASE(BUILD_LIST_UNPACK)
         CASE(BUILD_MAP_UNPACK)
         CASE(BUILD_MAP_UNPACK_WITH_CALL)
@@ -1554,7 +1897,6 @@ inline void FrameState::eval_next() {
         CASE(BUILD_SET_UNPACK)
         CASE(SETUP_ASYNC_WITH)
         CASE(FORMAT_VALUE)
-        CASE(BUILD_CONST_KEY_MAP)
         CASE(BUILD_STRING)
         CASE(BUILD_TUPLE_UNPACK_WITH_CALL)
         default:
@@ -1576,11 +1918,90 @@ inline void FrameState::eval_next() {
     this->r_pc++;
 }
 
+#ifdef TRACING_JIT_ON
+// Called after a backward jump to the instruction at r_pc. Once the loop it
+// starts is hot this runs the loop's trace, or records one by stepping through
+// an iteration of the loop first
+static void loop_backedge(FrameState& frame) {
+    uint16_t& count = frame.code->loops->backedges[frame.r_pc];
+    if (count < jit::HOT_LOOP) {
+        count++;
+        return ;
+    }
+    if (count == jit::COLD_LOOP || jit::recording || jit::run_trace(frame)) {
+        return ;
+    }
+
+    jit::Recorder recorder(frame);
+    while (recorder.before(frame)) {
+        frame.eval_next();
+        if (!recorder.after(frame)) {
+            break;
+        }
+    }
+    recorder.finish(frame);
+}
+#endif
+
+void InterpreterState::run(gc_ptr<FrameState> stop) {
+    for (;;) {
+        try {
+            while (this->cur_frame != stop) {
+                this->cur_frame->eval_next();
+            }
+            return ;
+        } catch (const pymemoryerror& err) {
+            if (!this->handle_error(err, stop)) {
+                throw;
+            }
+        }
+    }
+}
+
+bool InterpreterState::handle_error(const pymemoryerror& err, gc_ptr<FrameState> stop) {
+    for (gc_ptr<FrameState> frame = this->cur_frame; frame != stop && frame != nullptr; frame = frame->parent_frame) {
+        std::vector<Block>& blocks = frame->block_stack;
+        while (!blocks.empty()) {
+            Block block = blocks.back();
+            blocks.pop_back();
+            if (block.type == Block::Type::EXCEPT_HANDLER) {
+                // an error in an except block leaves it
+                frame->value_stack.resize(block.level);
+                continue;
+            }
+            if (block.type != Block::Type::EXCEPT && block.type != Block::Type::FINALLY) {
+                continue;
+            }
+
+            // the frames above are left, and the handler finds the error
+            // handled before this one and then this one, as traceback, value
+            // and type. Only one is handled at a time, so the first is None.
+            // A finally block gets the same, and its END_FINALLY raises the
+            // error again
+            this->cur_frame = frame;
+            frame->value_stack.resize(block.level);
+            Block handler;
+            handler.type = Block::Type::EXCEPT_HANDLER;
+            handler.level = block.level;
+            blocks.push_back(handler);
+            for (size_t i = 0; i < 3; ++i) {
+                frame->value_stack.push_back(value::NoneType());
+            }
+            frame->value_stack.push_back(value::NoneType());
+            frame->value_stack.push_back(alloc().heap_string.make(err.detail));
+            auto type = this->ns_builtins->find("MemoryError");
+            frame->value_stack.push_back(type != this->ns_builtins->end() ? type->second : value::NoneType());
+            frame->r_pc = block.handler;
+            return true;
+        }
+    }
+    return false;
+}
+
 void InterpreterState::eval() {
+    Allocator::Scope scope(*this->heap);
     try {
-        while (this->cur_frame != nullptr) {
-            this->cur_frame->eval_next();
-        } 
+        this->run(nullptr);
         #ifdef PROFILING_ON
             dump_and_clear_time_events();
         #elif defined PROFILING_SIMPLE
@@ -1591,6 +2012,10 @@ void InterpreterState::eval() {
             dump_and_clear_time_events();
         #endif
         auto& frame = *(this->cur_frame);
+        // the script's output so far goes out before the error report
+        try {
+            output.flush();
+        } catch (const pyerror&) { }
         std::cerr << err.what() << std::endl;
         std::cerr << "FRAME TRACE: " << std::endl;
 
@@ -1617,4 +2042,20 @@ void InterpreterState::eval() {
     }
 }
 
+Value value_helper::call_sync(FrameState& frame, Value callable, ArgList& args) {
+    InterpreterState& interp = *(frame.interpreter_state);
+    const gc_ptr<FrameState> caller = interp.cur_frame;
+    const size_t depth = frame.value_stack.size();
+
+    std::visit(value_helper::call_visitor(frame, args), callable);
+    interp.run(caller);
+
+    if (frame.value_stack.size() != depth + 1) {
+        throw pyerror("INTERNAL ERROR: call did not leave exactly one result");
+    }
+    Value result = std::move(frame.value_stack.back());
+    frame.value_stack.pop_back();
+    return result;
+}
+
 }
\ No newline at end of file
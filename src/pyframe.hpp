@@ -25,11 +25,11 @@ struct Block {
         NONE,
         LOOP,
         EXCEPT,
-        FINALLY
+        FINALLY,
+        EXCEPT_HANDLER // an except block that is running, its level is below the error it handles
     };
     Type type = NONE;
-    size_t pc_start = 0;
-    size_t pc_delta = 0;
+    size_t handler = 0; // the instruction a break out of the block jumps to
     size_t level = 0; // value level to pop up to
 };
 
@@ -60,7 +60,7 @@ public:
 
     // Needed in LOAD_CLOSURE, LOAD_DEREF, and STORE_DEREF
     ValuePyFunction curr_func; // The function of this current frame stat
-    std::vector<ValuePyObject> cells; // Cells that happen to be in my local namespace
+    std::vector<ValueCell> cells; // co_cellvars followed by co_freevars, indexed by the *_DEREF opcodes
 
     FrameState(const ValueCode code);
     FrameState(const ValueCode code, ValuePyClass& init_class);
@@ -83,6 +83,8 @@ public:
     void recycle(const ValueCode code, ValuePyClass& init_class);
 
     void eval_next();
+    // CALL_FUNCTION with keyword arguments
+    void call_function_kw(uint64_t arg);
 
     static void print_value(Value& val);
     void print_stack() const;
@@ -91,6 +93,11 @@ public:
     void add_to_ns_local(const std::string& name,Value&& v);
 
     void initialize_from_pyfunc(const ValuePyFunction func, ArgList& args);
+    // the same with the arguments in an array, self is not bound here
+    void initialize_from_pyfunc(const ValuePyFunction& func, const Value* args, size_t count);
+
+    // Create cells for co_cellvars and take the cells for co_freevars from func's closure
+    void initialize_cells(const ValuePyFunction& func);
     
     // flag getters and setters
     inline bool get_flag(const uint8_t flag) {
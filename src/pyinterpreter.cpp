@@ -7,13 +7,13 @@ namespace py {
 /* 
     INTERPRETER STATE
 */
-InterpreterState::InterpreterState(ValueCode code) {
+InterpreterState::InterpreterState(ValueCode code) : heap(Allocator::current) {
     //code->print_bytecode();
 
-    this->ns_builtins = alloc.heap_namespace.make();
+    this->ns_builtins = alloc().heap_namespace.make();
 
     this->push_frame(
-        alloc.heap_frame.make(code)
+        alloc().heap_frame.make(code)
     );
 
     // make ns_globals refer to the bottom's locals
@@ -34,6 +34,18 @@ InterpreterState::InterpreterState(ValueCode code) {
 
 }
 
+InterpreterState::~InterpreterState() {
+    // an incremental marking that started from this interpreter's roots is
+    // finished while they are still there
+    if (this->heap != nullptr && this->heap->marking && this->heap->marking_interp == this) {
+        Allocator::Scope scope(*this->heap);
+        this->heap->finish_marking();
+    }
+#ifdef PROFILING_ON
+    fflush(this->profiling_file);
+#endif
+}
+
 #ifdef PROFILING_ON
     #ifdef PER_OPCODE_PROFILING
         void InterpreterState::emit_opcode_data(const Code::Instruction& instruction,
@@ -38,13 +38,20 @@ struct InterpreterState {
     Namespace ns_globals; // ns_globals is just ns_local of the very bottom FrameState
     Namespace ns_builtins;
     ValueCode main_code;
-    
-    Allocator alloc;
+    Allocator* heap; // the allocator current when it was created, code must come from it
 
     InterpreterState(ValueCode code);
 
+    // runs with heap as this thread's current allocator
     void eval();
 
+    // runs frames until stop is the current frame again. A MemoryError goes
+    // to the innermost except block of the frames above stop, the frames
+    // above that one are left
+    void run(gc_ptr<FrameState> stop);
+    // returns false when none of those frames has an except block
+    bool handle_error(const pymemoryerror& err, gc_ptr<FrameState> stop);
+
     inline void push_frame(gc_ptr<FrameState> frame) {
         // TBD: does frame->parent_name need to be changed to a std::shared_ptr?
         frame->parent_frame = this->cur_frame;
@@ -104,11 +111,9 @@ struct InterpreterState {
     #endif
 
     void dump_and_clear_time_events();
-
-    ~InterpreterState() {
-        fflush(this->profiling_file);
-    }
 #endif
+
+    ~InterpreterState();
 };
 
 }
@@ -0,0 +1,895 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "pyjit.hpp"
+#include "pyframe.hpp"
+#include "pyinterpreter.hpp"
+#include "builtins/builtins.hpp"
+#include "optflags.hpp"
+#include "../lib/oplist.hpp"
+
+// #define DEBUG_ON
+#include "../lib/debug.hpp"
+
+/*
+    A trace is the instructions of one iteration of a loop, starting at its
+    header, in the order the interpreter ran them. Branches became guards that
+    leave the trace when they go the other way, and the jump back to the header
+    loops in native code.
+
+    A trace is compiled to a function uint32_t trace(int64_t* slots) that runs
+    the loop until a guard fails and returns the exit it took. The slots hold
+    the range a for loop iterates, then the variables and then one slot for
+    every depth of the stack, all unboxed. rbx points to them, every instruction
+    loads its operands into rax and rcx or xmm0 and xmm1 and stores its result
+    to the slot of the stack depth it is pushed at. Loads of variables and
+    constants push nothing, the instruction using them reads them directly.
+
+    Every exit knows the instruction the interpreter continues at, the types of
+    the variables there and what the stack holds, so the values are boxed back
+    into the namespaces and the stack only when the trace exits.
+*/
+
+namespace py {
+namespace jit {
+
+thread_local bool recording = false;
+
+namespace {
+
+// the longest iteration that is traced
+constexpr size_t MAX_TRACE = 1000;
+// recordings that fail before a loop is left to the interpreter for good
+constexpr uint8_t MAX_FAILURES = 4;
+// entries whose types do not match before a trace is dropped
+constexpr uint32_t MAX_MISSES = 64;
+
+Type type_of(const Value& value) {
+    if (std::holds_alternative<int64_t>(value)) {
+        return Type::INT;
+    } else if (std::holds_alternative<double>(value)) {
+        return Type::FLOAT;
+    } else if (std::holds_alternative<bool>(value)) {
+        return Type::BOOL;
+    }
+    return Type::NONE;
+}
+
+inline bool is_number(Type type) {
+    return type == Type::INT || type == Type::FLOAT;
+}
+
+int64_t unbox(const Value& value) {
+    if (auto i = std::get_if<int64_t>(&value)) {
+        return *i;
+    } else if (auto d = std::get_if<double>(&value)) {
+        int64_t bits;
+        std::memcpy(&bits, d, sizeof(bits));
+        return bits;
+    }
+    return std::get<bool>(value);
+}
+
+Value box(int64_t bits, Type type) {
+    if (type == Type::INT) {
+        return bits;
+    } else if (type == Type::FLOAT) {
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+    return bits != 0;
+}
+
+// INPLACE_* run the BINARY_* operation on numbers
+Code::ByteCode binary_op(Code::ByteCode bytecode) {
+    switch (bytecode) {
+        case op::INPLACE_ADD: return op::BINARY_ADD;
+        case op::INPLACE_SUBTRACT: return op::BINARY_SUBTRACT;
+        case op::INPLACE_MULTIPLY: return op::BINARY_MULTIPLY;
+        case op::INPLACE_TRUE_DIVIDE: return op::BINARY_TRUE_DIVIDE;
+        case op::INPLACE_FLOOR_DIVIDE: return op::BINARY_FLOOR_DIVIDE;
+        case op::INPLACE_MODULO: return op::BINARY_MODULO;
+        case op::INPLACE_POWER: return op::BINARY_POWER;
+        default: return bytecode;
+    }
+}
+
+bool is_binary(Code::ByteCode bytecode) {
+    switch (binary_op(bytecode)) {
+        case op::BINARY_ADD:
+        case op::BINARY_SUBTRACT:
+        case op::BINARY_MULTIPLY:
+        case op::BINARY_TRUE_DIVIDE:
+        case op::BINARY_FLOOR_DIVIDE:
+        case op::BINARY_MODULO:
+        case op::BINARY_POWER:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+    Just the x86-64 that traces need. The registers are all below r8 so no
+    instruction needs REX.R or REX.B
+*/
+enum Reg : uint8_t { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7 };
+enum Xmm : uint8_t { XMM0 = 0, XMM1 = 1 };
+enum Cond : uint8_t {
+    CC_O = 0x0, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_NS = 0x9,
+    CC_P = 0xA, CC_NP = 0xB, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+class Assembler {
+public:
+    std::vector<uint8_t> code;
+
+    size_t here() const {
+        return this->code.size();
+    }
+
+    // the opcode with a register operand and a [base + disp] one
+    void mem(std::initializer_list<uint8_t> opcode, uint8_t reg, Reg base, int32_t disp) {
+        this->code.insert(this->code.end(), opcode);
+        this->code.push_back(0x80 | reg << 3 | base);
+        this->imm(disp);
+    }
+    // the opcode with two register operands, reg and rm as the manual names them
+    void regs(std::initializer_list<uint8_t> opcode, uint8_t reg, uint8_t rm) {
+        this->code.insert(this->code.end(), opcode);
+        this->code.push_back(0xC0 | reg << 3 | rm);
+    }
+
+    void load(Reg dst, Reg base, int32_t disp) { this->mem({0x48, 0x8B}, dst, base, disp); }
+    void store(Reg base, int32_t disp, Reg src) { this->mem({0x48, 0x89}, src, base, disp); }
+    void load(Xmm dst, Reg base, int32_t disp) { this->mem({0xF2, 0x0F, 0x10}, dst, base, disp); }
+    void store(Reg base, int32_t disp, Xmm src) { this->mem({0xF2, 0x0F, 0x11}, src, base, disp); }
+    void add(Reg dst, Reg base, int32_t disp) { this->mem({0x48, 0x03}, dst, base, disp); }
+    void cmp(Reg dst, Reg base, int32_t disp) { this->mem({0x48, 0x3B}, dst, base, disp); }
+
+    void mov(Reg dst, int64_t value) {
+        this->code.push_back(0x48);
+        this->code.push_back(0xB8 | dst);
+        this->imm(value);
+    }
+    void mov(Reg dst, Reg src) { this->regs({0x48, 0x89}, src, dst); }
+    void movq(Xmm dst, Reg src) { this->regs({0x66, 0x48, 0x0F, 0x6E}, dst, src); }
+    void add(Reg dst, Reg src) { this->regs({0x48, 0x01}, src, dst); }
+    void sub(Reg dst, Reg src) { this->regs({0x48, 0x29}, src, dst); }
+    void xor_(Reg dst, Reg src) { this->regs({0x48, 0x31}, src, dst); }
+    void cmp(Reg dst, Reg src) { this->regs({0x48, 0x39}, src, dst); }
+    void test(Reg dst, Reg src) { this->regs({0x48, 0x85}, src, dst); }
+    void imul(Reg dst, Reg src) { this->regs({0x48, 0x0F, 0xAF}, dst, src); }
+    void neg(Reg dst) { this->regs({0x48, 0xF7}, 3, dst); }
+    void idiv(Reg src) { this->regs({0x48, 0xF7}, 7, src); }
+    void cqo() { this->code.insert(this->code.end(), {0x48, 0x99}); }
+    void cmp(Reg dst, int8_t value) { this->regs({0x48, 0x83}, 7, dst); this->code.push_back(value); }
+    void sub(Reg dst, int8_t value) { this->regs({0x48, 0x83}, 5, dst); this->code.push_back(value); }
+
+    // the low bytes of rax, rcx, rdx and rbx: al, cl, dl and bl
+    void setcc(Cond cond, Reg dst) { this->regs({0x0F, uint8_t(0x90 | cond)}, 0, dst); }
+    void and8(Reg dst, Reg src) { this->regs({0x20}, src, dst); }
+    void or8(Reg dst, Reg src) { this->regs({0x08}, src, dst); }
+    void movzx8(Reg dst, Reg src) { this->regs({0x0F, 0xB6}, dst, src); }
+
+    void addsd(Xmm dst, Xmm src) { this->regs({0xF2, 0x0F, 0x58}, dst, src); }
+    void subsd(Xmm dst, Xmm src) { this->regs({0xF2, 0x0F, 0x5C}, dst, src); }
+    void mulsd(Xmm dst, Xmm src) { this->regs({0xF2, 0x0F, 0x59}, dst, src); }
+    void divsd(Xmm dst, Xmm src) { this->regs({0xF2, 0x0F, 0x5E}, dst, src); }
+    void xorpd(Xmm dst, Xmm src) { this->regs({0x66, 0x0F, 0x57}, dst, src); }
+    void ucomisd(Xmm a, Xmm b) { this->regs({0x66, 0x0F, 0x2E}, a, b); }
+    void cvtsi2sd(Xmm dst, Reg src) { this->regs({0xF2, 0x48, 0x0F, 0x2A}, dst, src); }
+
+    void push(Reg src) { this->code.push_back(0x50 | src); }
+    void pop(Reg dst) { this->code.push_back(0x58 | dst); }
+    void call(Reg target) { this->regs({0xFF}, 2, target); }
+    void ret() { this->code.push_back(0xC3); }
+    void mov32(Reg dst, uint32_t value) {
+        this->code.push_back(0xB8 | dst);
+        this->imm(value);
+    }
+
+    // jumps return where their offset is for bind to fill in
+    size_t jcc(Cond cond) {
+        this->code.insert(this->code.end(), {0x0F, uint8_t(0x80 | cond)});
+        return this->offset();
+    }
+    size_t jmp() {
+        this->code.push_back(0xE9);
+        return this->offset();
+    }
+    void bind(size_t jump, size_t target) {
+        const int32_t rel = (int32_t)(target - (jump + 4));
+        std::memcpy(&this->code[jump], &rel, sizeof(rel));
+    }
+
+private:
+    template<typename T>
+    void imm(T value) {
+        const uint8_t* bytes = (const uint8_t*)&value;
+        this->code.insert(this->code.end(), bytes, bytes + sizeof(value));
+    }
+    size_t offset() {
+        this->imm((int32_t)0);
+        return this->here() - 4;
+    }
+};
+
+// a value on the stack of a trace, in a slot or a constant
+struct Operand {
+    Type type;
+    bool constant;
+    int64_t bits; // of the constant
+    size_t slot;
+};
+
+struct Exit {
+    uint64_t pc;
+    bool pop_iterator; // the range of the for loop ran out
+    std::vector<Type> types; // of the variables
+    std::vector<Operand> stack; // what the interpreter's stack holds above the loop's
+};
+
+}
+
+struct Trace {
+    std::vector<Variable> variables;
+    bool aliased;
+    bool for_loop;
+    std::vector<Exit> exits;
+    std::vector<int64_t> slots;
+    std::vector<Value*> homes; // where the variables are stored while it runs
+    uint32_t misses = 0;
+
+    void* memory = nullptr;
+    size_t size = 0;
+    uint32_t (*entry)(int64_t* slots) = nullptr;
+
+    ~Trace() {
+        if (this->memory != nullptr) {
+            munmap(this->memory, this->size);
+        }
+    }
+
+    // returns false without running if a variable does not have its type
+    bool enter(FrameState& frame);
+};
+
+namespace {
+
+class Compiler {
+public:
+    Compiler(Trace& trace, const Code& code) : trace(trace), code(code), types(trace.variables.size()) {
+        for (size_t i = 0; i < trace.variables.size(); ++i) {
+            this->types[i] = trace.variables[i].type;
+        }
+    }
+
+    bool compile(const std::vector<Step>& steps);
+
+private:
+    Trace& trace;
+    const Code& code;
+    Assembler as;
+    std::vector<Operand> stack;
+    std::vector<Type> types; // of the variables
+    std::vector<std::pair<size_t, uint32_t>> guards; // jumps to each exit
+    size_t max_depth = 0;
+
+    static int32_t disp(size_t slot) {
+        return (int32_t)(slot * sizeof(int64_t));
+    }
+    size_t home(int64_t variable) const {
+        return 1 + variable;
+    }
+    size_t stack_slot(size_t depth) const {
+        return 1 + this->trace.variables.size() + depth;
+    }
+
+    bool emit(const Step& step);
+    bool arithmetic(const Step& step);
+    bool compare(const Step& step);
+    bool branch(const Step& step);
+    void store(int64_t variable);
+
+    // leaves the trace when cond holds, to continue at pc with the stack as it is now
+    void exit_if(Cond cond, uint64_t pc, bool pop_iterator = false) {
+        this->trace.exits.push_back(Exit {pc, pop_iterator, this->types, this->stack});
+        this->guards.emplace_back(this->as.jcc(cond), this->trace.exits.size() - 1);
+    }
+
+    void load(Reg dst, const Operand& operand) {
+        if (operand.constant) {
+            this->as.mov(dst, operand.bits);
+        } else {
+            this->as.load(dst, RBX, disp(operand.slot));
+        }
+    }
+    // ints are converted like the interpreter's (double) casts, through rdx
+    void load(Xmm dst, const Operand& operand) {
+        if (operand.type != Type::FLOAT) {
+            this->load(RDX, operand);
+            this->as.cvtsi2sd(dst, RDX);
+        } else if (operand.constant) {
+            this->as.mov(RDX, operand.bits);
+            this->as.movq(dst, RDX);
+        } else {
+            this->as.load(dst, RBX, disp(operand.slot));
+        }
+    }
+
+    template<typename R>
+    void push(Type type, R src) {
+        const size_t slot = this->stack_slot(this->stack.size());
+        this->as.store(RBX, disp(slot), src);
+        this->stack.push_back(Operand {type, false, 0, slot});
+        this->max_depth = std::max(this->max_depth, this->stack.size());
+    }
+    void drop(size_t count) {
+        this->stack.resize(this->stack.size() - count);
+    }
+};
+
+bool Compiler::compile(const std::vector<Step>& steps) {
+    this->as.push(RBX);
+    this->as.mov(RBX, RDI);
+    const size_t top = this->as.here();
+    for (const Step& step : steps) {
+        if (!this->emit(step)) {
+            return false;
+        }
+    }
+    // the last step went back to the header, which expects the types it started with
+    if (!this->stack.empty() || this->types.size() != this->trace.variables.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < this->types.size(); ++i) {
+        if (this->types[i] != this->trace.variables[i].type) {
+            return false;
+        }
+    }
+    this->as.bind(this->as.jmp(), top);
+
+    for (const auto& guard : this->guards) {
+        this->as.bind(guard.first, this->as.here());
+        this->as.mov32(RAX, guard.second);
+        this->as.pop(RBX);
+        this->as.ret();
+    }
+
+    const size_t page = sysconf(_SC_PAGESIZE);
+    this->trace.size = (this->as.code.size() + page - 1) / page * page;
+    void* memory = mmap(nullptr, this->trace.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+    this->trace.memory = memory;
+    std::memcpy(memory, this->as.code.data(), this->as.code.size());
+    if (mprotect(memory, this->trace.size, PROT_READ | PROT_EXEC) != 0) {
+        return false;
+    }
+    this->trace.entry = (uint32_t (*)(int64_t*))memory;
+    this->trace.slots.resize(this->stack_slot(this->max_depth));
+    this->trace.homes.resize(this->trace.variables.size());
+    return true;
+}
+
+bool Compiler::emit(const Step& step) {
+    const Code::Instruction& instr = step.instr;
+    switch (instr.bytecode) {
+        case op::NOP:
+        case op::JUMP_ABSOLUTE:
+        case op::JUMP_FORWARD:
+            return true;
+        case op::FOR_ITER:
+        {
+            // next() of the range_generator in slot 0, whose layout is taken from one
+            builtins::range_generator range(0, 0, 0);
+            const int32_t stop = (int32_t)((char*)&range.stop - (char*)&range.start);
+            const int32_t step_size = (int32_t)((char*)&range.step_size - (char*)&range.start);
+            this->as.load(RDX, RBX, disp(0));
+            this->as.load(RAX, RDX, 0);
+            this->as.cmp(RAX, RDX, stop);
+            this->exit_if(CC_GE, instr.arg, true);
+            this->as.mov(RCX, RAX);
+            this->as.add(RCX, RDX, step_size);
+            this->as.store(RDX, 0, RCX);
+            this->push(Type::INT, RAX);
+            return true;
+        }
+        case op::LOAD_FAST:
+        case op::LOAD_NAME:
+        case op::LOAD_GLOBAL:
+            this->stack.push_back(Operand {this->types[step.variable], false, 0, this->home(step.variable)});
+            this->max_depth = std::max(this->max_depth, this->stack.size());
+            return true;
+        case op::STORE_FAST:
+        case op::STORE_NAME:
+        case op::STORE_GLOBAL:
+            this->store(step.variable);
+            return true;
+        case op::LOAD_CONST:
+        {
+            const Value& value = this->code.co_consts[instr.arg];
+            this->stack.push_back(Operand {type_of(value), true, unbox(value), 0});
+            this->max_depth = std::max(this->max_depth, this->stack.size());
+            return true;
+        }
+        case op::POP_TOP:
+            this->drop(1);
+            return true;
+        case op::UNARY_NEGATIVE:
+        {
+            const Operand a = this->stack.back();
+            if (a.type == Type::INT) {
+                this->load(RAX, a);
+                this->as.neg(RAX);
+                // -INT64_MIN is a BigInt
+                this->exit_if(CC_O, step.pc);
+                this->drop(1);
+                this->push(Type::INT, RAX);
+            } else {
+                this->load(XMM0, a);
+                this->as.mov(RDX, INT64_MIN);
+                this->as.movq(XMM1, RDX);
+                this->as.xorpd(XMM0, XMM1);
+                this->drop(1);
+                this->push(Type::FLOAT, XMM0);
+            }
+            return true;
+        }
+        case op::COMPARE_OP:
+            return this->compare(step);
+        case op::POP_JUMP_IF_FALSE:
+        case op::POP_JUMP_IF_TRUE:
+            return this->branch(step);
+        default:
+            if (is_binary(instr.bytecode)) {
+                return this->arithmetic(step);
+            }
+            return false;
+    }
+}
+
+bool Compiler::arithmetic(const Step& step) {
+    const Operand a = this->stack[this->stack.size() - 2];
+    const Operand b = this->stack.back();
+    const Code::ByteCode bytecode = binary_op(step.instr.bytecode);
+    if (a.type == Type::INT && b.type == Type::INT && bytecode != op::BINARY_TRUE_DIVIDE) {
+        this->load(RAX, a);
+        this->load(RCX, b);
+        switch (bytecode) {
+            case op::BINARY_ADD: this->as.add(RAX, RCX); break;
+            case op::BINARY_SUBTRACT: this->as.sub(RAX, RCX); break;
+            case op::BINARY_MULTIPLY: this->as.imul(RAX, RCX); break;
+            case op::BINARY_FLOOR_DIVIDE:
+            case op::BINARY_MODULO:
+            {
+                // the interpreter raises for 0 and handles -1, which could overflow
+                this->as.test(RCX, RCX);
+                this->exit_if(CC_E, step.pc);
+                this->as.cmp(RCX, (int8_t)-1);
+                this->exit_if(CC_E, step.pc);
+                this->as.cqo();
+                this->as.idiv(RCX);
+                // round towards negative infinity like op_divide and op_modulo
+                this->as.test(RDX, RDX);
+                const size_t exact = this->as.jcc(CC_E);
+                this->as.mov(RSI, RDX);
+                this->as.xor_(RSI, RCX);
+                const size_t same_sign = this->as.jcc(CC_NS);
+                this->as.sub(RAX, (int8_t)1);
+                this->as.add(RDX, RCX);
+                this->as.bind(exact, this->as.here());
+                this->as.bind(same_sign, this->as.here());
+                this->drop(2);
+                this->push(Type::INT, bytecode == op::BINARY_FLOOR_DIVIDE ? RAX : RDX);
+                return true;
+            }
+            default:
+                return false;
+        }
+        // an int that overflows is a BigInt, which the interpreter makes
+        this->exit_if(CC_O, step.pc);
+        this->drop(2);
+        this->push(Type::INT, RAX);
+        return true;
+    }
+
+    this->load(XMM0, a);
+    this->load(XMM1, b);
+    switch (bytecode) {
+        case op::BINARY_ADD: this->as.addsd(XMM0, XMM1); break;
+        case op::BINARY_SUBTRACT: this->as.subsd(XMM0, XMM1); break;
+        case op::BINARY_MULTIPLY: this->as.mulsd(XMM0, XMM1); break;
+        case op::BINARY_TRUE_DIVIDE: this->as.divsd(XMM0, XMM1); break;
+        case op::BINARY_POWER:
+        {
+            double (*power)(double, double) = std::pow;
+            this->as.mov(RAX, (int64_t)power);
+            this->as.call(RAX);
+            break;
+        }
+        default:
+            return false;
+    }
+    this->drop(2);
+    this->push(Type::FLOAT, XMM0);
+    return true;
+}
+
+bool Compiler::compare(const Step& step) {
+    const Operand a = this->stack[this->stack.size() - 2];
+    const Operand b = this->stack.back();
+    const uint64_t cmp = step.instr.arg;
+    if (a.type == Type::INT && b.type == Type::INT) {
+        this->load(RAX, a);
+        this->load(RCX, b);
+        this->as.cmp(RAX, RCX);
+        switch (cmp) {
+            case op::cmp::LT: this->as.setcc(CC_L, RAX); break;
+            case op::cmp::LTE: this->as.setcc(CC_LE, RAX); break;
+            case op::cmp::GT: this->as.setcc(CC_G, RAX); break;
+            case op::cmp::GTE: this->as.setcc(CC_GE, RAX); break;
+            case op::cmp::EQ: this->as.setcc(CC_E, RAX); break;
+            case op::cmp::NEQ: this->as.setcc(CC_NE, RAX); break;
+            default: return false;
+        }
+    } else {
+        // ucomisd leaves the flags of an unsigned compare, and all of them set
+        // when either side is a NaN, which compares false for all but !=
+        this->load(XMM0, a);
+        this->load(XMM1, b);
+        switch (cmp) {
+            case op::cmp::LT: this->as.ucomisd(XMM1, XMM0); this->as.setcc(CC_A, RAX); break;
+            case op::cmp::LTE: this->as.ucomisd(XMM1, XMM0); this->as.setcc(CC_AE, RAX); break;
+            case op::cmp::GT: this->as.ucomisd(XMM0, XMM1); this->as.setcc(CC_A, RAX); break;
+            case op::cmp::GTE: this->as.ucomisd(XMM0, XMM1); this->as.setcc(CC_AE, RAX); break;
+            case op::cmp::EQ:
+                this->as.ucomisd(XMM0, XMM1);
+                this->as.setcc(CC_E, RAX);
+                this->as.setcc(CC_NP, RCX);
+                this->as.and8(RAX, RCX);
+                break;
+            case op::cmp::NEQ:
+                this->as.ucomisd(XMM0, XMM1);
+                this->as.setcc(CC_NE, RAX);
+                this->as.setcc(CC_P, RCX);
+                this->as.or8(RAX, RCX);
+                break;
+            default:
+                return false;
+        }
+    }
+    this->as.movzx8(RAX, RAX);
+    this->drop(2);
+    this->push(Type::BOOL, RAX);
+    return true;
+}
+
+bool Compiler::branch(const Step& step) {
+    const Operand condition = this->stack.back();
+    // leaves ZF clear when the condition is truthy
+    if (condition.type == Type::FLOAT) {
+        this->load(XMM0, condition);
+        this->as.xorpd(XMM1, XMM1);
+        this->as.ucomisd(XMM0, XMM1);
+        this->as.setcc(CC_NE, RAX);
+        this->as.setcc(CC_P, RCX);
+        this->as.or8(RAX, RCX);
+    } else {
+        this->load(RAX, condition);
+        this->as.test(RAX, RAX);
+    }
+    this->drop(1);
+
+    // exit to where the branch did not go while recording
+    const bool jumps_if_truthy = step.instr.bytecode == op::POP_JUMP_IF_TRUE;
+    const bool was_truthy = step.taken == jumps_if_truthy;
+    this->exit_if(was_truthy ? CC_E : CC_NE, step.taken ? step.pc + 1 : step.instr.arg);
+    return true;
+}
+
+void Compiler::store(int64_t variable) {
+    const Operand value = this->stack.back();
+    this->stack.pop_back();
+    const size_t home = this->home(variable);
+    // what was loaded from the variable before keeps the old value
+    for (size_t i = 0; i < this->stack.size(); ++i) {
+        Operand& operand = this->stack[i];
+        if (!operand.constant && operand.slot == home) {
+            operand.slot = this->stack_slot(i);
+            this->as.load(RAX, RBX, disp(home));
+            this->as.store(RBX, disp(operand.slot), RAX);
+        }
+    }
+    if (value.constant || value.slot != home) {
+        this->load(RAX, value);
+        this->as.store(RBX, disp(home), RAX);
+    }
+    this->types[variable] = value.type;
+}
+
+}
+
+bool Trace::enter(FrameState& frame) {
+    Namespace& globals = frame.interpreter_state->ns_globals;
+    if ((frame.ns_local.get() == globals.get()) != this->aliased) {
+        return false;
+    }
+    for (size_t i = 0; i < this->variables.size(); ++i) {
+        const Variable& variable = this->variables[i];
+        auto& ns = variable.global ? *globals : *frame.ns_local;
+        auto found = ns.find(variable.name);
+        if (found == ns.end() || type_of(found->second) != variable.type) {
+            return false;
+        }
+        this->homes[i] = &found->second;
+        this->slots[1 + i] = unbox(found->second);
+    }
+    if (this->for_loop) {
+        auto generator = std::get_if<ValueCGenerator>(&frame.value_stack.back());
+        auto range = generator != nullptr ? dynamic_cast<builtins::range_generator*>(generator->get()) : nullptr;
+        if (range == nullptr) {
+            return false;
+        }
+        this->slots[0] = (int64_t)&range->start;
+    }
+
+    const Exit& exit = this->exits[this->entry(this->slots.data())];
+    DEBUG_ADV("trace exited to " << exit.pc);
+    for (size_t i = 0; i < this->variables.size(); ++i) {
+        *this->homes[i] = box(this->slots[1 + i], exit.types[i]);
+    }
+    if (exit.pop_iterator) {
+        frame.value_stack.pop_back();
+    }
+    for (const Operand& operand : exit.stack) {
+        frame.value_stack.push_back(box(operand.constant ? operand.bits : this->slots[operand.slot], operand.type));
+    }
+    frame.r_pc = exit.pc;
+    return true;
+}
+
+Loops::Loops(size_t instructions) : backedges(instructions, 0) {
+}
+
+Loops::~Loops() {
+}
+
+bool run_trace(FrameState& frame) {
+    Loops& loops = *frame.code->loops;
+    auto found = loops.traces.find(frame.r_pc);
+    if (found == loops.traces.end()) {
+        return false;
+    }
+    if (!found->second->enter(frame) && ++found->second->misses == MAX_MISSES) {
+        loops.backedges[frame.r_pc] = COLD_LOOP;
+        loops.traces.erase(found);
+    }
+    return true;
+}
+
+Recorder::Recorder(FrameState& frame) : header(frame.r_pc) {
+    recording = true;
+    this->aliased = frame.ns_local.get() == frame.interpreter_state->ns_globals.get();
+}
+
+Recorder::~Recorder() {
+    recording = false;
+}
+
+int64_t Recorder::variable(const std::string& name, bool global) {
+    global = global && !this->aliased;
+    for (size_t i = 0; i < this->variables.size(); ++i) {
+        if (this->variables[i].name == name && this->variables[i].global == global) {
+            return i;
+        }
+    }
+    this->variables.push_back(Variable {name, global, Type::NONE});
+    this->current.push_back(Type::NONE);
+    return this->variables.size() - 1;
+}
+
+bool Recorder::before(const FrameState& frame) {
+    if (this->steps.size() == MAX_TRACE) {
+        return false;
+    }
+    const Code& code = *frame.code;
+    const Code::Instruction& instr = code.instructions[frame.r_pc];
+    Step step {instr, frame.r_pc};
+    std::vector<Type>& types = this->types;
+
+    switch (instr.bytecode) {
+        case op::NOP:
+        case op::JUMP_ABSOLUTE:
+        case op::JUMP_FORWARD:
+            break;
+        case op::FOR_ITER:
+        {
+            // the loop's own header, any other is a loop inside it
+            if (!this->steps.empty() || frame.value_stack.empty()) {
+                return false;
+            }
+            auto generator = std::get_if<ValueCGenerator>(&frame.value_stack.back());
+            if (generator == nullptr || dynamic_cast<builtins::range_generator*>(generator->get()) == nullptr) {
+                return false;
+            }
+            types.push_back(Type::INT);
+            break;
+        }
+        case op::LOAD_FAST:
+        case op::LOAD_NAME:
+        case op::LOAD_GLOBAL:
+        case op::STORE_FAST:
+        case op::STORE_NAME:
+        case op::STORE_GLOBAL:
+        {
+            const bool fast = instr.bytecode == op::LOAD_FAST || instr.bytecode == op::STORE_FAST;
+            const bool global = instr.bytecode == op::LOAD_GLOBAL || instr.bytecode == op::STORE_GLOBAL;
+            const std::vector<std::string>& names = fast ? code.co_varnames : code.co_names;
+            if (instr.arg >= names.size()) {
+                return false;
+            }
+            const std::string& name = names[instr.arg];
+            if (instr.bytecode == op::STORE_FAST || instr.bytecode == op::STORE_NAME || instr.bytecode == op::STORE_GLOBAL) {
+                if (types.empty()) {
+                    return false;
+                }
+                step.variable = this->variable(name, global);
+                this->current[step.variable] = types.back();
+                types.pop_back();
+                break;
+            }
+
+            // a LOAD_NAME of a global or a builtin, or a LOAD_GLOBAL of a builtin,
+            // looks in more than one namespace
+            const auto& ns = global ? *frame.interpreter_state->ns_globals : *frame.ns_local;
+            auto found = ns.find(name);
+            if (found == ns.end()) {
+                return false;
+            }
+            const Type type = type_of(found->second);
+            if (type == Type::NONE) {
+                return false;
+            }
+            step.variable = this->variable(name, global);
+            if (this->current[step.variable] == Type::NONE) {
+                this->variables[step.variable].type = type;
+                this->current[step.variable] = type;
+            } else if (this->current[step.variable] != type) {
+                return false;
+            }
+            types.push_back(type);
+            break;
+        }
+        case op::LOAD_CONST:
+        {
+            const Type type = type_of(code.co_consts[instr.arg]);
+            if (type == Type::NONE) {
+                return false;
+            }
+            types.push_back(type);
+            break;
+        }
+        case op::POP_TOP:
+            if (types.empty()) {
+                return false;
+            }
+            types.pop_back();
+            break;
+        case op::UNARY_NEGATIVE:
+            if (types.empty() || !is_number(types.back())) {
+                return false;
+            }
+            break;
+        case op::COMPARE_OP:
+            if (types.size() < 2 || instr.arg > op::cmp::GTE
+                    || !is_number(types.back()) || !is_number(types[types.size() - 2])) {
+                return false;
+            }
+            types.pop_back();
+            types.back() = Type::BOOL;
+            break;
+        case op::POP_JUMP_IF_FALSE:
+        case op::POP_JUMP_IF_TRUE:
+            if (types.empty()) {
+                return false;
+            }
+            types.pop_back();
+            break;
+        default:
+        {
+            if (!is_binary(instr.bytecode) || types.size() < 2) {
+                return false;
+            }
+            const Type a = types[types.size() - 2];
+            const Type b = types.back();
+            if (!is_number(a) || !is_number(b)) {
+                return false;
+            }
+            const bool ints = a == Type::INT && b == Type::INT;
+            Type result = ints ? Type::INT : Type::FLOAT;
+            switch (binary_op(instr.bytecode)) {
+                case op::BINARY_TRUE_DIVIDE:
+                    result = Type::FLOAT;
+                    break;
+                case op::BINARY_FLOOR_DIVIDE:
+                case op::BINARY_MODULO:
+                    // floats go through fmod and floor in the interpreter
+                    if (!ints) return false;
+                    break;
+                case op::BINARY_POWER:
+                    // an int power is exact, which pow is not
+                    if (ints) return false;
+                    break;
+                default:
+                    break;
+            }
+            types.pop_back();
+            types.back() = result;
+            break;
+        }
+    }
+    this->steps.push_back(step);
+    return true;
+}
+
+bool Recorder::after(const FrameState& frame) {
+    if (frame.interpreter_state->cur_frame.get() != &frame) {
+        return false;
+    }
+    Step& step = this->steps.back();
+    if (step.instr.bytecode == op::FOR_ITER) {
+        // the range ran out, this was the last iteration
+        if (frame.r_pc != step.pc + 1) return false;
+    } else if (Code::is_jump(step.instr.bytecode)) {
+        step.taken = frame.r_pc != step.pc + 1;
+    }
+    // the result has the type the trace gives it, an int that overflowed does not
+    if (!this->types.empty() && type_of(frame.value_stack.back()) != this->types.back()) {
+        return false;
+    }
+    if (frame.r_pc == this->header) {
+        this->closed = true;
+        return false;
+    }
+    // a jump back to anywhere else is a loop inside this one
+    return frame.r_pc > step.pc;
+}
+
+void Recorder::finish(FrameState& frame) {
+    Loops& loops = *frame.code->loops;
+    if (this->closed && this->types.empty()) {
+        // the variables that were stored before they were loaded have the type
+        // they were stored with, the others have to keep theirs
+        bool stable = true;
+        for (size_t i = 0; i < this->variables.size(); ++i) {
+            if (this->variables[i].type == Type::NONE) {
+                this->variables[i].type = this->current[i];
+            } else if (this->variables[i].type != this->current[i]) {
+                stable = false;
+            }
+        }
+
+        auto trace = std::make_unique<Trace>();
+        trace->variables = this->variables;
+        trace->aliased = this->aliased;
+        trace->for_loop = this->steps.front().instr.bytecode == op::FOR_ITER;
+        if (stable && Compiler(*trace, *frame.code).compile(this->steps)) {
+            DEBUG_ADV("compiled a trace of " << this->steps.size() << " instructions at " << this->header);
+            loops.traces[this->header] = std::move(trace);
+            return ;
+        }
+    }
+    uint8_t& failures = loops.failures[this->header];
+    loops.backedges[this->header] = ++failures < MAX_FAILURES ? 0 : COLD_LOOP;
+}
+
+}
+}
@@ -0,0 +1,109 @@
+#pragma once
+#ifndef PYJIT_H
+#define PYJIT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pycode.hpp"
+#include "optflags.hpp"
+
+/*
+    A tracing JIT for hot loops. The interpreter counts the backward jumps to
+    every instruction, the header of a loop. Once a header is hot the next
+    iteration is recorded while the interpreter steps through it, together with
+    the types it saw, and compiled to x86-64 that keeps ints and floats unboxed.
+    Everything the trace assumed is guarded, it leaves the loop to the
+    interpreter at the instruction where a guard failed. Defined in pyjit.cpp
+*/
+
+namespace py {
+
+struct FrameState;
+
+namespace jit {
+
+// backward jumps to a loop header before the loop is traced
+constexpr uint16_t HOT_LOOP = 1000;
+// the counter of a loop that is not traced again
+constexpr uint16_t COLD_LOOP = UINT16_MAX;
+
+// the types a trace keeps unboxed, NONE for everything else
+enum class Type : uint8_t {
+    NONE,
+    INT,
+    FLOAT,
+    BOOL
+};
+
+struct Trace;
+
+// the loops of a code object, it creates them when it is loaded
+struct Loops {
+    std::vector<uint16_t> backedges; // backward jumps taken to each instruction
+    std::unordered_map<uint64_t, std::unique_ptr<Trace>> traces; // by header
+    std::unordered_map<uint64_t, uint8_t> failures; // recordings that failed, by header
+
+    Loops(size_t instructions);
+    ~Loops();
+};
+
+// set while a trace is being recorded on this thread, no other trace is recorded
+// or run then
+extern thread_local bool recording;
+
+// Runs the trace of the loop whose header is at frame.r_pc if the values it
+// works on have the types it was compiled for, and leaves r_pc where the trace
+// exited. Returns false if the loop has no trace
+bool run_trace(FrameState& frame);
+
+// A variable a trace works on, global ones are in the interpreter's globals
+struct Variable {
+    std::string name;
+    bool global;
+    Type type; // its type at the loop header
+};
+
+// One instruction of a recorded iteration
+struct Step {
+    Code::Instruction instr;
+    uint64_t pc;
+    int64_t variable = -1; // for loads and stores
+    bool taken = false; // for branches
+};
+
+// Records one iteration of the loop at frame.r_pc as the interpreter steps
+// through it, and compiles it once the loop closes
+class Recorder {
+public:
+    Recorder(FrameState& frame);
+    ~Recorder();
+
+    // called before the interpreter runs the instruction at r_pc, returns false
+    // to stop recording before it
+    bool before(const FrameState& frame);
+    // called after it ran, returns false to stop recording
+    bool after(const FrameState& frame);
+    // compiles the trace if the loop closed, otherwise leaves the loop to the
+    // interpreter for a while or for good
+    void finish(FrameState& frame);
+
+private:
+    uint64_t header;
+    bool aliased; // whether globals are the frame's locals, as in a module
+    bool closed = false;
+    std::vector<Step> steps;
+    std::vector<Variable> variables; // typed NONE until one is loaded before it is stored
+    std::vector<Type> current; // the variables' types so far
+    std::vector<Type> types; // of the values the iteration pushed
+
+    int64_t variable(const std::string& name, bool global);
+};
+
+}
+}
+
+#endif
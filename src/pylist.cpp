@@ -0,0 +1,260 @@
+#include <algorithm>
+
+#include "pyvalue.hpp"
+#include "pyvalue_helpers.hpp"
+
+namespace py {
+namespace value {
+
+namespace {
+
+inline List::Strategy strategy_for(const Value& value) {
+    if (std::holds_alternative<int64_t>(value)) {
+        return List::INTS;
+    } else if (std::holds_alternative<double>(value)) {
+        return List::DOUBLES;
+    }
+    return List::OBJECTS;
+}
+
+template<typename It>
+List::Strategy strategy_for(It first, It last) {
+    if (first == last) {
+        return List::INTS;
+    }
+    const List::Strategy strategy = strategy_for(*first);
+    for (++first; first != last && strategy != List::OBJECTS; ++first) {
+        if (strategy_for(*first) != strategy) {
+            return List::OBJECTS;
+        }
+    }
+    return strategy;
+}
+
+template<typename T, typename It>
+void unbox(std::vector<T>& out, It first, It last) {
+    out.reserve(out.size() + std::distance(first, last));
+    for (; first != last; ++first) {
+        out.push_back(std::get<T>(*first));
+    }
+}
+
+template<typename T>
+void box(std::vector<Value>& out, const std::vector<T>& in, size_t first, int64_t step, size_t length) {
+    out.reserve(out.size() + length);
+    for (size_t i = 0; i < length; ++i, first += step) {
+        out.push_back(in[first]);
+    }
+}
+
+template<typename T>
+void copy_strided(std::vector<T>& out, const std::vector<T>& in, int64_t first, int64_t step, size_t length) {
+    if (step == 1) {
+        out.insert(out.end(), in.begin() + first, in.begin() + first + length);
+        return;
+    }
+    out.reserve(out.size() + length);
+    for (size_t i = 0; i < length; ++i, first += step) {
+        out.push_back(in[first]);
+    }
+}
+
+}
+
+List::List(std::vector<Value>&& items) {
+    this->strategy = strategy_for(items.begin(), items.end());
+    switch (this->strategy) {
+        case INTS: unbox(this->ints, items.begin(), items.end()); break;
+        case DOUBLES: unbox(this->doubles, items.begin(), items.end()); break;
+        default: this->values = std::move(items);
+    }
+}
+
+List::List(std::vector<Value>::const_iterator first, std::vector<Value>::const_iterator last) {
+    this->strategy = strategy_for(first, last);
+    switch (this->strategy) {
+        case INTS: unbox(this->ints, first, last); break;
+        case DOUBLES: unbox(this->doubles, first, last); break;
+        default: this->values.assign(first, last);
+    }
+}
+
+bool List::accepts(const Value& value) {
+    if (this->size() == 0) {
+        this->strategy = strategy_for(value);
+        return true;
+    }
+    switch (this->strategy) {
+        case INTS: return std::holds_alternative<int64_t>(value);
+        case DOUBLES: return std::holds_alternative<double>(value);
+        default: return true;
+    }
+}
+
+void List::append_slow(const Value& value) {
+    if (!this->accepts(value)) {
+        this->generic();
+    }
+    this->append(value);
+}
+
+void List::insert(size_t index, const Value& value) {
+    write_barrier(value);
+    if (!this->accepts(value)) {
+        this->generic();
+    }
+    switch (this->strategy) {
+        case INTS: this->ints.insert(this->ints.begin() + index, std::get<int64_t>(value)); break;
+        case DOUBLES: this->doubles.insert(this->doubles.begin() + index, std::get<double>(value)); break;
+        default: this->values.insert(this->values.begin() + index, value);
+    }
+}
+
+void List::erase(size_t first, size_t last) {
+    switch (this->strategy) {
+        case INTS: this->ints.erase(this->ints.begin() + first, this->ints.begin() + last); break;
+        case DOUBLES: this->doubles.erase(this->doubles.begin() + first, this->doubles.begin() + last); break;
+        default: this->values.erase(this->values.begin() + first, this->values.begin() + last);
+    }
+}
+
+void List::splice(size_t first, size_t count, const std::vector<Value>& items) {
+    if (count == this->size()) {
+        // every item is replaced, so the new items alone pick the strategy
+        *this = List(items.begin(), items.end());
+        write_barrier(this->values.begin(), this->values.end());
+        return;
+    }
+    if (strategy_for(items.begin(), items.end()) != this->strategy && !items.empty()) {
+        this->generic();
+    }
+    this->erase(first, first + count);
+    switch (this->strategy) {
+        case INTS: {
+            std::vector<int64_t> unboxed;
+            unbox(unboxed, items.begin(), items.end());
+            this->ints.insert(this->ints.begin() + first, unboxed.begin(), unboxed.end());
+            break;
+        }
+        case DOUBLES: {
+            std::vector<double> unboxed;
+            unbox(unboxed, items.begin(), items.end());
+            this->doubles.insert(this->doubles.begin() + first, unboxed.begin(), unboxed.end());
+            break;
+        }
+        default:
+            write_barrier(items.begin(), items.end());
+            this->values.insert(this->values.begin() + first, items.begin(), items.end());
+    }
+}
+
+void List::extend(const List& other) {
+    if (&other == this) {
+        const List copy = other;
+        this->extend(copy);
+        return;
+    }
+    if (other.size() == 0) {
+        return;
+    }
+    if (this->size() == 0) {
+        this->strategy = other.strategy;
+    }
+
+    if (this->strategy == other.strategy) {
+        this->reserve(this->size() + other.size());
+        switch (this->strategy) {
+            case INTS: this->ints.insert(this->ints.end(), other.ints.begin(), other.ints.end()); break;
+            case DOUBLES: this->doubles.insert(this->doubles.end(), other.doubles.begin(), other.doubles.end()); break;
+            default:
+                write_barrier(other.values.begin(), other.values.end());
+                this->values.insert(this->values.end(), other.values.begin(), other.values.end());
+        }
+        return;
+    }
+
+    std::vector<Value>& values = this->generic();
+    switch (other.strategy) {
+        case INTS: box(values, other.ints, 0, 1, other.size()); break;
+        case DOUBLES: box(values, other.doubles, 0, 1, other.size()); break;
+        default:
+            write_barrier(other.values.begin(), other.values.end());
+            values.insert(values.end(), other.values.begin(), other.values.end());
+    }
+}
+
+void List::reserve(size_t n) {
+    switch (this->strategy) {
+        case INTS: this->ints.reserve(n); break;
+        case DOUBLES: this->doubles.reserve(n); break;
+        default: this->values.reserve(n);
+    }
+}
+
+void List::clear() {
+    this->ints.clear();
+    this->doubles.clear();
+    this->values.clear();
+    this->strategy = INTS;
+}
+
+void List::copy_slice(List& out, int64_t first, int64_t step, size_t length) const {
+    if (length == 0) {
+        return;
+    }
+    if (out.size() == 0) {
+        out.strategy = this->strategy;
+    }
+    if (out.strategy != this->strategy) {
+        std::vector<Value>& values = out.generic();
+        switch (this->strategy) {
+            case INTS: box(values, this->ints, first, step, length); break;
+            case DOUBLES: box(values, this->doubles, first, step, length); break;
+            default:
+                copy_strided(values, this->values, first, step, length);
+                write_barrier(values.end() - length, values.end());
+        }
+        return;
+    }
+    switch (this->strategy) {
+        case INTS: copy_strided(out.ints, this->ints, first, step, length); break;
+        case DOUBLES: copy_strided(out.doubles, this->doubles, first, step, length); break;
+        default:
+            copy_strided(out.values, this->values, first, step, length);
+            write_barrier(out.values.end() - length, out.values.end());
+    }
+}
+
+bool List::contains(const Value& value) const {
+    // a typed list is searched without boxing when the value has the same type
+    if (this->strategy == INTS) {
+        if (auto i = std::get_if<int64_t>(&value)) {
+            return std::find(this->ints.begin(), this->ints.end(), *i) != this->ints.end();
+        }
+    } else if (this->strategy == DOUBLES) {
+        if (auto d = std::get_if<double>(&value)) {
+            return std::find(this->doubles.begin(), this->doubles.end(), *d) != this->doubles.end();
+        }
+    }
+    for (size_t i = 0; i < this->size(); ++i) {
+        if (value_helper::values_equal(this->get(i), value)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<Value>& List::generic() {
+    if (this->strategy == INTS) {
+        box(this->values, this->ints, 0, 1, this->ints.size());
+        std::vector<int64_t>().swap(this->ints);
+    } else if (this->strategy == DOUBLES) {
+        box(this->values, this->doubles, 0, 1, this->doubles.size());
+        std::vector<double>().swap(this->doubles);
+    }
+    this->strategy = OBJECTS;
+    return this->values;
+}
+
+}
+}
@@ -38,8 +38,12 @@ struct op_lt { // a < b
         return v1 < v2;
     }
 
-    constexpr const static char* l_attr = "__lt__";
-    constexpr const static char* r_attr = "__gt__";
+    static bool action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::compare(v1, v2) < 0;
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::LT;
+    constexpr const static value::slot::Slot r_slot = value::slot::GT;
     constexpr const static char* op_name = "<";
 };
 
@@ -49,8 +53,12 @@ struct op_lte { // a <= b
         return v1 <= v2;
     }
 
-    constexpr const static char* l_attr = "__le__";
-    constexpr const static char* r_attr = "__ge__";
+    static bool action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::compare(v1, v2) <= 0;
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::LE;
+    constexpr const static value::slot::Slot r_slot = value::slot::GE;
     constexpr const static char* op_name = "<=";
 };
 
@@ -60,8 +68,12 @@ struct op_gt { // a > b
         return v1 > v2;
     }
 
-    constexpr const static char* l_attr = "__gt__";
-    constexpr const static char* r_attr = "__lt__";
+    static bool action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::compare(v1, v2) > 0;
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::GT;
+    constexpr const static value::slot::Slot r_slot = value::slot::LT;
     constexpr const static char* op_name = ">";
 };
 
@@ -71,8 +83,12 @@ struct op_gte { // a >= b
         return v1 >= v2;
     }
 
-    constexpr const static char* l_attr = "__ge__";
-    constexpr const static char* r_attr = "__le__";
+    static bool action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::compare(v1, v2) >= 0;
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::GE;
+    constexpr const static value::slot::Slot r_slot = value::slot::LE;
     constexpr const static char* op_name = ">=";
 };
 
@@ -82,8 +98,12 @@ struct op_eq { // a == b
         return v1 == v2;
     }
 
-    constexpr const static char* l_attr = "__eq__";
-    constexpr const static char* r_attr = "__eq__";
+    static bool action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::compare(v1, v2) == 0;
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::EQ;
+    constexpr const static value::slot::Slot r_slot = value::slot::EQ;
     constexpr const static char* op_name = "==";
 };
 
@@ -93,8 +113,12 @@ struct op_neq { // a != b
         return v1 != v2;
     }
 
-    constexpr const static char* l_attr = "__ne__";
-    constexpr const static char* r_attr = "__ne__";
+    static bool action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::compare(v1, v2) != 0;
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::NE;
+    constexpr const static value::slot::Slot r_slot = value::slot::NE;
     constexpr const static char* op_name = "!=";
 };
 
@@ -104,8 +128,20 @@ struct op_sub { // a - b
         return v1 - v2;
     }
 
-    constexpr const static char* l_attr = "__sub__";
-    constexpr const static char* r_attr = "__rsub__";
+    static Value action(int64_t v1, int64_t v2) {
+        int64_t result;
+        if (__builtin_expect(__builtin_sub_overflow(v1, v2, &result), 0)) {
+            return value::BigInt::sub_int64(v1, v2);
+        }
+        return result;
+    }
+
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::to_value(value::BigInt::sub(v1, v2));
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::SUB;
+    constexpr const static value::slot::Slot r_slot = value::slot::RSUB;
     constexpr const static char* op_name = "-";
 };
 
@@ -115,8 +151,20 @@ struct op_add { // a + b
         return v1 + v2;
     }
 
-    constexpr const static char* l_attr = "__add__";
-    constexpr const static char* r_attr = "__radd__";
+    static Value action(int64_t v1, int64_t v2) {
+        int64_t result;
+        if (__builtin_expect(__builtin_add_overflow(v1, v2, &result), 0)) {
+            return value::BigInt::add_int64(v1, v2);
+        }
+        return result;
+    }
+
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::to_value(value::BigInt::add(v1, v2));
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::ADD;
+    constexpr const static value::slot::Slot r_slot = value::slot::RADD;
     constexpr const static char* op_name = "+";
 };
 
@@ -126,8 +174,20 @@ struct op_mult { // a * b
         return v1 * v2;
     }
 
-    constexpr const static char* l_attr = "__mul__";
-    constexpr const static char* r_attr = "__rmul__";
+    static Value action(int64_t v1, int64_t v2) {
+        int64_t result;
+        if (__builtin_expect(__builtin_mul_overflow(v1, v2, &result), 0)) {
+            return value::BigInt::mul_int64(v1, v2);
+        }
+        return result;
+    }
+
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::to_value(value::BigInt::mul(v1, v2));
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::MUL;
+    constexpr const static value::slot::Slot r_slot = value::slot::RMUL;
     constexpr const static char* op_name = "*";
 };
 
@@ -137,8 +197,28 @@ struct op_divide { // a // b
         return (int64_t)(v1 / v2);
     }
 
-    constexpr const static char* l_attr = "__floordiv__";
-    constexpr const static char* r_attr = "__rfloordiv__";
+    // rounds towards negative infinity like python, not towards zero like C++
+    static Value action(int64_t v1, int64_t v2) {
+        if (v2 == 0) {
+            throw pyerror("ZeroDivisionError: integer division or modulo by zero");
+        } else if (__builtin_expect(v1 == INT64_MIN && v2 == -1, 0)) {
+            return value::BigInt::sub_int64(0, v1);
+        }
+        int64_t quotient = v1 / v2;
+        if (v1 % v2 != 0 && (v1 < 0) != (v2 < 0)) {
+            quotient--;
+        }
+        return quotient;
+    }
+
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        value::BigInt quotient;
+        value::BigInt::divmod(v1, v2, &quotient, nullptr);
+        return value::BigInt::to_value(std::move(quotient));
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::FLOORDIV;
+    constexpr const static value::slot::Slot r_slot = value::slot::RFLOORDIV;
     constexpr const static char* op_name = "//";
 };
 
@@ -148,14 +228,33 @@ struct op_true_div { // a / b
         return (double)v1 / (double)v2;
     }
 
-    constexpr const static char* l_attr = "__truediv__";
-    constexpr const static char* r_attr = "__rtruediv__";
+    static double action(const value::BigInt& v1, const value::BigInt& v2) {
+        return v1.to_double() / v2.to_double();
+    }
+
+    constexpr const static value::slot::Slot l_slot = value::slot::TRUEDIV;
+    constexpr const static value::slot::Slot r_slot = value::slot::RTRUEDIV;
     constexpr const static char* op_name = "/";
 };
 
 struct op_pow { // a ** b
-    static auto action(int64_t v1,int64_t v2) {
-        return (int64_t)pow(v1,v2);
+    static Value action(int64_t v1,int64_t v2) {
+        if (v2 < 0) {
+            return pow((double)v1, (double)v2);
+        }
+        // square and multiply, squaring overflows only if the result would too
+        int64_t result = 1, base = v1;
+        for (uint64_t exp = v2; ; ) {
+            if ((exp & 1) && __builtin_mul_overflow(result, base, &result)) {
+                return value::BigInt::pow_int64(v1, v2);
+            }
+            exp >>= 1;
+            if (exp == 0) break;
+            if (__builtin_mul_overflow(base, base, &base)) {
+                return value::BigInt::pow_int64(v1, v2);
+            }
+        }
+        return result;
     }
 
     static auto action(double v1,int64_t v2) {
@@ -170,20 +269,49 @@ struct op_pow { // a ** b
         return pow(v1,v2);
     }
 
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        if (v2.negative) {
+            return pow(v1.to_double(), v2.to_double());
+        } else if (!v2.fits_int64()) {
+            throw pyerror("OverflowError: exponent too large");
+        }
+        return value::BigInt::to_value(value::BigInt::pow(v1, v2.to_int64()));
+    }
+
     template<typename T1, typename T2>
     static auto action(T1 v1, T2 v2) {
         throw pyerror("Invalid operands for **\n");
         return value::NoneType();
     }
 
-    constexpr const static char* l_attr = "__pow__";
-    constexpr const static char* r_attr = "__rpow__";
+    constexpr const static value::slot::Slot l_slot = value::slot::POW;
+    constexpr const static value::slot::Slot r_slot = value::slot::RPOW;
     constexpr const static char* op_name = "**";
 };
 
 struct op_lshift { // a << b
-    static auto action(int64_t v1,int64_t v2) {
-        return v1 << v2;
+    static Value action(int64_t v1,int64_t v2) {
+        if (v2 < 0) {
+            throw pyerror("ValueError: negative shift count");
+        }
+        if (v2 < 64) {
+            const int64_t result = (int64_t)((uint64_t)v1 << v2);
+            if ((result >> v2) == v1) {
+                return result;
+            }
+        } else if (v1 == 0) {
+            return (int64_t)0;
+        }
+        return value::BigInt::lshift_int64(v1, v2);
+    }
+
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        if (v2.negative) {
+            throw pyerror("ValueError: negative shift count");
+        } else if (!v2.fits_int64()) {
+            throw pyerror("OverflowError: shift count too large");
+        }
+        return value::BigInt::to_value(value::BigInt::shift_left(v1, v2.to_int64()));
     }
 
     template<typename T1, typename T2>
@@ -192,14 +320,26 @@ struct op_lshift { // a << b
         return value::NoneType();
     }
 
-    constexpr const static char* l_attr = "__lshift__";
-    constexpr const static char* r_attr = "__rlshift__";
+    constexpr const static value::slot::Slot l_slot = value::slot::LSHIFT;
+    constexpr const static value::slot::Slot r_slot = value::slot::RLSHIFT;
     constexpr const static char* op_name = "<<";
 };
 
 struct op_rshift { // a >> b
     static auto action(int64_t v1,int64_t v2) {
-        return v1 >> v2;
+        if (v2 < 0) {
+            throw pyerror("ValueError: negative shift count");
+        }
+        return v2 < 64 ? v1 >> v2 : (v1 < 0 ? (int64_t)-1 : (int64_t)0);
+    }
+
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        if (v2.negative) {
+            throw pyerror("ValueError: negative shift count");
+        } else if (!v2.fits_int64()) {
+            return v1.negative ? (int64_t)-1 : (int64_t)0;
+        }
+        return value::BigInt::to_value(value::BigInt::shift_right(v1, v2.to_int64()));
     }
 
     template<typename T1, typename T2>
@@ -208,8 +348,8 @@ struct op_rshift { // a >> b
         return value::NoneType();
     }
 
-    constexpr const static char* l_attr = "__rshift__";
-    constexpr const static char* r_attr = "__rrshift__";
+    constexpr const static value::slot::Slot l_slot = value::slot::RSHIFT;
+    constexpr const static value::slot::Slot r_slot = value::slot::RRSHIFT;
     constexpr const static char* op_name = ">>";
 };
 
@@ -218,14 +358,18 @@ struct op_and { // a & b
         return v1 & v2;
     }
 
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::to_value(value::BigInt::bit_and(v1, v2));
+    }
+
     template<typename T1, typename T2>
     static auto action(T1 v1, T2 v2) {
         throw pyerror("Invalid operands for &\n");
         return value::NoneType();
     }
 
-    constexpr const static char* l_attr = "__and__";
-    constexpr const static char* r_attr = "__rand__";
+    constexpr const static value::slot::Slot l_slot = value::slot::AND;
+    constexpr const static value::slot::Slot r_slot = value::slot::RAND;
     constexpr const static char* op_name = "&";
 };
 
@@ -234,14 +378,18 @@ struct op_or { // a | b
         return v1 | v2;
     }
 
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::to_value(value::BigInt::bit_or(v1, v2));
+    }
+
     template<typename T1, typename T2>
     static auto action(T1 v1, T2 v2) {
         throw pyerror("Invalid operands for |\n");
         return value::NoneType();
     }
 
-    constexpr const static char* l_attr = "__or__";
-    constexpr const static char* r_attr = "__ror__";
+    constexpr const static value::slot::Slot l_slot = value::slot::OR;
+    constexpr const static value::slot::Slot r_slot = value::slot::ROR;
     constexpr const static char* op_name = "|";
 };
 
@@ -250,22 +398,41 @@ struct op_xor { // a ^ b
         return v1 ^ v2;
     }
 
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        return value::BigInt::to_value(value::BigInt::bit_xor(v1, v2));
+    }
+
     template<typename T1, typename T2>
     static auto action(T1 v1, T2 v2) {
         throw pyerror("Invalid operands for ^\n");
         return value::NoneType();
     }
 
-    constexpr const static char* l_attr = "__xor__";
-    constexpr const static char* r_attr = "__rxor__";
+    constexpr const static value::slot::Slot l_slot = value::slot::XOR;
+    constexpr const static value::slot::Slot r_slot = value::slot::RXOR;
     constexpr const static char* op_name = "^";
 };
 
 struct op_modulo { // a % b
 
-    // for integer values it is sufficient to use the default % operator
+    // the result takes the sign of the divisor like python, not of the dividend like C++
     static auto action(int64_t v1, int64_t v2) {
-        return v1 % v2;
+        if (v2 == 0) {
+            throw pyerror("ZeroDivisionError: integer division or modulo by zero");
+        } else if (v2 == -1) {
+            return (int64_t)0; // INT64_MIN % -1 would trap
+        }
+        int64_t result = v1 % v2;
+        if (result != 0 && (result < 0) != (v2 < 0)) {
+            result += v2;
+        }
+        return result;
+    }
+
+    static Value action(const value::BigInt& v1, const value::BigInt& v2) {
+        value::BigInt remainder;
+        value::BigInt::divmod(v1, v2, nullptr, &remainder);
+        return value::BigInt::to_value(std::move(remainder));
     }
 
     // for other type we fall back to the fmod operator, a more general
@@ -275,8 +442,8 @@ struct op_modulo { // a % b
         return std::fmod(v1, v2);
     }
 
-    constexpr const static char* l_attr = "__mod__";
-    constexpr const static char* r_attr = "__rmod__";
+    constexpr const static value::slot::Slot l_slot = value::slot::MOD;
+    constexpr const static value::slot::Slot r_slot = value::slot::RMOD;
     constexpr const static char* op_name = "%";
 };
 
@@ -289,24 +456,42 @@ struct add_visitor: public numeric_visitor<op_add> {
 
     add_visitor(FrameState &frame) : numeric_visitor<op_add>(frame) { };
     
-    void operator()(const gc_ptr<const std::string>& v1, const gc_ptr<const std::string> &v2) const {
-        frame.value_stack.push_back(
-            alloc.heap_string.make(*v1 + *v2)
-        );
+    void operator()(const ValueString& v1, const ValueString& v2) const {
+        frame.value_stack.push_back(value::String::concat(v1, v2));
     }
 
     void operator()(ValueList& v1, ValueList& v2) const {
         DEBUG_ADV("we are adding two lists");
-        ValueList newList = alloc.heap_list.make();
-        newList->values.assign(v1->values.begin(), v1->values.end());
+        ValueList newList = alloc().heap_list.make();
+        newList->reserve(v1->size() + v2->size());
+        newList->extend(*v1);
         // DEBUG_ADV("added in vector 1");
-        newList->values.insert(newList->values.end(), v2->values.begin(), v2->values.end());
+        newList->extend(*v2);
         // DEBUG_ADV("added in vector 2");
         frame.value_stack.push_back(newList);
         DEBUG_ADV("sum of the two lists: " << newList);
     }
 };
 
+// numeric_visitor extended with the set operation that shares the operator
+template<typename T, void (*SetOp)(value::Set&, const value::Set&, const value::Set&)>
+struct set_op_visitor: public numeric_visitor<T> {
+    using numeric_visitor<T>::operator();
+
+    set_op_visitor(FrameState &frame) : numeric_visitor<T>(frame) { };
+
+    void operator()(ValueSet& v1, ValueSet& v2) const {
+        ValueSet result = alloc().heap_set.make();
+        SetOp(*result, *v1, *v2);
+        this->frame.value_stack.push_back(result);
+    }
+};
+
+using or_visitor = set_op_visitor<op_or, value::Set::set_union>;
+using and_visitor = set_op_visitor<op_and, value::Set::set_intersection>;
+using sub_visitor = set_op_visitor<op_sub, value::Set::set_difference>;
+using xor_visitor = set_op_visitor<op_xor, value::Set::set_symmetric_difference>;
+
 struct mult_visitor: public numeric_visitor<op_mult> {
     /*
         the add visitor is simply a numeric_visitor with op_add but also
@@ -317,117 +502,210 @@ struct mult_visitor: public numeric_visitor<op_mult> {
     mult_visitor(FrameState &frame) : numeric_visitor<op_mult>(frame) { };
     
     void operator()(ValueList v1, int64_t v2) const {
-        ValueList newList = alloc.heap_list.make();
-        auto& values = newList->values;
-        for (size_t i = 0; i < v2; ++i) {
-            for (auto& val : *v1) {
-                values.push_back(val);
-            }
+        ValueList newList = alloc().heap_list.make();
+        for (int64_t i = 0; i < v2; ++i) {
+            newList->extend(*v1);
         }
         frame.value_stack.push_back(newList);
     }
 };
 
-struct binary_subscr_visitor {
-    /*
-        the binary subscript visitor is used to implement
-        Implements TOS = TOS1[TOS].
-    */
-    Value operator()(ValueList& list, int64_t index) {
-        auto& values = list->values;
-        if (index < 0) {
-            index = values.size() + index;
-        }
-        if (index >= values.size()) {
-            std::stringstream ss;
-            ss << "attempted list access out of range LIST[" << index << "] but list only held " << values.size() << " elements.";
-            throw pyerror(ss.str());
+// Builds seq[start:stop:step] for lists, tuples and strings. The result is filled
+// with a single allocation, and a full slice of an immutable sequence is the sequence itself.
+// A long slice with a step of 1 of a string or tuple is a view that copies nothing,
+// lists are mutable and are always copied
+struct slice_visitor {
+    const Value& start;
+    const Value& stop;
+    const Value& step;
+
+    template<typename Src, typename Dst>
+    static void copy_slice(const Src& src, Dst& dst, int64_t first, int64_t step, size_t length) {
+        dst.reserve(length);
+        if (step == 1) {
+            dst.insert(dst.end(), src.begin() + first, src.begin() + first + length);
+        } else {
+            for (size_t i = 0; i < length; ++i, first += step) {
+                dst.push_back(src[first]);
+            }
         }
+    }
 
-        return values[index];
+    Value operator()(const ValueList& list) const {
+        int64_t first, istep;
+        size_t length = value::Slice::adjust_indices(list->size(), start, stop, step, first, istep);
+        ValueList result = alloc().heap_list.make();
+        list->copy_slice(*result, first, istep, length);
+        return result;
     }
 
-    Value operator()(ValueList& list, ValuePyObject& slice){
-        DEBUG_ADV("BINARY_SUBSCR_VISITOR TOOK A SLICE ARGUMENT!");
-        try {
-            // Extract info from slice
-            // Any of thes must either be NoneType or int
-            Value vstart = slice->attrs->at("start");
-            Value vstop = slice->attrs->at("stop");
-            Value vstep = slice->attrs->at("step");
+    Value operator()(const ValueTuple& tuple) const {
+        int64_t first, istep;
+        size_t length = value::Slice::adjust_indices(tuple->size(), start, stop, step, first, istep);
+        if (istep == 1 && length == tuple->size()) {
+            return tuple;
+        }
+        ValueTuple result = alloc().heap_tuple.make();
+#ifdef SLICE_VIEWS_ON
+        if (istep == 1 && length >= value::Slice::VIEW_MIN_LENGTH && length * 2 >= tuple->size()) {
+            // a view of a view is one of the tuple that was cut from
+            result->base = tuple->base != nullptr ? tuple->base : tuple;
+            result->offset = (tuple->base != nullptr ? tuple->offset : 0) + first;
+            result->length = length;
+            return result;
+        }
+#endif
+        copy_slice(*tuple, result->values, first, istep, length);
+        return result;
+    }
+
+    Value operator()(const ValueString& str) const {
+        int64_t first, istep;
+        size_t length = value::Slice::adjust_indices(str->size(), start, stop, step, first, istep);
+        if (istep == 1 && length == str->size()) {
+            return str;
+        } else if (istep == 1) {
+            return value::String::slice(str, first, length);
+        }
+        std::string result;
+        copy_slice(str->view(), result, first, istep, length);
+        return alloc().heap_string.make(std::move(result));
+    }
 
-            auto start_check = std::get_if<value::NoneType>(&vstart);
-            int64_t start = (start_check == NULL ? std::get<int64_t>(vstart) : 0);
+    template<typename T>
+    Value operator()(const T& value) const {
+        std::stringstream ss;
+        ss << "TypeError: " << Value(value) << " can not be sliced";
+        throw pyerror(ss.str());
+    }
+};
 
-            auto stop_check = std::get_if<value::NoneType>(&vstop);
-            int64_t stop = (stop_check == NULL ? std::get<int64_t>(vstop) : list->size());
+// Implements seq[start:stop:step] = value for lists, a step of 1 may change the list's length
+struct store_slice_visitor {
+    const Value& start;
+    const Value& stop;
+    const Value& step;
+    const Value& value;
+
+    void operator()(const ValueList& list) const {
+        std::vector<Value> items;
+        if (auto src = std::get_if<ValueList>(&value)) {
+            // copied first so that a[:] = a works
+            items.reserve((*src)->size());
+            for (size_t i = 0; i < (*src)->size(); ++i) {
+                items.push_back((*src)->get(i));
+            }
+        } else if (auto src = std::get_if<ValueTuple>(&value)) {
+            items.assign((*src)->begin(), (*src)->end());
+        } else {
+            throw pyerror("TypeError: can only assign a list or tuple to a slice");
+        }
 
-            auto step_check = std::get_if<value::NoneType>(&vstep);
-            int64_t step = (step_check == NULL ? std::get<int64_t>(vstep) : 1);
+        int64_t first, istep;
+        size_t length = value::Slice::adjust_indices(list->size(), start, stop, step, first, istep);
+        if (istep == 1) {
+            list->splice(first, length, items);
+            return;
+        }
 
+        if (items.size() != length) {
+            std::stringstream ss;
+            ss << "ValueError: attempt to assign sequence of size " << items.size()
+               << " to extended slice of size " << length;
+            throw pyerror(ss.str());
+        }
+        for (size_t i = 0; i < length; ++i, first += istep) {
+            list->set(first, items[i]);
+        }
+    }
 
-            if(step == 0){
-                throw pyerror("Slice step size cannot be 0");
-            }
+    template<typename T>
+    void operator()(const T& value) const {
+        std::stringstream ss;
+        ss << "TypeError: " << Value(value) << " does not support slice assignment";
+        throw pyerror(ss.str());
+    }
+};
 
-            DEBUG_ADV("BINARY_SUBSCR was given a slice: " << start << ", " << stop << ", " << step);
+// Implements item in container
+struct contains_visitor {
+    const Value& item;
 
-            ValueList newList = alloc.heap_list.make();
-            for(auto valit = list->begin() + start; 
-                valit < list->end() && valit < (stop < 0 ? list->end() + stop : list->begin() + stop);
-                valit += step
-            ){
-                newList->values.push_back(*valit);
-            }
+    bool operator()(const ValueDict& dict) const {
+        return dict->find(item) != nullptr;
+    }
 
-            return newList;
+    bool operator()(const ValueSet& set) const {
+        return set->contains(item);
+    }
 
-        } catch (std::out_of_range& err) {
-            throw pyerror("BINARY_SUBSCR called with invalid slice class");
-        } catch (std::bad_variant_access& err) {
-            throw pyerror("SLICE_CLASS attributes must of type int64_t");
-        }
+    bool operator()(const ValueList& list) const {
+        return list->contains(item);
     }
 
-    Value operator()(ValueString& str, ValuePyObject& slice){
-        try {
-            // Extract info from slice
-            // Any of thes must either be NoneType or int
-            Value vstart = slice->attrs->at("start");
-            Value vstop = slice->attrs->at("stop");
-            Value vstep = slice->attrs->at("step");
+    bool operator()(const ValueTuple& tuple) const {
+        for (const Value& value : *tuple) {
+            if (value_helper::values_equal(value, item)) return true;
+        }
+        return false;
+    }
 
-            auto start_check = std::get_if<value::NoneType>(&vstart);
-            int64_t start = (start_check == NULL ? std::get<int64_t>(vstart) : 0);
+    bool operator()(const ValueString& str) const {
+        auto needle = std::get_if<ValueString>(&item);
+        if (needle == nullptr) {
+            throw pyerror("TypeError: 'in <string>' requires string as left operand");
+        }
+        return str->str().find((*needle)->str()) != std::string::npos;
+    }
 
-            auto stop_check = std::get_if<value::NoneType>(&vstop);
-            int64_t stop = (stop_check == NULL ? std::get<int64_t>(vstop) : str->length());
+    template<typename T>
+    bool operator()(const T& value) const {
+        std::stringstream ss;
+        ss << "TypeError: argument of type " << Value(value) << " is not iterable";
+        throw pyerror(ss.str());
+    }
+};
 
-            auto step_check = std::get_if<value::NoneType>(&vstep);
-            int64_t step = (step_check == NULL ? std::get<int64_t>(vstep) : 1);
+// python style index normalization, throws IndexError if the index is out of range
+inline size_t normalize_index(int64_t index, size_t size, const char* type_name) {
+    if (index < 0) {
+        index += size;
+    }
+    if (index < 0 || index >= (int64_t)size) {
+        std::stringstream ss;
+        ss << "IndexError: " << type_name << " index " << index << " out of range for size " << size;
+        throw pyerror(ss.str());
+    }
+    return index;
+}
 
+struct binary_subscr_visitor {
+    /*
+        the binary subscript visitor is used to implement
+        Implements TOS = TOS1[TOS].
+    */
+    Value operator()(ValueList& list, int64_t index) {
+        return list->get(normalize_index(index, list->size(), "list"));
+    }
 
-            if(step == 0){
-                throw pyerror("Slice step size cannot be 0");
-            }
+    Value operator()(ValueTuple& tuple, int64_t index) {
+        return (*tuple)[normalize_index(index, tuple->size(), "tuple")];
+    }
 
-            DEBUG_ADV("BINARY_SUBSCR was given a slice: " << start << ", " << stop << ", " << step);
+    Value operator()(ValueString& str, int64_t index) {
+        return value::String::character((*str)[normalize_index(index, str->size(), "string")]);
+    }
 
-            std::string build_str = "";
-            for(auto strit = str->begin() + start; 
-                strit < str->end() && strit < (stop < 0 ? str->end() + stop : str->begin() + stop);
-                strit += step
-            ){
-                build_str += (*strit);
-            }
+    Value operator()(ValueList& list, ValueSlice& slice) {
+        return slice_visitor {slice->start, slice->stop, slice->step}(list);
+    }
 
-            return alloc.heap_string.make(build_str);
+    Value operator()(ValueTuple& tuple, ValueSlice& slice) {
+        return slice_visitor {slice->start, slice->stop, slice->step}(tuple);
+    }
 
-        } catch (std::out_of_range& err) {
-            throw pyerror("BINARY_SUBSCR called with invalid slice class");
-        } catch (std::bad_variant_access& err) {
-            throw pyerror("SLICE_CLASS attributes must of type int64_t");
-        }
+    Value operator()(ValueString& str, ValueSlice& slice) {
+        return slice_visitor {slice->start, slice->stop, slice->step}(str);
     }
 
     template<typename A, typename B>
@@ -442,60 +720,12 @@ struct binary_subscr_visitor {
 struct store_subscr_visitor {
     Value value;
 
-    void operator()(ValueList list, int64_t k) const {
-        if (k < 0 || k > list->values.size()) {
-            throw pyerror("list index out of range");
-        }
-        list->values[k] = std::move(value);
+    void operator()(ValueList& list, int64_t k) const {
+        list->set(normalize_index(k, list->size(), "list"), value);
     }
     
-    void operator()(ValueList& list, ValuePyObject object) const {
-        try {
-            if (object->static_attrs == builtins::slice_class) {
-                DEBUG_ADV("store subscript detected that the argument is a list slice");
-                ValueList listValue = std::get<ValueList>(value);
-                Value start = object->get_attr("start");
-                Value stop = object->get_attr("stop");
-                Value step = object->get_attr("step");
-
-                int64_t i_start;
-                if (auto pstart = std::get_if<int64_t>(&start)) {
-                    i_start = *pstart;
-                } else 
-                    i_start = 0;
-
-                int64_t i_stop;
-                if (auto pstop = std::get_if<int64_t>(&stop)) {
-                    i_stop = *pstop;
-                } else 
-                    i_stop = list->size();
-
-                int64_t i_step;
-                if (auto pstep = std::get_if<int64_t>(&step)) {
-                    i_step = *pstep;
-                } else 
-                    i_step = 1;
-
-                size_t sstart = i_start >= 0 ? i_start : list->size() + i_start;
-                size_t sstop = i_stop >= 0 ? i_stop : list->size() + i_stop;
-                DEBUG_ADV("detected start: " << sstart << " stop: " << sstop << " step size: " << i_step);
-
-                size_t index = 0;
-                while (sstart < sstop) {
-                    DEBUG_ADV("\tassigning with assign subscript!");
-                    if (index >= listValue->size()) {
-                        throw pyerror("index out of range, no more values to assign in slice assignment");
-                    }
-                    list->values[sstart] = listValue->values[index++];
-                    sstart += i_step;
-                }
-            } else {
-                throw pyerror("List can only be indexed with subclasses of 'Slice'");
-            }
-        } catch (std::bad_variant_access& e) {
-            throw pyerror("Must be assigning a list of values");
-        }
-        
+    void operator()(ValueList& list, ValueSlice& slice) const {
+        store_slice_visitor {slice->start, slice->stop, slice->step, value}(list);
     }
 
     void operator()(auto value, auto key) const {
@@ -548,7 +778,7 @@ struct unpack_sequence_visitor {
         }
         DEBUG_ADV("unpacking a tuple!");
         for (int64_t i = 0; i < arg; ++i) {
-            frame.value_stack.push_back(list->values[arg - i - 1]);
+            frame.value_stack.push_back((*list)[arg - i - 1]);
         }
     }
 
@@ -0,0 +1,357 @@
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include "pycode.hpp"
+#include "pyophelpers.hpp"
+#include "pyallocator.hpp"
+#include "optflags.hpp"
+#include "../lib/oplist.hpp"
+
+// #define DEBUG_ON
+#include "../lib/debug.hpp"
+
+/*
+    The bytecode optimizer. Python's compiler already folds most constant
+    expressions itself, this pass catches what is left and cleans up after
+    the other rewrites. It runs on the decoded instructions, where every jump
+    holds the index of the instruction it lands on:
+
+    1) constant folding: LOAD_CONST, LOAD_CONST, BINARY_* and LOAD_CONST,
+       UNARY_NEGATIVE become a single LOAD_CONST of the result.
+    2) constant branches: a POP_JUMP_IF_* on a constant becomes a JUMP_ABSOLUTE
+       or nothing at all.
+    3) jump threading: a jump that lands on an unconditional jump goes straight
+       to that jump's target, and a jump to the next instruction is dropped.
+    4) dead code: NOPs and instructions no path from the entry reaches are
+       removed, and every jump target, pc_map and lnotab entry is renumbered.
+
+    Folding only happens where the operands can not be a jump target, and only
+    for operations whose result does not depend on runtime state. Anything that
+    would raise, like a division by zero, is left for the interpreter to raise.
+*/
+
+namespace py {
+
+namespace {
+
+using namespace eval_helpers;
+
+// longer folded strings stay a runtime concatenation, like CPython does
+constexpr size_t MAX_FOLDED_STRING = 4096;
+
+// ** and << are only folded when their result is known to fit this many bits
+// before it is computed, like CPython's safe_power and safe_lshift. Results
+// that do not fit an int64_t are not kept anyway
+constexpr int64_t MAX_FOLDED_INT_BITS = 128;
+
+int64_t bit_length(int64_t value) {
+    const uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    return magnitude == 0 ? 0 : 64 - __builtin_clzll(magnitude);
+}
+
+// whether a ** b or a << b is small enough to compute at load time
+bool small_power(const Value& a, const Value& b) {
+    auto base = std::get_if<int64_t>(&a);
+    auto exp = std::get_if<int64_t>(&b);
+    if (base == nullptr || exp == nullptr || *exp <= 0 || bit_length(*base) <= 1) {
+        return true;
+    }
+    return *exp <= MAX_FOLDED_INT_BITS / bit_length(*base);
+}
+
+bool small_shift(const Value& a, const Value& b) {
+    auto value = std::get_if<int64_t>(&a);
+    auto shift = std::get_if<int64_t>(&b);
+    if (value == nullptr || shift == nullptr) {
+        return true;
+    }
+    return *shift <= MAX_FOLDED_INT_BITS && bit_length(*value) + *shift <= MAX_FOLDED_INT_BITS;
+}
+
+template<typename T>
+constexpr bool is_number = std::is_same_v<T, int64_t> || std::is_same_v<T, double>;
+
+// applies Op to two numbers exactly like numeric_visitor does at runtime,
+// IntsOnly keeps float // and % (which are not folded) for the runtime
+template<class Op, bool IntsOnly = false>
+std::optional<Value> fold_numbers(const Value& a, const Value& b) {
+    return std::visit([](auto x, auto y) -> std::optional<Value> {
+        using X = decltype(x);
+        using Y = decltype(y);
+        if constexpr (IntsOnly && !(std::is_same_v<X, int64_t> && std::is_same_v<Y, int64_t>)) {
+            return std::nullopt;
+        } else if constexpr (is_number<X> && is_number<Y>) {
+            return Value(Op::action(x, y));
+        } else {
+            return std::nullopt;
+        }
+    }, a, b);
+}
+
+bool is_zero(const Value& value) {
+    return (std::holds_alternative<int64_t>(value) && std::get<int64_t>(value) == 0)
+        || (std::holds_alternative<double>(value) && std::get<double>(value) == 0.0);
+}
+
+std::optional<Value> fold_binary(const Code::Instruction& instr, const Value& a, const Value& b) {
+    switch (instr.bytecode) {
+        case op::BINARY_ADD:
+        {
+            auto sa = std::get_if<ValueString>(&a);
+            auto sb = std::get_if<ValueString>(&b);
+            if (sa != nullptr && sb != nullptr) {
+                if ((*sa)->size() + (*sb)->size() > MAX_FOLDED_STRING) {
+                    return std::nullopt;
+                }
+                return Value(alloc().heap_string.make((*sa)->str() + (*sb)->str()));
+            }
+            return fold_numbers<op_add>(a, b);
+        }
+        case op::BINARY_SUBTRACT: return fold_numbers<op_sub>(a, b);
+        case op::BINARY_MULTIPLY: return fold_numbers<op_mult>(a, b);
+        case op::BINARY_POWER:
+            return small_power(a, b) ? fold_numbers<op_pow>(a, b) : std::nullopt;
+        case op::BINARY_TRUE_DIVIDE:
+            return is_zero(b) ? std::nullopt : fold_numbers<op_true_div>(a, b);
+        case op::BINARY_FLOOR_DIVIDE:
+            return is_zero(b) ? std::nullopt : fold_numbers<op_divide, true>(a, b);
+        case op::BINARY_MODULO:
+            return is_zero(b) ? std::nullopt : fold_numbers<op_modulo, true>(a, b);
+        case op::BINARY_LSHIFT:
+            return small_shift(a, b) ? fold_numbers<op_lshift, true>(a, b) : std::nullopt;
+        case op::BINARY_RSHIFT: return fold_numbers<op_rshift, true>(a, b);
+        case op::BINARY_AND: return fold_numbers<op_and, true>(a, b);
+        case op::BINARY_OR: return fold_numbers<op_or, true>(a, b);
+        case op::BINARY_XOR: return fold_numbers<op_xor, true>(a, b);
+        case op::COMPARE_OP:
+            switch (instr.arg) {
+                case op::cmp::LT: return fold_numbers<op_lt>(a, b);
+                case op::cmp::LTE: return fold_numbers<op_lte>(a, b);
+                case op::cmp::GT: return fold_numbers<op_gt>(a, b);
+                case op::cmp::GTE: return fold_numbers<op_gte>(a, b);
+                case op::cmp::EQ: return fold_numbers<op_eq>(a, b);
+                case op::cmp::NEQ: return fold_numbers<op_neq>(a, b);
+                default: return std::nullopt;
+            }
+        default:
+            return std::nullopt;
+    }
+}
+
+std::optional<Value> fold_unary(const Code::Instruction& instr, const Value& a) {
+    if (instr.bytecode != op::UNARY_NEGATIVE) {
+        return std::nullopt;
+    } else if (auto i = std::get_if<int64_t>(&a)) {
+        if (*i == INT64_MIN) return std::nullopt;
+        return Value(-*i);
+    } else if (auto d = std::get_if<double>(&a)) {
+        return Value(-*d);
+    }
+    return std::nullopt;
+}
+
+// the constants whose truth a branch can be decided on at load time
+std::optional<bool> constant_truth(const Value& value) {
+    if (std::holds_alternative<bool>(value) || std::holds_alternative<int64_t>(value)
+            || std::holds_alternative<double>(value) || std::holds_alternative<value::NoneType>(value)
+            || std::holds_alternative<ValueString>(value)) {
+        return std::visit(value_helper::visitor_is_truthy(), value);
+    }
+    return std::nullopt;
+}
+
+// whether execution never continues with the next instruction
+bool is_unconditional(Code::ByteCode bytecode) {
+    switch (bytecode) {
+        case op::JUMP_ABSOLUTE:
+        case op::JUMP_FORWARD:
+        case op::RETURN_VALUE:
+        case op::RAISE_VARARGS:
+        case op::BREAK_LOOP:
+        case op::CONTINUE_LOOP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+}
+
+void Code::optimize() {
+    const size_t count = this->instructions.size();
+    std::vector<bool> is_target(count, false);
+    for (const Instruction& instr : this->instructions) {
+        if (is_jump(instr.bytecode)) {
+            is_target[instr.arg] = true;
+        }
+    }
+
+    auto make_const = [this](Instruction& instr, Value value) {
+        instr.bytecode = op::LOAD_CONST;
+        instr.arg = this->co_consts.size();
+        this->co_consts.push_back(std::move(value));
+    };
+
+    /*
+        constant folding and constant branches, consts holds the LOAD_CONSTs
+        that run back to back right before the current instruction
+    */
+    std::vector<size_t> consts;
+    for (size_t i = 0; i < count; ++i) {
+        Instruction& instr = this->instructions[i];
+        if (is_target[i]) {
+            consts.clear();
+        }
+        if (instr.bytecode == op::NOP) {
+            continue;
+        } else if (instr.bytecode == op::LOAD_CONST) {
+            consts.push_back(i);
+            continue;
+        }
+
+        std::optional<Value> folded;
+        if (consts.size() >= 2) {
+            try {
+                folded = fold_binary(instr,
+                    this->co_consts[this->instructions[consts[consts.size() - 2]].arg],
+                    this->co_consts[this->instructions[consts.back()].arg]);
+            } catch (const pyerror&) {
+                // left for the interpreter to raise
+            }
+            if (folded && !std::holds_alternative<ValueBigInt>(*folded)) {
+                DEBUG_ADV("folded " << op::name[instr.bytecode] << " at " << i << " to " << *folded);
+                this->instructions[consts.back()].bytecode = op::NOP;
+                consts.pop_back();
+                make_const(this->instructions[consts.back()], std::move(*folded));
+                instr.bytecode = op::NOP;
+                continue;
+            }
+        }
+        if (!consts.empty()) {
+            folded = fold_unary(instr, this->co_consts[this->instructions[consts.back()].arg]);
+            if (folded) {
+                make_const(this->instructions[consts.back()], std::move(*folded));
+                instr.bytecode = op::NOP;
+                continue;
+            }
+
+            if (instr.bytecode == op::POP_JUMP_IF_FALSE || instr.bytecode == op::POP_JUMP_IF_TRUE) {
+                std::optional<bool> truth = constant_truth(this->co_consts[this->instructions[consts.back()].arg]);
+                if (truth) {
+                    this->instructions[consts.back()].bytecode = op::NOP;
+                    if (*truth == (instr.bytecode == op::POP_JUMP_IF_TRUE)) {
+                        instr.bytecode = op::JUMP_ABSOLUTE;
+                    } else {
+                        instr.bytecode = op::NOP;
+                    }
+                }
+            }
+        }
+        consts.clear();
+    }
+
+    /*
+        jump threading, a jump to a NOP lands on whatever follows it and a jump
+        to an unconditional jump goes to where that one goes
+    */
+    auto final_target = [this, count](uint64_t target) {
+        for (size_t hops = 0; hops < count; ++hops) {
+            const Instruction& landing = this->instructions[target];
+            if (landing.bytecode == op::NOP && target + 1 < count) {
+                target++;
+            } else if (landing.bytecode == op::JUMP_ABSOLUTE || landing.bytecode == op::JUMP_FORWARD) {
+                if (landing.arg == target) break;
+                target = landing.arg;
+            } else {
+                break;
+            }
+        }
+        return target;
+    };
+    for (Instruction& instr : this->instructions) {
+        if (is_jump(instr.bytecode)) {
+            instr.arg = final_target(instr.arg);
+        }
+    }
+
+    /*
+        mark what is reachable from the entry, walking both ways out of every
+        branch. SETUP_* blocks count their handler as a successor since a break
+        or an exception gets there without a jump of its own
+    */
+    std::vector<bool> live(count, false);
+    std::vector<size_t> work { 0 };
+    while (!work.empty()) {
+        size_t i = work.back();
+        work.pop_back();
+        for (; i < count && !live[i]; ++i) {
+            live[i] = true;
+            const Instruction& instr = this->instructions[i];
+            if (is_jump(instr.bytecode)) {
+                work.push_back(instr.arg);
+            }
+            if (is_unconditional(instr.bytecode)) {
+                break;
+            }
+        }
+    }
+
+    // an unconditional jump to the instruction that follows it is a NOP too
+    std::vector<uint64_t> next_kept(count + 1, count);
+    for (size_t i = count; i-- > 0; ) {
+        const Instruction& instr = this->instructions[i];
+        next_kept[i] = live[i] && instr.bytecode != op::NOP ? i : next_kept[i + 1];
+    }
+    for (size_t i = 0; i < count; ++i) {
+        Instruction& instr = this->instructions[i];
+        if (live[i] && (instr.bytecode == op::JUMP_ABSOLUTE || instr.bytecode == op::JUMP_FORWARD)
+                && next_kept[i + 1] == next_kept[instr.arg]) {
+            instr.bytecode = op::NOP;
+        }
+    }
+
+    /*
+        compact, an instruction that is removed maps to the next one that stays
+    */
+    std::vector<uint64_t> new_index(count + 1);
+    std::vector<Instruction> kept;
+    kept.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        new_index[i] = kept.size();
+        const Instruction& instr = this->instructions[i];
+        if (live[i] && instr.bytecode != op::NOP) {
+            kept.push_back(instr);
+        }
+    }
+    new_index[count] = kept.size();
+    if (kept.size() == count) {
+        return ;
+    }
+    DEBUG_ADV("optimized " << this->co_name << " from " << count << " to " << kept.size() << " instructions");
+
+    for (Instruction& instr : kept) {
+        if (is_jump(instr.bytecode)) {
+            instr.arg = new_index[instr.arg];
+        }
+    }
+    for (uint64_t& index : this->pc_map) {
+        if (index != NOT_AN_INSTRUCTION) {
+            index = new_index[index];
+        }
+    }
+    // lines whose instructions are all gone are dropped
+    std::vector<LineNoMapping> lines;
+    for (const LineNoMapping& mapping : this->lnotab) {
+        const uint64_t pc = new_index[mapping.pc];
+        if (!lines.empty() && lines.back().pc == pc) {
+            lines.back().line = mapping.line;
+        } else if (pc < kept.size()) {
+            lines.push_back(LineNoMapping {mapping.line, pc});
+        }
+    }
+    this->lnotab = std::move(lines);
+    this->instructions = std::move(kept);
+}
+
+}
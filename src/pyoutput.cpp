@@ -0,0 +1,128 @@
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+
+#include "pyoutput.hpp"
+#include "pyerror.hpp"
+#include "optflags.hpp"
+
+namespace py {
+
+thread_local OutputBuffer output(STDOUT_FILENO);
+
+namespace {
+
+void write_all(int fd, const char* data, size_t size) {
+    const char* end = data + size;
+    while (data < end) {
+        ssize_t written = ::write(fd, data, end - data);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw pyerror(std::string("OSError: write failed: ") + std::strerror(errno));
+        }
+        data += written;
+    }
+}
+
+// writes the value straight into the buffer for the types print shows most,
+// everything else is formatted by the debug repr
+struct visitor_write {
+    OutputBuffer& out;
+    visitor_write(OutputBuffer& out) : out(out) { };
+
+    void operator()(bool v) {
+        if (v) {
+            out.write("true", 4);
+        } else {
+            out.write("false", 5);
+        }
+    }
+
+    void operator()(int64_t v) {
+        out.write(v);
+    }
+
+    void operator()(double v) {
+        out.write(v);
+    }
+
+    void operator()(const ValueString& str) {
+        out.write(str->c_str(), str->size());
+    }
+
+    void operator()(value::NoneType) {
+        out.write("None", 4);
+    }
+
+    template<typename T>
+    void operator()(const T& value) {
+        std::stringstream ss;
+        ss << Value(value);
+        out.write(ss.str());
+    }
+};
+
+}
+
+OutputBuffer::OutputBuffer(int fd) : fd(fd), buffer(new char[CAPACITY]) {
+#ifdef BUFFERED_OUTPUT_ON
+    this->line_buffered = isatty(fd);
+#else
+    this->line_buffered = true;
+#endif
+}
+
+OutputBuffer::~OutputBuffer() {
+    try {
+        this->flush();
+    } catch (const pyerror&) {
+        // nowhere left to report it
+    }
+}
+
+void OutputBuffer::write(const char* data, size_t size) {
+    if (this->used + size > CAPACITY) {
+        this->flush();
+        if (size > CAPACITY) {
+            // too big to be worth copying, hand it to the kernel as it is
+            write_all(this->fd, data, size);
+            return ;
+        }
+    }
+    std::memcpy(this->buffer.get() + this->used, data, size);
+    this->used += size;
+    if (this->line_buffered && std::memchr(data, '\n', size) != nullptr) {
+        this->flush();
+    }
+}
+
+void OutputBuffer::write(int64_t value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    this->write(digits, result.ptr - digits);
+}
+
+void OutputBuffer::write(double value) {
+    // the same six significant digits an ostream shows by default. to_chars
+    // only formats doubles from GCC 11 on
+    char digits[32];
+    const int size = std::snprintf(digits, sizeof(digits), "%.6g", value);
+    this->write(digits, size);
+}
+
+void OutputBuffer::write_value(const Value& value) {
+    std::visit(visitor_write(*this), value);
+}
+
+void OutputBuffer::flush() {
+    // drop the buffered bytes even if the write fails, so the error is not
+    // raised again by every later flush
+    const size_t size = this->used;
+    this->used = 0;
+    write_all(this->fd, this->buffer.get(), size);
+}
+
+}
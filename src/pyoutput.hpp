@@ -0,0 +1,53 @@
+#ifndef PYOUTPUT_H
+#define PYOUTPUT_H
+
+#include <memory>
+#include <string>
+
+#include "pyvalue.hpp"
+
+namespace py {
+
+// A buffered writer over a file descriptor, used for everything print writes.
+// Output is collected in a large buffer and written out when it fills up, on
+// flush() and when the writer is destroyed. If the descriptor is a terminal
+// every write that ends a line is flushed right away, like C stdio does
+class OutputBuffer {
+public:
+    static constexpr size_t CAPACITY = 1 << 16;
+
+    explicit OutputBuffer(int fd);
+    ~OutputBuffer();
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void write(const char* data, size_t size);
+
+    inline void write(const std::string& str) {
+        write(str.data(), str.size());
+    }
+
+    void write(int64_t value);
+    void write(double value);
+
+    // formats value the way print shows it
+    void write_value(const Value& value);
+
+    // writes out everything that is buffered, throws a pyerror if that fails
+    void flush();
+
+private:
+    int fd;
+    bool line_buffered;
+    size_t used = 0;
+    std::unique_ptr<char[]> buffer;
+};
+
+// the interpreter's stdout, flushed at exit and before an error is reported. Each
+// thread has its own, so interpreters on different threads write whole buffers
+extern thread_local OutputBuffer output;
+
+}
+
+#endif
@@ -0,0 +1,464 @@
+#include <algorithm>
+
+#include "pyvalue.hpp"
+#include "pyvalue_helpers.hpp"
+
+namespace py {
+namespace value {
+
+/*
+    A set of ints starts out as a bitmap and stays one for as long as the
+    range it covers is no bigger than what the same elements would take up in
+    the int table. The word loops over bitmaps are simple enough for the
+    compiler to vectorize, so set operations between two bitmaps do 64 (or
+    with AVX, 256) elements per instruction.
+*/
+
+namespace {
+
+// an element in the INTS table costs 16 bytes at the maximum load factor
+constexpr size_t BITS_PER_INT = 128;
+constexpr size_t MIN_BITMAP_BITS = 1024;
+constexpr size_t MIN_INTS_CAPACITY = 16;
+
+inline bool dense_enough(__int128 span, size_t n) {
+    return span <= (__int128)std::max(MIN_BITMAP_BITS, BITS_PER_INT * n);
+}
+
+inline int64_t floor64(int64_t v) {
+    return v & ~(int64_t)63;
+}
+
+inline __int128 bitmap_end(const Set& set) {
+    return (__int128)set.base + 64 * (__int128)set.words.size();
+}
+
+inline size_t int_slot(int64_t v, size_t mask) {
+    return (size_t)(((uint64_t)v * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+// 1, True and 1.0 are the same element
+inline bool as_int(const Value& value, int64_t& out) {
+    if (auto i = std::get_if<int64_t>(&value)) {
+        out = *i;
+        return true;
+    } else if (auto b = std::get_if<bool>(&value)) {
+        out = *b;
+        return true;
+    } else if (auto d = std::get_if<double>(&value)) {
+        if (*d >= -9.2e18 && *d <= 9.2e18 && *d == (double)(int64_t)*d) {
+            out = (int64_t)*d;
+            return true;
+        }
+    }
+    return false;
+}
+
+// insert v into a table with room for it, false if it was already there
+inline bool ints_insert(std::vector<int64_t>& ints, int64_t v) {
+    const size_t mask = ints.size() - 1;
+    for (size_t i = int_slot(v, mask);; i = (i + 1) & mask) {
+        if (ints[i] == v) {
+            return false;
+        } else if (ints[i] == Set::EMPTY_INT) {
+            ints[i] = v;
+            return true;
+        }
+    }
+}
+
+// rebuild the bitmap of set to cover nwords words starting at lo
+void bitmap_resize(Set& set, int64_t lo, size_t nwords) {
+    std::vector<uint64_t> words(nwords, 0);
+    if (!set.words.empty()) {
+        std::copy(set.words.begin(), set.words.end(), words.begin() + (size_t)((set.base - lo) / 64));
+    }
+    set.words.swap(words);
+    set.base = lo;
+}
+
+size_t popcount(const std::vector<uint64_t>& words) {
+    size_t count = 0;
+    for (uint64_t word : words) {
+        count += __builtin_popcountll(word);
+    }
+    return count;
+}
+
+// the word of src that lines up with word 0 of dst
+inline size_t word_offset(const Set& dst, const Set& src) {
+    return (size_t)((src.base - dst.base) / 64);
+}
+
+template<typename F>
+void for_each_int(const Set& set, F&& f) {
+    if (set.kind == Set::BITMAP) {
+        for (size_t w = 0; w < set.words.size(); ++w) {
+            for (uint64_t word = set.words[w]; word != 0; word &= word - 1) {
+                f(set.base + (int64_t)(w * 64 + __builtin_ctzll(word)));
+            }
+        }
+    } else {
+        for (int64_t v : set.ints) {
+            if (v != Set::EMPTY_INT) f(v);
+        }
+        if (set.has_empty_int) f(Set::EMPTY_INT);
+    }
+}
+
+template<typename F>
+void for_each(const Set& set, F&& f) {
+    if (set.kind == Set::GENERIC) {
+        for (const auto& entry : set.generic.entries) {
+            if (entry.hash != 0) f(entry.key);
+        }
+    } else {
+        for_each_int(set, [&](int64_t v) { f(Value(v)); });
+    }
+}
+
+}
+
+bool Set::contains_int(int64_t v) const {
+    if (this->kind == BITMAP) {
+        if (v < this->base) {
+            return false;
+        }
+        const uint64_t off = (uint64_t)v - (uint64_t)this->base;
+        if (off >= 64 * this->words.size()) {
+            return false;
+        }
+        return (this->words[off / 64] >> (off % 64)) & 1;
+    }
+
+    if (v == EMPTY_INT) {
+        return this->has_empty_int;
+    }
+    const size_t mask = this->ints.size() - 1;
+    for (size_t i = int_slot(v, mask); this->ints[i] != EMPTY_INT; i = (i + 1) & mask) {
+        if (this->ints[i] == v) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Set::add_int(int64_t v) {
+    if (this->kind == BITMAP) {
+        if (this->words.empty() || v < this->base || v >= bitmap_end(*this)) {
+            __int128 lo = floor64(v);
+            __int128 hi = lo + 64;
+            if (!this->words.empty()) {
+                lo = std::min<__int128>(lo, this->base);
+                hi = std::max(hi, bitmap_end(*this));
+            }
+            if (!dense_enough(hi - lo, this->count + 1)) {
+                this->to_ints();
+                this->add_int(v);
+                return;
+            }
+            bitmap_resize(*this, (int64_t)lo, (size_t)((hi - lo) / 64));
+        }
+
+        const uint64_t off = (uint64_t)v - (uint64_t)this->base;
+        uint64_t& word = this->words[off / 64];
+        const uint64_t bit = 1ULL << (off % 64);
+        if (!(word & bit)) {
+            word |= bit;
+            this->count++;
+        }
+        return;
+    }
+
+    if (v == EMPTY_INT) {
+        if (!this->has_empty_int) {
+            this->has_empty_int = true;
+            this->count++;
+        }
+        return;
+    }
+    // keep the load factor at or below 1/2
+    if ((this->count + 1) * 2 > this->ints.size()) {
+        this->rehash_ints(std::max(MIN_INTS_CAPACITY, this->ints.size() * 2));
+    }
+    if (ints_insert(this->ints, v)) {
+        this->count++;
+    }
+}
+
+bool Set::remove_int(int64_t v) {
+    if (!this->contains_int(v)) {
+        return false;
+    }
+    this->count--;
+
+    if (this->kind == BITMAP) {
+        const uint64_t off = (uint64_t)v - (uint64_t)this->base;
+        this->words[off / 64] &= ~(1ULL << (off % 64));
+        return true;
+    }
+
+    if (v == EMPTY_INT) {
+        this->has_empty_int = false;
+        return true;
+    }
+
+    // backward shift deletion, so lookups never need tombstones
+    const size_t mask = this->ints.size() - 1;
+    size_t i = int_slot(v, mask);
+    while (this->ints[i] != v) {
+        i = (i + 1) & mask;
+    }
+    for (size_t j = (i + 1) & mask; this->ints[j] != EMPTY_INT; j = (j + 1) & mask) {
+        const size_t home = int_slot(this->ints[j], mask);
+        // move ints[j] into the hole at i unless its home lies cyclically in (i, j]
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            this->ints[i] = this->ints[j];
+            i = j;
+        }
+    }
+    this->ints[i] = EMPTY_INT;
+    return true;
+}
+
+void Set::rehash_ints(size_t capacity) {
+    std::vector<int64_t> old(capacity, EMPTY_INT);
+    old.swap(this->ints);
+    for (int64_t v : old) {
+        if (v != EMPTY_INT) {
+            ints_insert(this->ints, v);
+        }
+    }
+}
+
+void Set::to_ints() {
+    std::vector<uint64_t> words;
+    words.swap(this->words);
+    const int64_t base = this->base;
+
+    size_t capacity = MIN_INTS_CAPACITY;
+    while (capacity < (this->count + 1) * 2) {
+        capacity *= 2;
+    }
+    this->kind = INTS;
+    this->ints.assign(capacity, EMPTY_INT);
+    for (size_t w = 0; w < words.size(); ++w) {
+        for (uint64_t word = words[w]; word != 0; word &= word - 1) {
+            const int64_t v = base + (int64_t)(w * 64 + __builtin_ctzll(word));
+            if (v == EMPTY_INT) {
+                this->has_empty_int = true;
+            } else {
+                ints_insert(this->ints, v);
+            }
+        }
+    }
+}
+
+void Set::to_generic() {
+    Dict generic;
+    generic.reserve(this->count);
+    for_each_int(*this, [&](int64_t v) {
+        generic.set(v, value::NoneType());
+    });
+    this->clear();
+    this->kind = GENERIC;
+    this->generic = std::move(generic);
+}
+
+bool Set::contains(const Value& value) const {
+    if (this->kind == GENERIC) {
+        return this->generic.find(value) != nullptr;
+    }
+    int64_t v;
+    return as_int(value, v) && this->contains_int(v);
+}
+
+void Set::add(const Value& value) {
+    if (this->kind != GENERIC) {
+        if (auto i = std::get_if<int64_t>(&value)) {
+            this->add_int(*i);
+            return;
+        }
+        int64_t v;
+        if (as_int(value, v) && this->contains_int(v)) {
+            return; // an equal int is already in the set
+        }
+        this->to_generic();
+    }
+    this->generic.set(value, value::NoneType());
+}
+
+bool Set::remove(const Value& value) {
+    if (this->kind == GENERIC) {
+        return this->generic.erase(value);
+    }
+    int64_t v;
+    return as_int(value, v) && this->remove_int(v);
+}
+
+void Set::clear() {
+    this->kind = BITMAP;
+    this->base = 0;
+    this->words.clear();
+    this->ints.clear();
+    this->has_empty_int = false;
+    this->generic.clear();
+    this->count = 0;
+}
+
+bool Set::next(size_t& pos, Value& out) const {
+    if (this->kind == BITMAP) {
+        const size_t nbits = 64 * this->words.size();
+        while (pos < nbits) {
+            const uint64_t word = this->words[pos / 64] >> (pos % 64);
+            if (word == 0) {
+                pos = (pos / 64 + 1) * 64;
+                continue;
+            }
+            pos += __builtin_ctzll(word);
+            out = this->base + (int64_t)pos;
+            pos++;
+            return true;
+        }
+        return false;
+    } else if (this->kind == INTS) {
+        for (; pos < this->ints.size(); ++pos) {
+            if (this->ints[pos] != EMPTY_INT) {
+                out = this->ints[pos++];
+                return true;
+            }
+        }
+        if (pos == this->ints.size() && this->has_empty_int) {
+            out = EMPTY_INT;
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    const auto& entries = this->generic.entries;
+    for (; pos < entries.size(); ++pos) {
+        if (entries[pos].hash != 0) {
+            out = entries[pos++].key;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Set::set_union(Set& result, const Set& a, const Set& b) {
+    if (a.kind == BITMAP && b.kind == BITMAP && !a.words.empty() && !b.words.empty()) {
+        const int64_t lo = std::min(a.base, b.base);
+        const __int128 hi = std::max(bitmap_end(a), bitmap_end(b));
+        if (dense_enough(hi - lo, a.count + b.count)) {
+            result.clear();
+            bitmap_resize(result, lo, (size_t)((hi - lo) / 64));
+            for (const Set* src : {&a, &b}) {
+                uint64_t* dst = result.words.data() + word_offset(result, *src);
+                const uint64_t* words = src->words.data();
+                for (size_t i = 0; i < src->words.size(); ++i) {
+                    dst[i] |= words[i];
+                }
+            }
+            result.count = popcount(result.words);
+            return;
+        }
+    }
+
+    result = a;
+    if (b.kind != GENERIC && result.kind != GENERIC) {
+        for_each_int(b, [&](int64_t v) { result.add_int(v); });
+    } else {
+        for_each(b, [&](const Value& v) { result.add(v); });
+    }
+}
+
+void Set::set_intersection(Set& result, const Set& a, const Set& b) {
+    result.clear();
+    if (a.kind == BITMAP && b.kind == BITMAP) {
+        const int64_t lo = std::max(a.base, b.base);
+        const __int128 hi = std::min(bitmap_end(a), bitmap_end(b));
+        if (a.words.empty() || b.words.empty() || hi <= lo) {
+            return;
+        }
+        bitmap_resize(result, lo, (size_t)((hi - lo) / 64));
+        const uint64_t* wa = a.words.data() + word_offset(a, result);
+        const uint64_t* wb = b.words.data() + word_offset(b, result);
+        uint64_t* dst = result.words.data();
+        for (size_t i = 0; i < result.words.size(); ++i) {
+            dst[i] = wa[i] & wb[i];
+        }
+        result.count = popcount(result.words);
+        return;
+    }
+
+    // probe the larger set with the elements of the smaller one
+    const Set& small = a.size() <= b.size() ? a : b;
+    const Set& large = a.size() <= b.size() ? b : a;
+    if (small.kind != GENERIC && large.kind != GENERIC) {
+        for_each_int(small, [&](int64_t v) {
+            if (large.contains_int(v)) result.add_int(v);
+        });
+    } else {
+        for_each(small, [&](const Value& v) {
+            if (large.contains(v)) result.add(v);
+        });
+    }
+}
+
+void Set::set_difference(Set& result, const Set& a, const Set& b) {
+    if (a.kind == BITMAP && b.kind == BITMAP) {
+        result = a;
+        const int64_t lo = std::max(a.base, b.base);
+        const __int128 hi = std::min(bitmap_end(a), bitmap_end(b));
+        if (!a.words.empty() && !b.words.empty() && hi > lo) {
+            const size_t n = (size_t)((hi - lo) / 64);
+            uint64_t* dst = result.words.data() + (size_t)((lo - a.base) / 64);
+            const uint64_t* wb = b.words.data() + (size_t)((lo - b.base) / 64);
+            for (size_t i = 0; i < n; ++i) {
+                dst[i] &= ~wb[i];
+            }
+            result.count = popcount(result.words);
+        }
+        return;
+    }
+
+    result.clear();
+    if (a.kind != GENERIC && b.kind != GENERIC) {
+        for_each_int(a, [&](int64_t v) {
+            if (!b.contains_int(v)) result.add_int(v);
+        });
+    } else {
+        for_each(a, [&](const Value& v) {
+            if (!b.contains(v)) result.add(v);
+        });
+    }
+}
+
+void Set::set_symmetric_difference(Set& result, const Set& a, const Set& b) {
+    if (a.kind == BITMAP && b.kind == BITMAP && !a.words.empty() && !b.words.empty()) {
+        const int64_t lo = std::min(a.base, b.base);
+        const __int128 hi = std::max(bitmap_end(a), bitmap_end(b));
+        if (dense_enough(hi - lo, a.count + b.count)) {
+            result.clear();
+            bitmap_resize(result, lo, (size_t)((hi - lo) / 64));
+            for (const Set* src : {&a, &b}) {
+                uint64_t* dst = result.words.data() + word_offset(result, *src);
+                const uint64_t* words = src->words.data();
+                for (size_t i = 0; i < src->words.size(); ++i) {
+                    dst[i] ^= words[i];
+                }
+            }
+            result.count = popcount(result.words);
+            return;
+        }
+    }
+
+    set_difference(result, a, b);
+    for_each(b, [&](const Value& v) {
+        if (!a.contains(v)) result.add(v);
+    });
+}
+
+}
+}
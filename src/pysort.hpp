@@ -0,0 +1,271 @@
+#ifndef PYSORT_HPP
+#define PYSORT_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace py {
+namespace sort {
+
+/*
+    A stable TimSort, following CPython's listsort.txt: the input is split into
+    natural runs (strictly descending runs are reversed in place), short runs are
+    extended to minrun with a binary insertion sort, and runs are merged from a
+    stack whose lengths are kept growing faster than the Fibonacci numbers.
+
+    Before two runs are merged, galloping finds where the first item of the right
+    run goes in the left run and where the last item of the left run goes in the
+    right one, so the items already in place are not touched. Partially sorted
+    input, the common case for real data, therefore costs close to n comparisons.
+
+    less may throw, which leaves the range in an unspecified state, so callers
+    that can not allow that sort a copy.
+*/
+
+namespace detail {
+
+inline size_t min_run_length(size_t n) {
+    size_t r = 0;
+    while (n >= 64) {
+        r |= n & 1;
+        n >>= 1;
+    }
+    return n + r;
+}
+
+// sorts [first, last) given that [first, start) is already sorted
+template<typename It, typename Less>
+void binary_insertion_sort(It first, It start, It last, Less& less) {
+    for (; start != last; ++start) {
+        auto pivot = std::move(*start);
+        // upper_bound keeps equal items in their order
+        It pos = std::upper_bound(first, start, pivot, less);
+        std::move_backward(pos, start, start + 1);
+        *pos = std::move(pivot);
+    }
+}
+
+// the length of the run at first, which is made ascending if it was descending
+template<typename It, typename Less>
+size_t count_run_and_make_ascending(It first, It last, Less& less) {
+    It run = first + 1;
+    if (run == last) {
+        return 1;
+    }
+    if (less(*run, *first)) {
+        // only a strictly descending run may be reversed without breaking stability
+        ++run;
+        while (run != last && less(*run, *(run - 1))) {
+            ++run;
+        }
+        std::reverse(first, run);
+    } else {
+        ++run;
+        while (run != last && !less(*run, *(run - 1))) {
+            ++run;
+        }
+    }
+    return run - first;
+}
+
+// the number of items in [first, first + n) that go before key (or before or at
+// key for gallop_right), probing from first at offsets 1, 3, 7, ...
+template<typename It, typename T, typename Less>
+size_t gallop_left(const T& key, It first, size_t n, Less& less) {
+    size_t lo = 0, hi = 1;
+    while (hi < n && less(first[hi - 1], key)) {
+        lo = hi;
+        hi = hi * 2 + 1;
+    }
+    hi = std::min(hi, n);
+    return std::lower_bound(first + lo, first + hi, key, less) - first;
+}
+
+template<typename It, typename T, typename Less>
+size_t gallop_right(const T& key, It first, size_t n, Less& less) {
+    size_t lo = 0, hi = 1;
+    while (hi < n && !less(key, first[hi - 1])) {
+        lo = hi;
+        hi = hi * 2 + 1;
+    }
+    hi = std::min(hi, n);
+    return std::upper_bound(first + lo, first + hi, key, less) - first;
+}
+
+template<typename It, typename Less>
+class TimSort {
+    using T = typename std::iterator_traits<It>::value_type;
+
+    struct Run {
+        It base;
+        size_t length;
+    };
+
+    Less& less;
+    std::vector<Run> runs;
+    std::vector<T> buffer;
+
+    // merges the run at i with the one at i + 1
+    void merge_at(size_t i) {
+        It a = runs[i].base;
+        size_t na = runs[i].length;
+        It b = runs[i + 1].base;
+        size_t nb = runs[i + 1].length;
+
+        runs[i].length = na + nb;
+        runs.erase(runs.begin() + i + 1);
+
+        // items of a before b[0] and items of b after a[na - 1] are already in place
+        const size_t skip = gallop_right(*b, a, na, less);
+        a += skip;
+        na -= skip;
+        if (na == 0) {
+            return;
+        }
+        nb = gallop_left(*(a + (na - 1)), b, nb, less);
+        if (nb == 0) {
+            return;
+        }
+
+        if (na <= nb) {
+            merge_low(a, na, b, nb);
+        } else {
+            merge_high(a, na, b, nb);
+        }
+    }
+
+    // a is copied out and the merge fills from the left
+    void merge_low(It a, size_t na, It b, size_t nb) {
+        buffer.assign(std::make_move_iterator(a), std::make_move_iterator(a + na));
+        auto left = buffer.begin(), left_end = buffer.end();
+        It right = b, right_end = b + nb, dest = a;
+        while (left != left_end && right != right_end) {
+            if (less(*right, *left)) {
+                *dest++ = std::move(*right++);
+            } else {
+                *dest++ = std::move(*left++);
+            }
+        }
+        std::move(left, left_end, dest);
+    }
+
+    // b is copied out and the merge fills from the right
+    void merge_high(It a, size_t na, It b, size_t nb) {
+        buffer.assign(std::make_move_iterator(b), std::make_move_iterator(b + nb));
+        auto right = buffer.end(), right_begin = buffer.begin();
+        It left = a + na, dest = b + nb;
+        while (left != a && right != right_begin) {
+            if (less(*(right - 1), *(left - 1))) {
+                *--dest = std::move(*--left);
+            } else {
+                *--dest = std::move(*--right);
+            }
+        }
+        std::move_backward(right_begin, right, dest);
+    }
+
+    void merge_collapse() {
+        while (runs.size() > 1) {
+            size_t n = runs.size() - 2;
+            if ((n > 0 && runs[n - 1].length <= runs[n].length + runs[n + 1].length) ||
+                (n > 1 && runs[n - 2].length <= runs[n - 1].length + runs[n].length)) {
+                if (runs[n - 1].length < runs[n + 1].length) {
+                    --n;
+                }
+            } else if (runs[n].length > runs[n + 1].length) {
+                break;
+            }
+            merge_at(n);
+        }
+    }
+
+    void merge_force_collapse() {
+        while (runs.size() > 1) {
+            size_t n = runs.size() - 2;
+            if (n > 0 && runs[n - 1].length < runs[n + 1].length) {
+                --n;
+            }
+            merge_at(n);
+        }
+    }
+
+public:
+    explicit TimSort(Less& less) : less(less) {}
+
+    void sort(It first, It last) {
+        size_t remaining = last - first;
+        if (remaining < 2) {
+            return;
+        }
+
+        const size_t min_run = min_run_length(remaining);
+        It pos = first;
+        while (remaining != 0) {
+            size_t length = count_run_and_make_ascending(pos, last, less);
+            if (length < min_run) {
+                const size_t forced = std::min(min_run, remaining);
+                binary_insertion_sort(pos, pos + length, pos + forced, less);
+                length = forced;
+            }
+            runs.push_back(Run {pos, length});
+            merge_collapse();
+            pos += length;
+            remaining -= length;
+        }
+        merge_force_collapse();
+    }
+};
+
+}
+
+template<typename It, typename Less>
+void timsort(It first, It last, Less less) {
+    detail::TimSort<It, Less>(less).sort(first, last);
+}
+
+// A stable LSD radix sort on the int64_t key(item), a byte at a time. Passes on
+// a byte that every key shares are skipped, so small ranges of keys are cheap
+template<typename T, typename Key>
+void radix_sort(std::vector<T>& items, Key key) {
+    const size_t n = items.size();
+    std::vector<T> scratch(n);
+    size_t counts[8][256] = {};
+    for (const T& item : items) {
+        // flipping the sign bit orders negative keys before positive ones
+        const uint64_t k = (uint64_t)key(item) ^ (UINT64_C(1) << 63);
+        for (size_t byte = 0; byte < 8; ++byte) {
+            counts[byte][(k >> (byte * 8)) & 0xff]++;
+        }
+    }
+
+    std::vector<T>* from = &items;
+    std::vector<T>* to = &scratch;
+    for (size_t byte = 0; byte < 8; ++byte) {
+        size_t* count = counts[byte];
+        if (std::find(count, count + 256, n) != count + 256) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < 256; ++i) {
+            const size_t c = count[i];
+            count[i] = offset;
+            offset += c;
+        }
+        for (T& item : *from) {
+            const uint64_t k = (uint64_t)key(item) ^ (UINT64_C(1) << 63);
+            (*to)[count[(k >> (byte * 8)) & 0xff]++] = std::move(item);
+        }
+        std::swap(from, to);
+    }
+    if (from != &items) {
+        items = std::move(*from);
+    }
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,121 @@
+#include <cctype>
+
+#include "pyvalue.hpp"
+#include "pyallocator.hpp"
+
+namespace py {
+namespace value {
+
+namespace {
+
+#ifdef STRING_BUILDER_ON
+// shorter concatenations are copied into a new string, their characters fit in
+// data's inline buffer or cost less to copy than a shared buffer costs to allocate
+constexpr size_t SHARED_CONCAT_MIN_LENGTH = 64;
+#endif
+
+#ifdef STRING_INTERNING_ON
+bool is_identifier(const std::string& str) {
+    for (char c : str) {
+        if (!(std::isalnum((unsigned char)c) || c == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+}
+
+ValueString String::concat(const ValueString& a, const ValueString& b) {
+    const size_t length = a->size() + b->size();
+    if (b->empty()) {
+        return a;
+    } else if (a->empty()) {
+        return b;
+    }
+
+#ifdef STRING_BUILDER_ON
+    if (length >= SHARED_CONCAT_MIN_LENGTH) {
+        if (a->shared != nullptr && a->length == a->shared->size()) {
+            // a ends its buffer, so the result can extend it in place
+            a->shared->append(b->str());
+            return alloc().heap_string.make(a->shared, length);
+        }
+        auto buffer = std::make_shared<std::string>();
+        buffer->reserve(length * 2);
+        buffer->append(a->view());
+        buffer->append(b->view());
+        return alloc().heap_string.make(std::move(buffer), length);
+    }
+#endif
+
+    std::string result;
+    result.reserve(length);
+    result.append(a->view());
+    result.append(b->view());
+    return alloc().heap_string.make(std::move(result));
+}
+
+ValueString String::slice(const ValueString& str, size_t first, size_t length) {
+#ifdef SLICE_VIEWS_ON
+    if (length >= Slice::VIEW_MIN_LENGTH && length * 2 >= str->size()) {
+        // a view of a view is one of the string that was cut from
+        if (str->base != nullptr) {
+            return alloc().heap_string.make(str->base, str->offset + first, length);
+        }
+        return alloc().heap_string.make(str, first, length);
+    }
+#endif
+    return alloc().heap_string.make(std::string(str->view().substr(first, length)));
+}
+
+const std::string& String::unshare() const {
+    if (this->base != nullptr) {
+        this->data.assign(this->view());
+        this->base = nullptr;
+        return this->data;
+    }
+    if (this->length == this->shared->size()) {
+        return *this->shared;
+    }
+    // the buffer was grown by a later concatenation, only the prefix is ours
+    this->data.assign(*this->shared, 0, this->length);
+    this->shared = nullptr;
+    return this->data;
+}
+
+ValueString String::intern(const std::string& str) {
+#ifdef STRING_INTERNING_ON
+    if (!is_identifier(str)) {
+        return alloc().heap_string.make(str);
+    }
+    auto& table = alloc().interned;
+    auto itr = table.find(str);
+    if (itr != table.end()) {
+        return itr->second;
+    }
+    ValueString result = alloc().heap_string.make(str);
+    result.retain();
+    table.emplace(str, result);
+    return result;
+#else
+    return alloc().heap_string.make(str);
+#endif
+}
+
+ValueString String::character(char c) {
+#ifdef STRING_INTERNING_ON
+    ValueString& result = alloc().characters[(unsigned char)c];
+    if (result == nullptr) {
+        result = alloc().heap_string.make(1, c);
+        result.retain();
+    }
+    return result;
+#else
+    return alloc().heap_string.make(1, c);
+#endif
+}
+
+}
+}
@@ -6,7 +6,7 @@ namespace py {
 namespace value {
 
 PyObject::PyObject(ValuePyClass cls) : static_attrs(cls) {
-    this->attrs = alloc.heap_namespace.make();
+    this->attrs = alloc().heap_namespace.make();
 };
 
 }
@@ -31,6 +31,10 @@ struct visitor_debug_repr {
         stream << d;
     }
 
+    void operator()(ValueBigInt d) {
+        stream << d->to_string();
+    }
+
     void operator()(ValueString d) {
         stream << *d;
     }
@@ -68,11 +72,10 @@ struct visitor_debug_repr {
 
     void operator()(ValueList list) {
         stream << "[";
-        size_t i = 0;
-        for (auto& value : list->values) {
-            std::visit(visitor_debug_repr(stream), value);
+        for (size_t i = 0; i < list->size(); ++i) {
+            std::visit(visitor_debug_repr(stream), list->get(i));
             stream << ", ";
-            if (i++ > 50) {
+            if (i > 51) {
                 stream << "...";
                 break;
             }
@@ -83,7 +86,7 @@ struct visitor_debug_repr {
     void operator()(ValueTuple list) {
         stream << "(";
         size_t i = 0;
-        for (auto& value : list->values) {
+        for (auto& value : *list) {
             std::visit(visitor_debug_repr(stream), value);
             stream << ", ";
             if (i++ > 50) {
@@ -98,6 +101,54 @@ struct visitor_debug_repr {
         stream << "(Unknown C Generator)";
     }
 
+    void operator()(ValueDict dict) {
+        stream << "{";
+        size_t i = 0;
+        for (const auto& entry : dict->entries) {
+            if (entry.hash == 0) continue; // erased
+            std::visit(visitor_debug_repr(stream), entry.key);
+            stream << ": ";
+            std::visit(visitor_debug_repr(stream), entry.value);
+            stream << ", ";
+            if (i++ > 50) {
+                stream << "...";
+                break;
+            }
+        }
+        stream << "}";
+    }
+
+    void operator()(ValueSet set) {
+        stream << "{";
+        size_t pos = 0;
+        Value value;
+        for (size_t i = 0; set->next(pos, value); ++i) {
+            std::visit(visitor_debug_repr(stream), value);
+            stream << ", ";
+            if (i > 50) {
+                stream << "...";
+                break;
+            }
+        }
+        stream << "}";
+    }
+
+    void operator()(ValueSlice slice) {
+        stream << "slice(";
+        std::visit(visitor_debug_repr(stream), slice->start);
+        stream << ", ";
+        std::visit(visitor_debug_repr(stream), slice->stop);
+        stream << ", ";
+        std::visit(visitor_debug_repr(stream), slice->step);
+        stream << ")";
+    }
+
+    void operator()(ValueCell cell) {
+        stream << "<cell: ";
+        std::visit(visitor_debug_repr(stream), cell->contents);
+        stream << ">";
+    }
+
     template<typename T> 
     void operator()(T) {
         // TODO: use typetraits to generate this.
@@ -11,8 +11,12 @@
 #include <ostream>
 #include <pygc.hpp>
 #include <tuple>
+#include <array>
+#include <atomic>
+#include <string_view>
 
 #include "pyerror.hpp"
+#include "optflags.hpp"
 
 namespace py {
 
@@ -38,12 +42,16 @@ namespace value {
 
     struct NoneType { };
 
+    struct String;
     struct CFunction;
     struct CMethod;
     struct List;
     struct Tuple;
-    // struct Map;
-    // struct Set;
+    struct Cell;
+    struct Slice;
+    struct Dict;
+    struct Set;
+    struct BigInt;
 
     // A function of python code
     struct PyFunc;
@@ -68,7 +76,7 @@ namespace value {
 // larger value types should be wrapped by a shared_ptr,
 // this is because we want to keep the size of our std::variant class small,
 // it also allows sharing string objects between multiple values whenever possible
-using ValueString = gc_ptr<const std::string>;
+using ValueString = gc_ptr<const value::String>;
 using ValueCode = gc_ptr<Code>;
 using ValueCFunction = std::shared_ptr<value::CFunction>;
 using ValueCMethod = std::shared_ptr<value::CMethod>;
@@ -79,6 +87,11 @@ using ValueCGenerator = std::shared_ptr<value::CGenerator>;
 using ValuePyClass = gc_ptr<value::PyClass>;
 using ValueList = gc_ptr<value::List>;
 using ValueTuple = gc_ptr<value::Tuple>;
+using ValueCell = gc_ptr<value::Cell>;
+using ValueSlice = gc_ptr<value::Slice>;
+using ValueDict = gc_ptr<value::Dict>;
+using ValueSet = gc_ptr<value::Set>;
+using ValueBigInt = gc_ptr<value::BigInt>;
 
 using Value = std::variant<
     bool,
@@ -95,12 +108,42 @@ using Value = std::variant<
     ValueList,
     ValueTuple,
     ValuePyGenerator,
-    ValueCGenerator
+    ValueCGenerator,
+    ValueCell,
+    ValueSlice,
+    ValueDict,
+    ValueSet,
+    ValueBigInt
 >;
 
 // Bad copy/paste from pyinterpreter.hpp
 using Namespace = gc_ptr<std::unordered_map<std::string, Value>>;
 
+// Marks a value that is stored into an object which an incremental collection
+// may have scanned already. Defined in pyallocator.cpp
+void shade(const Value& value);
+
+// Marks what a value refers to from a root, during a collection's marking.
+// Defined in pyallocator.cpp
+void mark_value(const Value& value);
+
+// called on every value stored into an existing object, objects made while
+// an incremental collection marks are scanned after they were filled in
+inline void write_barrier(const Value& value) {
+    if (gc_mark_worker::incremental != nullptr) {
+        shade(value);
+    }
+}
+
+template<typename Iterator>
+inline void write_barrier(Iterator first, Iterator last) {
+    if (gc_mark_worker::incremental != nullptr) {
+        for (; first != last; ++first) {
+            shade(*first);
+        }
+    }
+}
+
 // Arg List definition
 struct ArgList {
     /*
@@ -110,6 +153,10 @@ struct ArgList {
     size_t offset;
     std::vector<Value> _args;
 
+    // the names of the keyword arguments, which are the last kwnames.size()
+    // arguments. Only builtins take keyword arguments so far
+    std::vector<ValueString> kwnames;
+
     ArgList() {
         offset = 1;
         _args.resize(1);
@@ -150,6 +197,10 @@ struct ArgList {
     inline size_t size() const {
         return _args.size() - offset;
     }
+
+    inline size_t positional() const {
+        return size() - kwnames.size();
+    }
 };
 
 namespace value {
@@ -162,7 +213,7 @@ namespace value {
         Value thisArg = value::NoneType();
         std::function<void(FrameState&, ArgList&)> action;
         
-        CMethod(const decltype(action)& action) : thisArg(thisArg), action(action) {
+        CMethod(const decltype(action)& action) : action(action) {
         }
 
         CMethod(Value& thisArg, const decltype(action)& action) : thisArg(thisArg), action(action) {
@@ -179,53 +230,285 @@ namespace value {
         virtual ~CGenerator() { };
     };
     
-    struct List { 
-        // we must wrap the vector in a forward declared struct, because otherwise the type information
-        // and more importantly the size of py::Value, is not available at the time of its creation
-        // (before it needs to be included in the std::variant)
-        std::vector<Value> values;
+    // An immutable string. Its characters are normally kept in data, whose inline
+    // buffer holds short strings in the same allocation as the object, and the hash
+    // is computed on first use. A long concatenation instead shares a growing buffer
+    // with the string it extends: appending to the string that ends the buffer grows
+    // the buffer in place, so building a string with += in a loop is linear, and a
+    // string that the buffer has grown past copies its prefix out when it is read.
+    // A long slice is a view of the characters of the string it was cut from, which
+    // it keeps alive, and copies them out the first time str() is needed.
+    // Defined in pystring.cpp
+    struct String {
+        String() { }
+        String(std::string str) : data(std::move(str)) { }
+        String(const char* str) : data(str) { }
+        String(size_t count, char c) : data(count, c) { }
+        // the first length characters of buffer, only used by concat
+        String(std::shared_ptr<std::string> buffer, size_t length) : shared(std::move(buffer)), length(length) { }
+        // length characters of base from offset on, only used by slice
+        String(ValueString base, size_t offset, size_t length) : base(std::move(base)), offset(offset), length(length) { }
+
+        // a + b
+        static ValueString concat(const ValueString& a, const ValueString& b);
+        // str[first:first + length], a view when that is long enough to be worth it
+        static ValueString slice(const ValueString& str, size_t first, size_t length);
+        // The one string with these characters, for the constants of code objects
+        // that look like identifiers. Interned strings are never collected
+        static ValueString intern(const std::string& str);
+        // The interned one character string
+        static ValueString character(char c);
+
+        const std::string& str() const {
+            if (__builtin_expect(shared != nullptr || base != nullptr, 0)) {
+                return this->unshare();
+            }
+            return data;
+        }
 
-        template < typename... Args> 
-        List(Args&&... args) : values(std::forward<Args>(args)...) {
-        };
+        operator const std::string&() const {
+            return str();
+        }
 
-        auto begin() {
-            return values.begin();
+        // the characters wherever they are kept, without copying them
+        std::string_view view() const {
+            if (__builtin_expect(base != nullptr, 0)) {
+                return base->view().substr(offset, length);
+            } else if (__builtin_expect(shared != nullptr, 0)) {
+                return std::string_view(shared->data(), length);
+            }
+            return data;
         }
 
-        auto begin() const {
-            return values.begin();
+        // the string a view was cut from, null for any other
+        const ValueString& viewed() const {
+            return base;
         }
 
-        auto end() {
-            return values.end();
+        size_t size() const {
+            return shared != nullptr || base != nullptr ? length : data.size();
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        const char* c_str() const {
+            return str().c_str();
         }
 
-        auto end() const {
-            return values.end();
+        // the prefix of a shared buffer and the string a view was cut from never
+        // change, so no copy is needed
+        char operator[](size_t index) const {
+            return shared == nullptr && base == nullptr ? data[index] : view()[index];
         }
 
-        auto& operator[](size_t index) {
-            return values[index];
+        // the same hash std::string has, so an unordered_map of std::string keys
+        // and a view of the same characters agree
+        size_t hash() const {
+            if (!hashed) {
+                cached_hash = std::hash<std::string_view>()(view());
+                hashed = true;
+            }
+            return cached_hash;
+        }
+
+        bool operator==(const String& other) const {
+            if (size() != other.size() || (hashed && other.hashed && cached_hash != other.cached_hash)) {
+                return false;
+            }
+            return view() == other.view();
         }
 
-        const auto& operator[](size_t index) const {
-            return values[index];
+        bool operator!=(const String& other) const {
+            return !(*this == other);
         }
 
+        bool operator<(const String& other) const {
+            return view() < other.view();
+        }
+
+        bool operator==(const std::string& other) const {
+            return view() == other;
+        }
+
+        bool operator!=(const std::string& other) const {
+            return view() != other;
+        }
+
+    private:
+        mutable std::string data;
+        mutable std::shared_ptr<std::string> shared;
+        mutable ValueString base;
+        size_t offset = 0;
+        size_t length = 0;
+        mutable size_t cached_hash = 0;
+        mutable bool hashed = false;
+
+        const std::string& unshare() const;
+    };
+
+    inline std::ostream& operator<<(std::ostream& os, const String& str) {
+        return os << str.str();
+    }
+
+    inline std::string operator+(const String& a, const std::string& b) {
+        return a.str() + b;
+    }
+
+    inline std::string operator+(const std::string& a, const String& b) {
+        return a + b.str();
+    }
+
+    inline std::string operator+(const String& a, const char* b) {
+        return a.str() + b;
+    }
+
+    inline std::string operator+(const char* a, const String& b) {
+        return a + b.str();
+    }
+
+    // A list keeps its items in the narrowest of three storage strategies, like PyPy's
+    // list strategies: a plain int64_t or double array while every item has that
+    // type, and Values otherwise. Storing any other type moves it to OBJECTS for good,
+    // while an empty list takes whichever strategy its first item needs. Only an
+    // OBJECTS list has anything for the collector to mark. Defined in pylist.cpp
+    struct List {
+        enum Strategy : uint8_t { INTS, DOUBLES, OBJECTS };
+        Strategy strategy = INTS;
+
+        // only the vector of the current strategy holds items
+        std::vector<int64_t> ints;
+        std::vector<double> doubles;
+        std::vector<Value> values;
+
+        List() {};
+        explicit List(std::vector<Value>&& items);
+        List(std::vector<Value>::const_iterator first, std::vector<Value>::const_iterator last);
+
         size_t size() const {
-            return values.size();
+            switch (strategy) {
+                case INTS: return ints.size();
+                case DOUBLES: return doubles.size();
+                default: return values.size();
+            }
+        }
+
+        Value get(size_t index) const {
+            switch (strategy) {
+                case INTS: return ints[index];
+                case DOUBLES: return doubles[index];
+                default: return values[index];
+            }
         }
+
+        void set(size_t index, const Value& value) {
+            write_barrier(value);
+            if (strategy == INTS) {
+                if (auto i = std::get_if<int64_t>(&value)) {
+                    ints[index] = *i;
+                    return;
+                }
+            } else if (strategy == DOUBLES) {
+                if (auto d = std::get_if<double>(&value)) {
+                    doubles[index] = *d;
+                    return;
+                }
+            } else {
+                values[index] = value;
+                return;
+            }
+            this->generic()[index] = value;
+        }
+
+        void append(const Value& value) {
+            write_barrier(value);
+            if (strategy == INTS) {
+                if (auto i = std::get_if<int64_t>(&value)) {
+                    ints.push_back(*i);
+                    return;
+                }
+            } else if (strategy == DOUBLES) {
+                if (auto d = std::get_if<double>(&value)) {
+                    doubles.push_back(*d);
+                    return;
+                }
+            } else {
+                values.push_back(value);
+                return;
+            }
+            this->append_slow(value);
+        }
+
+        void insert(size_t index, const Value& value);
+        // Removes the items in [first, last)
+        void erase(size_t first, size_t last);
+        // Replaces the count items at first with items, as list[first:first + count] = items
+        void splice(size_t first, size_t count, const std::vector<Value>& items);
+        void extend(const List& other);
+        void reserve(size_t n);
+        void clear();
+
+        // Copies length items, starting at first and stepping by step, to the end of out
+        void copy_slice(List& out, int64_t first, int64_t step, size_t length) const;
+
+        bool contains(const Value& value) const;
+
+        // Moves the list to OBJECTS, for the operations that have no typed version
+        std::vector<Value>& generic();
+
+    private:
+        void append_slow(const Value& value);
+        // whether value can be stored without leaving the current strategy,
+        // picking the strategy for it first while the list is empty
+        bool accepts(const Value& value);
     };
 
-    struct Tuple : public List {
+    // A tuple holds its items in values, unless it is a long slice of another
+    // tuple. Then it is a view of length items of that one from offset on, and
+    // keeps it alive. Either way the items are read through begin(), end() and []
+    struct Tuple {
+        std::vector<Value> values;
+        gc_ptr<Tuple> base = nullptr;
+        size_t offset = 0;
+        size_t length = 0;
+
         template<typename... Args>
-        Tuple(Args&&... args) : List(std::forward<Args>(args)...) {
+        Tuple(Args&&... args) : values(std::forward<Args>(args)...) {
             
         }
 
+        Value* begin() {
+            return base != nullptr ? base->values.data() + offset : values.data();
+        }
+
+        const Value* begin() const {
+            return base != nullptr ? base->values.data() + offset : values.data();
+        }
+
+        Value* end() {
+            return begin() + size();
+        }
+
+        const Value* end() const {
+            return begin() + size();
+        }
+
+        Value& operator[](size_t index) {
+            return begin()[index];
+        }
+
+        const Value& operator[](size_t index) const {
+            return begin()[index];
+        }
+
+        size_t size() const {
+            return base != nullptr ? length : values.size();
+        }
+
         inline void initialize_fields() {
             this->values.resize(0);
+            this->base = nullptr;
         }
         
         void recycle() {
@@ -238,13 +521,192 @@ namespace value {
         }
     };
     
-    // struct Set {
-    //     unordered_set<Value> values;
-    // };
+    // A variable shared between a function and the closures created inside it
+    struct Cell {
+        Value contents = value::NoneType();
+        bool bound = false; // whether anything was stored yet
+    };
+
+    // The value of start:stop:step, each an int or None
+    struct Slice {
+        Value start = value::NoneType();
+        Value stop = value::NoneType();
+        Value step = value::NoneType();
+
+        // shorter slices of strings and tuples are copied, and so are the ones
+        // that would keep much more of what they were cut from alive than they show
+        static constexpr size_t VIEW_MIN_LENGTH = 64;
+
+        // Clamp start/stop/step to a sequence of the given length the way python does,
+        // returns the number of elements selected. Defined in builtins_slice.cpp
+        static size_t adjust_indices(
+            size_t length, const Value& start, const Value& stop, const Value& step,
+            int64_t& r_start, int64_t& r_step
+        );
+    };
+
+
+    // A dict, laid out like CPython's compact dict: the entries are kept in insertion
+    // order and are found through an open addressing index that is probed a group
+    // of 16 control bytes at a time. Defined in pydict.cpp
+    struct Dict {
+        static constexpr size_t GROUP_WIDTH = 16;
+
+        struct Entry {
+            size_t hash; // cached so that growing never rehashes a key, 0 once erased
+            Value key;
+            Value value;
+        };
+
+        // Insertion ordered, erased entries stay behind until the index is rebuilt
+        std::vector<Entry> entries;
+
+        // One control byte per slot of the index, followed by a copy of the first
+        // GROUP_WIDTH of them so a group can be loaded starting at any slot.
+        // A control byte is EMPTY, DELETED or the low 7 bits of the entry's hash
+        std::vector<int8_t> ctrl;
+
+        // The position in entries of the entry each full slot refers to
+        std::vector<uint32_t> slots;
+
+        // Number of entries that have not been erased
+        size_t live = 0;
+
+        // Number of inserts left before the index has to be rebuilt
+        size_t growth_left = 0;
+
+        size_t size() const {
+            return live;
+        }
+
+        // The value stored under key, or nullptr. Only valid until the next insert
+        Value* find(const Value& key);
+        const Value* find(const Value& key) const;
+
+        // d[key] = value
+        void set(const Value& key, Value value);
+
+        // Remove key, moving its value into removed if that is given
+        bool erase(const Value& key, Value* removed = nullptr);
+
+        void clear();
+
+        // Make room for n entries without rebuilding the index along the way
+        void reserve(size_t n);
+
+    private:
+        size_t capacity() const {
+            return slots.size();
+        }
+
+        template<typename Eq>
+        size_t find_slot(size_t hash, Eq&& eq) const;
+        size_t find_slot(const Value& key, size_t hash) const;
+        void insert_new(size_t hash, const Value& key, Value value);
+        void rebuild(size_t new_capacity);
+        void set_ctrl(size_t slot, int8_t value);
+    };
+
+    // A set. While it only holds ints it is a bitmap when they are dense and a
+    // flat table of int64s otherwise, so membership tests never touch a Value.
+    // The first element that is not an int moves it to a Dict with None values.
+    // Defined in pyset.cpp
+    struct Set {
+        enum Kind : uint8_t { BITMAP, INTS, GENERIC };
+        Kind kind = BITMAP;
+
+        // BITMAP: bit i of words is set when base + i is in the set
+        int64_t base = 0;
+        std::vector<uint64_t> words;
+
+        // INTS: linear probing table, free slots hold EMPTY_INT
+        static constexpr int64_t EMPTY_INT = INT64_MIN;
+        std::vector<int64_t> ints;
+        bool has_empty_int = false; // whether EMPTY_INT itself is in the set
+
+        // GENERIC: the keys of the dict are the elements
+        Dict generic;
+
+        // number of elements for BITMAP and INTS
+        size_t count = 0;
+
+        size_t size() const {
+            return kind == GENERIC ? generic.size() : count;
+        }
+
+        bool contains(const Value& value) const;
+        void add(const Value& value);
+        bool remove(const Value& value);
+        void clear();
+
+        // Iterate by advancing pos from 0, returns false once there are no more elements
+        bool next(size_t& pos, Value& out) const;
+
+        // Python's a | b, a & b, a - b and a ^ b
+        static void set_union(Set& result, const Set& a, const Set& b);
+        static void set_intersection(Set& result, const Set& a, const Set& b);
+        static void set_difference(Set& result, const Set& a, const Set& b);
+        static void set_symmetric_difference(Set& result, const Set& a, const Set& b);
+
+    private:
+        bool contains_int(int64_t value) const;
+        void add_int(int64_t value);
+        bool remove_int(int64_t value);
+        void to_ints();
+        void to_generic();
+        void rehash_ints(size_t capacity);
+    };
+
+    // An int that does not fit in an int64_t. Ints are only stored as a BigInt while
+    // they are out of that range, so a BigInt is never equal to an int64_t. The
+    // magnitude is kept in base 2^32 digits, least significant first, with no
+    // leading zero digits. Defined in pybigint.cpp
+    struct BigInt {
+        bool negative = false;
+        std::vector<uint32_t> digits;
 
-    // struct Map {
-    //     unordered_map<Value, Value> values;
-    // }
+        BigInt() {};
+        explicit BigInt(int64_t value);
+
+        // Parses an optionally signed decimal number, throws a ValueError otherwise
+        static BigInt from_string(const std::string& str);
+        // Truncates d towards zero, throws for inf and nan
+        static BigInt from_double(double d);
+
+        // The value as an int64_t if it fits, otherwise as a new BigInt on the heap
+        static Value to_value(BigInt&& value);
+
+        bool is_zero() const {
+            return digits.empty();
+        }
+
+        bool fits_int64() const;
+        int64_t to_int64() const;
+        double to_double() const;
+        std::string to_string() const;
+
+        static int compare(const BigInt& a, const BigInt& b);
+
+        static BigInt add(const BigInt& a, const BigInt& b);
+        static BigInt sub(const BigInt& a, const BigInt& b);
+        static BigInt mul(const BigInt& a, const BigInt& b);
+        static BigInt pow(const BigInt& base, uint64_t exp);
+        // Python's floor division and modulo, either output may be null
+        static void divmod(const BigInt& a, const BigInt& b, BigInt* quotient, BigInt* remainder);
+        static BigInt shift_left(const BigInt& a, uint64_t bits);
+        static BigInt shift_right(const BigInt& a, uint64_t bits);
+        static BigInt bit_and(const BigInt& a, const BigInt& b);
+        static BigInt bit_or(const BigInt& a, const BigInt& b);
+        static BigInt bit_xor(const BigInt& a, const BigInt& b);
+
+        // The results of the int64_t operations that overflowed,
+        // kept out of line so the fast paths stay small
+        static Value add_int64(int64_t a, int64_t b);
+        static Value sub_int64(int64_t a, int64_t b);
+        static Value mul_int64(int64_t a, int64_t b);
+        static Value pow_int64(int64_t base, int64_t exp);
+        static Value lshift_int64(int64_t a, int64_t bits);
+    };
     
     struct PyFunc {
         // Its name
@@ -262,11 +724,31 @@ namespace value {
         // Flags as needed
         const uint8_t flags;
 
-        // CHANGE TO TO A TUPLE!
-        ValueList __closure__ = nullptr;
+        // The cells of the free variables, in the order of co_freevars
+        ValueTuple __closure__ = nullptr;
 
     };
 
+    // Indices into PyClass::slots, one for each dunder the interpreter dispatches on
+    namespace slot {
+        enum Slot : uint8_t {
+            LT, LE, GT, GE, EQ, NE,
+            ADD, RADD, SUB, RSUB, MUL, RMUL,
+            FLOORDIV, RFLOORDIV, TRUEDIV, RTRUEDIV, POW, RPOW, MOD, RMOD,
+            LSHIFT, RLSHIFT, RSHIFT, RRSHIFT, AND, RAND, OR, ROR, XOR, RXOR,
+            IADD, ISUB, IMUL, IFLOORDIV, ITRUEDIV, IPOW, IMOD,
+            ILSHIFT, IRSHIFT, IAND, IOR, IXOR,
+            INIT, CALL, GETITEM, SETITEM, LEN,
+            COUNT
+        };
+
+        // The attribute name of each slot, "__lt__" for LT and so on
+        extern const char* name[COUNT];
+
+        // Whether attr is the name of a slot. Defined in pyvalue_helpers.cpp
+        bool is_slot_name(const std::string& attr);
+    }
+
     // The static value of a class
     struct PyClass {
         // Static Attributes
@@ -299,9 +781,49 @@ namespace value {
                                     const std::string& attr
                                 );
 
-        // Store an attribute into attrs
+        // Look in the class itself and then its parents, nothing gets bound
+        // Defined in FrameState
+        static std::tuple<Value,bool> find_attr_in_class(
+                                    ValuePyClass& cls,
+                                    const std::string& attr
+                                );
+
+        // The dunders of this class resolved through the parents, NoneType where
+        // the class does not define one. Only valid while slots_epoch == epoch.
+        // Everything in here is reachable from attrs or the parents, so the
+        // garbage collector does not need to look at it
+        std::array<Value, slot::COUNT> slots;
+        uint64_t slots_epoch = 0;
+
+        // Bumped whenever any class is modified, since a change to a parent
+        // also changes the slots of all its children. Shared by all interpreters,
+        // a change in one only makes the others refill their slots
+        static std::atomic<uint64_t> epoch;
+
+        // Recompute slots from attrs and the parents
+        static void fill_slots(ValuePyClass& cls);
+
+        // The overload of the given dunder, or nullptr if there is none
+        static inline const Value* get_slot(ValuePyClass& cls, slot::Slot which) {
+#ifdef OPERATOR_SLOTS_ON
+            if (cls->slots_epoch != epoch.load(std::memory_order_relaxed)) {
+                fill_slots(cls);
+            }
+#else
+            cls->slots[which] = std::get<0>(find_attr_in_class(cls, slot::name[which]));
+#endif
+            const Value& val = cls->slots[which];
+            return std::holds_alternative<value::NoneType>(val) ? nullptr : &val;
+        }
+
+        // Store an attribute into attrs, only a dunder with a slot can change
+        // the slot tables of this class and the ones inheriting from it
         void store_attr(const std::string& str, Value val){
+            write_barrier(val);
             (*attrs)[str] = val;
+            if (slot::is_slot_name(str)) {
+                epoch.fetch_add(1, std::memory_order_relaxed);
+            }
         }
     };
 
@@ -322,6 +844,7 @@ namespace value {
 
         // Store an attribute into attrs
         void store_attr(const std::string& str, Value val){
+            write_barrier(val);
             (*attrs)[str] = val;
         }
 
@@ -1,6 +1,9 @@
 #include <iostream>
 #include <sstream>
 #include <stdio.h>
+#include <cstring>
+#include <cmath>
+#include <type_traits>
 
 #include "pyvalue_helpers.hpp"
 #include "builtins/builtins.hpp"
@@ -27,6 +30,146 @@ namespace value_helper {
         return false;
     }
 
+    bool visitor_is_truthy::operator()(const ValueDict& d) const {
+        return d->size() != 0;
+    }
+
+    bool visitor_is_truthy::operator()(const ValueSet& s) const {
+        return s->size() != 0;
+    }
+
+
+    /*
+        hash and equality of dict keys
+    */
+
+    // spreads the entropy of a 64 bit value over all of its bits (the murmur3 finalizer),
+    // the dict takes the slot from the high bits and the control byte from the low ones
+    static inline size_t mix_hash(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    struct visitor_hash {
+        size_t operator()(bool v) const {
+            return mix_hash(v);
+        }
+
+        size_t operator()(int64_t v) const {
+            return mix_hash(v);
+        }
+
+        size_t operator()(double v) const {
+            // 1.0 == 1 so they must hash the same
+            if (v >= -9.2e18 && v <= 9.2e18 && v == std::trunc(v)) {
+                return mix_hash((int64_t)v);
+            }
+            uint64_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            return mix_hash(bits);
+        }
+
+        size_t operator()(const ValueString& str) const {
+            return mix_hash(str->hash());
+        }
+
+        size_t operator()(value::NoneType) const {
+            return 0x5bd1e995;
+        }
+
+        size_t operator()(const ValueTuple& tuple) const {
+            // the xxHash64 round that CPython also uses to combine element hashes
+            uint64_t acc = 0x27d4eb2f165667c5ULL;
+            for (const Value& item : *tuple) {
+                acc += hash_value(item) * 0xc2b2ae3d27d4eb4fULL;
+                acc = (acc << 31) | (acc >> 33);
+                acc *= 0x9e3779b185ebca87ULL;
+            }
+            return acc + (tuple->size() ^ 0x27d4eb2f165667c5ULL);
+        }
+
+        size_t operator()(const ValueBigInt& v) const {
+            // a BigInt that a double holds exactly must hash like that double,
+            // 31 digits stay clear of the largest finite double
+            if (v->digits.size() <= 31) {
+                const double d = v->to_double();
+                if (value::BigInt::compare(value::BigInt::from_double(d), *v) == 0) {
+                    return (*this)(d);
+                }
+            }
+            uint64_t acc = v->negative;
+            for (uint32_t digit : v->digits) {
+                acc = mix_hash(acc ^ digit);
+            }
+            return acc;
+        }
+
+        size_t operator()(const ValueList&) const {
+            throw pyerror("TypeError: unhashable type: 'list'");
+        }
+
+        size_t operator()(const ValueDict&) const {
+            throw pyerror("TypeError: unhashable type: 'dict'");
+        }
+
+        size_t operator()(const ValueSet&) const {
+            throw pyerror("TypeError: unhashable type: 'set'");
+        }
+
+        size_t operator()(const value::PyGenerator& gen) const {
+            return mix_hash((uintptr_t)gen.frame.get());
+        }
+
+        template<typename T>
+        size_t operator()(const T& ptr) const {
+            return mix_hash((uintptr_t)ptr.get());
+        }
+    };
+
+    size_t hash_value(const Value& value) {
+        size_t h = std::visit(visitor_hash(), value);
+        return h != 0 ? h : 1;
+    }
+
+    struct visitor_equal {
+        template<typename T1, typename T2>
+        bool operator()(const T1& a, const T2& b) const {
+            if constexpr (std::is_arithmetic_v<T1> && std::is_arithmetic_v<T2>) {
+                return a == b;
+            } else if constexpr (std::is_same_v<T1, ValueBigInt> && std::is_same_v<T2, double>) {
+                return std::isfinite(b) && b == std::trunc(b)
+                    && value::BigInt::compare(*a, value::BigInt::from_double(b)) == 0;
+            } else if constexpr (std::is_same_v<T1, double> && std::is_same_v<T2, ValueBigInt>) {
+                return values_equal(b, a);
+            } else if constexpr (!std::is_same_v<T1, T2>) {
+                // BigInts are only used out of the int64_t range, so never equal to an int
+                return false;
+            } else if constexpr (std::is_same_v<T1, ValueBigInt>) {
+                return a == b || value::BigInt::compare(*a, *b) == 0;
+            } else if constexpr (std::is_same_v<T1, ValueString>) {
+                return a == b || *a == *b;
+            } else if constexpr (std::is_same_v<T1, ValueTuple>) {
+                if (a == b) return true;
+                if (a->size() != b->size()) return false;
+                for (size_t i = 0; i < a->size(); ++i) {
+                    if (!values_equal(a->values[i], b->values[i])) return false;
+                }
+                return true;
+            } else if constexpr (std::is_same_v<T1, value::NoneType>) {
+                return true;
+            } else {
+                return a == b;
+            }
+        }
+    };
+
+    bool values_equal(const Value& a, const Value& b) {
+        return std::visit(visitor_equal(), a, b);
+    }
 
     /*
         attribute visitor implementations for specific types i.e. lists
@@ -50,11 +193,127 @@ namespace value_helper {
         }
     }
 
-    ValuePyObject create_cell(Value contents){
-        DEBUG_ADV("Creating cell for " << contents << "\n");
-        ValuePyObject nobj = alloc.heap_pyobject.make(builtins::cell_class);
-        nobj->store_attr("contents",contents);
-        return nobj;
+    void load_attr_visitor::operator()(ValueDict& dict) {
+        auto itr = builtins::builtin_dict_attributes.find(attr);
+        if (itr != builtins::builtin_dict_attributes.end()) {
+            frame.value_stack.push_back(itr->second->bindThisArg(dict));
+        } else {
+            std::stringstream ss;
+            ss << "AttributeError: 'dict' object has no attribute '" << attr << "'";
+            throw pyerror(ss.str());
+        }
+    }
+
+    void load_attr_visitor::operator()(ValueSet& set) {
+        auto itr = builtins::builtin_set_attributes.find(attr);
+        if (itr != builtins::builtin_set_attributes.end()) {
+            frame.value_stack.push_back(itr->second->bindThisArg(set));
+        } else {
+            std::stringstream ss;
+            ss << "AttributeError: 'set' object has no attribute '" << attr << "'";
+            throw pyerror(ss.str());
+        }
+    }
+
+    void load_attr_visitor::operator()(ValueString& str) {
+        auto itr = builtins::builtin_string_attributes.find(attr);
+        if (itr != builtins::builtin_string_attributes.end()) {
+            frame.value_stack.push_back(itr->second->bindThisArg(str));
+        } else {
+            std::stringstream ss;
+            ss << "AttributeError: 'str' object has no attribute '" << attr << "'";
+            throw pyerror(ss.str());
+        }
+    }
+
+    // of the C iterators only files have attributes
+    void load_attr_visitor::operator()(ValueCGenerator& gen) {
+        auto itr = builtins::builtin_file_attributes.find(attr);
+        if (dynamic_cast<builtins::file_object*>(gen.get()) != nullptr && itr != builtins::builtin_file_attributes.end()) {
+            frame.value_stack.push_back(itr->second->bindThisArg(gen));
+        } else {
+            std::stringstream ss;
+            ss << "AttributeError: iterator has no attribute '" << attr << "'";
+            throw pyerror(ss.str());
+        }
+    }
+
+    /*
+        load_method_visitor methods
+    */
+
+    void load_method_visitor::operator()(ValuePyObject& obj) {
+        // an attribute set on the instance shadows the class and is called as is
+        if (obj->attrs->find(attr) == obj->attrs->end()) {
+            std::tuple<Value,bool> res = value::PyClass::find_attr_in_class(obj->static_attrs, attr);
+            auto pf = std::get_if<ValuePyFunction>(&std::get<0>(res));
+            if (pf != NULL && !((*pf)->flags & (value::CLASS_METHOD | value::STATIC_METHOD))) {
+                frame.value_stack.push_back(*pf);
+                frame.value_stack.push_back(obj);
+                return ;
+            }
+        }
+        frame.value_stack.push_back(value::NoneType());
+        load_attr_visitor(frame, attr)(obj);
+    }
+
+    void load_method_visitor::operator()(ValueList& list) {
+        auto itr = builtins::builtin_list_attributes.find(attr);
+        if (itr != builtins::builtin_list_attributes.end()) {
+            frame.value_stack.push_back(itr->second);
+            frame.value_stack.push_back(list);
+        } else {
+            frame.value_stack.push_back(value::NoneType());
+            load_attr_visitor(frame, attr)(list);
+        }
+    }
+
+
+    void load_method_visitor::operator()(ValueDict& dict) {
+        auto itr = builtins::builtin_dict_attributes.find(attr);
+        if (itr != builtins::builtin_dict_attributes.end()) {
+            frame.value_stack.push_back(itr->second);
+            frame.value_stack.push_back(dict);
+        } else {
+            frame.value_stack.push_back(value::NoneType());
+            load_attr_visitor(frame, attr)(dict);
+        }
+    }
+
+
+    void load_method_visitor::operator()(ValueSet& set) {
+        auto itr = builtins::builtin_set_attributes.find(attr);
+        if (itr != builtins::builtin_set_attributes.end()) {
+            frame.value_stack.push_back(itr->second);
+            frame.value_stack.push_back(set);
+        } else {
+            frame.value_stack.push_back(value::NoneType());
+            load_attr_visitor(frame, attr)(set);
+        }
+    }
+
+
+    void load_method_visitor::operator()(ValueString& str) {
+        auto itr = builtins::builtin_string_attributes.find(attr);
+        if (itr != builtins::builtin_string_attributes.end()) {
+            frame.value_stack.push_back(itr->second);
+            frame.value_stack.push_back(str);
+        } else {
+            frame.value_stack.push_back(value::NoneType());
+            load_attr_visitor(frame, attr)(str);
+        }
+    }
+
+
+    void load_method_visitor::operator()(ValueCGenerator& gen) {
+        auto itr = builtins::builtin_file_attributes.find(attr);
+        if (dynamic_cast<builtins::file_object*>(gen.get()) != nullptr && itr != builtins::builtin_file_attributes.end()) {
+            frame.value_stack.push_back(itr->second);
+            frame.value_stack.push_back(gen);
+        } else {
+            frame.value_stack.push_back(value::NoneType());
+            load_attr_visitor(frame, attr)(gen);
+        }
     }
 
 
@@ -71,29 +330,11 @@ namespace value_helper {
             frame.print_value(it->second);
             printf("\n");
         }*/
-        ValuePyObject npo = alloc.heap_pyobject.make(cls);
+        ValuePyObject npo = alloc().heap_pyobject.make(cls);
 
 
         // Check the class if it has an init function
-        auto itr = cls->attrs->find("__init__");
-        Value vv;
-        bool has_init = true;
-        if(itr == cls->attrs->end()){
-            std::tuple<Value,bool> par_val = value::PyClass::find_attr_in_parents(cls,std::string("__init__"));
-            if(std::get<1>(par_val)){
-                vv = std::get<0>(par_val);
-            } else {
-                has_init = false;
-            }
-        } else {
-            vv = itr->second;
-        }
-
-        if(has_init){
-            // call the init function, pushing the new object as the first argument 'self'
-            args.bind(npo);
-            std::visit(call_visitor(frame, args),vv);
-            
+        if(call_slot(frame, npo, value::slot::INIT, args)){
             // Now that a new frame is on the stack, set a flag in it that it's an initializer frame
             frame.interpreter_state->cur_frame->set_flag(FrameState::FLAG_OBJECT_INIT_FRAME);
         }
@@ -115,7 +356,7 @@ namespace value_helper {
 
         // Push a new FrameState
         frame.interpreter_state->push_frame(
-            alloc.heap_frame.make(func->code)
+            alloc().heap_frame.make(func->code)
         );
         frame.interpreter_state->cur_frame->initialize_from_pyfunc(func, args);
     }
@@ -123,15 +364,7 @@ namespace value_helper {
     void call_visitor::operator()(ValuePyObject& obj) const {
         DEBUG("call_visitor dispatching on a PyObject");
 
-        std::tuple<Value,bool> res = value::PyObject::find_attr_in_obj(obj,"__call__");
-        if(std::get<1>(res)){
-            // Visit again with the newly found thing
-            args.bind(obj);
-            std::visit(
-                call_visitor(frame,args),
-                std::get<0>(res)
-            );
-        } else {
+        if(!call_slot(frame, obj, value::slot::CALL, args)){
             throw pyerror(std::string(
                 "'" + *(std::get<ValueString>((obj->static_attrs->attrs->at("__qualname__"))))
                 + "' object is not callable"
@@ -206,13 +439,46 @@ void value::PyClass::remove_from_linearizations(
     }
 }
 
+const char* value::slot::name[value::slot::COUNT] = {
+    "__lt__", "__le__", "__gt__", "__ge__", "__eq__", "__ne__",
+    "__add__", "__radd__", "__sub__", "__rsub__", "__mul__", "__rmul__",
+    "__floordiv__", "__rfloordiv__", "__truediv__", "__rtruediv__", "__pow__", "__rpow__", "__mod__", "__rmod__",
+    "__lshift__", "__rlshift__", "__rshift__", "__rrshift__", "__and__", "__rand__", "__or__", "__ror__", "__xor__", "__rxor__",
+    "__iadd__", "__isub__", "__imul__", "__ifloordiv__", "__itruediv__", "__ipow__", "__imod__",
+    "__ilshift__", "__irshift__", "__iand__", "__ior__", "__ixor__",
+    "__init__", "__call__", "__getitem__", "__setitem__", "__len__"
+};
+
+bool value::slot::is_slot_name(const std::string& attr) {
+    if (attr.size() < 6 || attr[0] != '_' || attr[1] != '_') {
+        return false;
+    }
+    for (size_t i = 0; i < slot::COUNT; ++i) {
+        if (attr == slot::name[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// starts above the slots_epoch of a new class so its slots are filled on first use
+std::atomic<uint64_t> value::PyClass::epoch(1);
+
+void value::PyClass::fill_slots(ValuePyClass& cls) {
+    DEBUG_ADV("Filling the operator slots of class " << Value(cls));
+    for (size_t i = 0; i < slot::COUNT; ++i) {
+        cls->slots[i] = std::get<0>(find_attr_in_class(cls, slot::name[i]));
+    }
+    cls->slots_epoch = epoch.load(std::memory_order_relaxed);
+}
+
 value::PyClass::PyClass(){
     // Allocate the attributes namespace
-    this->attrs = alloc.heap_namespace.make();
+    this->attrs = alloc().heap_namespace.make();
 }
 
 value::PyClass::PyClass(std::string&& qualname) : PyClass() {
-    (*(this->attrs))["__qualname__"] = alloc.heap_string.make(qualname);
+    (*(this->attrs))["__qualname__"] = alloc().heap_string.make(qualname);
 }
 
 value::PyClass::PyClass(std::vector<ValuePyClass>& ps) : PyClass() {
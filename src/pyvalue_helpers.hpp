@@ -30,6 +30,8 @@ struct visitor_is_truthy {
     bool operator()(int64_t) const;
     bool operator()(const ValueString&) const;
     bool operator()(const value::NoneType) const;
+    bool operator()(const ValueDict&) const;
+    bool operator()(const ValueSet&) const;
     inline bool operator()(bool val) const {
         // inline this to make the common case fast
         return val;
@@ -96,6 +98,33 @@ struct call_visitor {
     }
 };
 
+// Python's hash() for the builtin types, anything else is hashed by identity.
+// Throws a TypeError for lists and dicts. Never returns 0, which dicts use to
+// mark erased entries
+size_t hash_value(const Value& value);
+
+// Python's == as used to compare dict keys, values of different numeric types
+// compare by value and anything that is not a builtin type compares by identity
+bool values_equal(const Value& a, const Value& b);
+
+// Calls callable from C++ and returns its result, any frames the call pushes
+// are run to completion first. Defined in pyframe.cpp next to eval
+Value call_sync(FrameState& frame, Value callable, ArgList& args);
+
+// Calls obj's overload of a dunder with obj bound as self,
+// returns false when obj's class does not define it
+inline bool call_slot(FrameState& frame, ValuePyObject& obj, value::slot::Slot which, ArgList& args) {
+    const Value* slot = value::PyClass::get_slot(obj->static_attrs, which);
+    if (slot == nullptr) {
+        return false;
+    }
+    // copy it out, the call may run code that refills the slot table
+    Value method = *slot;
+    args.bind(obj);
+    std::visit(call_visitor(frame, args), method);
+    return true;
+}
+
 template<class T>
 struct numeric_visitor {
     FrameState& frame;
@@ -117,41 +146,46 @@ struct numeric_visitor {
     inline void operator()(int64_t v1, int64_t v2) const {
         frame.value_stack.push_back(T::action(v1, v2));
     }
+
+    // ints that overflowed an int64_t, the operators take them both as BigInts
+    void operator()(const ValueBigInt& v1, const ValueBigInt& v2) const {
+        frame.value_stack.push_back(T::action(*v1, *v2));
+    }
+
+    void operator()(const ValueBigInt& v1, int64_t v2) const {
+        frame.value_stack.push_back(T::action(*v1, value::BigInt(v2)));
+    }
+
+    void operator()(int64_t v1, const ValueBigInt& v2) const {
+        frame.value_stack.push_back(T::action(value::BigInt(v1), *v2));
+    }
+
+    void operator()(const ValueBigInt& v1, double v2) const {
+        frame.value_stack.push_back(T::action(v1->to_double(), v2));
+    }
+
+    void operator()(double v1, const ValueBigInt& v2) const {
+        frame.value_stack.push_back(T::action(v1, v2->to_double()));
+    }
     
     void operator()(ValuePyObject& v1, ValuePyObject& v2) const {
-        /// Get the attribute for it
-        std::tuple<Value,bool> res = value::PyObject::find_attr_in_obj(v1,std::string(T::l_attr));
-        if(std::get<1>(res)){
-            // Call it like a function
-            ArgList arglist(v2);
-            arglist.bind(v1);
-            std::visit(
-                call_visitor(frame, arglist),
-                std::get<0>(res)
-            );
-        } else {
-            throw pyerror(
-                string("TypeError: unsupported operand type(s) for ") + T::op_name + string(": '")
-                + *(std::get<ValueString>((v1->static_attrs->attrs->at("__qualname__"))))
-                + string("' and '")
-                + *(std::get<ValueString>((v1->static_attrs->attrs->at("__qualname__")))) + "' "
-            );
-        }
+        // Try the left operand's overload, then the right operand's reflected one
+        ArgList l_args(v2);
+        if (call_slot(frame, v1, T::l_slot, l_args)) return ;
+        ArgList r_args(v1);
+        if (call_slot(frame, v2, T::r_slot, r_args)) return ;
+        throw pyerror(
+            string("TypeError: unsupported operand type(s) for ") + T::op_name + string(": '")
+            + *(std::get<ValueString>((v1->static_attrs->attrs->at("__qualname__"))))
+            + string("' and '")
+            + *(std::get<ValueString>((v2->static_attrs->attrs->at("__qualname__")))) + "' "
+        );
     }
 
     template<typename OT>
     void operator()(ValuePyObject& v1, OT& v2) const {
-        // Get the attribute for it
-        std::tuple<Value,bool> res = value::PyObject::find_attr_in_obj(v1,std::string(T::l_attr));
-        if(std::get<1>(res)){
-            // Call it like a function
-            ArgList arglist(v2);
-            arglist.bind(v1);
-            std::visit(
-                call_visitor(frame, arglist),
-                std::get<0>(res)
-            );
-        } else {
+        ArgList arglist(v2);
+        if (!call_slot(frame, v1, T::l_slot, arglist)) {
             throw pyerror(
                 string("TypeError: unsupported operand type(s) for ") + T::op_name + string(": '")
                 + *(std::get<ValueString>((v1->static_attrs->attrs->at("__qualname__"))))
@@ -162,17 +196,8 @@ struct numeric_visitor {
 
     template<typename OT2>
     void operator()(OT2& v1, ValuePyObject& v2) const {
-        // Get the attribute for it
-        std::tuple<Value,bool> res = value::PyObject::find_attr_in_obj(v2,std::string(T::r_attr));
-        if(std::get<1>(res)){
-            // Call it like a function
-            ArgList arglist(v1);
-            arglist.bind(v2);
-            std::visit(
-                call_visitor(frame, arglist),
-                std::get<0>(res)
-            );
-        } else {
+        ArgList arglist(v1);
+        if (!call_slot(frame, v2, T::r_slot, arglist)) {
             throw pyerror(string("TypeError: unsupported operand type(s) for ") + T::op_name + string(": '")
                 + typeid(OT2).name() + string("' and '") 
                 + *(std::get<ValueString>((v2->static_attrs->attrs->at("__qualname__")))) + "' "
@@ -229,15 +254,48 @@ struct load_attr_visitor {
     // Load attribute for a List 
     void operator()(ValueList& list);
 
+    void operator()(ValueDict& dict);
+
+    void operator()(ValueSet& set);
+
+    void operator()(ValueString& str);
+
+    void operator()(ValueCGenerator& gen);
+
     template<typename T>
     void operator()(T) const {
         throw pyerror(string("can not get attributed from an object of type ") + typeid(T).name());
     }
 
 };
-// I do not believe this can be a reference
-// Return a cell
-ValuePyObject create_cell(Value contents);
+// Visitor for LOAD_METHOD, leaves [method, self] on the stack when the attribute
+// is a plain method so CALL_METHOD can pass self along without binding anything,
+// otherwise leaves [None, attribute] and CALL_METHOD calls the attribute as is
+struct load_method_visitor {
+    FrameState& frame;
+    const std::string& attr;
+
+    load_method_visitor(FrameState& frame, const std::string& attr) : frame(frame), attr(attr) {}
+
+    void operator()(ValuePyObject& obj);
+
+    void operator()(ValueList& list);
+
+    void operator()(ValueDict& dict);
+
+    void operator()(ValueSet& set);
+
+    void operator()(ValueString& str);
+
+    void operator()(ValueCGenerator& gen);
+
+    template<typename T>
+    void operator()(T& value) {
+        frame.value_stack.push_back(value::NoneType());
+        Value val = value;
+        std::visit(load_attr_visitor(frame, attr), val);
+    }
+};
 
 }
 }
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <fstream>
@@ -6,6 +8,7 @@
 #include "../lib/base64.hpp"
 #include "pyinterpreter.hpp"
 #include "pyvalue.hpp"
+#include "pyoutput.hpp"
 #include "builtins/builtins.hpp"
 
 // #define DEBUG_ON
@@ -21,29 +24,61 @@ using namespace py::builtins;
 
 int main(const int argc, const char *argv[]) 
 {
+    // print writes through py::output, the iostreams only read the source
+    std::ios::sync_with_stdio(false);
+
 #ifdef STATS_ON
     std::cout << "statistics: " << std::endl;
     std::cout << "\tsize of 'Value' union struct: " << sizeof(py::Value) << std::endl;
     std::cout << "\tsize of 'Frame': " << sizeof(py::FrameState) << std::endl;
 #endif
 
-    initialize_slice_class();
+    // the heaps of the one interpreter this runs
+    Allocator heap;
+    Allocator::Scope scope(heap);
+
     initialize_list_class();
-    initialize_cell_class();
+    initialize_dict_class();
+    initialize_set_class();
+    initialize_string_class();
+    initialize_file_class();
 
-    alloc.retain_all();
+    alloc().retain_all();
 
     // const char *source_code = "{\"type\": \"code\", \"co_code\": \"ZABTAA==\", \"co_lnotab\": \"\", \"co_consts\": [{\"type\": \"literal\", \"real_type\": \"<class 'NoneType'>\", \"value\": null}], \"co_name\": \"<module>\", \"co_filename\": \"sys.stdin.py\", \"co_argcount\": 0, \"co_kwonlyargcount\": 0, \"co_nlocals\": 0, \"co_stacksize\": 1, \"co_names\": null, \"co_varnames\": null, \"co_freevars\": null, \"co_cellvars\": null}";
     // json obj = json::parse(source_code);
     // std::cout << std::setw(4) << obj << std::endl;
 
+    // --max-heap=SIZE limits what the script may allocate, --huge-pages backs
+    // the heaps with huge pages, and the first other argument is the file to run
+    const char* path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+#ifdef HUGE_PAGES_ON
+        if (arg == "--huge-pages") {
+            gc_pool::huge_pages = true;
+            continue;
+        }
+#endif
+        if (arg.rfind("--max-heap=", 0) == 0) {
+            const size_t limit = Allocator::parse_size(argv[i] + strlen("--max-heap="));
+            if (limit == 0) {
+                std::cerr << "--max-heap expects a size such as 512M" << std::endl;
+                return 1;
+            }
+            heap.set_max_heap(limit);
+        } else if (path == nullptr) {
+            path = argv[i];
+        }
+    }
+
     // this is the new default case, take raw source code as input
     gc_ptr<Code> code = nullptr;
 
     std::istreambuf_iterator<char> eos;
-    if (argc > 1 && argv[1] != nullptr) {
+    if (path != nullptr) {
         DEBUG("loading python source from file");
-        std::ifstream fstream(argv[1]);
+        std::ifstream fstream(path);
         std::string s(std::istreambuf_iterator<char>(fstream), eos);;
         code = Code::from_program(s, "../pytools/compile.py");
     } else {
@@ -59,7 +94,12 @@ int main(const int argc, const char *argv[])
     #ifdef PROFILING_SIMPLE
         state.dump_op_durations();
     #endif
+
+    if (std::getenv("MYPY_GC_STATS") != nullptr) {
+        alloc().print_stats(std::cerr);
+    }
     
+    output.flush();
     std::cout << "Done." << std::endl;
     return 0;
 }
\ No newline at end of file
@@ -8,11 +8,17 @@ using namespace py;
 using namespace py::builtins;
 
 int main( int argc, char* argv[] ) {
-    initialize_slice_class();
+    // the heaps of the interpreters the tests run on the main thread
+    Allocator heap;
+    Allocator::Scope scope(heap);
+
     initialize_list_class();
-    initialize_cell_class();
+    initialize_dict_class();
+    initialize_set_class();
+    initialize_string_class();
+    initialize_file_class();
 
-    alloc.retain_all();
+    alloc().retain_all();
 
     int result = Catch::Session().run( argc, argv );
     return result;
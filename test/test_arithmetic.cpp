@@ -3,6 +3,7 @@
 #include "include/test_helpers.hpp"
 
 #include "../src/pyallocator.hpp"
+#include "../src/builtins/builtins.hpp"
 
 TEST_CASE("should be able to perform arithmetic", "[arithmetic]") {
     SECTION( "adding two values" ) {
@@ -50,12 +51,35 @@ check_string(x + " test")
         auto code = build_string(theCode);
         InterpreterState state(code);
         // TODO: fix this, it actually is leaking memory! that is pretty bad :S 
-        gc_ptr<const std::string> str = alloc.heap_string.make("test test");
+        ValueString str = alloc().heap_string.make("test test");
         str.retain();
         (*(state.ns_builtins))["check_string"] = make_builtin_check_value(str);
         state.eval();
     }
 
+    SECTION( "build a long string by concatenation" ) {
+        const char *theCode = R"(
+s = ""
+for i in range(100):
+    s += "ab"
+t = s
+s += "c"
+u = t + "xy"
+check_int(len(t))
+check_int(len(s) - 1)
+check_int(len(u) - 2)
+check_string(u[199:] + s[200])
+)";
+        auto code = build_string(theCode);
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        ValueString str = alloc().heap_string.make("bxyc");
+        str.retain();
+        (*(state.ns_builtins))["check_int"] = make_builtin_check_value((int64_t)200);
+        (*(state.ns_builtins))["check_string"] = make_builtin_check_value(str);
+        state.eval();
+    }
+
     SECTION( "can not multiply an int and a string" ) {
         const char *theCode = R"(
 x = 5
@@ -67,4 +91,115 @@ x * "test"
         (*(state.ns_builtins))["check_double"] = make_builtin_check_value((double)27.5);
         REQUIRE_THROWS(state.eval());
     }
-}
\ No newline at end of file
+}
+TEST_CASE("ints should grow past 64 bits", "[arithmetic][bigint]") {
+    SECTION( "promoting on overflow and demoting when the result fits" ) {
+        auto code = build_string(R"(
+x = 4611686018427387904
+y = x + x + x
+check_string(str(y))
+check_int1(y - x - x - x)
+check_int2((y * y) // (y * 3))
+check_true(y > x)
+check_true(x < y)
+check_true(y == x * 3)
+check_true(y != x)
+check_true(y > 5.0)
+        )");
+        InterpreterState state(code);
+        ValueString str = alloc().heap_string.make("13835058055282163712");
+        str.retain();
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_string"] = make_builtin_check_value(str);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)0);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)4611686018427387904);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION( "computing large products and powers" ) {
+        auto code = build_string(R"(
+f = 1
+i = 2
+while i <= 50:
+    f *= i
+    i += 1
+check_string(str(f))
+a = 3 ** 2000
+b = 7 ** 1500
+check_true((a * b) // b == a)
+check_true((a * b + 5) % b == 5)
+check_true((a * b) % a == 0)
+n = 2
+check_int(len(str(n ** 10000)))
+        )");
+        InterpreterState state(code);
+        ValueString str = alloc().heap_string.make(
+            "30414093201713378043612608166064768844377641568960512000000000000");
+        str.retain();
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_string"] = make_builtin_check_value(str);
+        (*(state.ns_builtins))["check_int"] = make_builtin_check_value((int64_t)3011);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION( "rounding division towards negative infinity" ) {
+        auto code = build_string(R"(
+check_int1(-7 // 2)
+check_int2(-7 % 2)
+check_int3(7 % -2)
+big = -1000000000000000000000000000000
+check_string(str(big // 7))
+check_int4(big % 7)
+check_true(big * 7 // 7 == big)
+        )");
+        InterpreterState state(code);
+        ValueString str = alloc().heap_string.make("-142857142857142857142857142858");
+        str.retain();
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_string"] = make_builtin_check_value(str);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)-4);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)1);
+        (*(state.ns_builtins))["check_int3"] = make_builtin_check_value((int64_t)-1);
+        (*(state.ns_builtins))["check_int4"] = make_builtin_check_value((int64_t)6);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION( "shifting and masking" ) {
+        auto code = build_string(R"(
+one = 1
+check_int1((one << 100) >> 99)
+check_int2(((one << 100) - 1) & 255)
+check_int3((-(one << 70)) >> 69)
+check_true(-(-9223372036854775807 - 1) == 9223372036854775808)
+check_int4((one << 70) ^ (one << 70))
+check_true((one << 70) | 1 == (one << 70) + 1)
+check_true(-(one << 70) & ((one << 80) - 1) == (one << 80) - (one << 70))
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)2);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)255);
+        (*(state.ns_builtins))["check_int3"] = make_builtin_check_value((int64_t)-2);
+        (*(state.ns_builtins))["check_int4"] = make_builtin_check_value((int64_t)0);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION( "as dict keys and through int()" ) {
+        auto code = build_string(R"(
+d = {2 ** 70: 5}
+k = 2 ** 69
+check_true(d[k * 2] == 5)
+check_true(int("123456789012345678901234567890") == 123456789012345678901234567890)
+check_true(int(2.0 ** 70) == 2 ** 70)
+check_true(float(2 ** 70) == 2.0 ** 70)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+}
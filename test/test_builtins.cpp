@@ -3,8 +3,10 @@
 #include "include/test_helpers.hpp"
 #include "../src/builtins/builtins.hpp"
 #include "../src/pyvalue.hpp"
+#include "../src/pyoutput.hpp"
 
 #include <iostream>
+#include <unistd.h>
 
 TEST_CASE("list builtins", "[builtins]") {
     SECTION( "should be able to appned to a list" ) {
@@ -19,6 +21,349 @@ check_int(x[0])
     }
 }
 
+TEST_CASE("aggregate builtins", "[builtins]") {
+    SECTION( "should reduce int and float lists" ) {
+        auto code = build_string(R"(
+ints = [i for i in range(1, 101)]
+check_true(sum(ints) == 5050)
+check_true(sum(ints, 10) == 5060)
+check_true(min(ints) == 1)
+check_true(max(ints) == 100)
+check_true(any(ints))
+check_true(all(ints))
+ints.append(0)
+check_false(all(ints))
+floats = [i * 0.5 for i in range(9)]
+check_true(sum(floats) == 18.0)
+check_true(min(floats) == 0.0)
+check_true(max(floats) == 4.0)
+check_true(any(floats))
+check_false(all(floats))
+check_true(sum([9223372036854775807, 9223372036854775807, 2]) == 18446744073709551616)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        (*(state.ns_builtins))["check_false"] = make_builtin_check_value(false);
+        state.eval();
+    }
+
+    SECTION( "should reduce ranges and other iterables" ) {
+        auto code = build_string(R"(
+check_true(sum(range(10)) == 45)
+check_true(sum(range(3, 100, 7)) == 679)
+check_true(min(range(3, 100, 7)) == 3)
+check_true(max(range(3, 100, 7)) == 94)
+check_false(any(range(0, 1)))
+check_true(any(range(0, 2)))
+check_false(all(range(-9, 10, 3)))
+check_true(all(range(-9, 10, 4)))
+check_true(sum((1, 2.5, True)) == 4.5)
+check_true(min(3, 1, 2) == 1)
+check_true(max({4, 8, 2}) == 8)
+check_false(any([]))
+check_true(all([]))
+check_true(abs(-3) == 3)
+check_true(abs(-2.5) == 2.5)
+check_true(abs(-9223372036854775807 - 1) == 9223372036854775808)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        (*(state.ns_builtins))["check_false"] = make_builtin_check_value(false);
+        state.eval();
+    }
+
+    SECTION( "should raise on an empty min" ) {
+        auto code = build_string(R"(
+min([])
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        REQUIRE_THROWS(state.eval());
+    }
+}
+
+TEST_CASE("sorting", "[builtins]") {
+    SECTION( "should sort ints, floats and strings" ) {
+        auto code = build_string(R"(
+a = [5, 3, 9, 1, 3, -7, 0]
+a.sort()
+check_true(a[0] == -7)
+check_true(a[3] == 3)
+check_true(a[6] == 9)
+a.sort(reverse=True)
+check_true(a[0] == 9)
+check_true(a[6] == -7)
+b = sorted([2.5, -1.0, 3.25, 0.5])
+check_true(b[0] == -1.0)
+check_true(b[3] == 3.25)
+s = sorted(['pear', 'apple', 'fig'])
+check_true(len(s[0]) == 5)
+check_true(len(s[1]) == 3)
+check_true(len(s[2]) == 4)
+m = sorted([3, 1.5, 2, 0.5])
+check_true(m[1] == 1.5)
+check_true(m[3] == 3)
+big = [(i * 7919) % 1000 - 500 for i in range(2000)]
+big.sort()
+check_true(big[0] == -500)
+check_true(big[1] == -500)
+check_true(big[1999] == 499)
+check_true(len(big) == 2000)
+check_true(sorted({5, 1, 3})[0] == 1)
+check_true(sorted(range(5), reverse=True)[0] == 4)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        (*(state.ns_builtins))["check_false"] = make_builtin_check_value(false);
+        state.eval();
+    }
+
+    SECTION( "should sort by key and keep equal items in order" ) {
+        auto code = build_string(R"(
+first = lambda r: r[0]
+second = lambda r: r[1]
+negate = lambda x: -x
+recs = [(3, 30), (1, 10), (2, 20), (1, 19)]
+by_first = sorted(recs, key=first)
+check_true(by_first[0][1] == 10)
+check_true(by_first[1][1] == 19)
+by_second = sorted(recs, key=second, reverse=True)
+check_true(by_second[0][1] == 30)
+check_true(by_second[3][1] == 10)
+words = sorted(['pear', 'apple', 'fig', 'kiwi'], key=len)
+check_true(len(words[0]) == 3)
+check_true(len(words[3]) == 5)
+big = [i for i in range(300)]
+big.sort(key=negate)
+check_true(big[0] == 299)
+check_true(big[299] == 0)
+pairs = [[i % 5, i] for i in range(20)]
+pairs.sort(key=first)
+check_true(pairs[3][1] == 15)
+check_true(pairs[4][1] == 1)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        (*(state.ns_builtins))["check_false"] = make_builtin_check_value(false);
+        state.eval();
+    }
+
+    SECTION( "should raise on an unknown keyword" ) {
+        auto code = build_string(R"(
+sorted([2, 1], cmp=None)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        REQUIRE_THROWS(state.eval());
+    }
+}
+
+TEST_CASE("string methods", "[builtins]") {
+    SECTION( "should search, split and join" ) {
+        auto code = build_string(R"(
+text = "the quick brown fox jumps over the lazy dog"
+check_true(text.find("fox") == 16)
+check_true(text.find("the", 1) == 31)
+check_true(text.find("cat") == -1)
+check_true(text.find("o", 0, 12) == -1)
+check_true(text.count("o") == 4)
+check_true(text.count("the") == 2)
+check_true("abc".find("", 3) == 3)
+check_true("abc".find("", 4) == -1)
+check_true("abc".count("", 3) == 1)
+check_true("abc".count("", 4) == 0)
+check_true("abc".count("") == 4)
+check_true(text.startswith("the"))
+check_true(text.endswith("dog"))
+check_false(text.startswith("dog"))
+words = text.split()
+check_true(len(words) == 9)
+check_true(len(words[2]) == 5)
+parts = "a,,b".split(",")
+check_true(len(parts) == 3)
+check_true(len(parts[1]) == 0)
+check_string("-".join(["x", "y", "z"]))
+long = "abcdefghijklmnopqrstuvwxyz0123456789"
+long = long + long + "needle" + long
+check_true(long.find("needle") == 72)
+check_true(long.find("needlf") == -1)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        ValueString str = alloc().heap_string.make("x-y-z");
+        str.retain();
+        (*(state.ns_builtins))["check_string"] = make_builtin_check_value(str);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        (*(state.ns_builtins))["check_false"] = make_builtin_check_value(false);
+        state.eval();
+    }
+
+    SECTION( "should replace and strip" ) {
+        auto code = build_string(R"(
+check_string1("  padded\n".strip())
+check_string2("aXbXc".replace("X", "--"))
+check_true(len("xxhixx".lstrip("x")) == 4)
+check_true(len("xxhixx".rstrip("x")) == 4)
+check_true(len("aaaa".replace("a", "b", 2)) == 4)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        ValueString padded = alloc().heap_string.make("padded");
+        padded.retain();
+        ValueString replaced = alloc().heap_string.make("a--b--c");
+        replaced.retain();
+        (*(state.ns_builtins))["check_string1"] = make_builtin_check_value(padded);
+        (*(state.ns_builtins))["check_string2"] = make_builtin_check_value(replaced);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION( "should raise on an unknown method" ) {
+        auto code = build_string(R"(
+"abc".frobnicate()
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        REQUIRE_THROWS(state.eval());
+    }
+}
+
+static std::string read_pipe(int fd) {
+    char buffer[256];
+    ssize_t size = read(fd, buffer, sizeof(buffer));
+    return std::string(buffer, size > 0 ? size : 0);
+}
+
+TEST_CASE("buffered output", "[builtins]") {
+    SECTION( "should format values into the buffer until flushed" ) {
+        int fds[2];
+        REQUIRE(pipe(fds) == 0);
+        {
+            OutputBuffer out(fds[1]);
+            out.write((int64_t)-9223372036854775807 - 1);
+            out.write(" ", 1);
+            out.write(2.5);
+            out.write(" ", 1);
+            out.write(1.0 / 3.0);
+            out.write(" ", 1);
+            out.write_value(alloc().heap_string.make("text"));
+            out.write_value(value::NoneType());
+            out.write_value(true);
+            out.flush();
+            REQUIRE(read_pipe(fds[0]) == "-9223372036854775808 2.5 0.333333 textNonetrue");
+            out.write("left in the buffer", 18);
+        }
+        // and written out when the writer goes away
+        REQUIRE(read_pipe(fds[0]) == "left in the buffer");
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    SECTION( "print should take sep, end and flush" ) {
+        auto code = build_string(R"(
+print(1, 2.5, "x", sep="-", end="!", flush=True)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+
+        int fds[2];
+        REQUIRE(pipe(fds) == 0);
+        output.flush();
+        int saved = dup(STDOUT_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        state.eval();
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+        REQUIRE(read_pipe(fds[0]) == "1-2.5-x!");
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    SECTION( "print should raise on an unknown keyword" ) {
+        auto code = build_string(R"(
+print(1, file=None)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        REQUIRE_THROWS(state.eval());
+    }
+}
+
+TEST_CASE("files", "[builtins]") {
+    SECTION( "should write a file and read it back by line" ) {
+        // 20000 lines is large enough to be mapped rather than read
+        auto code = build_string(R"(
+f = open("/tmp/mypy_test_file.txt", "w")
+for i in range(20000):
+    f.write(str(i) + "\n")
+check_true(f.write("no newline") == 10)
+f.close()
+count = 0
+total = 0
+for line in open("/tmp/mypy_test_file.txt"):
+    count += 1
+    total += len(line)
+check_true(count == 20001)
+check_true(total == 108900)
+g = open("/tmp/mypy_test_file.txt", "r")
+check_true(len(g.readline()) == 2)
+check_true(len(g.read(4)) == 4)
+rest = g.readlines()
+check_true(len(rest) == 19998)
+check_true(len(rest[19997]) == 10)
+check_true(len(g.readline()) == 0)
+g.close()
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION( "should read small files in chunks" ) {
+        auto code = build_string(R"(
+f = open("/tmp/mypy_test_file.txt", "w")
+f.write("a\nbb\n\nccc")
+f.close()
+lines = open("/tmp/mypy_test_file.txt").readlines()
+check_true(len(lines) == 4)
+check_true(len(lines[1]) == 3)
+check_true(len(lines[2]) == 1)
+check_string(lines[3])
+check_true(len(open("/tmp/mypy_test_file.txt", "rb").read()) == 9)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        ValueString str = alloc().heap_string.make("ccc");
+        str.retain();
+        (*(state.ns_builtins))["check_string"] = make_builtin_check_value(str);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION( "should raise on a missing file and after close" ) {
+        auto missing = build_string(R"(
+open("/tmp/mypy_no_such_dir/file.txt")
+        )");
+        InterpreterState state(missing);
+        builtins::inject_builtins(state.ns_builtins);
+        REQUIRE_THROWS(state.eval());
+
+        auto closed = build_string(R"(
+f = open("/tmp/mypy_test_file.txt")
+f.close()
+f.read()
+        )");
+        InterpreterState closed_state(closed);
+        builtins::inject_builtins(closed_state.ns_builtins);
+        REQUIRE_THROWS(closed_state.eval());
+    }
+}
+
 // TEST_CASE("should be able to call a builtin", "[builtins]") {
 //     SECTION("my dumb builtin test") {
 //         auto myFunc = builtins::pycfunction_builder([](int64_t a, int64_t b) {
@@ -166,6 +166,100 @@ check_int3(foo.sm(bar))
         (*(state.ns_builtins))["check_int3"] = make_builtin_check_value((int64_t)21);
         state.eval();
     }
+
+    SECTION( "and call methods without binding them" ){
+        auto code = build_string(R"(
+class A:
+    val = 3
+    def add(self, x, y=1):
+        return self.val + x + y
+    def other(self):
+        return 100
+
+def shadow():
+    return 7
+
+foo = A()
+bar = A()
+bar.val = 10
+check_int1(foo.add(bar.add(foo.add(1), 2)))
+m = bar.add
+check_int2(m(1, 1))
+check_int3(foo.add(1))
+foo.other = shadow
+check_int4(foo.other())
+check_int5(bar.other())
+l = []
+l.append(foo.add(2, 2))
+check_int6(l[0])
+)");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)21);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)12);
+        (*(state.ns_builtins))["check_int3"] = make_builtin_check_value((int64_t)5);
+        (*(state.ns_builtins))["check_int4"] = make_builtin_check_value((int64_t)7);
+        (*(state.ns_builtins))["check_int5"] = make_builtin_check_value((int64_t)100);
+        (*(state.ns_builtins))["check_int6"] = make_builtin_check_value((int64_t)7);
+        state.eval();
+    }
+
+    SECTION( "and call what attributes of attributes and items of attributes hold" ){
+        auto code = build_string(R"(
+def twelve():
+    return 12
+
+class Inner:
+    def c(self):
+        return 5
+
+class Outer:
+    def __init__(self):
+        self.b = Inner()
+        self.f = [twelve]
+        self.d = {"k": twelve}
+    def b(self):
+        return 1
+
+a = Outer()
+check_int1(a.b.c())
+check_int2(a.f[0]())
+check_int2(a.d["k"]())
+check_int3(a.b.c() + a.f[0]() * a.b.c())
+)");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)5);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)12);
+        (*(state.ns_builtins))["check_int3"] = make_builtin_check_value((int64_t)65);
+        state.eval();
+
+        // only the attributes that are called are loaded as methods
+        std::vector<uint8_t> loads;
+        for (auto& instr : code->instructions) {
+            if (instr.bytecode == op::LOAD_ATTR || instr.bytecode == op::LOAD_METHOD) {
+                loads.push_back(instr.bytecode);
+            }
+        }
+        REQUIRE(loads == std::vector<uint8_t>({
+            op::LOAD_ATTR, op::LOAD_METHOD, op::LOAD_ATTR, op::LOAD_ATTR,
+            op::LOAD_ATTR, op::LOAD_METHOD, op::LOAD_ATTR, op::LOAD_ATTR, op::LOAD_METHOD,
+        }));
+    }
+
+    SECTION( "and complain about methods called with too many arguments" ){
+        auto code = build_string(R"(
+class A:
+    def f(self, x):
+        return x
+
+foo = A()
+foo.f(1, 2)
+)");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        REQUIRE_THROWS(state.eval());
+    }
 }
 
 TEST_CASE("Classes should inherit", "[classes]") {
@@ -365,6 +459,85 @@ check_int2(foo(foo(2)))
         (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)200);
         state.eval();
     }
+    SECTION( "of the container operators"){
+            auto code = build_string(R"(
+class Vec:
+    def __init__(self, n):
+        self.items = [0] * n
+    def __getitem__(self, i):
+        return self.items[i]
+    def __setitem__(self, i, v):
+        self.items[i] = v
+    def __len__(self):
+        return len(self.items)
+
+v = Vec(3)
+v[1] = 5
+v[2] = v[1] + 2
+check_int1(v[1] + v[2])
+check_int2(len(v))
+    )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)12);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)3);
+        state.eval();
+    }
+    SECTION( "that are changed after the class is created"){
+            auto code = build_string(R"(
+class A:
+    val = 2
+    def __add__(self, other):
+        return self.val + other
+
+class B(A):
+    pass
+
+def mul_add(self, other):
+    return self.val * other
+
+b = B()
+check_int1(b + 5)
+A.__add__ = mul_add
+check_int2(b + 5)
+B.__add__ = lambda self, other: other
+check_int3(b + 5)
+    )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)7);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)10);
+        (*(state.ns_builtins))["check_int3"] = make_builtin_check_value((int64_t)5);
+        state.eval();
+    }
+
+    SECTION( "without refilling slots when other class attributes change"){
+            auto code = build_string(R"(
+class Counter:
+    count = 0
+    def __add__(self, other):
+        return Counter.count + other
+
+c = Counter()
+check_int1(c + 1)
+started()
+for i in range(100):
+    Counter.count += 1
+check_int2(c + 1)
+    )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        uint64_t epoch = 0;
+        (*(state.ns_builtins))["started"] = std::make_shared<value::CFunction>([&epoch](FrameState& frame, ArgList& args) {
+            epoch = value::PyClass::epoch.load();
+            frame.value_stack.push_back(value::NoneType());
+        });
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)1);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)101);
+        state.eval();
+        REQUIRE(epoch != 0);
+        REQUIRE(value::PyClass::epoch.load() == epoch);
+    }
 
 
     SECTION( "of the + operator"){
@@ -6,93 +6,145 @@
 
 using namespace builtins;
 
-// TEST_CASE("Closures should work", "[closures]") {
-//     SECTION( "in a basic case" ){
-//         std::cout << "START LOOKING HERE, HERE IS A SPECIAL SEQUENCE TO SEARCH FOR: 1aenifpnneivafp" << std::endl;
-//         auto code = build_string(R"(
-// def print_msg(msg):
-//     def printer():
-//         return msg
-//     return printer
-
-// a = print_msg(100)
-// check_int1(a())
-// b = print_msg(200)
-// check_int2(b())
-// check_int3(a())
-//         )");
-//         InterpreterState state(code);
-//         (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)100);
-//         (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)200);
-//         (*(state.ns_builtins))["check_int3"] = make_builtin_check_value((int64_t)100);
-//         state.eval();
-
-//         std::cout << "STOP LOOKING HERE, THIS IS THAT SEQUENCE AGAIN: 1aenifpnneivafp" << std::endl;
-//     }
-
-//     SECTION( "in a nested case" ){
-//         auto code = build_string(R"(
-// def ret_msg(msg):
-//     def printer(alt):
-//         def b():
-//             return(msg + 4)
-//         return b
-//     return printer(msg)
-
-// c = ret_msg(1)
-// check_int1(c())
-// d = ret_msg(5.5)
-// check_int2(d())
-//         )");
-//         InterpreterState state(code);
-//         (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)5);
-//         (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((double)9.5);
-//         state.eval();
-//     }
-
-//     SECTION( "and can have modified inputs" ){
-//         auto code = build_string(R"(
-// def print_msg_store(msg):
-//     msg = -1
-//     def printer():
-//         return msg
-//     return printer
-
-// e = print_msg_store(300)
-// check_int1(e())
-//         )");
-//         InterpreterState state(code);
-//         (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)-1);
-//         state.eval();
-//     }
-
-    /*SECTION( "and correct changes as classes do or dont" ){
+TEST_CASE("Closures should work", "[closures]") {
+    SECTION( "in a basic case" ){
         auto code = build_string(R"(
-weird = 10
-class Ah:
-    val = weird
-    def getfunc(self,something):
-        def bar():
-            return(self.val + something)
-        return bar
-    )");*/
-/*
+def print_msg(msg):
+    def printer():
+        return msg
+    return printer
+
+a = print_msg(100)
+check_int1(a())
+b = print_msg(200)
+check_int2(b())
+check_int3(a())
+        )");
+        InterpreterState state(code);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)100);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)200);
+        (*(state.ns_builtins))["check_int3"] = make_builtin_check_value((int64_t)100);
+        state.eval();
+    }
+
+    SECTION( "in a nested case" ){
+        auto code = build_string(R"(
+def ret_msg(msg):
+    def printer(alt):
+        def b():
+            return(msg + 4)
+        return b
+    return printer(msg)
+
+c = ret_msg(1)
+check_int1(c())
+d = ret_msg(5.5)
+check_int2(d())
+        )");
+        InterpreterState state(code);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)5);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((double)9.5);
+        state.eval();
+    }
+
+    SECTION( "and can have modified inputs" ){
+        auto code = build_string(R"(
+def print_msg_store(msg):
+    msg = -1
+    def printer():
+        return msg
+    return printer
+
+e = print_msg_store(300)
+check_int1(e())
+        )");
+        InterpreterState state(code);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)-1);
+        state.eval();
+    }
+
+    SECTION( "and share the variable with the enclosing function" ){
+        auto code = build_string(R"(
+def counter(start):
+    count = start
+    def inc(by):
+        nonlocal count
+        count += by
+        return count
+    def get():
+        return count
+    return inc, get
+
+inc, get = counter(10)
+inc(1)
+inc(5)
+check_int1(get())
+inc2, get2 = counter(0)
+inc2(3)
+check_int2(get2())
+check_int3(get())
+        )");
+        InterpreterState state(code);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)16);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)3);
+        (*(state.ns_builtins))["check_int3"] = make_builtin_check_value((int64_t)16);
+        state.eval();
+    }
+
+    SECTION( "inside of class bodies and methods" ){
+        auto code = build_string(R"(
+def make_class(base):
+    class Ah:
+        val = base
+        def getfunc(self, something):
+            def bar():
+                return self.val + something + base
+            return bar
+    return Ah
+
+Ah = make_class(1)
 f = Ah()
 g = f.getfunc(10)
 check_int1(g())
 f.val = 12
 check_int2(g())
-h = Ah()
-i = h.getfunc(30)
-check_int3(i())
-weird = 90
-check_int4(i())
-        )");*/
-        //InterpreterState state(code);
-        //(*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)-1);
-        //(*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)-1);
-        //(*(state.ns_builtins))["check_int3"] = make_builtin_check_value((int64_t)-1);
-        //(*(state.ns_builtins))["check_int4"] = make_builtin_check_value((int64_t)-1);
-       // state.eval();
-    //}
-// }
\ No newline at end of file
+        )");
+        InterpreterState state(code);
+        inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_int1"] = make_builtin_check_value((int64_t)12);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)23);
+        state.eval();
+    }
+
+    SECTION( "but not read a free variable before it is assigned" ){
+        auto code = build_string(R"(
+def outer():
+    def inner():
+        return late
+    result = inner()
+    late = 1
+    return result
+
+outer()
+        )");
+        InterpreterState state(code);
+        inject_builtins(state.ns_builtins);
+        REQUIRE_THROWS_WITH(state.eval(),
+            "NameError: free variable 'late' referenced before assignment in enclosing scope");
+    }
+
+    SECTION( "nor a captured local before it is assigned" ){
+        auto code = build_string(R"(
+def outer():
+    def inner():
+        return late
+    print(late)
+    late = 1
+
+outer()
+        )");
+        InterpreterState state(code);
+        inject_builtins(state.ns_builtins);
+        REQUIRE_THROWS_WITH(state.eval(), "UnboundLocalError: local variable 'late' referenced before assignment");
+    }
+}
@@ -2,6 +2,9 @@
 
 #include "include/test_helpers.hpp"
 
+#include "../src/builtins/builtins.hpp"
+#include "../src/pyjit.hpp"
+
 TEST_CASE("while loops should loop", "[control]") {
     SECTION( "basic while loop" ) {
         auto code = build_string(R"(
@@ -14,4 +17,72 @@ check_int(x)
         (*(state.ns_builtins))["check_int"] = make_builtin_check_value((int64_t)100);
         state.eval();
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("hot loops run as traces", "[control][jit]") {
+    SECTION( "int arithmetic in a while loop" ) {
+        auto code = build_string(R"(
+x = 0
+i = 0
+while i < 5000:
+    x += i * 3 - i // 7 + i % 5 - (-i) // 4
+    i += 1
+check_int(x)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_int"] = make_builtin_check_value((int64_t)38845535);
+        state.eval();
+#ifdef TRACING_JIT_ON
+        REQUIRE(code->loops->traces.size() == 1);
+#endif
+    }
+
+    SECTION( "floats and a branch in a for loop" ) {
+        auto code = build_string(R"(
+t = 0.0
+for i in range(5000):
+    t = t + i / 8
+    if t > 1000.0:
+        t -= 999.5
+check_double(t)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_double"] = make_builtin_check_value((double)968.5);
+        state.eval();
+    }
+
+    SECTION( "an int that overflows leaves the trace" ) {
+        auto code = build_string(R"(
+x = 1
+for i in range(3000):
+    if i < 2000:
+        x += 1
+    else:
+        x = x * 2
+check_int(x % 1000003)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_int"] = make_builtin_check_value((int64_t)799583);
+        state.eval();
+    }
+
+    SECTION( "a variable that changes type leaves the trace" ) {
+        auto code = build_string(R"(
+def f():
+    x = 0
+    for i in range(3000):
+        x += 1
+        if i == 2500:
+            x = 0.5
+    return x
+check_double(f())
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_double"] = make_builtin_check_value((double)499.5);
+        state.eval();
+    }
+}
@@ -0,0 +1,99 @@
+#include <catch.hpp>
+
+#include <vector>
+
+#include "../src/mypy.hpp"
+
+TEST_CASE("modules are loaded once and their functions called from C++", "[embedding]") {
+    mypy::Runtime runtime;
+    mypy::Module module = runtime.load(R"(
+calls = 0
+
+def add(a, b):
+    global calls
+    calls += 1
+    return a + b
+
+def describe(name, suffix="!"):
+    return name + suffix
+
+def numbers(n):
+    return [i * i for i in range(n)]
+
+def total(values):
+    result = 0
+    for value in values:
+        result += value
+    return result
+
+def churn():
+    for i in range(20000):
+        garbage = [i, str(i)]
+    collect_garbage()
+    return 0
+
+class Point:
+    def __init__(self, x, y):
+        self.x = x
+        self.y = y
+)");
+
+    SECTION( "results come back as native types" ) {
+        mypy::Callable add = module.function("add");
+        REQUIRE(add.call<int64_t>(1, 2) == 3);
+        REQUIRE(add.call<int>(40, 2) == 42);
+        REQUIRE(add.call<double>(1.5, 2) == 3.5);
+        REQUIRE(add.call<std::string>("py", "thon") == "python");
+        REQUIRE(module.get("calls").as<int64_t>() == 4);
+        REQUIRE(module.function("describe").call<std::string>("ab") == "ab!");
+        REQUIRE_THROWS_AS(add.call<std::string>(1, 2), pyerror);
+    }
+
+    SECTION( "a call repeated does not run the module again" ) {
+        mypy::Callable add = module.function("add");
+        int64_t sum = 0;
+        for (int64_t i = 0; i < 10000; ++i) {
+            sum = add.call<int64_t>(sum, i);
+        }
+        REQUIRE(sum == 49995000);
+        REQUIRE(module.get("calls").as<int64_t>() == 10000);
+    }
+
+    SECTION( "handles keep what they hold through collections" ) {
+        mypy::Handle squares = module.function("numbers").call(100);
+        // far more holders of one object than retain() counts
+        std::vector<mypy::Handle> copies(1000, squares);
+        module.function("churn").call<void>();
+        REQUIRE(module.function("total").call<int64_t>(copies.back()) == 328350);
+
+        mypy::Handle point = module.function("Point")(3, 4);
+        module.function("churn").call<void>();
+        REQUIRE(std::holds_alternative<py::ValuePyObject>(point.get()));
+    }
+
+    SECTION( "what outlives a call is taken off the heap it was counted against" ) {
+        py::Allocator& heap = runtime.allocator();
+        heap.set_max_heap(64 * 1024 * 1024);
+        mypy::Callable describe = module.function("describe");
+        // the strings returned are made while the runtime's heaps are the
+        // current ones, and freed once they are not
+        const std::string name(100, 'x');
+        module.function("churn").call<void>();
+        const int64_t before = heap.account->used();
+        for (int i = 0; i < 20000; ++i) {
+            REQUIRE(describe.call<std::string>(name).size() == 101);
+        }
+        module.function("churn").call<void>();
+        REQUIRE(heap.account->used() - before < 256 * 1024);
+        heap.set_max_heap(0);
+    }
+
+    SECTION( "an error leaves the module ready for the next call" ) {
+        mypy::Callable total = module.function("total");
+        REQUIRE_THROWS_AS(total.call<int64_t>(1), pyerror);
+        REQUIRE_THROWS_AS(module.function("add").call<int64_t>(1, 2, 3), pyerror);
+        REQUIRE_THROWS_AS(module.function("missing"), pyerror);
+        REQUIRE_THROWS_AS(module.function("calls"), pyerror);
+        REQUIRE(module.function("add").call<int64_t>(1, 2) == 3);
+    }
+}
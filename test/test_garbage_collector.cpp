@@ -28,11 +28,29 @@ struct Baz {
     std::vector<MyType> values;
 };
 
+struct Node {
+    std::vector<gc_ptr<Node>> children;
+};
+
 namespace gc{
     void mark_children(gc_ptr<int>& object) {
         
     }
 
+    void mark_children(gc_ptr<Node>& object) {
+        for (auto& child : object->children) {
+            child.mark();
+        }
+    }
+
+    void mark_children(gc_ptr<Baz>& object) {
+        for (auto& value : object->values) {
+            if (auto baz = std::get_if<gc_ptr<Baz>>(&value)) {
+                baz->mark();
+            }
+        }
+    }
+
     void mark_children(gc_ptr<MyClass>& object) {
         if (object->pointer != nullptr) {
             object->pointer.mark();
@@ -85,4 +103,205 @@ TEST_CASE("should be able to do garbage collection", "[arithmetic]") {
         gc_heap<Baz> bazzes;
         MyType foo = bazzes.make();
     }
+
+    SECTION("marking on several threads") {
+        gc_heap<Node> nodes;
+        // a wide tree, every node with four children, and as much garbage
+        std::vector<gc_ptr<Node>> level = {nodes.make()};
+        gc_ptr<Node> root = level[0];
+        size_t live = 1;
+        while (live < 100000) {
+            std::vector<gc_ptr<Node>> next;
+            for (auto& parent : level) {
+                for (int i = 0; i < 4; ++i) {
+                    gc_ptr<Node> child = nodes.make();
+                    parent->children.push_back(child);
+                    next.push_back(child);
+                    nodes.make()->children.push_back(child);
+                }
+            }
+            live += next.size();
+            level = std::move(next);
+        }
+
+        gc_marker marker(4);
+        REQUIRE(marker.threads() == 4);
+        marker.run([&root]() { root.mark(); });
+        nodes.sweep();
+        REQUIRE(nodes.size() == live);
+
+        // the marks were cleared, and the marker can run again
+        marker.run([&root]() { root->children[0].mark(); });
+        nodes.sweep();
+        REQUIRE(nodes.size() == (live - 1) / 4);
+    }
+
+    SECTION("sweeping a little at a time") {
+        gc_heap<int> myHeap;
+        std::vector<gc_ptr<int>> kept;
+        for (int i = 0; i < 10; ++i) {
+            gc_ptr<int> ptr = myHeap.make(i);
+            if (i % 2 == 0) {
+                ptr.mark();
+                kept.push_back(ptr);
+            }
+        }
+
+        myHeap.start_sweep();
+        REQUIRE(myHeap.sweep_some(4) == 4);
+        REQUIRE(myHeap.size() == 8);
+        REQUIRE(myHeap.sweeping);
+
+        // objects made during the sweep are not swept by it, and the ones it
+        // has not reached yet can still be retained
+        gc_ptr<int> made = myHeap.make(10);
+        kept.front().retain();
+
+        int survivors = 0;
+        REQUIRE(myHeap.sweep_some(100, [&survivors](int&) { survivors++; }) == 6);
+        REQUIRE(!myHeap.sweeping);
+        REQUIRE(survivors == 3);
+        REQUIRE(myHeap.size() == 6);
+
+        // the next sweep frees all but the retained one
+        myHeap.sweep();
+        REQUIRE(myHeap.size() == 1);
+        REQUIRE(myHeap.objects.front().object == 0);
+    }
+
+    SECTION("objects made count down what is left to allocate") {
+        std::atomic<int64_t> countdown{100};
+        gc_heap<int> myHeap;
+        myHeap.countdown = &countdown;
+        myHeap.make(1);
+        myHeap.make(2);
+        REQUIRE(myHeap.pool.slot_bytes() >= sizeof(int));
+        REQUIRE(countdown.load() == 100 - 2 * (int64_t)myHeap.pool.slot_bytes());
+    }
+
+    SECTION("pages no object is left on are given back") {
+        gc_heap<int> myHeap;
+        gc_ptr<int> kept = myHeap.make(-1);
+        kept.retain();
+        for (int i = 0; i < 100000; ++i) {
+            myHeap.make(i);
+        }
+        REQUIRE(myHeap.pool.resident_bytes() > 2 * gc_pool::SLAB_SIZE);
+
+        myHeap.sweep();
+        REQUIRE(myHeap.size() == 1);
+        REQUIRE(myHeap.compact() > 0);
+        // only the slab the retained object is on is kept
+        REQUIRE(myHeap.pool.resident_bytes() <= gc_pool::SLAB_SIZE);
+        REQUIRE(*kept == -1);
+
+        // and the released ones are used again
+        for (int i = 0; i < 100000; ++i) {
+            myHeap.make(i);
+        }
+        REQUIRE(myHeap.size() == 100001);
+        REQUIRE(myHeap.pool.used_bytes() >= 100001 * sizeof(int));
+    }
+
+    SECTION("free pages among the objects left are given back") {
+        gc_heap<int> myHeap;
+        std::vector<gc_ptr<int>> kept;
+        for (int i = 0; i < 200000; ++i) {
+            gc_ptr<int> ptr = myHeap.make(i);
+            if (i % 1000 == 0) {
+                ptr.retain();
+                kept.push_back(ptr);
+            }
+        }
+        myHeap.sweep();
+        REQUIRE(myHeap.size() == 200);
+        const size_t resident = myHeap.pool.resident_bytes();
+        REQUIRE(!myHeap.has_empty_slabs());
+
+        REQUIRE(myHeap.compact() > resident / 2);
+        REQUIRE(myHeap.pool.resident_bytes() < resident / 2);
+        REQUIRE(myHeap.compact() == 0);
+        for (size_t i = 0; i < kept.size(); ++i) {
+            REQUIRE(*kept[i] == (int)i * 1000);
+        }
+
+        // the slots on the pages given back are used again once the rest
+        // of their slab is full
+        for (int i = 0; i < 200000; ++i) {
+            myHeap.make(-i);
+        }
+        REQUIRE(myHeap.size() == 200200);
+        REQUIRE(myHeap.pool.resident_bytes() <= resident + gc_pool::SLAB_SIZE);
+        for (size_t i = 0; i < kept.size(); ++i) {
+            REQUIRE(*kept[i] == (int)i * 1000);
+        }
+    }
+
+    SECTION("slabs are cut from huge page regions") {
+        gc_pool::huge_pages = true;
+        gc_heap<int> myHeap;
+        std::vector<gc_ptr<int>> kept;
+        for (int i = 0; i < 100000; ++i) {
+            kept.push_back(myHeap.make(i));
+        }
+        gc_pool::huge_pages = false;
+
+        // the slabs the first objects filled lie in one region
+        const uintptr_t region = ~(uintptr_t)(gc_pool::REGION_SIZE - 1);
+        REQUIRE(myHeap.pool.resident_bytes() > gc_pool::SLAB_SIZE);
+        REQUIRE(((uintptr_t)&*kept.front() & region) == ((uintptr_t)&*kept[50000] & region));
+        REQUIRE(*kept[50000] == 50000);
+
+        size_t huge = 0;
+        size_t resident = 0;
+        REQUIRE(gc_pool::huge_page_usage(huge, resident));
+        REQUIRE(resident > 0);
+        REQUIRE(huge <= resident);
+    }
+
+    SECTION("pools given the same regions cut their slabs from one") {
+        gc_pool::huge_pages = true;
+        gc_regions regions;
+        gc_heap<int> ints;
+        gc_heap<Node> nodes;
+        ints.pool.regions = &regions;
+        nodes.pool.regions = &regions;
+        gc_ptr<int> i = ints.make(1);
+        gc_ptr<Node> node = nodes.make();
+        gc_pool::huge_pages = false;
+
+        const uintptr_t region = ~(uintptr_t)(gc_pool::REGION_SIZE - 1);
+        REQUIRE(((uintptr_t)&*i & region) == ((uintptr_t)&*node & region));
+        REQUIRE(regions.uncut_bytes() == gc_pool::REGION_SIZE - 2 * gc_pool::SLAB_SIZE);
+    }
+
+    SECTION("marking a slice at a time") {
+        gc_heap<Node> nodes;
+        gc_ptr<Node> root = nodes.make();
+        for (int i = 0; i < 10; ++i) {
+            root->children.push_back(nodes.make());
+            nodes.make(); // garbage
+        }
+
+        gc_mark_worker grey;
+        gc_mark_worker::current = &grey;
+        root.mark();
+        gc_mark_worker::current = nullptr;
+
+        // objects made while the marking goes on start out grey
+        gc_mark_worker::incremental = &grey;
+        gc_ptr<Node> late = nodes.make();
+        late->children.push_back(nodes.make());
+        root->children[0]->children.push_back(late);
+
+        REQUIRE(grey.drain(1) == 1);
+        REQUIRE(!grey.empty());
+        while (grey.drain(1) == 1) {
+        }
+        REQUIRE(grey.empty());
+        gc_mark_worker::incremental = nullptr;
+
+        nodes.sweep();
+        REQUIRE(nodes.size() == 13);
+    }
 }
@@ -0,0 +1,322 @@
+#include <catch.hpp>
+
+#include <thread>
+
+#include "include/test_helpers.hpp"
+
+#include "../src/pyallocator.hpp"
+#include "../src/builtins/builtins.hpp"
+
+// runs source in a new interpreter with its own heaps and returns the string it
+// passed to result(). Catch's assertions are not thread safe, so nothing here
+// checks anything
+static std::string run_isolated(const std::string& source,
+        const Allocator::Budget* budget = nullptr, Allocator::Stats* stats = nullptr, size_t max_heap = 0) {
+    Allocator heap;
+    Allocator::Scope scope(heap);
+    if (budget != nullptr) {
+        heap.budget = *budget;
+    }
+    heap.set_max_heap(max_heap);
+
+    std::string result;
+    auto code = build_string(source);
+    InterpreterState state(code);
+    builtins::inject_builtins(state.ns_builtins);
+    (*(state.ns_builtins))["result"] = std::make_shared<value::CFunction>([&result](FrameState& frame, ArgList& args) {
+        result = std::get<ValueString>(args[0])->str();
+        frame.value_stack.push_back(value::NoneType());
+    });
+    state.eval();
+    if (stats != nullptr) {
+        *stats = heap.stats;
+    }
+    return result;
+}
+
+TEST_CASE("interpreters have their own heaps", "[interpreters]") {
+    SECTION( "interned strings belong to the current allocator" ) {
+        ValueString outer = value::String::intern("name");
+        {
+            Allocator heap;
+            Allocator::Scope scope(heap);
+            ValueString inner = value::String::intern("name");
+            REQUIRE(inner != outer);
+            REQUIRE(value::String::intern("name") == inner);
+            REQUIRE(heap.heap_string.size() == 1);
+        }
+        REQUIRE(value::String::intern("name") == outer);
+    }
+
+    SECTION( "run on separate threads at once" ) {
+        const std::string source = R"(
+class Point:
+    def __init__(self, x, y):
+        self.x = x
+        self.y = y
+
+total = 0
+names = []
+for i in range(20000):
+    p = Point(i, [i, str(i)])
+    total += p.x + len(p.y[1])
+    if i % 1000 == 0:
+        names.append("n" + str(i))
+result(str(total) + ":" + ",".join(names[:3]))
+)";
+        std::string results[4];
+        std::vector<std::thread> threads;
+        for (auto& result : results) {
+            threads.emplace_back([&result, &source]() {
+                result = run_isolated(source);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        for (auto& result : results) {
+            REQUIRE(result == "200078890:n0,n1000,n2000");
+        }
+    }
+}
+
+TEST_CASE("collections report marking and sweeping apart", "[interpreters]") {
+    const std::string source = R"(
+pairs = []
+for i in range(50000):
+    pairs = [i, str(i)]
+collect_garbage()
+stats = gc_stats()
+# the sweep goes on as more is allocated
+for i in range(5000):
+    pairs = [i, str(i)]
+after = gc_stats()
+if stats["collections"] > 0 and stats["freed"] > 0 and after["freed"] > stats["freed"] and after["sweep_ms"] > 0.0:
+    result("ok")
+else:
+    result("nothing was collected")
+)";
+    REQUIRE(run_isolated(source) == "ok");
+}
+
+TEST_CASE("compaction gives back what a large temporary list took", "[interpreters]") {
+    const std::string source = R"(
+big = []
+for i in range(200000):
+    big.append(str(i))
+count = len(big)
+big = 0
+# the sweep may compact by itself before gc.compact does
+gc.compact()
+stats = gc_stats()
+if count == 200000 and stats["compactions"] > 0 and stats["released"] > 1000000:
+    result("ok")
+else:
+    result("nothing was released")
+)";
+    REQUIRE(run_isolated(source) == "ok");
+}
+
+TEST_CASE("finally blocks run however their try block is left", "[interpreters]") {
+    const std::string source = R"(
+finished = 0
+
+def first_even(values):
+    global finished
+    for value in values:
+        try:
+            if value % 2 == 0:
+                return value
+        finally:
+            finished += 1
+    return -1
+
+def count_to(n):
+    global finished
+    i = 0
+    while True:
+        try:
+            i += 1
+            if i == n:
+                break
+        finally:
+            finished += 1
+    return i
+
+found = first_even([1, 3, 4, 5])
+counted = count_to(5)
+result(str(found) + " " + str(counted) + " " + str(finished))
+)";
+    REQUIRE(run_isolated(source) == "4 5 8");
+}
+
+TEST_CASE("compaction gives back the pages among the objects that are left", "[interpreters]") {
+    const std::string source = R"(
+big = []
+for i in range(200000):
+    big.append(str(i))
+kept = []
+for i in range(0, 200000, 1000):
+    kept.append(big[i])
+big = 0
+before = gc_stats()["released"]
+# the sweep may compact by itself before gc.compact does
+gc.compact()
+released = gc_stats()["released"] - before
+if len(kept) == 200 and released > 10000000 and int(kept[3]) == 3000:
+    result("ok")
+else:
+    result("released " + str(released))
+)";
+    REQUIRE(run_isolated(source) == "ok");
+}
+
+TEST_CASE("a script that outgrows its heap limit can catch MemoryError", "[interpreters]") {
+    const std::string source = R"(
+def grow(size):
+    big = []
+    while len(big) < size:
+        big.append(str(len(big)))
+    return len(big)
+
+caught = 0
+for attempt in range(3):
+    try:
+        grow(100000000)
+    except MemoryError:
+        caught += 1
+small = grow(1000)
+usage = heap_limit()
+if caught == 3 and small == 1000 and usage["memory_errors"] == 3 and usage["used"] < usage["limit"]:
+    result("ok")
+else:
+    result(str(caught) + " MemoryErrors, " + str(usage["used"]) + " bytes used")
+)";
+    Allocator::Stats stats;
+    REQUIRE(run_isolated(source, nullptr, &stats, 16 << 20) == "ok");
+    REQUIRE(stats.emergency_collections > 0);
+
+    SECTION( "the error can be bound to a name" ) {
+        const std::string source = R"(
+def grow(size):
+    big = []
+    while len(big) < size:
+        big.append(str(len(big)))
+    return len(big)
+
+def attempt():
+    try:
+        grow(100000000)
+    except MemoryError as e:
+        return "caught: " + str(e)
+    return "not caught"
+
+message = attempt()
+try:
+    grow(100000000)
+except MemoryError as error:
+    message = message + ", " + str(error)[:9]
+result(message)
+)";
+        REQUIRE(run_isolated(source, nullptr, nullptr, 16 << 20)
+            == "caught: the heap limit of 16777216 bytes was exceeded, the heap ");
+    }
+
+    SECTION( "sizes are read with a unit" ) {
+        REQUIRE(Allocator::parse_size("512") == 512);
+        REQUIRE(Allocator::parse_size("64k") == 64 << 10);
+        REQUIRE(Allocator::parse_size("16M") == 16 << 20);
+        REQUIRE(Allocator::parse_size("2G") == (size_t)2 << 30);
+        REQUIRE(Allocator::parse_size("lots") == 0);
+        REQUIRE(Allocator::parse_size("5MB") == 0);
+    }
+}
+
+TEST_CASE("incremental collections mark a slice at a time", "[interpreters]") {
+    // old lists and namespaces are written to while they are being marked
+    const std::string source = R"(
+class Node:
+    def __init__(self, value, next):
+        self.value = value
+        self.next = next
+
+keep = []
+for i in range(300):
+    keep.append([i, 0, 0, 0])
+table = {}
+head = Node(0, 0)
+for i in range(30000):
+    slot = keep[i % 300]
+    slot[i // 300 % 4] = str(i)
+    if i % 3 == 0:
+        head = Node(i, head)
+    table[i % 97] = slot
+total = 0
+for slot in keep:
+    total += len(slot[1] + slot[2])
+count = 0
+node = head
+while count < 10000:
+    total += node.value
+    node = node.next
+    count += 1
+result(str(total) + ":" + table[5][2])
+)";
+    REQUIRE(run_isolated(source) == "149988000:29678");
+
+    SECTION( "with a budget of objects" ) {
+        Allocator::Budget budget;
+        budget.objects = 16;
+        Allocator::Stats stats;
+        REQUIRE(run_isolated(source, &budget, &stats) == "149988000:29678");
+        REQUIRE(stats.mark_steps > stats.collections);
+        REQUIRE(stats.pauses.count > stats.collections);
+    }
+
+    SECTION( "with a budget of time" ) {
+        Allocator::Budget budget;
+        budget.ns = 20000;
+        Allocator::Stats stats;
+        REQUIRE(run_isolated(source, &budget, &stats) == "149988000:29678");
+        REQUIRE(stats.mark_steps > 0);
+    }
+}
+
+TEST_CASE("safepoints stop the interpreter when asked to", "[interpreters]") {
+    Allocator heap;
+    Allocator::Scope scope(heap);
+    auto code = build_string(R"(
+i = 0
+while i < 1000:
+    i += 1
+)");
+    InterpreterState state(code);
+    heap.size_at_last_gc = 1 << 30;
+    heap.countdown = 1 << 30;
+
+    SECTION( "a loop of ints allocates nothing, so nothing is collected" ) {
+        state.eval();
+        REQUIRE(heap.stats.collections == 0);
+    }
+
+    SECTION( "a request is handled at the next jump" ) {
+        heap.request(Allocator::REQUEST_COLLECT);
+        REQUIRE(heap.at_safepoint());
+        state.eval();
+        REQUIRE(heap.stats.collections == 1);
+        REQUIRE(heap.requests.load() == 0);
+        REQUIRE(!heap.at_safepoint());
+    }
+
+    SECTION( "a request is not lost to an object made at the same time" ) {
+        heap.request(Allocator::REQUEST_COLLECT);
+        // what an object made on the interpreter's thread writes back when
+        // it read the countdown before the request came
+        heap.countdown = 1 << 30;
+        REQUIRE(heap.at_safepoint());
+        state.eval();
+        REQUIRE(heap.stats.collections == 1);
+        REQUIRE(heap.requests.load() == 0);
+    }
+}
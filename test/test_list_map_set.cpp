@@ -5,103 +5,11 @@
 
 #include <functional>
 
-// struct hash_visitor {
-//     template<typename T>
-//     size_t operator()(const ValueString val) {
-//         return std::hash<std::string>(val);
-//     }
-
-//     size_t operator()(const ValuePyGenerator& gen) {
-//         return hash_visitor()(gen.frame);
-//     }
-
-//     size_t operator()(const value::NoneType none) {
-//         return 37;
-//     }
-
-//     template<typename T>
-//     size_t operator()(const gc_ptr<T> value) {
-//         return (size_t)(value.get());
-//     }
-
-//     template<typename T>
-//     size_t operator()(const std::shared_ptr<T> value) {
-//         return (size_t)(value.get());
-//     }
-
-//     size_t operator()(const int64_t value) {
-//         return std::hash<double>()(value);
-//     }
-
-//     size_t operator()(const double value) {
-//         return std::hash<double>()(value);
-//     }
-
-//     template<typename T>
-//     size_t operator()(const T value) {
-//         return std::hash<T>()(value);
-//     }
-// };
-
-// struct equality_visitor {
-//     bool operator()(const ValueString l, const ValueString r) const {
-//         return *l == *r;
-//     }
-
-//     bool operator()(const ValuePyGenerator& l, const ValuePyGenerator& r) const {
-//         return l.frame == r.frame;
-//     }
-
-//     bool operator()(const value::NoneType, const value::NoneType) const {
-//         return true;
-//     }
-
-//     template<typename T>
-//     bool operator()(const gc_ptr<T>& l, const gc_ptr<T>& r) const {
-//         return (size_t)(l.get()) == (size_t)(r.get());
-//     }
-
-//     template<typename T>
-//     bool operator()(const std::shared_ptr<T>& l, const std::shared_ptr<T>& r) const {
-//         return (size_t)(l.get()) == (size_t)(r.get());
-//     }
-
-//     bool operator()(const value::NoneType, const value::NoneType) {
-//         return true;
-//     }
-
-//     template<typename T1, typename T2>
-//     bool operator()(const T1 v1, const T2 v2) const {
-//         const constexpr bool is_numeric_1 = std::is_same<T1, double>::value || std::is_same<T1, int64_t>::value;
-//         const constexpr bool is_numeric_2 = std::is_same<T2, double>::value || std::is_same<T2, int64_t>::value;
-
-//         if constexpr(is_numeric_1 && is_numeric_2) {
-//             return v1 == v2;
-//         } else {
-//             return false;
-//         }
-//     }
-// };
-
-// namespace std {
-//     template <> struct hash<Value>
-//     {
-//         size_t operator()(const Value& val) const
-//         {
-//             return std::visit(hash_visitor(), val);
-//         }
-//     };
-// }
-
-// bool operator == (const Value a, const Value b) {
-//     return std::visit(equality_visitor(), a, b);
-// }
-
 TEST_CASE("lists should work", "[lists]") {
 
     SECTION("can create an unordered_map<Value, Value>") {
         // std::unordered_map<Value, Value> myMap;
-        // myMap[Value((int64_t)15)] = alloc.heap_string.make("hello worlddd").retain();
+        // myMap[Value((int64_t)15)] = alloc().heap_string.make("hello worlddd").retain();
     }
 
     SECTION("can create a list") {
@@ -308,4 +216,391 @@ check_val5(part[3])
         state.eval();
     }
 
-}
\ No newline at end of file
+    SECTION("Can slice with a negative step"){
+        auto code = build_string(R"(
+values = [1,2,3,4,5,6]
+part = values[::-2]
+check_val1(len(part))
+check_val2(part[0])
+check_val3(part[2])
+check_val4(len(values[4:1:-1]) + len(values[1:4:-1]))
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)3);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)6);
+        (*(state.ns_builtins))["check_val3"] = make_builtin_check_value((int64_t)2);
+        (*(state.ns_builtins))["check_val4"] = make_builtin_check_value((int64_t)3);
+        state.eval();
+    }
+
+    SECTION("Can slice tuples and strings"){
+        auto code = build_string(R"(
+x = 1
+values = (x,2,3,4,5)
+part = values[1:-1]
+check_val1(part[0] + part[-1])
+check_val2(len(values[:]))
+s = slice(None, None, -1)
+check_str("hello world"[s])
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        ValueString str = alloc().heap_string.make("dlrow olleh");
+        str.retain();
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)6);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)5);
+        (*(state.ns_builtins))["check_str"] = make_builtin_check_value(str);
+        state.eval();
+    }
+
+    SECTION("Long slices of tuples and strings share what they were cut from"){
+        auto code = build_string(R"(
+text = "0123456789"
+for i in range(3):
+    text = text + text + "0123456789"
+values = numbers()
+tail = text[1:]
+part = tail[9:89]
+check_view(part)
+check_str(part)
+check_str(part[:])
+index = {part: 1}
+check_val1(index[str(text[10:90])] + len(part))
+items = values[10:190]
+inner = items[50:]
+check_view(inner)
+check_val2(inner[0] + inner[-1] + len(inner))
+text = 0
+values = 0
+tail = 0
+items = 0
+collect_garbage()
+check_str(part)
+check_val2(inner[0] + inner[-1] + len(inner))
+check_val3(len(part + part))
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        std::string expected;
+        for (int i = 0; i < 8; ++i) {
+            expected += "0123456789";
+        }
+        ValueString str = alloc().heap_string.make(expected);
+        str.retain();
+        (*(state.ns_builtins))["check_view"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+            if (auto str = std::get_if<ValueString>(&args[0])) {
+                REQUIRE((*str)->viewed() != nullptr);
+            } else {
+                REQUIRE(std::get<ValueTuple>(args[0])->base != nullptr);
+            }
+            frame.value_stack.push_back(value::NoneType());
+        });
+        (*(state.ns_builtins))["numbers"] = std::make_shared<value::CFunction>([](FrameState& frame, ArgList& args) {
+            ValueTuple numbers = alloc().heap_tuple.make();
+            for (int64_t i = 0; i < 200; ++i) {
+                numbers->values.push_back(i);
+            }
+            frame.value_stack.push_back(numbers);
+        });
+        (*(state.ns_builtins))["check_str"] = make_builtin_check_value(str);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)81);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)(60 + 189 + 130));
+        (*(state.ns_builtins))["check_val3"] = make_builtin_check_value((int64_t)160);
+        state.eval();
+    }
+
+    SECTION("Can assign to a slice"){
+        auto code = build_string(R"(
+values = [1,2,3,4,5,6]
+values[1:3] = [7,8,9,10]
+check_val1(len(values))
+check_val2(values[4])
+values[::2] = [0,0,0,0]
+check_val3(values[0] + values[2] + values[6])
+values[:] = []
+check_val4(len(values))
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)8);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)10);
+        (*(state.ns_builtins))["check_val3"] = make_builtin_check_value((int64_t)0);
+        (*(state.ns_builtins))["check_val4"] = make_builtin_check_value((int64_t)0);
+        state.eval();
+    }
+
+    SECTION("Rejects a mismatched extended slice assignment"){
+        auto code = build_string(R"(
+values = [1,2,3,4,5,6]
+values[::2] = [1,2]
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        REQUIRE_THROWS(state.eval());
+    }
+
+    SECTION("Keeps its items when an int list takes other types"){
+        auto code = build_string(R"(
+values = [1,2,3]
+values.append(4)
+values.append("five")
+values.insert(0, 0.5)
+check_val1(len(values))
+check_val2(values[1] + values[4])
+check_float(values[0])
+values[0] = 10
+check_val3(values[0] + values[3])
+check_true(3 in values)
+check_true(2.0 in values)
+check_true(7 not in values)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)6);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)5);
+        (*(state.ns_builtins))["check_val3"] = make_builtin_check_value((int64_t)13);
+        (*(state.ns_builtins))["check_float"] = make_builtin_check_value(0.5);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION("Mixes int and float lists"){
+        auto code = build_string(R"(
+ints = [1,2,3]
+floats = [0.5,1.5]
+both = ints + floats
+check_val1(len(both))
+check_float(both[3] + both[4])
+check_val2(both[2])
+ints[1:2] = floats
+check_float(ints[1] + ints[2])
+more = floats * 3
+more.extend(more)
+check_val3(len(more))
+check_true(1.5 in more)
+del more[0]
+check_float(more[0] + more[1])
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)5);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)3);
+        (*(state.ns_builtins))["check_val3"] = make_builtin_check_value((int64_t)12);
+        (*(state.ns_builtins))["check_float"] = make_builtin_check_value(2.0);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+}
+
+TEST_CASE("dicts should work", "[dicts]") {
+    SECTION("can create and index a dict") {
+        auto code = build_string(R"(
+x = 3
+d = {"a": 1, "b": 2, x: "three", 4.0: 4}
+check_val1(d["a"] + d["b"])
+check_val2(d[4])
+check_val3(len(d))
+check_str(d[3])
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        ValueString str = alloc().heap_string.make("three");
+        str.retain();
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)3);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)4);
+        (*(state.ns_builtins))["check_val3"] = make_builtin_check_value((int64_t)4);
+        (*(state.ns_builtins))["check_str"] = make_builtin_check_value(str);
+        state.eval();
+    }
+
+    SECTION("can store, delete and test for keys") {
+        auto code = build_string(R"(
+d = {}
+i = 0
+while i < 1000:
+    d[i] = i * 2
+    i += 1
+i = 0
+while i < 1000:
+    if i % 3 != 0:
+        del d[i]
+    i += 1
+check_val1(len(d))
+check_val2(d[999])
+check_true(999 in d)
+check_true(998 not in d)
+check_true((1, "a") not in d)
+d[(1, "a")] = 5
+check_val3(d[(1, "a")])
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)334);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)1998);
+        (*(state.ns_builtins))["check_val3"] = make_builtin_check_value((int64_t)5);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION("iterates in insertion order") {
+        auto code = build_string(R"(
+d = {x: x * x for x in [5, 1, 4, 2]}
+del d[1]
+d[1] = 0
+order = 0
+for k in d:
+    order = order * 10 + k
+check_val1(order)
+total = 0
+for k, v in d.items():
+    total += k * v
+check_val2(total)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)5421);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)(125 + 64 + 8));
+        state.eval();
+    }
+
+    SECTION("supports the common methods") {
+        auto code = build_string(R"(
+d = {"a": 1}
+check_val1(d.get("a") + d.get("b", 10))
+check_val2(d.setdefault("b", 5) + d.setdefault("b", 7))
+check_val3(d.pop("a") + d.pop("a", 100))
+e = d.copy()
+e.update({"c": 3})
+check_val4(len(d) + len(e))
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)11);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)10);
+        (*(state.ns_builtins))["check_val3"] = make_builtin_check_value((int64_t)101);
+        (*(state.ns_builtins))["check_val4"] = make_builtin_check_value((int64_t)3);
+        state.eval();
+    }
+
+    SECTION("raises on missing or unhashable keys") {
+        auto code = build_string(R"(
+d = {"a": 1}
+d["b"]
+        )");
+        InterpreterState state(code);
+        REQUIRE_THROWS(state.eval());
+
+        auto code2 = build_string(R"(
+d = {}
+d[[1, 2]] = 3
+        )");
+        InterpreterState state2(code2);
+        REQUIRE_THROWS(state2.eval());
+    }
+}
+
+TEST_CASE("sets should work", "[sets]") {
+    SECTION("with membership, add and discard") {
+        auto code = build_string(R"(
+s = {1, 2, 3}
+s.add(2)
+s.add(4)
+check_val1(len(s))
+check_true(3 in s)
+check_true(5 not in s)
+check_true(True in s)
+s.discard(1)
+s.discard(100)
+check_val2(len(s))
+check_true(1 not in s)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)4);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)3);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION("when switching from dense to sparse to mixed keys") {
+        auto code = build_string(R"(
+s = set()
+i = 0
+while i < 2000:
+    s.add(i * 3)
+    i += 1
+check_val1(len(s))
+s.add(1000000000000)
+s.add(-5)
+check_true(1000000000000 in s)
+check_true(5997 in s)
+check_true(5998 not in s)
+s.add("str")
+s.add(2.0)
+check_val2(len(s))
+check_true("str" in s)
+check_true(-5 in s)
+check_true(1000000000000 in s)
+check_true(5997 in s)
+s.remove(-5)
+check_true(-5 not in s)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)2000);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)2004);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION("with the set operators") {
+        auto code = build_string(R"(
+a = set([1, 2, 3, 4])
+b = {3, 4, 5, 1000000000}
+check_val1(len(a | b))
+check_val2(len(a & b))
+check_val2(len(a - b))
+check_val4(len(a ^ b))
+check_true(1000000000 in a ^ b)
+c = {"x", 1}
+check_val2(len(a.intersection([1, 2])))
+check_val3(len(c.union(a) - a))
+total = 0
+for x in a | {10}:
+    total += x
+check_val5(total)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)6);
+        (*(state.ns_builtins))["check_val2"] = make_builtin_check_value((int64_t)2);
+        (*(state.ns_builtins))["check_val3"] = make_builtin_check_value((int64_t)1);
+        (*(state.ns_builtins))["check_val4"] = make_builtin_check_value((int64_t)4);
+        (*(state.ns_builtins))["check_val5"] = make_builtin_check_value((int64_t)20);
+        (*(state.ns_builtins))["check_true"] = make_builtin_check_value(true);
+        state.eval();
+    }
+
+    SECTION("built from comprehensions") {
+        auto code = build_string(R"(
+s = {x % 7 for x in [1, 8, 15, 2, 9, 3]}
+check_val1(len(s))
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_val1"] = make_builtin_check_value((int64_t)3);
+        state.eval();
+    }
+
+    SECTION("and raise KeyError on a missing remove") {
+        auto code = build_string(R"(
+s = {1}
+s.remove(2)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        REQUIRE_THROWS(state.eval());
+    }
+}
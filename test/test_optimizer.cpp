@@ -0,0 +1,149 @@
+#include <catch.hpp>
+
+#include "include/test_helpers.hpp"
+
+#include "../lib/base64.hpp"
+#include "../lib/json.hpp"
+#include "../lib/oplist.hpp"
+#include "../src/pyallocator.hpp"
+#include "../src/builtins/builtins.hpp"
+
+// builds a module from raw bytecode, ops that take an argument are followed by
+// its two bytes. consts are ints and lnotab is [line, bytecode offset] pairs
+static gc_ptr<Code> assemble(const std::vector<uint8_t>& bytecode, const std::vector<int64_t>& consts, const json& lnotab) {
+    json tree;
+    tree["co_code"] = base64_encode(bytecode.data(), bytecode.size());
+    tree["co_consts"] = json::array();
+    for (int64_t value : consts) {
+        tree["co_consts"].push_back({{"type", "literal"}, {"real_type", "<class 'int'>"}, {"value", value}});
+    }
+    tree["co_name"] = "<module>";
+    tree["co_stacksize"] = 4;
+    tree["co_nlocals"] = 0;
+    tree["co_argcount"] = 0;
+    tree["co_names"] = nullptr;
+    tree["co_varnames"] = nullptr;
+    tree["co_cellvars"] = nullptr;
+    tree["co_freevars"] = nullptr;
+    tree["lnotab"] = lnotab;
+    return alloc().heap_code.make(tree);
+}
+
+TEST_CASE("bytecode optimizer", "[optimizer]") {
+    SECTION( "folds constant arithmetic" ) {
+        // return 6 * 7 - 2
+        auto code = assemble({
+            op::LOAD_CONST, 0, 0,
+            op::LOAD_CONST, 1, 0,
+            op::BINARY_MULTIPLY,
+            op::LOAD_CONST, 2, 0,
+            op::BINARY_SUBTRACT,
+            op::RETURN_VALUE,
+        }, {6, 7, 2}, json::array({{1, 0}, {2, 7}}));
+        REQUIRE(code->instructions.size() == 2);
+        REQUIRE(code->instructions[0].bytecode == op::LOAD_CONST);
+        REQUIRE(std::get<int64_t>(code->co_consts[code->instructions[0].arg]) == 40);
+        REQUIRE(code->instructions[1].bytecode == op::RETURN_VALUE);
+        // the second line starts with the constant folded into the first's
+        REQUIRE(code->lnotab.size() == 2);
+        REQUIRE(code->lnotab[0].pc == 0);
+        REQUIRE(code->lnotab[1].line == 2);
+        REQUIRE(code->lnotab[1].pc == 1);
+    }
+
+    SECTION( "leaves operations that raise to the interpreter" ) {
+        // return 1 // 0
+        auto code = assemble({
+            op::LOAD_CONST, 0, 0,
+            op::LOAD_CONST, 1, 0,
+            op::BINARY_FLOOR_DIVIDE,
+            op::RETURN_VALUE,
+        }, {1, 0}, json::array({{1, 0}}));
+        REQUIRE(code->instructions.size() == 4);
+    }
+
+    SECTION( "does not compute huge powers and shifts at load time" ) {
+        // return 2 ** 100000000, and 1 << 1000000000
+        for (uint8_t opcode : {op::BINARY_POWER, op::BINARY_LSHIFT}) {
+            auto code = assemble({
+                op::LOAD_CONST, 0, 0,
+                op::LOAD_CONST, 1, 0,
+                opcode,
+                op::RETURN_VALUE,
+            }, {2, opcode == op::BINARY_POWER ? 100000000 : 1000000000}, json::array({{1, 0}}));
+            REQUIRE(code->instructions.size() == 4);
+        }
+
+        // return 3 ** 20 is still folded
+        auto code = assemble({
+            op::LOAD_CONST, 0, 0,
+            op::LOAD_CONST, 1, 0,
+            op::BINARY_POWER,
+            op::RETURN_VALUE,
+        }, {3, 20}, json::array({{1, 0}}));
+        REQUIRE(code->instructions.size() == 2);
+        REQUIRE(std::get<int64_t>(code->co_consts[code->instructions[0].arg]) == 3486784401);
+    }
+
+    SECTION( "drops a branch on a constant and the code it skips" ) {
+        // if 0: return 1
+        // return 2
+        auto code = assemble({
+            op::LOAD_CONST, 0, 0,
+            op::POP_JUMP_IF_FALSE, 10, 0,
+            op::LOAD_CONST, 1, 0,
+            op::RETURN_VALUE,
+            op::LOAD_CONST, 2, 0,
+            op::RETURN_VALUE,
+        }, {0, 1, 2}, json::array({{1, 0}, {2, 6}, {3, 10}}));
+        REQUIRE(code->instructions.size() == 2);
+        REQUIRE(std::get<int64_t>(code->co_consts[code->instructions[0].arg]) == 2);
+        REQUIRE(code->pc_map[10] == 0);
+        REQUIRE(code->lnotab.size() == 1);
+        REQUIRE(code->lnotab[0].line == 3);
+    }
+
+    SECTION( "threads jumps to jumps" ) {
+        // the branch goes through a JUMP_ABSOLUTE and a JUMP_FORWARD to the
+        // second return, neither of which anything else reaches
+        auto code = assemble({
+            op::LOAD_NAME, 0, 0,
+            op::POP_JUMP_IF_TRUE, 10, 0,
+            op::LOAD_CONST, 1, 0,
+            op::RETURN_VALUE,
+            op::JUMP_ABSOLUTE, 13, 0,
+            op::JUMP_FORWARD, 0, 0,
+            op::LOAD_CONST, 2, 0,
+            op::RETURN_VALUE,
+        }, {0, 1, 2}, json::array({{1, 0}}));
+        REQUIRE(code->instructions.size() == 6);
+        REQUIRE(code->instructions[1].bytecode == op::POP_JUMP_IF_TRUE);
+        REQUIRE(code->instructions[1].arg == 4);
+        REQUIRE(code->instructions[4].bytecode == op::LOAD_CONST);
+    }
+
+    SECTION( "runs programs with branches and loops the same" ) {
+        auto code = build_string(R"(
+x = 3
+if x == 2:
+    y = 1
+else:
+    y = 2
+check_int(y)
+total = 0
+for i in range(10):
+    for j in range(10):
+        if j > i:
+            break
+        total += j
+    else:
+        total += 1000
+check_int2(total)
+        )");
+        InterpreterState state(code);
+        builtins::inject_builtins(state.ns_builtins);
+        (*(state.ns_builtins))["check_int"] = make_builtin_check_value((int64_t)2);
+        (*(state.ns_builtins))["check_int2"] = make_builtin_check_value((int64_t)1165);
+        state.eval();
+    }
+}